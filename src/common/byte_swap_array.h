@@ -50,6 +50,25 @@ byte_swap_aligned(DataType *dst, const DataType *srcStart, const DataType *srcEn
 }
 #endif
 
+/**
+ * Byte swap count elements from src into dst, using the SSE swap for as much
+ * of the range as possible. Neither pointer needs to be 16 byte aligned.
+ */
+template<typename DataType>
+static inline void
+byte_swap_copy(DataType *dst,
+               const DataType *src,
+               size_t count)
+{
+   constexpr auto ElementsPerVector = 16 / sizeof(DataType);
+   auto vectorCount = count - (count % ElementsPerVector);
+
+   byte_swap_aligned<DataType>(dst, src, src + vectorCount);
+   byte_swap_unaligned<DataType>(dst + vectorCount,
+                                 src + vectorCount,
+                                 src + count);
+}
+
 #ifdef PLATFORM_HAS_SSE3
 template<typename DataType>
 static inline void *
@@ -1,34 +1,290 @@
 #include "platform.h"
 #include "platform_fiber.h"
+#include "platform_memory.h"
+#include "decaf_assert.h"
 #include "log.h"
 
 #ifdef PLATFORM_POSIX
-#include <array>
+#include <cstdint>
 #include <errno.h>
-#include <signal.h>
+#include <fmt/core.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define PLATFORM_FIBER_ASM
+#else
 #include <ucontext.h>
+#endif
 
 #ifdef DECAF_VALGRIND
    #include <valgrind/valgrind.h>
 #endif
 
+/*
+ * On x86-64 and AArch64 we switch fibers with a small assembly routine rather
+ * than swapcontext, which makes a sigprocmask syscall on every switch.  The
+ * routine pushes the callee saved registers and floating point control state
+ * onto the current stack, stores the stack pointer into the current fiber,
+ * then loads the target fiber's stack pointer and pops its registers.  As we
+ * only ever switch from inside a function call, nothing else needs saving.
+ *
+ * A new fiber's stack is set up to look like it was switched away from, with
+ * the return address pointing at platformFiberStart which calls the entry
+ * point with the fiber.
+ *
+ * Stacks are reserved with mmap so they are only committed as they are used,
+ * with a guard page below them to catch overflows.  Destroyed fibers return
+ * their stack to a pool so creating a new fiber does not need any syscalls.
+ */
+
+#ifdef PLATFORM_APPLE
+#define FIBER_ASM_SYMBOL(name) "_" #name
+#else
+#define FIBER_ASM_SYMBOL(name) #name
+#endif
+
+#ifdef PLATFORM_FIBER_ASM
+extern "C" void
+platformFiberSwitch(void **saveStackPointer, void *loadStackPointer);
+
+extern "C" void
+platformFiberStart();
+#endif
+
+#if defined(__x86_64__)
+asm(
+   ".text\n"
+   ".globl " FIBER_ASM_SYMBOL(platformFiberSwitch) "\n"
+   ".p2align 4\n"
+   FIBER_ASM_SYMBOL(platformFiberSwitch) ":\n"
+   "   pushq %rbp\n"
+   "   pushq %rbx\n"
+   "   pushq %r12\n"
+   "   pushq %r13\n"
+   "   pushq %r14\n"
+   "   pushq %r15\n"
+   "   subq $8, %rsp\n"
+   "   stmxcsr (%rsp)\n"
+   "   fnstcw 4(%rsp)\n"
+   "   movq %rsp, (%rdi)\n"
+   "   movq %rsi, %rsp\n"
+   "   ldmxcsr (%rsp)\n"
+   "   fldcw 4(%rsp)\n"
+   "   addq $8, %rsp\n"
+   "   popq %r15\n"
+   "   popq %r14\n"
+   "   popq %r13\n"
+   "   popq %r12\n"
+   "   popq %rbx\n"
+   "   popq %rbp\n"
+   "   ret\n"
+   "\n"
+   ".globl " FIBER_ASM_SYMBOL(platformFiberStart) "\n"
+   ".p2align 4\n"
+   FIBER_ASM_SYMBOL(platformFiberStart) ":\n"
+   "   .cfi_startproc\n"
+   "   .cfi_undefined rip\n"
+   "   movq %r12, %rdi\n"
+   "   callq *%r13\n"
+   "   ud2\n"
+   "   .cfi_endproc\n"
+);
+
+struct FiberInitialFrame
+{
+   uint32_t mxcsr;
+   uint16_t fpucw;
+   uint16_t padding;
+   uint64_t r15;
+   uint64_t r14;
+   uint64_t r13;
+   uint64_t r12;
+   uint64_t rbx;
+   uint64_t rbp;
+   uint64_t returnAddress;
+};
+static_assert(sizeof(FiberInitialFrame) % 16 == 0);
+
+static void
+initialiseFrame(FiberInitialFrame *frame,
+                void (*entry)(void *),
+                void *param)
+{
+   asm volatile("stmxcsr %0" : "=m"(frame->mxcsr));
+   asm volatile("fnstcw %0" : "=m"(frame->fpucw));
+   frame->padding = 0;
+   frame->r15 = 0;
+   frame->r14 = 0;
+   frame->r13 = reinterpret_cast<uint64_t>(entry);
+   frame->r12 = reinterpret_cast<uint64_t>(param);
+   frame->rbx = 0;
+   frame->rbp = 0;
+   frame->returnAddress = reinterpret_cast<uint64_t>(&platformFiberStart);
+}
+
+#elif defined(__aarch64__)
+asm(
+   ".text\n"
+   ".globl " FIBER_ASM_SYMBOL(platformFiberSwitch) "\n"
+   ".p2align 4\n"
+   FIBER_ASM_SYMBOL(platformFiberSwitch) ":\n"
+   "   sub sp, sp, #176\n"
+   "   stp x19, x20, [sp, #0]\n"
+   "   stp x21, x22, [sp, #16]\n"
+   "   stp x23, x24, [sp, #32]\n"
+   "   stp x25, x26, [sp, #48]\n"
+   "   stp x27, x28, [sp, #64]\n"
+   "   stp x29, x30, [sp, #80]\n"
+   "   stp d8, d9, [sp, #96]\n"
+   "   stp d10, d11, [sp, #112]\n"
+   "   stp d12, d13, [sp, #128]\n"
+   "   stp d14, d15, [sp, #144]\n"
+   "   mrs x9, fpcr\n"
+   "   str x9, [sp, #160]\n"
+   "   mov x9, sp\n"
+   "   str x9, [x0]\n"
+   "   mov sp, x1\n"
+   "   ldr x9, [sp, #160]\n"
+   "   msr fpcr, x9\n"
+   "   ldp x19, x20, [sp, #0]\n"
+   "   ldp x21, x22, [sp, #16]\n"
+   "   ldp x23, x24, [sp, #32]\n"
+   "   ldp x25, x26, [sp, #48]\n"
+   "   ldp x27, x28, [sp, #64]\n"
+   "   ldp x29, x30, [sp, #80]\n"
+   "   ldp d8, d9, [sp, #96]\n"
+   "   ldp d10, d11, [sp, #112]\n"
+   "   ldp d12, d13, [sp, #128]\n"
+   "   ldp d14, d15, [sp, #144]\n"
+   "   add sp, sp, #176\n"
+   "   ret\n"
+   "\n"
+   ".globl " FIBER_ASM_SYMBOL(platformFiberStart) "\n"
+   ".p2align 4\n"
+   FIBER_ASM_SYMBOL(platformFiberStart) ":\n"
+   "   .cfi_startproc\n"
+   "   .cfi_undefined x30\n"
+   "   mov x0, x19\n"
+   "   blr x20\n"
+   "   brk #0\n"
+   "   .cfi_endproc\n"
+);
+
+struct FiberInitialFrame
+{
+   uint64_t x19;
+   uint64_t x20;
+   uint64_t x21_x28[8];
+   uint64_t fp;
+   uint64_t lr;
+   uint64_t d8_d15[8];
+   uint64_t fpcr;
+   uint64_t padding;
+};
+static_assert(sizeof(FiberInitialFrame) == 176);
+
+static void
+initialiseFrame(FiberInitialFrame *frame,
+                void (*entry)(void *),
+                void *param)
+{
+   *frame = FiberInitialFrame { };
+   asm volatile("mrs %0, fpcr" : "=r"(frame->fpcr));
+   frame->x19 = reinterpret_cast<uint64_t>(param);
+   frame->x20 = reinterpret_cast<uint64_t>(entry);
+   frame->lr = reinterpret_cast<uint64_t>(&platformFiberStart);
+}
+#endif
+
 namespace platform
 {
 
-static const size_t
+static constexpr size_t
 DefaultStackSize = 1024 * 1024;
 
+static constexpr size_t
+MaxPooledStacks = 64;
+
+struct FiberStack
+{
+   //! Start of the mapping, including the guard page.
+   uint8_t *base = nullptr;
+
+   //! Size of the mapping, including the guard page.
+   size_t size = 0;
+};
+
 struct Fiber
 {
+#ifdef PLATFORM_FIBER_ASM
+   void *stackPointer = nullptr;
+#else
    ucontext_t context;
+#endif
    FiberEntryPoint entry = nullptr;
    void *entryParam = nullptr;
+   FiberStack stack;
 #ifdef DECAF_VALGRIND
    unsigned int valgrindStackId;
 #endif
-   std::array<char, DefaultStackSize> stack;
 };
 
+static std::mutex sStackPoolMutex;
+static std::vector<FiberStack> sStackPool;
+
+static FiberStack
+allocateStack()
+{
+   {
+      std::unique_lock<std::mutex> lock { sStackPoolMutex };
+      if (!sStackPool.empty()) {
+         auto stack = sStackPool.back();
+         sStackPool.pop_back();
+         return stack;
+      }
+   }
+
+   auto guardSize = getSystemPageSize();
+   auto stack = FiberStack { };
+   stack.size = guardSize + DefaultStackSize;
+
+   // MAP_NORESERVE means the pages of the stack are only committed once they
+   // are touched, then we open up everything above the guard page.
+   auto base = mmap(nullptr,
+                    stack.size,
+                    PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                    -1,
+                    0);
+   if (base == MAP_FAILED) {
+      decaf_abort(fmt::format("Failed to reserve fiber stack, error: {}", errno));
+   }
+
+   stack.base = static_cast<uint8_t *>(base);
+
+   if (mprotect(stack.base + guardSize, DefaultStackSize, PROT_READ | PROT_WRITE) != 0) {
+      decaf_abort(fmt::format("Failed to commit fiber stack, error: {}", errno));
+   }
+
+   return stack;
+}
+
+static void
+freeStack(const FiberStack &stack)
+{
+   {
+      std::unique_lock<std::mutex> lock { sStackPoolMutex };
+      if (sStackPool.size() < MaxPooledStacks) {
+         sStackPool.push_back(stack);
+         return;
+      }
+   }
+
+   munmap(stack.base, stack.size);
+}
+
 Fiber *
 getThreadFiber()
 {
@@ -37,9 +293,11 @@ getThreadFiber()
 }
 
 static void
-fiberEntryPoint(Fiber *fiber)
+fiberEntryPoint(void *param)
 {
+   auto fiber = reinterpret_cast<Fiber *>(param);
    fiber->entry(fiber->entryParam);
+   decaf_abort("Fiber entry point returned");
 }
 
 Fiber *
@@ -48,17 +306,27 @@ createFiber(FiberEntryPoint entry, void *entryParam)
    auto fiber = new Fiber();
    fiber->entry = entry;
    fiber->entryParam = entryParam;
+   fiber->stack = allocateStack();
+
+   auto stackTop = fiber->stack.base + fiber->stack.size;
 
 #ifdef DECAF_VALGRIND
-   fiber->valgrindStackId = VALGRIND_STACK_REGISTER(&fiber->stack[0], &fiber->stack[fiber->stack.size() - 1]);
+   fiber->valgrindStackId = VALGRIND_STACK_REGISTER(stackTop - DefaultStackSize,
+                                                    stackTop - 1);
 #endif
 
+#ifdef PLATFORM_FIBER_ASM
+   auto frame = reinterpret_cast<FiberInitialFrame *>(stackTop) - 1;
+   initialiseFrame(frame, &fiberEntryPoint, fiber);
+   fiber->stackPointer = frame;
+#else
    getcontext(&fiber->context);
-   fiber->context.uc_stack.ss_sp = &fiber->stack[0];
-   fiber->context.uc_stack.ss_size = fiber->stack.size();
+   fiber->context.uc_stack.ss_sp = stackTop - DefaultStackSize;
+   fiber->context.uc_stack.ss_size = DefaultStackSize;
    fiber->context.uc_link = nullptr;
 
    makecontext(&fiber->context, reinterpret_cast<void(*)()>(&fiberEntryPoint), 1, fiber);
+#endif
    return fiber;
 }
 
@@ -69,17 +337,30 @@ destroyFiber(Fiber *fiber)
    VALGRIND_STACK_DEREGISTER(fiber->valgrindStackId);
 #endif
 
+   if (fiber->stack.base) {
+      freeStack(fiber->stack);
+   }
+
    delete fiber;
 }
 
 void
 swapToFiber(Fiber *current, Fiber *target)
 {
+#ifdef PLATFORM_FIBER_ASM
+   if (!current) {
+      void *unusedStackPointer = nullptr;
+      platformFiberSwitch(&unusedStackPointer, target->stackPointer);
+   } else {
+      platformFiberSwitch(&current->stackPointer, target->stackPointer);
+   }
+#else
    if (!current) {
       setcontext(&target->context);
    } else {
       swapcontext(&current->context, &target->context);
    }
+#endif
 }
 
 } // namespace platform
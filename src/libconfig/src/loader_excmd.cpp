@@ -59,6 +59,12 @@ getExcmdGroups(excmd::parser &parser)
                   description { "Enable the JIT engine." })
       .add_option("no-jit",
                   description { "Disable the JIT engine." })
+      .add_option("jit-cache-path",
+                  description { "Path to the persistent JIT translation cache file." },
+                  value<std::string> {})
+      .add_option("jit-compile-threads",
+                  description { "Number of background JIT compile threads, 0 compiles on the executing core." },
+                  value<unsigned> {})
       .add_option("jit-fast-math",
                   description { "Enable JIT floating-point optimizations which may not exactly match PowerPC behavior.  May not work for all games." },
                   default_value<std::string> { "full" },
@@ -69,6 +75,11 @@ getExcmdGroups(excmd::parser &parser)
                   description { "Set the JIT optimization level.  Higher levels give better performance but may cause longer translation delays.  Level 3 may not work for all games." },
                   default_value<int> { 1 },
                   allowed<int> { { 0, 1, 2, 3 } })
+      .add_option("jit-tiered",
+                  description { "Compile blocks with cheap optimizations first and recompile hot blocks with the full optimization level." })
+      .add_option("jit-tier-up-threshold",
+                  description { "Number of executions before a block is recompiled with full optimizations." },
+                  value<unsigned> {})
       .add_option("jit-verify",
                   description { "Verify JIT implementation against interpreter." })
       .add_option("jit-verify-addr",
@@ -219,6 +230,22 @@ loadFromExcmd(excmd::option_state &options,
       cpuSettings.jit.enabled = false;
    }
 
+   if (options.has("jit-cache-path")) {
+      cpuSettings.jit.cachePath = options.get<std::string>("jit-cache-path");
+   }
+
+   if (options.has("jit-compile-threads")) {
+      cpuSettings.jit.compileThreads = options.get<unsigned>("jit-compile-threads");
+   }
+
+   if (options.has("jit-tiered")) {
+      cpuSettings.jit.tieredCompilation = true;
+   }
+
+   if (options.has("jit-tier-up-threshold")) {
+      cpuSettings.jit.tierUpThreshold = options.get<unsigned>("jit-tier-up-threshold");
+   }
+
    if (options.has("jit-verify")) {
       cpuSettings.jit.verify = true;
    }
@@ -271,21 +298,28 @@ loadFromExcmd(excmd::option_state &options,
       //  use with --jit-verify as long as the game doesn't actually look
       //  at FPSCR status bits.  Other optimization flags may result in
       //  verification differences even if the generated code is correct.
-      cpuSettings.jit.optimisationFlags.push_back("PPC_NO_FPSCR_STATE");
+      auto fastMathFlags = std::vector<std::string> { "PPC_NO_FPSCR_STATE" };
       if (options.get<std::string>("jit-fast-math").compare("full") == 0) {
-         cpuSettings.jit.optimisationFlags.push_back("DSE_FP");
-         cpuSettings.jit.optimisationFlags.push_back("FOLD_FP_CONSTANTS");
-         cpuSettings.jit.optimisationFlags.push_back("NATIVE_IEEE_NAN");
-         cpuSettings.jit.optimisationFlags.push_back("NATIVE_IEEE_UNDERFLOW");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_ASSUME_NO_SNAN");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_FAST_FMADDS");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_FAST_FMULS");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_FAST_STFS");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_FNMADD_ZERO_SIGN");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_IGNORE_FPSCR_VXFOO");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_NATIVE_RECIPROCAL");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_PS_STORE_DENORMALS");
-         cpuSettings.jit.optimisationFlags.push_back("PPC_SINGLE_PREC_INPUTS");
+         fastMathFlags.push_back("DSE_FP");
+         fastMathFlags.push_back("FOLD_FP_CONSTANTS");
+         fastMathFlags.push_back("NATIVE_IEEE_NAN");
+         fastMathFlags.push_back("NATIVE_IEEE_UNDERFLOW");
+         fastMathFlags.push_back("PPC_ASSUME_NO_SNAN");
+         fastMathFlags.push_back("PPC_FAST_FMADDS");
+         fastMathFlags.push_back("PPC_FAST_FMULS");
+         fastMathFlags.push_back("PPC_FAST_STFS");
+         fastMathFlags.push_back("PPC_FNMADD_ZERO_SIGN");
+         fastMathFlags.push_back("PPC_IGNORE_FPSCR_VXFOO");
+         fastMathFlags.push_back("PPC_NATIVE_RECIPROCAL");
+         fastMathFlags.push_back("PPC_PS_STORE_DENORMALS");
+         fastMathFlags.push_back("PPC_SINGLE_PREC_INPUTS");
+      }
+
+      // Fast math changes the behaviour of generated code, so it must apply
+      //  to both tiers when using tiered compilation.
+      for (const auto &flag : fastMathFlags) {
+         cpuSettings.jit.optimisationFlags.push_back(flag);
+         cpuSettings.jit.baselineOptimisationFlags.push_back(flag);
       }
    }
 
@@ -92,13 +92,20 @@ loadFromTOML(std::shared_ptr<cpptoml::table> config,
 {
    readValue(config, "mem.writetrack", cpuSettings.memory.writeTrackEnabled);
 
+   readValue(config, "interpreter.block_cache", cpuSettings.interpreter.blockCache);
+
    readValue(config, "jit.enabled", cpuSettings.jit.enabled);
    readValue(config, "jit.verify", cpuSettings.jit.verify);
    readValue(config, "jit.verify_addr", cpuSettings.jit.verifyAddress);
+   readValue(config, "jit.compile_threads", cpuSettings.jit.compileThreads);
    readValue(config, "jit.code_cache_size_mb", cpuSettings.jit.codeCacheSizeMB);
    readValue(config, "jit.data_cache_size_mb", cpuSettings.jit.dataCacheSizeMB);
    readArray(config, "jit.opt_flags", cpuSettings.jit.optimisationFlags);
+   readValue(config, "jit.tiered_compilation", cpuSettings.jit.tieredCompilation);
+   readValue(config, "jit.tier_up_threshold", cpuSettings.jit.tierUpThreshold);
+   readArray(config, "jit.baseline_opt_flags", cpuSettings.jit.baselineOptimisationFlags);
    readValue(config, "jit.rodata_read_only", cpuSettings.jit.rodataReadOnly);
+   readValue(config, "jit.cache_path", cpuSettings.jit.cachePath);
    return true;
 }
 
@@ -146,6 +153,7 @@ loadFromTOML(std::shared_ptr<cpptoml::table> config,
    readValue(config, "system.slc_path", decafSettings.system.slc_path);
    readValue(config, "system.content_path", decafSettings.system.content_path);
    readValue(config, "system.time_scale", decafSettings.system.time_scale);
+   readValue(config, "system.io_uring", decafSettings.system.io_uring);
    readArray(config, "system.lle_modules", decafSettings.system.lle_modules);
    readValue(config, "system.dump_hle_rpl", decafSettings.system.dump_hle_rpl);
    readArray(config, "system.title_directories", decafSettings.system.title_directories);
@@ -159,6 +167,11 @@ loadFromTOML(std::shared_ptr<cpptoml::table> config,
    readValue(config, "gpu.debug", gpuSettings.debug.debug_enabled);
    readValue(config, "gpu.dump_shaders", gpuSettings.debug.dump_shaders);
    readValue(config, "gpu.dump_shader_binaries_only", gpuSettings.debug.dump_shader_binaries_only);
+   readValue(config, "gpu.pm4_profiling", gpuSettings.debug.pm4_profiling);
+   readValue(config, "gpu.cache_path", gpuSettings.cache.path);
+   readValue(config, "gpu.shader_cache", gpuSettings.cache.shader_cache);
+   readValue(config, "gpu.pipeline_cache", gpuSettings.cache.pipeline_cache);
+   readValue(config, "gpu.async_compile", gpuSettings.compile.async);
 
    auto display = config->get_table("display");
    if (display) {
@@ -205,6 +218,15 @@ bool
 saveToTOML(std::shared_ptr<cpptoml::table> config,
            const cpu::Settings &cpuSettings)
 {
+   // interpreter
+   auto interpreter = config->get_table("interpreter");
+   if (!interpreter) {
+      interpreter = cpptoml::make_table();
+   }
+
+   interpreter->insert("block_cache", cpuSettings.interpreter.blockCache);
+   config->insert("interpreter", interpreter);
+
    // jit
    auto jit = config->get_table("jit");
    if (!jit) {
@@ -214,9 +236,11 @@ saveToTOML(std::shared_ptr<cpptoml::table> config,
    jit->insert("enabled", cpuSettings.jit.enabled);
    jit->insert("verify", cpuSettings.jit.verify);
    jit->insert("verify_addr", cpuSettings.jit.verifyAddress);
+   jit->insert("compile_threads", cpuSettings.jit.compileThreads);
    jit->insert("code_cache_size_mb", cpuSettings.jit.codeCacheSizeMB);
    jit->insert("data_cache_size_mb", cpuSettings.jit.dataCacheSizeMB);
    jit->insert("rodata_read_only", cpuSettings.jit.rodataReadOnly);
+   jit->insert("cache_path", cpuSettings.jit.cachePath);
 
    auto opt_flags = cpptoml::make_array();
    for (auto &flag : cpuSettings.jit.optimisationFlags) {
@@ -224,6 +248,15 @@ saveToTOML(std::shared_ptr<cpptoml::table> config,
    }
 
    jit->insert("opt_flags", opt_flags);
+   jit->insert("tiered_compilation", cpuSettings.jit.tieredCompilation);
+   jit->insert("tier_up_threshold", cpuSettings.jit.tierUpThreshold);
+
+   auto baseline_opt_flags = cpptoml::make_array();
+   for (auto &flag : cpuSettings.jit.baselineOptimisationFlags) {
+      baseline_opt_flags->push_back(flag);
+   }
+
+   jit->insert("baseline_opt_flags", baseline_opt_flags);
    config->insert("jit", jit);
    return true;
 }
@@ -308,6 +341,7 @@ saveToTOML(std::shared_ptr<cpptoml::table> config,
    system->insert("slc_path", decafSettings.system.slc_path);
    system->insert("content_path", decafSettings.system.content_path);
    system->insert("time_scale", decafSettings.system.time_scale);
+   system->insert("io_uring", decafSettings.system.io_uring);
 
    auto lle_modules = cpptoml::make_array();
    for (auto &name : decafSettings.system.lle_modules) {
@@ -340,6 +374,11 @@ saveToTOML(std::shared_ptr<cpptoml::table> config,
    gpu->insert("debug", gpuSettings.debug.debug_enabled);
    gpu->insert("dump_shaders", gpuSettings.debug.dump_shaders);
    gpu->insert("dump_shader_binaries_only", gpuSettings.debug.dump_shader_binaries_only);
+   gpu->insert("pm4_profiling", gpuSettings.debug.pm4_profiling);
+   gpu->insert("cache_path", gpuSettings.cache.path);
+   gpu->insert("shader_cache", gpuSettings.cache.shader_cache);
+   gpu->insert("pipeline_cache", gpuSettings.cache.pipeline_cache);
+   gpu->insert("async_compile", gpuSettings.compile.async);
 
    config->insert("gpu", gpu);
 
@@ -18,6 +18,9 @@ struct JitSettings
    //! Select a single block (starting address) for verification (0 = verify everything)
    uint32_t verifyAddress = 0u;
 
+   //! Number of background JIT compile threads (0 = compile on the executing core)
+   unsigned int compileThreads = 0;
+
    //! JIT code cache size in megabytes
    unsigned int codeCacheSizeMB = 1024;
 
@@ -39,18 +42,49 @@ struct JitSettings
       "X86_STORE_IMMEDIATE",
    };
 
+   //! Compile blocks with baselineOptimisationFlags first, and retranslate
+   //! them with optimisationFlags once they are executed tierUpThreshold times
+   bool tieredCompilation = false;
+
+   //! Number of executions before a baseline block is retranslated
+   unsigned int tierUpThreshold = 1000;
+
+   //! List of JIT optimizations to enable for baseline blocks when using
+   //! tiered compilation
+   std::vector<std::string> baselineOptimisationFlags =
+   {
+      "BASIC",
+      "FOLD_CONSTANTS",
+      "PPC_PAIRED_LWARX_STWCX",
+      "X86_FIXED_REGS",
+   };
+
    //! Treat .rodata sections as read-only regardless of RPL/RPX flags
    bool rodataReadOnly = true;
+
+   //! Path to the persistent translation cache file (empty = disabled)
+   std::string cachePath = "";
+};
+
+struct InterpreterSettings
+{
+   //! Execute cached pre-decoded basic blocks instead of decoding every instruction
+   bool blockCache = true;
 };
 
 struct MemorySettings
 {
    //! Whether page guards for write tracking is enabled or not.
+   //!
+   //! The kernel fails with EFAULT rather than raising a fault when it writes
+   //! to a guarded page, so host I/O which writes straight into guest memory
+   //! (read(2), io_uring, ...) must call cpu::unprotectForHostWrite first.
    bool writeTrackEnabled = false;
 };
 
 struct Settings
 {
+   InterpreterSettings interpreter;
    JitSettings jit;
    MemorySettings memory;
 };
@@ -12,6 +12,10 @@ const uint32_t ALARM_INTERRUPT = 1 << 2;
 const uint32_t DBGBREAK_INTERRUPT = 1 << 3;
 const uint32_t GPU7_INTERRUPT = 1 << 4;
 const uint32_t IPC_INTERRUPT = 1 << 5;
+
+//! Used by the JIT to make a core return to its dispatcher, this is never
+//! passed to the interrupt handler.
+const uint32_t JIT_FLUSH_INTERRUPT = 1 << 6;
 const uint32_t INTERRUPT_MASK = 0xFFFFFFFF;
 const uint32_t NONMASKABLE_INTERRUPTS = SRESET_INTERRUPT;
 
@@ -31,6 +35,10 @@ void
 addJitReadOnlyRange(uint32_t address,
                     uint32_t size);
 
+void
+addJitReadOnlyCodeRange(uint32_t address,
+                        uint32_t size);
+
 void
 interrupt(int core_idx,
           uint32_t flags);
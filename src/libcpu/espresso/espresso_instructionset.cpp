@@ -3,76 +3,21 @@
 #include <common/bitutils.h>
 #include <common/decaf_assert.h>
 #include <algorithm>
+#include <array>
+#include <initializer_list>
 
 namespace espresso
 {
 
-struct TableEntry
-{
-   struct FieldMap
-   {
-      InstructionField field;
-      std::vector<TableEntry> children;
-   };
-
-   void
-   addInstruction(InstructionField field, uint32_t value, InstructionInfo *instrInfo)
-   {
-      auto fieldMap = getFieldMap(field);
-      decaf_check(fieldMap);
-      decaf_check(value < fieldMap->children.size());
-      fieldMap->children[value].instr = instrInfo;
-   }
-
-   void
-   addTable(InstructionField field)
-   {
-      if (!getFieldMap(field)) {
-         auto fieldMap = FieldMap {};
-         auto size = 1 << getInstructionFieldWidth(field);
-         fieldMap.field = field;
-         fieldMap.children.resize(size);
-         fieldMaps.emplace_back(fieldMap);
-      }
-   }
-
-   TableEntry *
-   getEntry(InstructionField field, uint32_t value)
-   {
-      auto fieldMap = getFieldMap(field);
-      decaf_check(fieldMap);
-      decaf_check(value < fieldMap->children.size());
-      return &fieldMap->children[value];
-   }
-
-   FieldMap *
-   getFieldMap(InstructionField field)
-   {
-      for (auto &fieldMap : fieldMaps) {
-         if (fieldMap.field == field) {
-            return &fieldMap;
-         }
-      }
-
-      return nullptr;
-   }
-
-   InstructionInfo *instr = nullptr;
-   std::vector<FieldMap> fieldMaps;
-};
-
 static std::vector<InstructionInfo>
 sInstructionInfo;
 
 static std::vector<InstructionAlias>
 sAliasData;
 
-static TableEntry
-sInstructionTable;
-
 #define FLD(x, y, z, ...) {y, z},
 #define MRKR(x, ...) {-1, -1},
-static std::pair<int, int>
+static constexpr std::pair<int, int>
 sFieldBits[] = {
    { -1, -1 },
 #include "espresso_instruction_fields.inl"
@@ -113,18 +58,39 @@ getInstructionFieldName(InstructionField field)
    return sFieldNames[static_cast<int>(field)];
 }
 
+// First bit of instruction field
+static constexpr uint32_t
+fieldStart(InstructionField field)
+{
+   return 31 - sFieldBits[static_cast<int>(field)].second;
+}
+
+// Last bit of instruction field
+static constexpr uint32_t
+fieldEnd(InstructionField field)
+{
+   return 31 - sFieldBits[static_cast<int>(field)].first;
+}
+
+// Absolute bitmask of instruction field
+static constexpr uint32_t
+fieldBitmask(InstructionField field)
+{
+   return make_bitmask(fieldStart(field), fieldEnd(field));
+}
+
 // First bit of instruction field
 uint32_t
 getInstructionFieldStart(InstructionField field)
 {
-   return 31 - sFieldBits[static_cast<int>(field)].second;
+   return fieldStart(field);
 }
 
 // Last bit of instruction field
 uint32_t
 getInstructionFieldEnd(InstructionField field)
 {
-   return 31 - sFieldBits[static_cast<int>(field)].first;
+   return fieldEnd(field);
 }
 
 // Width of instruction field in bits
@@ -140,9 +106,7 @@ getInstructionFieldWidth(InstructionField field)
 uint32_t
 getInstructionFieldBitmask(InstructionField field)
 {
-   auto end = getInstructionFieldEnd(field);
-   auto start = getInstructionFieldStart(field);
-   return make_bitmask(start, end);
+   return fieldBitmask(field);
 }
 
 uint32_t
@@ -171,48 +135,6 @@ encodeSPR(Instruction &instr, SPR spr)
    instr.spr = ((sprInt << 5) & 0x3E0) | ((sprInt >> 5) & 0x1F);
 }
 
-// Decode Instruction to InstructionInfo
-InstructionInfo *
-decodeInstruction(Instruction instr)
-{
-   auto table = &sInstructionTable;
-
-   while (table) {
-      for (auto &fieldMap : table->fieldMaps) {
-         auto value = getInstructionFieldValue(fieldMap.field, instr);
-         table = &fieldMap.children[value];
-
-         if (table->instr || table->fieldMaps.size()) {
-            break;
-         }
-      }
-
-      if (table->fieldMaps.size() == 0) {
-         return table->instr;
-      }
-   }
-
-   return nullptr;
-}
-
-// Encode specified instruction
-Instruction
-encodeInstruction(InstructionID id)
-{
-   auto &data = sInstructionInfo[static_cast<size_t>(id)];
-   auto instr = 0u;
-
-   for (auto &op : data.opcode) {
-      auto field = op.field;
-      auto value = op.value;
-      auto start = getInstructionFieldStart(field);
-
-      instr |= value << start;
-   }
-
-   return instr;
-}
-
 // Find InstructionInfo for InstructionID
 InstructionInfo *
 findInstructionInfo(InstructionID instrId)
@@ -249,45 +171,6 @@ findInstructionAlias(InstructionInfo *info, Instruction instr)
    return nullptr;
 }
 
-// Check if instruction is a certain instruction
-bool
-isA(InstructionID id, Instruction instr)
-{
-   const auto &data = sInstructionInfo[static_cast<size_t>(id)];
-
-   return std::all_of(data.opcode.begin(), data.opcode.end(), [instr](const auto &op) {
-      auto field = op.field;
-      auto value = op.value;
-      auto start = getInstructionFieldStart(field);
-      auto mask = getInstructionFieldBitmask(field);
-
-      return ((instr.value & mask) >> start) == value;
-   });
-}
-
-// Initialise instructionTable
-static void
-initialiseInstructionTable()
-{
-   for (auto &instr : sInstructionInfo) {
-      TableEntry *table = &sInstructionTable;
-
-      // Resolve opcodes
-      for (auto i = 0u; i < instr.opcode.size() - 1; ++i) {
-         auto field = instr.opcode[i].field;
-         auto value = instr.opcode[i].value;
-         table->addTable(field);
-         table = table->getEntry(field, value);
-      }
-
-      // Add the actual instruction entry
-      auto field = instr.opcode.back().field;
-      auto value = instr.opcode.back().value;
-      table->addTable(field);
-      table->addInstruction(field, value, &instr);
-   }
-}
-
 static std::string
 cleanInsName(const std::string& name)
 {
@@ -310,28 +193,28 @@ cleanInsName(const std::string& name)
  */
 struct FieldIndex
 {
-   FieldIndex(InstructionField _id) : id(_id)
+   constexpr FieldIndex(InstructionField _id) : id(_id)
    {
    }
 
-   operator InstructionField() const
+   constexpr operator InstructionField() const
    {
       return id;
    }
 
-   InstructionOpcode
+   constexpr InstructionOpcode
    operator==(const int &other) const
    {
       return InstructionOpcode(id, other);
    }
 
-   InstructionOpcode
+   constexpr InstructionOpcode
    operator==(const FieldIndex &other) const
    {
       return InstructionOpcode(id, other.id);
    }
 
-   InstructionOpcode
+   constexpr InstructionOpcode
    operator!() const
    {
       return InstructionOpcode(id, 0);
@@ -341,8 +224,8 @@ struct FieldIndex
 };
 
 // Create FieldIndex to match the field names we use inside the spec files
-#define FLD(x, ...)  static const FieldIndex x(InstructionField::x);
-#define MRKR(x, ...) static const FieldIndex x(InstructionField::x);
+#define FLD(x, ...)  static constexpr FieldIndex x(InstructionField::x);
+#define MRKR(x, ...) static constexpr FieldIndex x(InstructionField::x);
 #include "espresso_instruction_fields.inl"
 #undef FLD
 #undef MRKR
@@ -372,6 +255,209 @@ struct FieldIndex
 #undef INS
 #undef INSA
 
+/*
+ * The decode tables are generated at compile time from the instruction
+ * definitions.
+ *
+ * Every instruction is reduced to a single mask and value which must match,
+ * the primary opcode then indexes sDecodeTables.primary.  Primary opcodes
+ * which have extended opcodes (bits 21-30) use a second table indexed by
+ * those bits.  Each table entry holds a short list of candidate instructions
+ * in definition order, the first candidate whose mask and value matches is
+ * the decoded instruction.
+ */
+struct OpcodeMatch
+{
+   uint32_t mask;
+   uint32_t value;
+};
+
+static constexpr OpcodeMatch
+makeOpcodeMatch(std::initializer_list<InstructionOpcode> opcodes)
+{
+   auto match = OpcodeMatch { 0, 0 };
+
+   for (auto &op : opcodes) {
+      match.mask |= fieldBitmask(op.field);
+      match.value |= op.value << fieldStart(op.field);
+   }
+
+   return match;
+}
+
+#define INS(name, write, read, flags, opcodes, fullname) \
+   makeOpcodeMatch({ PRINTOPS opcodes }),
+
+static constexpr OpcodeMatch
+sOpcodeMatches[] = {
+#  include "espresso_instruction_definitions.inl"
+};
+
+#undef INS
+
+static constexpr auto NumInstructions = sizeof(sOpcodeMatches) / sizeof(sOpcodeMatches[0]);
+static constexpr auto PrimaryOpcodeShift = 26u;
+static constexpr auto NumPrimaryOpcodes = 64u;
+static constexpr auto ExtendedOpcodeShift = 1u;
+static constexpr auto ExtendedOpcodeMask = 0x3FFu;
+static constexpr auto NumExtendedOpcodes = ExtendedOpcodeMask + 1;
+static constexpr auto MaxDecodeCandidates = 2u;
+static constexpr uint16_t InvalidCandidate = 0xFFFF;
+
+static_assert(NumInstructions == static_cast<size_t>(InstructionID::Invalid),
+              "Instruction definitions do not match InstructionID");
+static_assert(NumInstructions < InvalidCandidate,
+              "Too many instructions for decode table");
+
+struct DecodeEntry
+{
+   std::array<uint16_t, MaxDecodeCandidates> candidates = { InvalidCandidate, InvalidCandidate };
+};
+
+struct PrimaryDecodeEntry
+{
+   //! Index into DecodeTables::extended, or -1 if decoded by entry alone.
+   int extended = -1;
+
+   //! Candidates for primary opcodes with no extended opcode.
+   DecodeEntry entry;
+};
+
+static constexpr bool
+hasExtendedOpcode(const OpcodeMatch &match)
+{
+   return !!((match.mask >> ExtendedOpcodeShift) & ExtendedOpcodeMask);
+}
+
+static constexpr size_t
+countExtendedDecodeTables()
+{
+   bool extended[NumPrimaryOpcodes] = { };
+   auto count = size_t { 0 };
+
+   for (auto &match : sOpcodeMatches) {
+      auto opcd = match.value >> PrimaryOpcodeShift;
+
+      if (hasExtendedOpcode(match) && !extended[opcd]) {
+         extended[opcd] = true;
+         ++count;
+      }
+   }
+
+   return count;
+}
+
+struct DecodeTables
+{
+   std::array<PrimaryDecodeEntry, NumPrimaryOpcodes> primary;
+   std::array<std::array<DecodeEntry, NumExtendedOpcodes>, countExtendedDecodeTables()> extended;
+
+   //! Set if more than MaxDecodeCandidates instructions shared an entry.
+   bool overflow = false;
+};
+
+static constexpr void
+addDecodeCandidate(DecodeTables &tables,
+                   DecodeEntry &entry,
+                   uint16_t index)
+{
+   for (auto &candidate : entry.candidates) {
+      if (candidate == InvalidCandidate) {
+         candidate = index;
+         return;
+      }
+   }
+
+   tables.overflow = true;
+}
+
+static constexpr DecodeTables
+generateDecodeTables()
+{
+   auto tables = DecodeTables { };
+   auto numExtended = 0;
+
+   for (auto &match : sOpcodeMatches) {
+      auto &primary = tables.primary[match.value >> PrimaryOpcodeShift];
+
+      if (hasExtendedOpcode(match) && primary.extended < 0) {
+         primary.extended = numExtended++;
+      }
+   }
+
+   for (auto i = 0u; i < NumInstructions; ++i) {
+      auto &match = sOpcodeMatches[i];
+      auto &primary = tables.primary[match.value >> PrimaryOpcodeShift];
+
+      if (primary.extended < 0) {
+         addDecodeCandidate(tables, primary.entry, static_cast<uint16_t>(i));
+         continue;
+      }
+
+      // Add to every extended opcode which matches the fixed bits of the
+      // instruction, by iterating all subsets of the free bits.
+      auto &extended = tables.extended[primary.extended];
+      auto xoMask = (match.mask >> ExtendedOpcodeShift) & ExtendedOpcodeMask;
+      auto xoValue = (match.value >> ExtendedOpcodeShift) & ExtendedOpcodeMask;
+      auto xoFree = ~xoMask & ExtendedOpcodeMask;
+      auto xoBits = 0u;
+
+      do {
+         addDecodeCandidate(tables, extended[xoValue | xoBits], static_cast<uint16_t>(i));
+         xoBits = (xoBits - xoFree) & xoFree;
+      } while (xoBits);
+   }
+
+   return tables;
+}
+
+static constexpr DecodeTables
+sDecodeTables = generateDecodeTables();
+
+static_assert(!sDecodeTables.overflow,
+              "Too many instructions share a decode table entry, increase MaxDecodeCandidates");
+
+// Decode Instruction to InstructionInfo
+InstructionInfo *
+decodeInstruction(Instruction instr)
+{
+   auto &primary = sDecodeTables.primary[instr.opcd];
+   auto entry = &primary.entry;
+
+   if (primary.extended >= 0) {
+      auto xo = (instr.value >> ExtendedOpcodeShift) & ExtendedOpcodeMask;
+      entry = &sDecodeTables.extended[primary.extended][xo];
+   }
+
+   for (auto index : entry->candidates) {
+      if (index == InvalidCandidate) {
+         break;
+      }
+
+      auto &match = sOpcodeMatches[index];
+      if ((instr.value & match.mask) == match.value) {
+         return &sInstructionInfo[index];
+      }
+   }
+
+   return nullptr;
+}
+
+// Encode specified instruction
+Instruction
+encodeInstruction(InstructionID id)
+{
+   return sOpcodeMatches[static_cast<size_t>(id)].value;
+}
+
+// Check if instruction is a certain instruction
+bool
+isA(InstructionID id, Instruction instr)
+{
+   auto &match = sOpcodeMatches[static_cast<size_t>(id)];
+   return (instr.value & match.mask) == match.value;
+}
+
 #define INS(name, ...) sInstructionInfo.emplace_back(info_ ## name);
 #define INSA(name, ...) sAliasData.emplace_back(alias_ ## name);
 
@@ -383,9 +469,6 @@ initialiseInstructionSet()
 
    // Populate sInstructionAlias
 #  include "espresso_instruction_aliases.inl"
-
-   // Create instruction table
-   initialiseInstructionTable();
 };
 
 #undef INS
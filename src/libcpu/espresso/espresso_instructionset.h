@@ -21,17 +21,17 @@ enum class InstructionField : uint32_t
 
 struct InstructionOpcode
 {
-   InstructionOpcode()
+   constexpr InstructionOpcode()
    {
    }
 
-   InstructionOpcode(InstructionField field_, uint32_t value_) :
+   constexpr InstructionOpcode(InstructionField field_, uint32_t value_) :
       field(field_),
       value(value_)
    {
    }
 
-   InstructionOpcode(InstructionField field_, InstructionField field2_) :
+   constexpr InstructionOpcode(InstructionField field_, InstructionField field2_) :
       field(field_),
       field2(field2_)
    {
@@ -4,6 +4,7 @@
 #include <common/platform.h>
 #include <cstdint>
 #include <gsl/gsl-lite.hpp>
+#include <vector>
 
 #ifdef PLATFORM_WINDOWS
 #define WIN32_LEAN_AND_MEAN
@@ -36,11 +37,23 @@ struct CodeBlockProfileData
    std::atomic<uint64_t> time;
 };
 
+enum class CodeBlockTier : uint32_t
+{
+   //! Compiled with the cheap baseline optimisation flags.
+   Baseline,
+
+   //! Compiled with the full optimisation flags.
+   Optimised,
+};
+
 struct CodeBlock
 {
    //! Guest address of PPC code.
    uint32_t address;
 
+   //! Size of guest code the block may have been translated from.
+   uint32_t guestSize;
+
    //! Host address of compiled code.
    void *code;
 
@@ -50,6 +63,13 @@ struct CodeBlock
    //! Profiling data.
    CodeBlockProfileData profileData;
 
+   //! Optimisation tier the code was compiled at.
+   CodeBlockTier tier;
+
+   //! Executions remaining until the block is promoted to the next tier,
+   //! zero if the block will not be promoted.
+   std::atomic<uint32_t> tierUpCounter;
+
    //! Code block unwind info, only used on Windows.
    CodeBlockUnwindInfo unwindInfo;
 };
@@ -60,12 +80,36 @@ static constexpr CodeBlockIndex CodeBlockIndexUncompiled = -1;
 static constexpr CodeBlockIndex CodeBlockIndexCompiling = -2;
 static constexpr CodeBlockIndex CodeBlockIndexError = -3;
 
+struct InterpretedRegionStats
+{
+   //! First guest address of the region.
+   uint32_t start;
+
+   //! Guest address after the end of the region.
+   uint32_t end;
+
+   //! Number of times execution has entered the region.
+   uint64_t entries;
+
+   //! Number of basic blocks interpreted in the region.
+   uint64_t blocks;
+
+   //! Time spent interpreting the region, in rdtsc ticks.
+   uint64_t time;
+};
+
 struct JitStats
 {
    uint64_t totalTimeInCodeBlocks = 0;
    uint64_t usedCodeCacheSize = 0;
    uint64_t usedDataCacheSize = 0;
+   uint64_t persistentCacheHits = 0;
+   uint64_t persistentCacheMisses = 0;
+   uint64_t tierUpCompiles = 0;
+   uint64_t codeCacheFlushes = 0;
+   uint64_t totalTimeInterpreted = 0;
    gsl::span<CodeBlock> compiledBlocks;
+   std::vector<InterpretedRegionStats> interpretedRegions;
 };
 
 bool
@@ -45,4 +45,11 @@ MemtrackState
 getMemoryState(PhysicalAddress physicalAddress,
                uint32_t size);
 
+bool
+isWriteTrackingEnabled();
+
+void
+unprotectForHostWrite(PhysicalAddress physicalAddress,
+                      uint32_t size);
+
 } // namespace cpu
@@ -50,6 +50,7 @@ initialise()
    initialiseMemory();
    espresso::initialiseInstructionSet();
    interpreter::initialise();
+   interpreter::setBlockCacheEnabled(settings->interpreter.blockCache);
 
    if (sJitEnabled) {
       auto backend = new jit::BinrecBackend {
@@ -57,7 +58,20 @@ initialise()
          settings->jit.dataCacheSizeMB * 1024 * 1024
       };
       backend->setOptFlags(settings->jit.optimisationFlags);
+
+      if (settings->jit.tieredCompilation) {
+         backend->setTieredCompilation(settings->jit.baselineOptimisationFlags,
+                                       settings->jit.tierUpThreshold);
+      }
+
       backend->setVerifyEnabled(settings->jit.verify, settings->jit.verifyAddress);
+
+      if (!settings->jit.cachePath.empty()) {
+         backend->setPersistentCachePath(settings->jit.cachePath);
+      }
+
+      backend->setCompileThreads(settings->jit.compileThreads);
+
       jit::setBackend(backend);
    }
 
@@ -67,6 +81,7 @@ initialise()
 void
 clearInstructionCache()
 {
+   cpu::interpreter::clearBlockCache();
    cpu::jit::clearCache(0, 0xFFFFFFFF);
 }
 
@@ -74,6 +89,7 @@ void
 invalidateInstructionCache(uint32_t address,
                            uint32_t size)
 {
+   cpu::interpreter::invalidateBlockCache(address, size);
    cpu::jit::clearCache(address, size);
 }
 
@@ -84,6 +100,13 @@ addJitReadOnlyRange(uint32_t address,
    jit::addReadOnlyRange(address, size);
 }
 
+void
+addJitReadOnlyCodeRange(uint32_t address,
+                        uint32_t size)
+{
+   jit::addReadOnlyCodeRange(address, size);
+}
+
 void
 coreEntryPoint(Core *core)
 {
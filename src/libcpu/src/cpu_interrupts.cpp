@@ -32,6 +32,16 @@ setInterruptHandler(InterruptHandler handler)
    sUserInterruptHandler = handler;
 }
 
+/**
+ * Interrupts which will be passed to the interrupt handler, the JIT flush
+ * interrupt is only used to exit JIT code and is handled by the JIT itself.
+ */
+static uint32_t
+getHandledInterrupts(Core *core)
+{
+   return (core->interrupt_mask | NONMASKABLE_INTERRUPTS) & ~JIT_FLUSH_INTERRUPT;
+}
+
 namespace this_core
 {
 
@@ -60,11 +70,11 @@ void
 checkInterrupts()
 {
    auto core = state();
-   auto mask = core->interrupt_mask | NONMASKABLE_INTERRUPTS;
+   auto mask = getHandledInterrupts(core);
    auto flags = core->interrupt.fetch_and(~mask);
 
    if (flags & mask) {
-      sUserInterruptHandler(core, flags);
+      sUserInterruptHandler(core, flags & ~JIT_FLUSH_INTERRUPT);
    }
 }
 
@@ -79,12 +89,12 @@ waitForInterrupt()
          decaf_abort("WFI thread found all maskable interrupts were disabled");
       }
 
-      auto mask = core->interrupt_mask | NONMASKABLE_INTERRUPTS;
+      auto mask = getHandledInterrupts(core);
       auto flags = core->interrupt.fetch_and(~mask);
 
       if (flags & mask) {
          lock.unlock();
-         sUserInterruptHandler(core, flags);
+         sUserInterruptHandler(core, flags & ~JIT_FLUSH_INTERRUPT);
          lock.lock();
       } else {
          sInterruptCondition.wait(lock);
@@ -102,7 +112,7 @@ waitNextInterrupt(std::chrono::steady_clock::time_point until)
       decaf_abort("WFI thread found all maskable interrupts were disabled");
    }
 
-   auto mask = core->interrupt_mask | NONMASKABLE_INTERRUPTS;
+   auto mask = getHandledInterrupts(core);
    auto flags = core->interrupt.fetch_and(~mask);
 
    if (!(flags & mask)) {
@@ -112,14 +122,14 @@ waitNextInterrupt(std::chrono::steady_clock::time_point until)
          sInterruptCondition.wait_until(lock, until);
       }
 
-      mask = core->interrupt_mask | NONMASKABLE_INTERRUPTS;
+      mask = getHandledInterrupts(core);
       flags = core->interrupt.fetch_and(~mask);
    }
 
    lock.unlock();
 
    if (flags & mask) {
-      sUserInterruptHandler(core, flags);
+      sUserInterruptHandler(core, flags & ~JIT_FLUSH_INTERRUPT);
    }
 }
 
@@ -5,15 +5,146 @@
 #include <common/platform.h>
 #ifdef PLATFORM_POSIX
 
+#include "cpu_config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <common/platform_exception.h>
+#include <common/platform_memory.h>
+#include <common/rangecombiner.h>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <vector>
+
 namespace cpu
 {
 
+/*
+ * Write tracking works by write protecting the virtual pages of a range when
+ * its state is queried.  The first write to a protected page raises SIGSEGV,
+ * which we handle by bumping the generation counter of the physical page and
+ * making the page writable again.  The state of a range is then just the sum
+ * of the generation counters of its pages.
+ *
+ * sVirtLookup maps each virtual page to its physical page, with VirtIsMappedBit
+ * set for pages in a tracked range and VirtTrackSetBit set for pages which are
+ * currently write protected.
+ *
+ * sProtectLock serialises changes to VirtTrackSetBit with the matching
+ * mprotect call, otherwise the fault handler could make a page writable after
+ * getMemoryState has just protected it again.  It is a spin lock because it
+ * is taken from the signal handler.
+ */
+static constexpr uint32_t VirtTrackSetBit = 0x80000000;
+static constexpr uint32_t VirtIsMappedBit = 0x40000000;
+
+struct MappedArea
+{
+   cpu::VirtualAddress virtAddr;
+   cpu::PhysicalAddress physAddr;
+   uint32_t size;
+};
+
+static uintptr_t sVirtBaseAddress = 0;
+static uint64_t sPageSizeBits = 0;
+static std::unique_ptr<std::atomic<uint32_t>[]> sVirtLookup;
+static std::unique_ptr<std::atomic<uint64_t>[]> sTrackCount;
+static std::atomic_flag sProtectLock = ATOMIC_FLAG_INIT;
+static std::mutex sVirtMapMutex;
+static std::vector<MappedArea> sVirtMap;
+
+static void
+lockProtect()
+{
+   while (sProtectLock.test_and_set(std::memory_order_acquire)) {
+   }
+}
+
+static void
+unlockProtect()
+{
+   sProtectLock.clear(std::memory_order_release);
+}
+
 namespace internal
 {
 
+static platform::ExceptionResumeFunc
+writeExceptionHandler(platform::Exception *exception)
+{
+   if (exception->type != platform::Exception::AccessViolation) {
+      return platform::UnhandledException;
+   }
+
+   auto info = reinterpret_cast<platform::AccessViolationException *>(exception);
+   auto address = info->address;
+
+   if (address < sVirtBaseAddress || address >= sVirtBaseAddress + 0x100000000) {
+      return platform::UnhandledException;
+   }
+
+   auto lookupIdx = (address - sVirtBaseAddress) >> sPageSizeBits;
+
+   lockProtect();
+   auto oldLookupValue = sVirtLookup[lookupIdx].fetch_and(~VirtTrackSetBit);
+   if (!(oldLookupValue & VirtIsMappedBit)) {
+      // This page is not tracked, so this is a real fault
+      sVirtLookup[lookupIdx].store(oldLookupValue);
+      unlockProtect();
+      return platform::UnhandledException;
+   }
+
+   if (oldLookupValue & VirtTrackSetBit) {
+      // Increment the counter to mark it as having changed
+      auto trackIdx = oldLookupValue & ~(VirtTrackSetBit | VirtIsMappedBit);
+      sTrackCount[trackIdx].fetch_add(1);
+
+      // Finally we reprotect the memory to its normal state, we can not use
+      // platform::protectMemory here as it is not safe to log in a signal
+      // handler.
+      auto pageAddress = sVirtBaseAddress + (lookupIdx << sPageSizeBits);
+      if (mprotect(reinterpret_cast<void *>(pageAddress),
+                   size_t { 1 } << sPageSizeBits,
+                   PROT_READ | PROT_WRITE) != 0) {
+         unlockProtect();
+         return platform::UnhandledException;
+      }
+   }
+
+   // If the track bit was already clear then another thread has just handled
+   // a write to the same page, so we can simply retry the write.
+   unlockProtect();
+   return platform::HandledException;
+}
+
 void
 initialiseMemtrack()
 {
+   if (!config()->memory.writeTrackEnabled) {
+      return;
+   }
+
+   auto pageSize = platform::getSystemPageSize();
+   auto pageSizeBits = 0;
+   auto i = pageSize;
+   while (i >>= 1) pageSizeBits++;
+
+   sVirtBaseAddress = cpu::getBaseVirtualAddress();
+   sPageSizeBits = pageSizeBits;
+
+   auto numtrackTableEntries = 0x100000000ull >> pageSizeBits;
+   sVirtLookup = std::make_unique<std::atomic<uint32_t>[]>(numtrackTableEntries);
+   sTrackCount = std::make_unique<std::atomic<uint64_t>[]>(numtrackTableEntries);
+
+   for (auto idx = 0ull; idx < numtrackTableEntries; ++idx) {
+      sVirtLookup[idx].store(0, std::memory_order_relaxed);
+      sTrackCount[idx].store(0, std::memory_order_relaxed);
+   }
+
+   // This must be installed before the cpu host exception handler, which
+   // would otherwise treat the write as a guest segfault.
+   platform::installExceptionHandler(writeExceptionHandler);
 }
 
 void
@@ -21,30 +152,255 @@ registerTrackedRange(VirtualAddress virtualAddress,
                      PhysicalAddress physicalAddress,
                      uint32_t size)
 {
+   if (!sTrackCount) {
+      return;
+   }
+
+   if (size == 0) {
+      return;
+   }
+
+   std::unique_lock<std::mutex> lock { sVirtMapMutex };
+
+   // Remove any conflicting virtual mappings, see cpu_memtrack_win.cpp.
+   for (auto iter = sVirtMap.begin(); iter != sVirtMap.end(); ) {
+      if (virtualAddress >= iter->virtAddr && virtualAddress < iter->virtAddr + iter->size) {
+         iter = sVirtMap.erase(iter);
+      } else {
+         ++iter;
+      }
+   }
+
+   sVirtMap.push_back({ virtualAddress, physicalAddress, size });
+
+   auto firstPhysPage = physicalAddress.getAddress() >> sPageSizeBits;
+   auto firstPage = virtualAddress.getAddress() >> sPageSizeBits;
+   auto lastPage = (virtualAddress.getAddress() + (size - 1)) >> sPageSizeBits;
+
+   for (auto pageIdx = firstPage, physPageIdx = firstPhysPage;
+        pageIdx <= lastPage;
+        ++pageIdx, ++physPageIdx)
+   {
+      auto oldPhysPage = sVirtLookup[pageIdx].exchange(VirtIsMappedBit | physPageIdx);
+      if (oldPhysPage & VirtIsMappedBit) {
+         decaf_abort("write tracker attempted to register an already registered page");
+      }
+
+      // The memory may have changed while it was not tracked, the next time
+      // the pages are checked for changes they will be protected.
+      sTrackCount[physPageIdx].fetch_add(1);
+   }
 }
 
 void
 unregisterTrackedRange(VirtualAddress virtualAddress,
                        uint32_t size)
 {
+   if (!sTrackCount) {
+      return;
+   }
+
+   if (size == 0) {
+      return;
+   }
+
+   std::unique_lock<std::mutex> lock { sVirtMapMutex };
+
+   for (auto iter = sVirtMap.begin(); iter != sVirtMap.end(); ++iter) {
+      if (iter->virtAddr == virtualAddress && iter->size == size) {
+         sVirtMap.erase(iter);
+         break;
+      }
+   }
+
+   auto firstPage = virtualAddress.getAddress() >> sPageSizeBits;
+   auto lastPage = firstPage + ((size - 1) >> sPageSizeBits);
+
+   lockProtect();
+
+   for (auto pageIdx = firstPage; pageIdx <= lastPage; ++pageIdx) {
+      auto oldPhysPage = sVirtLookup[pageIdx].exchange(0x00000000);
+      if (!(oldPhysPage & VirtIsMappedBit)) {
+         unlockProtect();
+         decaf_abort("write tracker attempted to unregister an already unregister page");
+      }
+   }
+
+   unlockProtect();
 }
 
 void
 clearTrackedRanges()
 {
+   if (!sTrackCount) {
+      return;
+   }
+
+   std::unique_lock<std::mutex> lock { sVirtMapMutex };
+   auto numtrackTableEntries = 0x100000000ull >> sPageSizeBits;
+   sVirtMap.clear();
+
+   lockProtect();
+
+   for (auto idx = 0ull; idx < numtrackTableEntries; ++idx) {
+      sVirtLookup[idx].store(0, std::memory_order_relaxed);
+   }
+
+   unlockProtect();
 }
 
 } // namespace internal
 
+/**
+ * Returns true when memory states are page write counters rather than hashes
+ * of the memory contents.
+ */
+bool
+isWriteTrackingEnabled()
+{
+   return !!sTrackCount;
+}
+
+/**
+ * Make a range of guest memory writable for a write done by the host which
+ * bypasses our fault handler, and mark it as changed.
+ *
+ * The kernel returns EFAULT rather than raising SIGSEGV when read(2), io_uring
+ * and friends write into a protected page, and writes through the physical
+ * view are never seen by the fault handler.  As getMemoryState may protect the
+ * range again before an asynchronous write completes, this should also be
+ * called once the write has completed and callers must be prepared to retry a
+ * write which failed with EFAULT.
+ */
+void
+unprotectForHostWrite(PhysicalAddress physicalAddress,
+                      uint32_t size)
+{
+   if (!sTrackCount || size == 0) {
+      return;
+   }
+
+   auto physStart = uint64_t { physicalAddress.getAddress() };
+   auto physEnd = physStart + size;
+
+   {
+      std::unique_lock<std::mutex> lock { sVirtMapMutex };
+
+      for (auto &area : sVirtMap) {
+         auto areaStart = uint64_t { area.physAddr.getAddress() };
+         auto areaEnd = areaStart + area.size;
+         auto start = std::max(physStart, areaStart);
+         auto end = std::min(physEnd, areaEnd);
+         if (start >= end) {
+            continue;
+         }
+
+         auto virtStart = area.virtAddr.getAddress() + (start - areaStart);
+         auto startPage = virtStart >> sPageSizeBits;
+         auto lastPage = (virtStart + (end - start - 1)) >> sPageSizeBits;
+         auto pageAddr = sVirtBaseAddress + (startPage << sPageSizeBits);
+         auto pageSize = uintptr_t { 1 } << sPageSizeBits;
+
+         auto unprotectCombiner = makeRangeCombiner<void *, uintptr_t, uintptr_t>(
+            [](void *, uintptr_t address, uintptr_t size) {
+               platform::protectMemory(address, size, platform::ProtectFlags::ReadWrite);
+            });
+
+         lockProtect();
+
+         for (auto i = startPage; i <= lastPage; ++i) {
+            auto oldTrackValue = sVirtLookup[i].load(std::memory_order_relaxed);
+            if ((oldTrackValue & VirtIsMappedBit) && (oldTrackValue & VirtTrackSetBit)) {
+               sVirtLookup[i].store(oldTrackValue & ~VirtTrackSetBit, std::memory_order_relaxed);
+               unprotectCombiner.push(nullptr, pageAddr, pageSize);
+            }
+
+            pageAddr += pageSize;
+         }
+
+         unprotectCombiner.flush();
+         unlockProtect();
+      }
+   }
+
+   auto startPage = physStart >> sPageSizeBits;
+   auto lastPage = (physEnd - 1) >> sPageSizeBits;
+
+   for (auto i = startPage; i <= lastPage; ++i) {
+      sTrackCount[i].fetch_add(1);
+   }
+}
+
 MemtrackState
 getMemoryState(PhysicalAddress physicalAddress,
                uint32_t size)
 {
-   // POSIX always hashes for the moment.  This is due to my inability to actually
-   // test any sort of implementation on a linux system.
-   auto physPtr = reinterpret_cast<void *>(cpu::getBasePhysicalAddress() + physicalAddress.getAddress());
-   auto hashVal = DataHash {}.write(physPtr, size);
-   return MemtrackState { hashVal.value() };
+   if (!sTrackCount) {
+      // If the write tracking system is not enabled, we simply hash.
+      auto physPtr = reinterpret_cast<void *>(cpu::getBasePhysicalAddress() + physicalAddress.getAddress());
+      auto hashVal = DataHash {}.write(physPtr, size);
+      return MemtrackState { hashVal.value() };
+   }
+
+   if (size == 0) {
+      return MemtrackState { 0 };
+   }
+
+   // Write-protect the range before reading the counters, so that any write
+   // which happens after we have read them is guaranteed to change them.
+   {
+      std::unique_lock<std::mutex> lock { sVirtMapMutex };
+
+      for (auto &area : sVirtMap) {
+         if (physicalAddress < area.physAddr || physicalAddress >= area.physAddr + area.size) {
+            continue;
+         }
+
+         auto virtualAddress = area.virtAddr + (physicalAddress - area.physAddr);
+         uintptr_t startAddr = virtualAddress.getAddress();
+         uintptr_t endAddr = startAddr + (size - 1);
+
+         auto startPage = startAddr >> sPageSizeBits;
+         auto lastPage = endAddr >> sPageSizeBits;
+         auto pageAddr = sVirtBaseAddress + (startPage << sPageSizeBits);
+         auto pageSize = uintptr_t { 1 } << sPageSizeBits;
+
+         auto protectCombiner = makeRangeCombiner<void *, uintptr_t, uintptr_t>(
+            [](void *, uintptr_t address, uintptr_t size) {
+               platform::protectMemory(address, size, platform::ProtectFlags::ReadOnly);
+            });
+
+         lockProtect();
+
+         for (auto i = startPage; i <= lastPage; ++i) {
+            auto oldTrackValue = sVirtLookup[i].load(std::memory_order_relaxed);
+            if (!(oldTrackValue & VirtIsMappedBit)) {
+               // Past the end of the mapped area
+               break;
+            }
+
+            if (!(oldTrackValue & VirtTrackSetBit)) {
+               sVirtLookup[i].store(oldTrackValue | VirtTrackSetBit, std::memory_order_relaxed);
+               protectCombiner.push(nullptr, pageAddr, pageSize);
+            }
+
+            pageAddr += pageSize;
+         }
+
+         protectCombiner.flush();
+         unlockProtect();
+      }
+   }
+
+   uint64_t pageIndexTotal = 0;
+   auto startPage = physicalAddress.getAddress() >> sPageSizeBits;
+   auto lastPage = (physicalAddress.getAddress() + (size - 1ull)) >> sPageSizeBits;
+
+   for (auto i = startPage; i <= lastPage; ++i) {
+      pageIndexTotal += sTrackCount[i].load();
+   }
+
+   return MemtrackState { pageIndexTotal };
 }
 
 } // namespace cpu
@@ -6,6 +6,7 @@
 #include "cpu_internal.h"
 #include "mmu.h"
 
+#include <algorithm>
 #include <common/datahash.h>
 #include <common/platform.h>
 #include <common/rangecombiner.h>
@@ -227,6 +228,79 @@ clearTrackedRanges()
 
 } // namespace internal
 
+/**
+ * Returns true when memory states are page write counters rather than hashes
+ * of the memory contents.
+ */
+bool
+isWriteTrackingEnabled()
+{
+   return sTrackCount != nullptr;
+}
+
+/**
+ * Make a range of guest memory writable for a write done by the host which
+ * bypasses our exception handler, and mark it as changed.
+ *
+ * ReadFile and friends fail with ERROR_NOACCESS rather than raising an access
+ * violation when they write into a protected page.  As getMemoryState may
+ * protect the range again before an asynchronous write completes, this should
+ * also be called once the write has completed.
+ */
+void
+unprotectForHostWrite(PhysicalAddress physicalAddress,
+                      uint32_t size)
+{
+   if (!sTrackCount || size == 0) {
+      return;
+   }
+
+   auto physStart = uint64_t { physicalAddress.getAddress() };
+   auto physEnd = physStart + size;
+
+   for (auto &area : sVirtMap) {
+      auto areaStart = uint64_t { area.physAddr.getAddress() };
+      auto areaEnd = areaStart + area.size;
+      auto start = std::max(physStart, areaStart);
+      auto end = std::min(physEnd, areaEnd);
+      if (start >= end) {
+         continue;
+      }
+
+      auto virtStart = area.virtAddr.getAddress() + (start - areaStart);
+      auto startPage = virtStart >> sPageSizeBits;
+      auto lastPage = (virtStart + (end - start - 1)) >> sPageSizeBits;
+
+      auto pagePtr = reinterpret_cast<uint8_t*>(sVirtBaseAddress + (startPage << sPageSizeBits));
+      auto pageSize = 1 << sPageSizeBits;
+
+      auto unprotectCombiner = makeRangeCombiner<void*, uint8_t*, uint64_t>(
+         [=](void*, uint8_t* pagePtr, uint64_t pageSize)
+         {
+            DWORD oldProtection;
+            VirtualProtect(pagePtr, pageSize, PAGE_READWRITE, &oldProtection);
+         });
+
+      for (auto i = startPage; i <= lastPage; ++i) {
+         auto oldTrackValue = sVirtLookup[i].fetch_and(~VirtTrackSetBit);
+         if ((oldTrackValue & VirtIsMappedBit) && (oldTrackValue & VirtTrackSetBit)) {
+            unprotectCombiner.push(nullptr, pagePtr, pageSize);
+         }
+
+         pagePtr += pageSize;
+      }
+
+      unprotectCombiner.flush();
+   }
+
+   auto startPage = physStart >> sPageSizeBits;
+   auto lastPage = (physEnd - 1) >> sPageSizeBits;
+
+   for (auto i = startPage; i <= lastPage; ++i) {
+      sTrackCount[i].fetch_add(1);
+   }
+}
+
 MemtrackState
 getMemoryState(PhysicalAddress physicalAddress,
                uint32_t size)
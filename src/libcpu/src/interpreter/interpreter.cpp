@@ -110,7 +110,7 @@ resume()
    auto core = cpu::this_core::state();
    while (core->nia != cpu::CALLBACK_ADDR) {
       this_core::checkInterrupts();
-      core = step_one(this_core::state());
+      core = step_block(this_core::state());
    }
 }
 
@@ -13,6 +13,19 @@ initialise();
 Core *
 step_one(Core *core);
 
+Core *
+step_block(Core *core);
+
+void
+setBlockCacheEnabled(bool enabled);
+
+void
+clearBlockCache();
+
+void
+invalidateBlockCache(uint32_t address,
+                     uint32_t size);
+
 void
 resume();
 
@@ -0,0 +1,318 @@
+#include "cpu_breakpoints.h"
+#include "cpu_internal.h"
+#include "espresso/espresso_instructionset.h"
+#include "interpreter.h"
+#include "interpreter_insreg.h"
+#include "mem.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace cpu
+{
+
+namespace interpreter
+{
+
+/**
+ * The block cache holds guest basic blocks which have already been read and
+ * decoded into a list of instruction handlers, so step_block can execute a
+ * whole block by calling each handler in turn without touching the decoder.
+ *
+ * Each core has its own cache which is only ever accessed from that core's
+ * thread.  Invalidation from other threads appends the invalidated range to
+ * sInvalidations and bumps sCacheGeneration, the next time a core notices the
+ * generation has changed it drops only the blocks overlapping the ranges it
+ * has not seen yet.  A core which has fallen more than MaxPendingInvalidations
+ * behind drops its whole cache instead.
+ */
+static constexpr auto MaxBlockInstructions = 64u;
+static constexpr auto BlockPageSize = 4096u;
+static constexpr auto RecentBlockCacheSize = 1024u;
+static constexpr auto MaxPendingInvalidations = 64u;
+
+struct DecodedInstruction
+{
+   instrfptr_t handler;
+   Instruction instr;
+};
+
+struct DecodedBlock
+{
+   uint32_t address;
+   std::vector<DecodedInstruction> instrs;
+};
+
+struct BlockCache
+{
+   uint32_t generation = 0;
+   std::unordered_map<uint32_t, std::unique_ptr<DecodedBlock>> blocks;
+
+   //! Direct mapped lookup of recently executed blocks to skip the hash map.
+   std::array<DecodedBlock *, RecentBlockCacheSize> recent = { };
+};
+
+struct InvalidatedRange
+{
+   uint32_t address;
+   uint32_t size;
+};
+
+static std::mutex
+sInvalidationMutex;
+
+//! Ring of recent invalidations, generation N is stored at index
+//! N % MaxPendingInvalidations.
+static std::array<InvalidatedRange, MaxPendingInvalidations>
+sInvalidations;
+
+static std::atomic<uint32_t>
+sCacheGeneration { 1 };
+
+static bool
+sBlockCacheEnabled = true;
+
+static std::array<BlockCache, 3>
+sBlockCaches;
+
+
+/**
+ * Returns true if the instruction must be the last one in a block, because
+ * it may change nia or the core we are running on.
+ */
+static bool
+isBlockTerminator(espresso::InstructionID id)
+{
+   return espresso::isBranchInstruction(id)
+      || id == InstructionID::kc
+      || id == InstructionID::sc
+      || id == InstructionID::rfi
+      || id == InstructionID::tw
+      || id == InstructionID::twi;
+}
+
+
+/**
+ * Decode the basic block starting at address.
+ *
+ * A block ends after a terminator instruction, before an instruction with a
+ * breakpoint, before an instruction which can not be decoded, or at the end
+ * of a page.  Returns nullptr if not even the first instruction is suitable,
+ * in which case the caller should use step_one.
+ */
+static std::unique_ptr<DecodedBlock>
+decodeBlock(uint32_t address)
+{
+   auto block = std::make_unique<DecodedBlock>();
+   block->address = address;
+
+   for (auto cia = address; block->instrs.size() < MaxBlockInstructions; cia += 4) {
+      if (block->instrs.size() && (cia % BlockPageSize) == 0) {
+         break;
+      }
+
+      if (hasBreakpoint(cia)) {
+         break;
+      }
+
+      auto instr = mem::read<espresso::Instruction>(cia);
+      auto data = espresso::decodeInstruction(instr);
+      if (!data) {
+         break;
+      }
+
+      auto handler = getInstructionHandler(data->id);
+      if (!handler) {
+         break;
+      }
+
+      block->instrs.push_back({ handler, instr });
+
+      if (isBlockTerminator(data->id)) {
+         break;
+      }
+   }
+
+   if (block->instrs.empty()) {
+      return nullptr;
+   }
+
+   return block;
+}
+
+
+/**
+ * Drop every block in the cache which overlaps the given range.
+ */
+static void
+invalidateBlocks(BlockCache &cache,
+                 const InvalidatedRange &range)
+{
+   auto maxBlockSize = MaxBlockInstructions * 4;
+   auto end = uint64_t { range.address } + range.size;
+   auto first = uint64_t { range.address & ~3u };
+   first = first > maxBlockSize - 4 ? first - (maxBlockSize - 4) : 0;
+
+   auto erase = [&](std::unordered_map<uint32_t, std::unique_ptr<DecodedBlock>>::iterator itr) {
+      auto block = itr->second.get();
+      auto blockEnd = uint64_t { block->address } + block->instrs.size() * 4;
+      if (block->address >= end || blockEnd <= range.address) {
+         return std::next(itr);
+      }
+
+      auto &recent = cache.recent[(block->address >> 2) % RecentBlockCacheSize];
+      if (recent == block) {
+         recent = nullptr;
+      }
+
+      return cache.blocks.erase(itr);
+   };
+
+   // Blocks start on a word and are at most maxBlockSize long, so for small
+   // ranges it is cheaper to look up each possible start address.
+   if ((end - first) / 4 < cache.blocks.size()) {
+      for (auto address = first; address < end; address += 4) {
+         auto itr = cache.blocks.find(static_cast<uint32_t>(address));
+         if (itr != cache.blocks.end()) {
+            erase(itr);
+         }
+      }
+   } else {
+      for (auto itr = cache.blocks.begin(); itr != cache.blocks.end(); ) {
+         itr = erase(itr);
+      }
+   }
+}
+
+
+/**
+ * Apply any invalidations the cache has not seen yet.
+ */
+static void
+updateBlockCache(BlockCache &cache)
+{
+   std::lock_guard<std::mutex> lock { sInvalidationMutex };
+   auto generation = sCacheGeneration.load(std::memory_order_relaxed);
+
+   if (generation - cache.generation > MaxPendingInvalidations) {
+      cache.blocks.clear();
+      cache.recent.fill(nullptr);
+   } else {
+      while (cache.generation != generation) {
+         ++cache.generation;
+         invalidateBlocks(cache,
+                          sInvalidations[cache.generation % MaxPendingInvalidations]);
+      }
+   }
+
+   cache.generation = generation;
+}
+
+
+/**
+ * Find the decoded block at address in the core's block cache, decoding it
+ * if necessary.
+ */
+static DecodedBlock *
+getDecodedBlock(BlockCache &cache,
+                uint32_t address)
+{
+   if (cache.generation != sCacheGeneration.load(std::memory_order_acquire)) {
+      updateBlockCache(cache);
+   }
+
+   auto &recent = cache.recent[(address >> 2) % RecentBlockCacheSize];
+   if (recent && recent->address == address) {
+      return recent;
+   }
+
+   auto itr = cache.blocks.find(address);
+   if (itr == cache.blocks.end()) {
+      auto block = decodeBlock(address);
+      if (!block) {
+         return nullptr;
+      }
+
+      itr = cache.blocks.emplace(address, std::move(block)).first;
+   }
+
+   recent = itr->second.get();
+   return recent;
+}
+
+
+/**
+ * Enable or disable execution of pre-decoded blocks in step_block.
+ */
+void
+setBlockCacheEnabled(bool enabled)
+{
+   sBlockCacheEnabled = enabled;
+}
+
+
+/**
+ * Forget every decoded block on all cores.
+ */
+void
+clearBlockCache()
+{
+   invalidateBlockCache(0, 0xFFFFFFFF);
+}
+
+
+/**
+ * Forget any decoded block on any core which overlaps the given range.
+ */
+void
+invalidateBlockCache(uint32_t address,
+                     uint32_t size)
+{
+   std::lock_guard<std::mutex> lock { sInvalidationMutex };
+   auto generation = sCacheGeneration.load(std::memory_order_relaxed) + 1;
+   sInvalidations[generation % MaxPendingInvalidations] = { address, size };
+   sCacheGeneration.store(generation, std::memory_order_release);
+}
+
+
+/**
+ * Execute the basic block at core->nia.
+ *
+ * Falls back to step_one when the block cache is disabled, when the core is
+ * being traced, or when there is a breakpoint at core->nia.  Interrupts are
+ * only checked by the caller between blocks.
+ */
+Core *
+step_block(Core *core)
+{
+   if (!sBlockCacheEnabled || core->tracer) {
+      return step_one(core);
+   }
+
+   auto block = getDecodedBlock(sBlockCaches[core->id], core->nia);
+   if (!block) {
+      return step_one(core);
+   }
+
+   // The last instruction may switch us to another core, after which the
+   // block may be freed by its owner, so we must not touch it again.
+   auto cia = block->address;
+   auto itr = block->instrs.data();
+   auto end = itr + block->instrs.size();
+
+   for (; itr != end; ++itr, cia += 4) {
+      core->cia = cia;
+      core->nia = cia + 4;
+      itr->handler(core, itr->instr);
+   }
+
+   return this_core::state();
+}
+
+} // namespace interpreter
+
+} // namespace cpu
@@ -7,12 +7,16 @@
 #include "mem.h"
 #include "mmu.h"
 
+#include <algorithm>
 #include <cfenv>
 #include <common/bitutils.h>
+#include <common/datahash.h>
 #include <common/decaf_assert.h>
 #include <common/log.h>
+#include <common/platform_thread.h>
 #include <cstdlib>
 #include <fmt/core.h>
+#include <memory>
 
 #define offsetof2(s, m) ((size_t)&reinterpret_cast<char const volatile&>((((s*)0)->m)))
 
@@ -22,6 +26,13 @@ namespace cpu
 namespace jit
 {
 
+// Increment whenever a change to BinrecBackend or BinrecCore makes previously
+// translated code incompatible with the persistent cache.
+static constexpr uint32_t BinrecBackendVersion = 1;
+
+// Largest range of guest code we ask libbinrec to translate at once.
+static constexpr uint32_t MaxTranslateSize = 4096;
+
 static void *brChainLookup(BinrecCore *core, ppcaddr_t address);
 static uint64_t brTimeBaseHandler(BinrecCore *core);
 static BinrecCore *brSyscallHandler(BinrecCore *core, espresso::Instruction instr);
@@ -35,10 +46,21 @@ BinrecBackend::BinrecBackend(size_t codeCacheSize,
 {
    mCodeCache.initialise(codeCacheSize, dataCacheSize);
    mHandles.fill(nullptr);
+   mHandleGenerations.fill(0);
+   mCoreWaitingForFlush.fill(false);
+
+   for (auto &inJit : mCoreInJit) {
+      inJit.store(false);
+   }
+
+   for (auto &count : mSystemCallsInProgress) {
+      count.store(0);
+   }
 }
 
 BinrecBackend::~BinrecBackend()
 {
+   stopCompileThreads();
    mCodeCache.free();
 }
 
@@ -87,17 +109,126 @@ BinrecBackend::initialiseCore(uint32_t id)
 void
 BinrecBackend::addReadOnlyRange(uint32_t address, uint32_t size)
 {
+   std::lock_guard<std::mutex> lock { mReadOnlyRangeMutex };
    mReadOnlyRanges.emplace_back(address, size);
+   mReadOnlyDataHashValid = false;
+   mReadOnlyRangeGeneration++;
+}
+
+void
+BinrecBackend::addReadOnlyCodeRange(uint32_t address, uint32_t size)
+{
+   std::lock_guard<std::mutex> lock { mReadOnlyRangeMutex };
+   mReadOnlyCodeRanges.emplace_back(address, size);
+}
+
+
+/**
+ * Open the persistent translation cache.
+ *
+ * The cache is keyed on the backend version and optimisation flags, so this
+ * must be called after setOptFlags.  The persistent cache is not used in
+ * verify mode as the verify callbacks are compiled into the generated code.
+ */
+bool
+BinrecBackend::setPersistentCachePath(const std::string &path)
+{
+   if (mVerifyEnabled) {
+      return false;
+   }
+
+   struct
+   {
+      uint32_t version;
+      uint32_t useChaining;
+      uint32_t common;
+      uint32_t guest;
+      uint32_t host;
+      uint32_t hostFeatures;
+      uint32_t coreSize;
+      uint32_t padding;
+   } config;
+   std::memset(&config, 0, sizeof(config));
+   config.version = BinrecBackendVersion;
+   config.useChaining = mOptFlags.useChaining ? 1 : 0;
+   config.common = mOptFlags.common;
+   config.guest = mOptFlags.guest;
+   config.host = mOptFlags.host;
+   config.hostFeatures = static_cast<uint32_t>(binrec::native_features());
+   config.coreSize = static_cast<uint32_t>(sizeof(BinrecCore));
+
+   return mPersistentCache.open(path, XXH64(&config, sizeof(config), 0));
+}
+
+
+/**
+ * Check if address lies within read-only code, and so is eligible for the
+ * persistent translation cache.
+ */
+bool
+BinrecBackend::isPersistentCacheable(uint32_t address,
+                                     uint32_t &rangeEnd)
+{
+   if (!mPersistentCache.isOpen()) {
+      return false;
+   }
+
+   std::lock_guard<std::mutex> lock { mReadOnlyRangeMutex };
+   for (const auto &range : mReadOnlyCodeRanges) {
+      if (address >= range.first && address - range.first < range.second) {
+         rangeEnd = range.first + range.second;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/**
+ * Get a hash of all read-only data ranges.
+ *
+ * libbinrec is allowed to fold loads from read-only data into the generated
+ * code, so a persistent cache entry is only valid if the read-only data is
+ * also unchanged.
+ */
+uint64_t
+BinrecBackend::getReadOnlyDataHash()
+{
+   std::lock_guard<std::mutex> lock { mReadOnlyRangeMutex };
+   if (!mReadOnlyDataHashValid) {
+      mReadOnlyDataHash = 0;
+
+      for (const auto &range : mReadOnlyRanges) {
+         mReadOnlyDataHash = XXH64(mem::translate(range.first), range.second,
+                                   mReadOnlyDataHash);
+      }
+
+      mReadOnlyDataHashValid = true;
+   }
+
+   return mReadOnlyDataHash;
 }
 
 void
 BinrecBackend::clearCache(uint32_t address, uint32_t size)
 {
+   std::lock_guard<std::mutex> flushLock { mCodeCacheFlushMutex };
+
    if (address == 0 && size == 0xFFFFFFFF) {
+      cancelQueuedCompiles();
       mCodeCache.clear();
       mTotalProfileTime = 0;
+      mCodeCacheFull = false;
+
+      std::lock_guard<std::mutex> lock { mInterpretedRegionMutex };
+      mInterpretedRegions.clear();
    } else {
+      // Queued compiles will read the new code, only compiles which may have
+      // already read the old code need to finish before we invalidate.
+      waitForInFlightCompiles();
       mCodeCache.invalidate(address, size);
+      removeInterpretedRegions(address, size);
    }
 }
 
@@ -153,6 +284,7 @@ BinrecBackend::createBinrecHandle()
       handle->set_post_insn_callback(brVerifyPostHandler);
    }
 
+   std::lock_guard<std::mutex> lock { mReadOnlyRangeMutex };
    for (const auto &range : mReadOnlyRanges) {
       handle->add_readonly_region(range.first, range.second);
    }
@@ -160,6 +292,25 @@ BinrecBackend::createBinrecHandle()
    return handle;
 }
 
+/**
+ * Returns a handle which knows about every current read-only range, binrec
+ * only reads them at handle creation so the handle is recreated whenever a
+ * range has been added since it was created.
+ */
+BinrecHandle *
+BinrecBackend::updateBinrecHandle(BinrecHandle *handle,
+                                  unsigned &generation)
+{
+   auto currentGeneration = mReadOnlyRangeGeneration.load();
+   if (handle && generation == currentGeneration) {
+      return handle;
+   }
+
+   delete handle;
+   generation = currentGeneration;
+   return createBinrecHandle();
+}
+
 CodeBlock *
 BinrecBackend::checkForCodeBlockTrampoline(uint32_t address)
 {
@@ -207,18 +358,6 @@ BinrecBackend::getCodeBlock(BinrecCore *core, uint32_t address)
    auto indexPtr = mCodeCache.getIndexPointer(address);
    auto blockIndex = indexPtr->load();
 
-   // If block is uncompiled, let's try mark it as compiling!
-   if (UNLIKELY(blockIndex == CodeBlockIndexUncompiled)) {
-      if (!indexPtr->compare_exchange_strong(blockIndex, CodeBlockIndexCompiling)) {
-         // Another thread has started compiling, wait for it to finish.
-         while (blockIndex == CodeBlockIndexCompiling) {
-            using namespace std::chrono_literals;
-            std::this_thread::sleep_for(10us);
-            blockIndex = indexPtr->load();
-         }
-      }
-   }
-
    // Check if the block has been compiled
    if (LIKELY(blockIndex >= 0)) {
       auto block = mCodeCache.getBlockByIndex(blockIndex);
@@ -235,17 +374,112 @@ BinrecBackend::getCodeBlock(BinrecCore *core, uint32_t address)
       return nullptr;
    }
 
-   // Check for possible branch trampoline
-   if (auto block = checkForCodeBlockTrampoline(address)) {
-      return block;
+   // Do not try to compile inside a region which has already failed.
+   if (UNLIKELY(blockIndex == CodeBlockIndexUncompiled &&
+                findInterpretedRegion(address))) {
+      indexPtr->compare_exchange_strong(blockIndex, CodeBlockIndexError);
+      return nullptr;
    }
 
-   auto handle = mHandles[core->id];
-   if (!handle) {
-      handle = createBinrecHandle();
+   // If block is uncompiled, let's try mark it as compiling!
+   if (blockIndex == CodeBlockIndexUncompiled &&
+       indexPtr->compare_exchange_strong(blockIndex, CodeBlockIndexCompiling)) {
+      if (!mCompileThreads.empty()) {
+         // Let a compile thread translate the block whilst we continue on
+         // in the interpreter.
+         queueCompile(core, address, getInitialTier());
+         return nullptr;
+      }
+
+      auto handle = updateBinrecHandle(mHandles[core->id],
+                                       mHandleGenerations[core->id]);
       mHandles[core->id] = handle;
+
+      auto block = compileCodeBlock(handle, core, address, getInitialTier());
+
+      // Clear any floating-point exceptions raised by the translation so
+      // the translated code doesn't pick them up.
+      std::feclearexcept(FE_ALL_EXCEPT);
+      return block;
+   }
+
+   if (!mCompileThreads.empty()) {
+      // Block is queued for compilation, fall back to the interpreter.
+      return blockIndex >= 0 ? mCodeCache.getBlockByIndex(blockIndex) : nullptr;
+   }
+
+   // Another thread has started compiling, wait for it to finish.
+   while (blockIndex == CodeBlockIndexCompiling) {
+      using namespace std::chrono_literals;
+      std::this_thread::sleep_for(10us);
+      blockIndex = indexPtr->load();
+   }
+
+   if (blockIndex >= 0) {
+      return mCodeCache.getBlockByIndex(blockIndex);
+   }
+
+   return nullptr;
+}
+
+
+/**
+ * Translate the code block at address and publish it to the code cache.
+ *
+ * For the initial translation of a block the caller must have already marked
+ * the block index as compiling.  When promoting a block to the optimised tier
+ * the existing block remains valid until it is replaced in the index, and it
+ * is kept if the retranslation fails.
+ */
+CodeBlock *
+BinrecBackend::compileCodeBlock(BinrecHandle *handle,
+                                BinrecCore *core,
+                                uint32_t address,
+                                CodeBlockTier tier)
+{
+   auto indexPtr = mCodeCache.getIndexPointer(address);
+   auto promotion = mTierUpThreshold && tier == CodeBlockTier::Optimised;
+
+   // Check for possible branch trampoline
+   if (!promotion) {
+      if (auto block = checkForCodeBlockTrampoline(address)) {
+         return block;
+      }
    }
 
+   // Check for a previous translation in the persistent cache, which only
+   // holds code compiled with the full optimisation flags.
+   auto cacheRangeEnd = uint32_t { 0 };
+   auto cacheable = isPersistentCacheable(address, cacheRangeEnd);
+   auto cacheSeed = uint64_t { 0 };
+
+   if (cacheable && !promotion) {
+      auto entry = PersistentCache::Entry { };
+      cacheSeed = getReadOnlyDataHash();
+
+      if (mPersistentCache.find(address, cacheSeed, entry)) {
+         auto block = mCodeCache.registerCodeBlock(address,
+                                                   entry.guestSize,
+                                                   entry.code.data(),
+                                                   entry.code.size(),
+                                                   entry.unwindInfo.data(),
+                                                   entry.unwindInfo.size());
+         if (!block) {
+            handleCodeCacheFull(address, false);
+            return nullptr;
+         }
+
+         mPersistentCacheHits++;
+         return block;
+      }
+
+      mPersistentCacheMisses++;
+   }
+
+   auto &flags = (tier == CodeBlockTier::Baseline) ? mBaselineOptFlags : mOptFlags;
+   handle->set_optimization_flags(flags.common, flags.guest, flags.host);
+   handle->enable_chaining(flags.useChaining);
+
    if (mVerifyEnabled && mVerifyAddress != 0) {
       if (address == mVerifyAddress) {
          handle->set_pre_insn_callback(brVerifyPreHandler);
@@ -260,18 +494,25 @@ BinrecBackend::getCodeBlock(BinrecCore *core, uint32_t address)
    // optimizations enabled), translation could fail due to internal
    // libbinrec limits, so try repeatedly with smaller code ranges if
    // the first translation attempt fails.
-   auto limit = 4096u;
+   auto limit = MaxTranslateSize;
    auto size = long { 0 };
    void *buffer = nullptr;
 
    while (!handle->translate(core, address, address + limit - 1, &buffer, &size)) {
-      limit /= 2;
+      if (limit / 2 < 256) {
+         if (promotion) {
+            gLog->warn("Failed to retranslate code at 0x{:X}", address);
+            return nullptr;
+         }
 
-      if (limit < 256) {
-         gLog->warn("Failed to translate code at 0x{:X}", address);
+         gLog->warn("Failed to translate code at 0x{:X}, interpreting 0x{:X} to 0x{:X}",
+                    address, address, address + limit);
+         addInterpretedRegion(address, limit);
          indexPtr->store(CodeBlockIndexError);
          return nullptr;
       }
+
+      limit /= 2;
    }
 
 #ifdef PLATFORM_WINDOWS
@@ -288,16 +529,376 @@ BinrecBackend::getCodeBlock(BinrecCore *core, uint32_t address)
    auto unwindSize = size_t { 0 };
 #endif
 
-   auto block = mCodeCache.registerCodeBlock(address, code, codeSize, unwindInfo, unwindSize);
-   decaf_check(block);
-   free(buffer);
+   auto tierUpCount = (tier == CodeBlockTier::Baseline) ? mTierUpThreshold : 0u;
+   auto block = mCodeCache.registerCodeBlock(address, limit, code, codeSize,
+                                             unwindInfo, unwindSize,
+                                             tier, tierUpCount);
+   if (!block) {
+      handleCodeCacheFull(address, promotion);
+      free(buffer);
+      return nullptr;
+   }
 
-   // Clear any floating-point exceptions raised by the translation so
-   // the translated code doesn't pick them up.
-   std::feclearexcept(FE_ALL_EXCEPT);
+   if (promotion) {
+      mTierUpCompiles++;
+   }
+
+   if (cacheable && tier == CodeBlockTier::Optimised) {
+      auto guestSize = std::min<uint32_t>(limit, cacheRangeEnd - address);
+      mPersistentCache.insert(address, guestSize, cacheSeed,
+                              code, codeSize, unwindInfo, unwindSize);
+   }
+
+   free(buffer);
    return block;
 }
 
+
+/**
+ * Handle a failure to register a code block because the code cache is full.
+ *
+ * The address is marked as an error so it will be interpreted until the code
+ * cache has been flushed, unless this was a promotion in which case the
+ * baseline block is kept.
+ */
+void
+BinrecBackend::handleCodeCacheFull(uint32_t address,
+                                   bool promotion)
+{
+   if (!mCodeCacheFull.exchange(true)) {
+      gLog->warn("JIT code cache is full, it will be flushed once every core has left JIT code");
+      requestCodeCacheFlush();
+   }
+
+   if (!promotion) {
+      mCodeCache.getIndexPointer(address)->store(CodeBlockIndexError);
+   }
+}
+
+
+/**
+ * Request a flush of the code cache.
+ *
+ * Cores running JIT code are made to return to their dispatcher with the JIT
+ * flush interrupt, where they wait until the flush is complete.  The last core
+ * to stop running JIT code performs the flush.
+ */
+void
+BinrecBackend::requestCodeCacheFlush()
+{
+   if (mVerifyEnabled || mCodeCacheFlushPending.exchange(true)) {
+      return;
+   }
+
+   for (auto i = 0u; i < mCoreInJit.size(); ++i) {
+      if (auto core = getCore(i)) {
+         core->interrupt.fetch_or(JIT_FLUSH_INTERRUPT);
+      }
+   }
+}
+
+
+/**
+ * Wait for a pending code cache flush to complete, must only be called when
+ * the core is not executing JIT code.
+ */
+void
+BinrecBackend::waitForCodeCacheFlush(BinrecCore *core)
+{
+   core->interrupt.fetch_and(~JIT_FLUSH_INTERRUPT);
+
+   std::unique_lock<std::mutex> lock { mCodeCacheFlushMutex };
+   mCoreWaitingForFlush[core->id] = true;
+
+   while (mCodeCacheFlushPending.load() && !tryFlushCodeCache()) {
+      mCodeCacheFlushCondition.wait(lock);
+   }
+
+   mCoreWaitingForFlush[core->id] = false;
+}
+
+
+/**
+ * Flush the code cache if no core can be executing JIT code, must be called
+ * with mCodeCacheFlushMutex held.
+ *
+ * Code which a suspended system call will return into is kept by flushing to
+ * the other code region, if system calls will still return into that region
+ * the flush is skipped until the last of them has returned.
+ */
+bool
+BinrecBackend::tryFlushCodeCache()
+{
+   for (auto i = 0u; i < mCoreInJit.size(); ++i) {
+      if (mCoreInJit[i].load() && !mCoreWaitingForFlush[i]) {
+         return false;
+      }
+   }
+
+   auto nextRegion = mCodeCache.getCodeRegion() ^ 1;
+   if (mSystemCallsInProgress[nextRegion].load() == 0) {
+      cancelQueuedCompiles();
+      mCodeCache.flush();
+      mTotalProfileTime = 0;
+      mCodeCacheFull = false;
+      mCodeCacheFlushes++;
+
+      {
+         std::lock_guard<std::mutex> lock { mInterpretedRegionMutex };
+         mInterpretedRegions.clear();
+      }
+
+      gLog->info("Flushed JIT code cache, {} flushes so far",
+                 mCodeCacheFlushes.load());
+   }
+
+   mCodeCacheFlushPending = false;
+   mCodeCacheFlushCondition.notify_all();
+   return true;
+}
+
+
+/**
+ * Mark whether a core may be executing JIT code.
+ */
+void
+BinrecBackend::setCoreInJit(uint32_t coreId,
+                            bool inJit)
+{
+   mCoreInJit[coreId].store(inJit);
+
+   if (!inJit && UNLIKELY(mCodeCacheFlushPending.load())) {
+      // A flush may have been waiting for this core.
+      std::lock_guard<std::mutex> lock { mCodeCacheFlushMutex };
+      mCodeCacheFlushCondition.notify_all();
+   }
+}
+
+
+/**
+ * Handle interrupts in the dispatcher, returns the current core as we may
+ * have been rescheduled.
+ *
+ * The flush interrupt is checked after marking the core as in JIT again so a
+ * flush can never start whilst we go on to execute JIT code.
+ */
+BinrecCore *
+BinrecBackend::checkDispatcherInterrupts(BinrecCore *core)
+{
+   if (core->interrupt.load() & ~JIT_FLUSH_INTERRUPT) {
+      setCoreInJit(core->id, false);
+      this_core::checkInterrupts();
+      core = reinterpret_cast<BinrecCore *>(this_core::state());
+      setCoreInJit(core->id, true);
+   }
+
+   while (core->interrupt.load() & JIT_FLUSH_INTERRUPT) {
+      waitForCodeCacheFlush(core);
+   }
+
+   return core;
+}
+
+
+/**
+ * Called from the system call handler before leaving JIT code, returns the
+ * code region the system call will return into.
+ */
+unsigned
+BinrecBackend::beginSystemCall(BinrecCore *core)
+{
+   // The code cache can not be flushed whilst this core is in JIT code, so
+   // the code which made the system call is in the current region.
+   auto codeRegion = mCodeCache.getCodeRegion();
+   mSystemCallsInProgress[codeRegion]++;
+   setCoreInJit(core->id, false);
+   return codeRegion;
+}
+
+
+/**
+ * Called from the system call handler before returning into JIT code.
+ */
+void
+BinrecBackend::endSystemCall(BinrecCore *core,
+                             unsigned codeRegion)
+{
+   setCoreInJit(core->id, true);
+
+   // Wait for any flush before we stop counting against our code region.
+   while (core->interrupt.load() & JIT_FLUSH_INTERRUPT) {
+      waitForCodeCacheFlush(core);
+   }
+
+   if (--mSystemCallsInProgress[codeRegion] == 0 &&
+       codeRegion != mCodeCache.getCodeRegion() && mCodeCacheFull) {
+      // A flush was skipped because of system calls returning into this
+      // region, now that the last one has returned we can try again.
+      requestCodeCacheFlush();
+   }
+}
+
+
+/**
+ * Queue a code block to be translated on a compile thread.
+ *
+ * We take a copy of the GQRs as libbinrec may read them from the processor
+ * state at translation time.
+ */
+void
+BinrecBackend::queueCompile(BinrecCore *core,
+                            uint32_t address,
+                            CodeBlockTier tier)
+{
+   auto request = CompileRequest { };
+   request.address = address;
+   request.tier = tier;
+
+   for (auto i = 0u; i < request.gqr.size(); ++i) {
+      request.gqr[i] = core->gqr[i];
+   }
+
+   std::unique_lock<std::mutex> lock { mCompileMutex };
+   mCompileQueue.push_back(request);
+   mCompileCondition.notify_one();
+}
+
+
+/**
+ * Set the number of background compile threads.
+ *
+ * When there are no compile threads blocks are translated synchronously by
+ * the core which first executes them.  Compile threads are not used in verify
+ * mode.
+ */
+void
+BinrecBackend::setCompileThreads(unsigned count)
+{
+   stopCompileThreads();
+
+   if (mVerifyEnabled) {
+      return;
+   }
+
+   mCompileThreadsRunning = true;
+
+   for (auto i = 0u; i < count; ++i) {
+      mCompileThreads.emplace_back([this]() { compileThreadEntry(); });
+      platform::setThreadName(&mCompileThreads.back(),
+                              fmt::format("JIT Compile Thread #{}", i));
+   }
+}
+
+
+/**
+ * Stop and join all background compile threads.
+ */
+void
+BinrecBackend::stopCompileThreads()
+{
+   {
+      std::unique_lock<std::mutex> lock { mCompileMutex };
+      mCompileThreadsRunning = false;
+      mCompileCondition.notify_all();
+   }
+
+   for (auto &thread : mCompileThreads) {
+      if (thread.joinable()) {
+         thread.join();
+      }
+   }
+
+   mCompileThreads.clear();
+   cancelQueuedCompiles();
+}
+
+
+/**
+ * Drop any queued compile requests and wait for in-flight compiles to finish.
+ */
+void
+BinrecBackend::cancelQueuedCompiles()
+{
+   std::unique_lock<std::mutex> lock { mCompileMutex };
+
+   for (auto &request : mCompileQueue) {
+      if (request.tier == getInitialTier()) {
+         mCodeCache.getIndexPointer(request.address)->store(CodeBlockIndexUncompiled);
+      }
+   }
+
+   mCompileQueue.clear();
+   mCompileIdleCondition.wait(lock, [this]() { return mCompilesInFlight.empty(); });
+}
+
+
+/**
+ * Wait for compiles which have already been taken from the queue to finish.
+ */
+void
+BinrecBackend::waitForInFlightCompiles()
+{
+   std::unique_lock<std::mutex> lock { mCompileMutex };
+
+   // Only wait for the compiles running now, so a busy queue can not keep us
+   // waiting forever.
+   auto nextTicket = mNextCompileTicket;
+   mCompileIdleCondition.wait(lock, [&]() {
+      return std::none_of(mCompilesInFlight.begin(), mCompilesInFlight.end(),
+                          [&](uint64_t ticket) { return ticket < nextTicket; });
+   });
+}
+
+
+/**
+ * Entry point for background compile threads.
+ */
+void
+BinrecBackend::compileThreadEntry()
+{
+   auto handle = static_cast<BinrecHandle *>(nullptr);
+   auto handleGeneration = 0u;
+   auto state = std::unique_ptr<BinrecCore> { new BinrecCore { } };
+   state->backend = this;
+
+   while (true) {
+      std::unique_lock<std::mutex> lock { mCompileMutex };
+      mCompileCondition.wait(lock, [this]() {
+         return !mCompileThreadsRunning || !mCompileQueue.empty();
+      });
+
+      if (!mCompileThreadsRunning) {
+         break;
+      }
+
+      auto request = mCompileQueue.front();
+      mCompileQueue.pop_front();
+      auto ticket = mNextCompileTicket++;
+      mCompilesInFlight.push_back(ticket);
+      lock.unlock();
+
+      for (auto i = 0u; i < request.gqr.size(); ++i) {
+         state->gqr[i] = request.gqr[i];
+      }
+
+      // Modules loaded after this thread started add read-only ranges.
+      handle = updateBinrecHandle(handle, handleGeneration);
+
+      if (handle) {
+         compileCodeBlock(handle, state.get(), request.address, request.tier);
+      } else if (request.tier == getInitialTier()) {
+         mCodeCache.getIndexPointer(request.address)->store(CodeBlockIndexError);
+      }
+
+      lock.lock();
+      mCompilesInFlight.erase(std::find(mCompilesInFlight.begin(),
+                                        mCompilesInFlight.end(), ticket));
+      mCompileIdleCondition.notify_all();
+   }
+
+   delete handle;
+}
+
 inline CodeBlock *
 BinrecBackend::getCodeBlockFast(BinrecCore *core, uint32_t address)
 {
@@ -346,16 +947,22 @@ BinrecBackend::resumeExecution()
       return resumeVerifyExecution();
    }
 
+   setCoreInJit(core->id, true);
+
    do {
       if (UNLIKELY(core->interrupt.load())) {
-         this_core::checkInterrupts();
          // We might have been rescheduled onto a different core.
-         core = reinterpret_cast<BinrecCore *>(this_core::state());
+         core = checkDispatcherInterrupts(core);
       }
 
       const ppcaddr_t address = core->nia;
       auto block = getCodeBlockFast(core, address);
 
+      if (LIKELY(block) &&
+          UNLIKELY(block->tierUpCounter.load(std::memory_order_relaxed))) {
+         checkTierUp(core, block);
+      }
+
       // To keep overhead in the non-profiling case as low as possible, we
       //  only check for zeroness of the profiling mask here, which is just
       //  a memory-immediate compare and a non-taken branch on x86.  If the
@@ -371,14 +978,7 @@ BinrecBackend::resumeExecution()
             auto entry = reinterpret_cast<BinrecEntry>(block->code);
             core = entry(core, memBase);
          } else {
-            // Step over the current instruction, in case it's confusing
-            // the translator.  TODO: Consider blacklisting the address to
-            // avoid trying to translate it every time we encounter it.
-            interpreter::step_one(core);
-
-            // If we just returned from a system call, we might have been
-            //  rescheduled onto a different core.
-            core = reinterpret_cast<BinrecCore *>(this_core::state());
+            core = interpretUntilCompiled(core);
          }
       } else { // mProfilingMask != 0
          const uint64_t start = rdtsc();
@@ -387,8 +987,7 @@ BinrecBackend::resumeExecution()
             auto entry = reinterpret_cast<BinrecEntry>(block->code);
             core = entry(core, memBase);
          } else {
-            interpreter::step_one(core);
-            core = reinterpret_cast<BinrecCore *>(this_core::state());
+            core = interpretUntilCompiled(core);
          }
 
          // Don't count profiling data for HLE calls since those have
@@ -405,6 +1004,237 @@ BinrecBackend::resumeExecution()
          }
       }
    } while (core->nia != CALLBACK_ADDR);
+
+   setCoreInJit(core->id, false);
+}
+
+
+/**
+ * Count an execution of a baseline block, and retranslate it with the full
+ * optimisation flags once it has been executed often enough.
+ */
+void
+BinrecBackend::checkTierUp(BinrecCore *core,
+                           CodeBlock *block)
+{
+   auto count = block->tierUpCounter.load(std::memory_order_relaxed);
+
+   // Losing a count to a race with another core is harmless, but only one
+   // core must see the counter reach zero.
+   if (!count ||
+       !block->tierUpCounter.compare_exchange_weak(count, count - 1,
+                                                   std::memory_order_relaxed) ||
+       count != 1) {
+      return;
+   }
+
+   if (!mCompileThreads.empty()) {
+      queueCompile(core, block->address, CodeBlockTier::Optimised);
+      return;
+   }
+
+   auto handle = updateBinrecHandle(mHandles[core->id],
+                                    mHandleGenerations[core->id]);
+   mHandles[core->id] = handle;
+
+   compileCodeBlock(handle, core, block->address, CodeBlockTier::Optimised);
+   std::feclearexcept(FE_ALL_EXCEPT);
+}
+
+
+/**
+ * Run the interpreter whilst there is no compiled block available.
+ *
+ * If the address failed to translate we interpret the whole of its region,
+ * otherwise we execute the rest of the basic block at nia with the
+ * interpreter's block cache.  With compile threads this means we do not queue
+ * a compile for every instruction of a block which is still pending.
+ */
+BinrecCore *
+BinrecBackend::interpretUntilCompiled(BinrecCore *core)
+{
+   // The interpreter may make system calls which reschedule, so we do not
+   // count it as JIT code.
+   setCoreInJit(core->id, false);
+
+   auto indexPtr = mCodeCache.getConstIndexPointer(core->nia);
+   auto region = std::shared_ptr<InterpretedRegion> { };
+
+   if (indexPtr && indexPtr->load() == CodeBlockIndexError) {
+      region = findInterpretedRegion(core->nia);
+   }
+
+   if (region) {
+      core = interpretRegion(core, *region);
+   } else {
+      // If we just returned from a system call, we might have been
+      //  rescheduled onto a different core.
+      core = reinterpret_cast<BinrecCore *>(interpreter::step_block(core));
+   }
+
+   setCoreInJit(core->id, true);
+   return core;
+}
+
+
+/**
+ * Interpret code in a region which failed translation until we reach an
+ * address which has a compiled block, or an uncompiled address outside of
+ * the region which we can try to translate.
+ *
+ * We also return to the dispatcher for interrupts and system calls, time
+ * spent in a system call is not counted against the region.
+ */
+BinrecCore *
+BinrecBackend::interpretRegion(BinrecCore *core,
+                               InterpretedRegion &region)
+{
+   auto blocks = uint64_t { 0 };
+   auto time = uint64_t { 0 };
+   region.entries++;
+
+   while (true) {
+      auto start = rdtsc();
+      auto next = reinterpret_cast<BinrecCore *>(interpreter::step_block(core));
+      ++blocks;
+
+      if (next != core ||
+          espresso::isA<espresso::InstructionID::kc>(mem::read<espresso::Instruction>(core->cia))) {
+         core = next;
+         break;
+      }
+
+      time += rdtsc() - start;
+
+      if (core->interrupt.load() || core->nia == CALLBACK_ADDR) {
+         break;
+      }
+
+      auto indexPtr = mCodeCache.getConstIndexPointer(core->nia);
+      auto index = indexPtr ? indexPtr->load() : CodeBlockIndexUncompiled;
+
+      if (index >= 0) {
+         break;
+      }
+
+      if (index == CodeBlockIndexUncompiled &&
+          (core->nia < region.start || core->nia >= region.end)) {
+         break;
+      }
+   }
+
+   region.blocks += blocks;
+   region.time += time;
+   return core;
+}
+
+
+/**
+ * Record a range of guest code which failed translation, so that we
+ * interpret it rather than trying to translate every address within it.
+ */
+void
+BinrecBackend::addInterpretedRegion(uint32_t address,
+                                    uint32_t size)
+{
+   auto region = std::make_shared<InterpretedRegion>();
+   region->start = address;
+   region->end = address + size;
+
+   std::lock_guard<std::mutex> lock { mInterpretedRegionMutex };
+   mInterpretedRegions.emplace(address, std::move(region));
+}
+
+
+/**
+ * Find the interpreted region which contains address, if any.
+ */
+std::shared_ptr<BinrecBackend::InterpretedRegion>
+BinrecBackend::findInterpretedRegion(uint32_t address)
+{
+   std::lock_guard<std::mutex> lock { mInterpretedRegionMutex };
+   auto itr = mInterpretedRegions.upper_bound(address);
+
+   // Regions may overlap, so check every region which starts close enough
+   // before address to contain it.
+   while (itr != mInterpretedRegions.begin()) {
+      --itr;
+
+      if (address - itr->first >= MaxTranslateSize) {
+         break;
+      }
+
+      if (address < itr->second->end) {
+         return itr->second;
+      }
+   }
+
+   return nullptr;
+}
+
+
+/**
+ * Forget any interpreted regions which overlap a range of guest code, and
+ * allow the addresses within them to be translated again.
+ */
+void
+BinrecBackend::removeInterpretedRegions(uint32_t address,
+                                        uint32_t size)
+{
+   auto end = uint64_t { address } + size;
+   std::lock_guard<std::mutex> lock { mInterpretedRegionMutex };
+
+   for (auto itr = mInterpretedRegions.begin(); itr != mInterpretedRegions.end(); ) {
+      auto &region = *itr->second;
+
+      if (region.start >= end || region.end <= address) {
+         ++itr;
+         continue;
+      }
+
+      for (auto addr = region.start; addr < region.end; addr += 4) {
+         auto index = CodeBlockIndexError;
+         mCodeCache.getIndexPointer(addr)->compare_exchange_strong(index, CodeBlockIndexUncompiled);
+      }
+
+      itr = mInterpretedRegions.erase(itr);
+   }
+}
+
+
+/**
+ * Slow path for block chaining, find the target block and remember it in the
+ * core's chain cache.
+ *
+ * The chain cache holds direct references to block code, so it is flushed
+ * whenever the code cache generation changes.
+ */
+void *
+BinrecBackend::getChainTarget(BinrecCore *core,
+                              uint32_t address)
+{
+   auto generation = mCodeCache.getGeneration();
+   if (UNLIKELY(core->chainCacheGeneration != generation)) {
+      core->chainCache.fill({ 0, nullptr });
+      core->chainCacheGeneration = generation;
+   }
+
+   auto block = getCodeBlock(core, address);
+   if (!block) {
+      return nullptr;
+   }
+
+   // Blocks waiting to be promoted must keep coming back here so that their
+   // executions are counted.
+   if (UNLIKELY(block->tierUpCounter.load(std::memory_order_relaxed))) {
+      checkTierUp(core, block);
+      return block->code;
+   }
+
+   auto &entry = core->chainCache[(address >> 2) & (BinrecChainCacheSize - 1)];
+   entry.address = address;
+   entry.code = block->code;
+   return block->code;
 }
 
 
@@ -418,6 +1248,25 @@ BinrecBackend::sampleStats(JitStats &stats)
    stats.compiledBlocks = mCodeCache.getCompiledCodeBlocks();
    stats.usedCodeCacheSize = mCodeCache.getCodeCacheSize();
    stats.usedDataCacheSize = mCodeCache.getDataCacheSize();
+   stats.persistentCacheHits = mPersistentCacheHits;
+   stats.persistentCacheMisses = mPersistentCacheMisses;
+   stats.tierUpCompiles = mTierUpCompiles;
+   stats.codeCacheFlushes = mCodeCacheFlushes;
+   stats.totalTimeInterpreted = 0;
+   stats.interpretedRegions.clear();
+
+   std::lock_guard<std::mutex> lock { mInterpretedRegionMutex };
+   for (auto &[start, region] : mInterpretedRegions) {
+      auto regionStats = InterpretedRegionStats { };
+      regionStats.start = region->start;
+      regionStats.end = region->end;
+      regionStats.entries = region->entries;
+      regionStats.blocks = region->blocks;
+      regionStats.time = region->time;
+      stats.totalTimeInterpreted += regionStats.time;
+      stats.interpretedRegions.push_back(regionStats);
+   }
+
    return true;
 }
 
@@ -435,6 +1284,16 @@ BinrecBackend::resetProfileStats()
       block.profileData.time = 0;
    }
 
+   // Clear interpreted region stats
+   {
+      std::lock_guard<std::mutex> lock { mInterpretedRegionMutex };
+      for (auto &[start, region] : mInterpretedRegions) {
+         region->entries = 0;
+         region->blocks = 0;
+         region->time = 0;
+      }
+   }
+
    // Clear generic stats
    mTotalProfileTime = 0;
 }
@@ -466,12 +1325,13 @@ BinrecBackend::getProfilingMask()
 void *
 brChainLookup(BinrecCore *core, ppcaddr_t address)
 {
-   auto block = core->backend->getCodeBlock(core, address);
-   if (!block) {
-      return nullptr;
+   auto &entry = core->chainCache[(address >> 2) & (BinrecChainCacheSize - 1)];
+   if (LIKELY(entry.address == address && entry.code &&
+              core->chainCacheGeneration == core->backend->getCodeCacheGeneration())) {
+      return entry.code;
    }
 
-   return block->code;
+   return core->backend->getChainTarget(core, address);
 }
 
 
@@ -493,11 +1353,14 @@ brSyscallHandler(BinrecCore *core,
                  espresso::Instruction instr)
 {
    core->systemCallStackHead = core->gpr[1];
+   auto backend = core->backend;
+   auto codeRegion = backend->beginSystemCall(core);
    auto handler = cpu::getSystemCallHandler(instr.kcn);
    auto newCore = handler(core, instr.kcn);
 
    // We might have been rescheduled on a new core.
    core = reinterpret_cast<BinrecCore *>(newCore);
+   backend->endSystemCall(core, codeRegion);
 
    // If the next instruction is a blr, execute it ourselves rather than
    // spending the overhead of calling into JIT for just that instruction.
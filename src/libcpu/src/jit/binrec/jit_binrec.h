@@ -4,8 +4,16 @@
 #include "espresso/espresso_instruction.h"
 #include "jit/jit_codecache.h"
 #include "jit/jit_backend.h"
+#include "jit/jit_persistentcache.h"
 
+#include <array>
 #include <binrec++.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <string>
 
@@ -15,6 +23,14 @@ namespace cpu
 namespace jit
 {
 
+struct BinrecChainCacheEntry
+{
+   uint32_t address;
+   void *code;
+};
+
+static constexpr size_t BinrecChainCacheSize = 4096;
+
 struct BinrecOptimisationFlags
 {
    bool useChaining = false;
@@ -49,6 +65,12 @@ struct BinrecCore : public Core
 
    //! Trap Handler hit a breakpoint.
    bool hitBreakpoint;
+
+   //! CodeCache generation the chain cache is valid for.
+   uint32_t chainCacheGeneration;
+
+   //! Direct mapped cache of guest address to host code for block chaining.
+   std::array<BinrecChainCacheEntry, BinrecChainCacheSize> chainCache;
 };
 
 using BinrecHandle = binrec::Handle<BinrecCore *>;
@@ -76,6 +98,10 @@ public:
    addReadOnlyRange(uint32_t address,
                     uint32_t size) override;
 
+   void
+   addReadOnlyCodeRange(uint32_t address,
+                        uint32_t size) override;
+
    bool
    sampleStats(JitStats &stats) override;
 
@@ -95,11 +121,129 @@ public:
    void
    setVerifyEnabled(bool enabled, uint32_t address = 0);
 
+   bool
+   setPersistentCachePath(const std::string &path);
+
+   void
+   setCompileThreads(unsigned count);
+
+   void
+   setTieredCompilation(const std::vector<std::string> &baselineOptList,
+                        unsigned tierUpThreshold);
+
    CodeBlock *
    getCodeBlock(BinrecCore *core, uint32_t address);
 
+   void *
+   getChainTarget(BinrecCore *core, uint32_t address);
+
+   uint32_t
+   getCodeCacheGeneration()
+   {
+      return mCodeCache.getGeneration();
+   }
+
+   unsigned
+   beginSystemCall(BinrecCore *core);
+
+   void
+   endSystemCall(BinrecCore *core,
+                 unsigned codeRegion);
+
 protected:
+   struct CompileRequest
+   {
+      uint32_t address;
+      CodeBlockTier tier;
+      std::array<espresso::GraphicsQuantisationRegister, 8> gqr;
+   };
+
+   //! A range of guest code which failed to translate and is always run
+   //! with the interpreter.
+   struct InterpretedRegion
+   {
+      uint32_t start;
+      uint32_t end;
+      std::atomic<uint64_t> entries { 0 };
+      std::atomic<uint64_t> blocks { 0 };
+      std::atomic<uint64_t> time { 0 };
+   };
+
    BinrecHandle *createBinrecHandle();
+   BinrecHandle *updateBinrecHandle(BinrecHandle *handle,
+                                    unsigned &generation);
+
+   CodeBlock *
+   compileCodeBlock(BinrecHandle *handle,
+                    BinrecCore *core,
+                    uint32_t address,
+                    CodeBlockTier tier);
+
+   void
+   queueCompile(BinrecCore *core,
+                uint32_t address,
+                CodeBlockTier tier);
+
+   void
+   checkTierUp(BinrecCore *core,
+               CodeBlock *block);
+
+   void
+   handleCodeCacheFull(uint32_t address,
+                       bool promotion);
+
+   void
+   requestCodeCacheFlush();
+
+   void
+   waitForCodeCacheFlush(BinrecCore *core);
+
+   bool
+   tryFlushCodeCache();
+
+   void
+   setCoreInJit(uint32_t coreId,
+                bool inJit);
+
+   BinrecCore *
+   checkDispatcherInterrupts(BinrecCore *core);
+
+   //! Tier that blocks are first compiled at.
+   CodeBlockTier
+   getInitialTier() const
+   {
+      return mTierUpThreshold ? CodeBlockTier::Baseline : CodeBlockTier::Optimised;
+   }
+
+   void
+   stopCompileThreads();
+
+   void
+   cancelQueuedCompiles();
+
+   void
+   waitForInFlightCompiles();
+
+   void
+   compileThreadEntry();
+
+   BinrecCore *
+   interpretUntilCompiled(BinrecCore *core);
+
+   BinrecCore *
+   interpretRegion(BinrecCore *core,
+                   InterpretedRegion &region);
+
+   void
+   addInterpretedRegion(uint32_t address,
+                        uint32_t size);
+
+   std::shared_ptr<InterpretedRegion>
+   findInterpretedRegion(uint32_t address);
+
+   void
+   removeInterpretedRegions(uint32_t address,
+                            uint32_t size);
 
    inline CodeBlock *
    getCodeBlockFast(BinrecCore *core, uint32_t address);
@@ -107,6 +251,13 @@ protected:
    CodeBlock *
    checkForCodeBlockTrampoline(uint32_t address);
 
+   bool
+   isPersistentCacheable(uint32_t address,
+                         uint32_t &rangeEnd);
+
+   uint64_t
+   getReadOnlyDataHash();
+
    void resumeVerifyExecution();
 
    void
@@ -133,8 +284,49 @@ protected:
 private:
    CodeCache mCodeCache;
    std::array<BinrecHandle *, 3> mHandles;
+   std::array<unsigned, 3> mHandleGenerations;
    BinrecOptimisationFlags mOptFlags;
+   BinrecOptimisationFlags mBaselineOptFlags;
+   unsigned mTierUpThreshold = 0;
+   std::atomic<uint64_t> mTierUpCompiles { 0 };
+   std::atomic<bool> mCodeCacheFull { false };
+   std::atomic<bool> mCodeCacheFlushPending { false };
+   std::atomic<uint64_t> mCodeCacheFlushes { 0 };
+   std::mutex mCodeCacheFlushMutex;
+   std::condition_variable mCodeCacheFlushCondition;
+
+   //! Whether each core may be executing JIT code, cores in a system call,
+   //! an interrupt handler or the interpreter are not.
+   std::array<std::atomic<bool>, 3> mCoreInJit;
+
+   //! Whether each core is waiting in waitForCodeCacheFlush.
+   std::array<bool, 3> mCoreWaitingForFlush;
+
+   //! Number of system calls which will return into each code region.
+   std::array<std::atomic<unsigned>, 2> mSystemCallsInProgress;
+   std::map<uint32_t, std::shared_ptr<InterpretedRegion>> mInterpretedRegions;
+   std::mutex mInterpretedRegionMutex;
    std::vector<std::pair<ppcaddr_t, uint32_t>> mReadOnlyRanges;
+   std::vector<std::pair<ppcaddr_t, uint32_t>> mReadOnlyCodeRanges;
+   std::mutex mReadOnlyRangeMutex;
+   std::atomic<unsigned> mReadOnlyRangeGeneration { 0 };
+   PersistentCache mPersistentCache;
+   uint64_t mReadOnlyDataHash = 0;
+   bool mReadOnlyDataHashValid = false;
+   std::atomic<uint64_t> mPersistentCacheHits { 0 };
+   std::atomic<uint64_t> mPersistentCacheMisses { 0 };
+   std::vector<std::thread> mCompileThreads;
+   std::deque<CompileRequest> mCompileQueue;
+   std::mutex mCompileMutex;
+   std::condition_variable mCompileCondition;
+   std::condition_variable mCompileIdleCondition;
+
+   //! Tickets of compiles which have been taken from the queue but not yet
+   //! finished, tickets are handed out in the order compiles start.
+   std::vector<uint64_t> mCompilesInFlight;
+   uint64_t mNextCompileTicket = 0;
+
+   bool mCompileThreadsRunning = false;
    std::atomic<uint64_t> mTotalProfileTime { 0 };
    uint32_t mProfilingMask = 0;
    bool mVerifyEnabled = false;
@@ -100,13 +100,10 @@ sOptFlags = {
    {"CHAIN",                    {OptFlagInfo::OPTFLAG_CHAIN}},
 };
 
-void
-BinrecBackend::setOptFlags(const std::vector<std::string> &optList)
+static BinrecOptimisationFlags
+parseOptFlags(const std::vector<std::string> &optList)
 {
-   mOptFlags.common = 0;
-   mOptFlags.guest = 0;
-   mOptFlags.host = 0;
-   mOptFlags.useChaining = false;
+   auto flags = BinrecOptimisationFlags { };
 
    for (const auto &i : optList) {
       auto flag = sOptFlags.find(i);
@@ -118,19 +115,35 @@ BinrecBackend::setOptFlags(const std::vector<std::string> &optList)
 
       switch (flag->second.type) {
       case OptFlagInfo::OPTFLAG_CHAIN:
-         mOptFlags.useChaining = true;
+         flags.useChaining = true;
          break;
       case OptFlagInfo::OPTFLAG_COMMON:
-         mOptFlags.common |= flag->second.value;
+         flags.common |= flag->second.value;
          break;
       case OptFlagInfo::OPTFLAG_GUEST:
-         mOptFlags.guest |= flag->second.value;
+         flags.guest |= flag->second.value;
          break;
       case OptFlagInfo::OPTFLAG_HOST:
-         mOptFlags.host |= flag->second.value;
+         flags.host |= flag->second.value;
          break;
       }
    }
+
+   return flags;
+}
+
+void
+BinrecBackend::setOptFlags(const std::vector<std::string> &optList)
+{
+   mOptFlags = parseOptFlags(optList);
+}
+
+void
+BinrecBackend::setTieredCompilation(const std::vector<std::string> &baselineOptList,
+                                    unsigned tierUpThreshold)
+{
+   mBaselineOptFlags = parseOptFlags(baselineOptList);
+   mTierUpThreshold = tierUpThreshold;
 }
 
 void
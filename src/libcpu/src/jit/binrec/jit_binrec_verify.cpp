@@ -75,7 +75,7 @@ BinrecBackend::resumeVerifyExecution()
          auto entry = reinterpret_cast<BinrecEntry>(codeBlock->code);
          entry(core, getBaseVirtualAddress());
       } else {
-         interpreter::step_one(core);
+         interpreter::step_block(core);
       }
 
       core = reinterpret_cast<BinrecCore *>(this_core::state());
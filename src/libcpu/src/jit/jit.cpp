@@ -48,7 +48,8 @@ initialiseCore(uint32_t id)
  * Clear the JIT cache for the given address range.
  *
  * This function must not be called while any JIT code is being executed.
- * There is no guarentee that only the selected address range will be cleared.
+ * Only blocks translated from guest code in the selected address range are
+ * forgotten, the host memory they used is not reclaimed until a full clear.
  */
 void
 clearCache(uint32_t address, uint32_t size)
@@ -71,6 +72,19 @@ addReadOnlyRange(uint32_t address, uint32_t size)
 }
 
 
+/**
+ * Mark the given range of addresses as read-only code, translations of code
+ * within these ranges may be stored in the persistent translation cache.
+ */
+void
+addReadOnlyCodeRange(uint32_t address, uint32_t size)
+{
+   if (sBackend) {
+      sBackend->addReadOnlyCodeRange(address, size);
+   }
+}
+
+
 /**
  * Begin executing guest code on the current core.
  */
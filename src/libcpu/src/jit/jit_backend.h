@@ -30,6 +30,10 @@ public:
    virtual void
    addReadOnlyRange(uint32_t address, uint32_t size) = 0;
 
+   //! Mark a region of memory as read only code.
+   virtual void
+   addReadOnlyCodeRange(uint32_t address, uint32_t size) = 0;
+
    //! Sample JIT stats.
    virtual bool
    sampleStats(JitStats &stats) = 0;
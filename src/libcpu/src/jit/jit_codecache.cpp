@@ -1,6 +1,7 @@
 #include "jit_codecache.h"
 #include "jit_stats.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <cstring>
@@ -45,12 +46,22 @@ CodeCache::initialise(size_t codeSize,
 
    decaf_assert(mReserveAddress, "Failed to map memory for JIT");
 
-   mCodeAllocator.flags = platform::ProtectFlags::ReadWriteExecute;
-   mCodeAllocator.baseAddress = mReserveAddress;
-   mCodeAllocator.reserved = codeSize;
-   mCodeAllocator.growthSize = 4 * 1024 * 1024;
-   mCodeAllocator.committed = 0;
-   mCodeAllocator.allocated = 0;
+   // Each code region must be a multiple of the growth size so committing
+   // memory never crosses into the next region.
+   auto codeGrowthSize = size_t { 4 * 1024 * 1024 };
+   auto codeRegionSize = align_down(codeSize / 2, codeGrowthSize);
+
+   for (auto i = 0u; i < mCodeAllocators.size(); ++i) {
+      auto &allocator = mCodeAllocators[i];
+      allocator.flags = platform::ProtectFlags::ReadWriteExecute;
+      allocator.baseAddress = mReserveAddress + i * codeRegionSize;
+      allocator.reserved = codeRegionSize;
+      allocator.growthSize = codeGrowthSize;
+      allocator.committed = 0;
+      allocator.allocated = 0;
+   }
+
+   mCodeRegion = 0;
 
    mDataAllocator.flags = platform::ProtectFlags::ReadWrite;
    mDataAllocator.baseAddress = mReserveAddress + codeSize;
@@ -82,9 +93,18 @@ CodeCache::clear()
    }
 #endif
 
+   // Invalidate any direct references to code before we reuse its memory.
+   mGeneration.fetch_add(1, std::memory_order_acq_rel);
+
    // Reset the allocators, don't bother uncommitting their memory.
    mDataAllocator.allocated = 0;
-   mCodeAllocator.allocated = 0;
+   mCodeAllocators[mCodeRegion].allocated = 0;
+
+   // Forget guest page ownership.
+   {
+      std::lock_guard<std::mutex> lock { mPageBlocksMutex };
+      mPageBlocks.clear();
+   }
 
    // Clear fast index, don't bother unallocating memory.
    if (mFastIndex) {
@@ -103,32 +123,96 @@ CodeCache::clear()
 }
 
 
+/**
+ * Flush the code cache.
+ *
+ * Like clear, but new code is allocated from the other code region so the
+ * code in the current region is left intact.  The caller must ensure nothing
+ * can still return into code in the other region.
+ */
+void
+CodeCache::flush()
+{
+   auto nextRegion = mCodeRegion.load() ^ 1;
+   clear();
+
+   mCodeAllocators[nextRegion].allocated = 0;
+   mCodeRegion.store(nextRegion, std::memory_order_release);
+}
+
+
 /**
  * Invalidate a region of code.
  *
- * Because it's super complicated to do properly let's just be a leaky fuck,
- * for now our "invalidation" is really just forgetting that we compiled a block.
+ * Only blocks which were translated from guest code overlapping the region
+ * are forgotten, along with any trampoline addresses which point to them.
+ * Because it's super complicated to do properly we do not try to reclaim the
+ * host memory used by invalidated blocks, a core may still be executing them.
  */
 void
 CodeCache::invalidate(uint32_t base,
                       uint32_t size)
 {
-   // Find any block containing this address and invalidate them!
-   auto blocks = getCompiledCodeBlocks();
+   if (!size) {
+      return;
+   }
 
-   for (auto &block : blocks) {
-      auto start = block.address;
-      auto end = start + 4096; // FIXME: Just assume 4096 limit for now..
+   auto end = uint64_t { base } + size;
+   auto firstPage = base >> PageShift;
+   auto lastPage = static_cast<uint32_t>((end - 1) >> PageShift);
+   auto invalidated = false;
 
-      if (base + size < start) {
-         continue;
+   auto invalidatePage = [&](std::vector<PageBlockEntry> &entries) {
+      for (auto itr = entries.begin(); itr != entries.end(); ) {
+         auto indexPtr = getIndexPointer(itr->address);
+         auto index = itr->index;
+
+         if (indexPtr->load() != index) {
+            // Stale entry, block has already been replaced or invalidated
+            itr = entries.erase(itr);
+            continue;
+         }
+
+         auto block = getBlockByIndex(index);
+         auto blockEnd = uint64_t { block->address } + block->guestSize;
+         auto overlapsBlock = block->address < end && blockEnd > base;
+         auto overlapsEntry = itr->address >= base && itr->address < end;
+
+         if (!overlapsBlock && !overlapsEntry) {
+            ++itr;
+            continue;
+         }
+
+         if (indexPtr->compare_exchange_strong(index, CodeBlockIndexUncompiled)) {
+            invalidated = true;
+         }
+
+         itr = entries.erase(itr);
       }
+   };
 
-      if (base >= end) {
-         continue;
+   {
+      std::lock_guard<std::mutex> lock { mPageBlocksMutex };
+
+      if (lastPage - firstPage >= mPageBlocks.size()) {
+         // Range covers more pages than we track, so walk the tracked pages
+         for (auto &[page, entries] : mPageBlocks) {
+            if (page >= firstPage && page <= lastPage) {
+               invalidatePage(entries);
+            }
+         }
+      } else {
+         for (auto page = firstPage; page <= lastPage; ++page) {
+            auto itr = mPageBlocks.find(page);
+            if (itr != mPageBlocks.end()) {
+               invalidatePage(itr->second);
+            }
+         }
       }
+   }
 
-      getIndexPointer(block.address)->store(CodeBlockIndexUncompiled);
+   if (invalidated) {
+      mGeneration.fetch_add(1, std::memory_order_acq_rel);
    }
 }
 
@@ -168,7 +252,7 @@ CodeCache::free()
 size_t
 CodeCache::getCodeCacheSize()
 {
-   return mCodeAllocator.allocated;
+   return mCodeAllocators[mCodeRegion].allocated;
 }
 
 
@@ -264,12 +348,16 @@ CodeCache::getIndexPointer(uint32_t address)
 
 /**
  * Set a CodeBlockIndex for an address, useful for mirroring duplicate functions.
+ *
+ * The address is tracked against both its own page and the pages of the
+ * target block, so invalidating either will forget the mirror.
  */
 void
 CodeCache::setBlockIndex(uint32_t address,
                          CodeBlockIndex index)
 {
    decaf_check(index >= 0);
+   addPageBlockEntry(address, index, getBlockByIndex(index));
    getIndexPointer(address)->store(index);
 }
 
@@ -278,20 +366,34 @@ CodeCache::setBlockIndex(uint32_t address,
  * Register a block of code in the CodeCache.
  *
  * This will allocate memory for the code and data, and update the code block index.
+ * Returns nullptr if the code cache is full.
+ * If a block is already registered for the address it is replaced, the old
+ * block's code is left in place for any core which may still be executing it.
  */
 CodeBlock *
 CodeCache::registerCodeBlock(uint32_t address,
+                             uint32_t guestSize,
                              void *code,
                              size_t size,
                              void *unwindInfo,
-                             size_t unwindSize)
+                             size_t unwindSize,
+                             CodeBlockTier tier,
+                             uint32_t tierUpCount)
 {
+   auto codeAddress = allocate(mCodeAllocators[mCodeRegion], size, 16);
+   if (!codeAddress) {
+      return nullptr;
+   }
+
    auto dataAddress = allocate(mDataAllocator, sizeof(CodeBlock), 1);
-   auto codeAddress = allocate(mCodeAllocator, size, 16);
+   if (!dataAddress) {
+      return nullptr;
+   }
 
    // Setup me block
    auto block = reinterpret_cast<CodeBlock *>(dataAddress);
    block->address = address;
+   block->guestSize = guestSize;
    block->code = reinterpret_cast<void *>(codeAddress);
    block->codeSize = static_cast<uint32_t>(size);
    std::memcpy(block->code, code, size);
@@ -300,6 +402,10 @@ CodeCache::registerCodeBlock(uint32_t address,
    block->profileData.count = 0;
    block->profileData.time = 0;
 
+   // Initialise tiering data
+   block->tier = tier;
+   block->tierUpCounter = tierUpCount;
+
 #ifdef PLATFORM_WINDOWS
    // Register unwind info
    decaf_check(unwindSize <= CodeBlockUnwindInfo::MaxUnwindInfoSize);
@@ -314,30 +420,72 @@ CodeCache::registerCodeBlock(uint32_t address,
 #endif
 
    auto index = getIndex(block);
+   addPageBlockEntry(address, index, block);
+
    auto indexPtr = getIndexPointer(address);
-   indexPtr->store(index);
+   auto previousIndex = indexPtr->exchange(index);
+
+   if (previousIndex >= 0) {
+      // We have replaced an existing block
+      mGeneration.fetch_add(1, std::memory_order_acq_rel);
+   }
+
    return block;
 }
 
 
+/**
+ * Track a block index registered at address against the guest pages the
+ * block was translated from.
+ */
+void
+CodeCache::addPageBlockEntry(uint32_t address,
+                             CodeBlockIndex index,
+                             CodeBlock *block)
+{
+   auto entry = PageBlockEntry { address, index };
+   auto blockEnd = uint64_t { block->address } + std::max(block->guestSize, 4u);
+   auto firstPage = block->address >> PageShift;
+   auto lastPage = static_cast<uint32_t>((blockEnd - 1) >> PageShift);
+
+   std::lock_guard<std::mutex> lock { mPageBlocksMutex };
+   for (auto page = firstPage; page <= lastPage; ++page) {
+      mPageBlocks[page].push_back(entry);
+   }
+
+   if ((address >> PageShift) < firstPage || (address >> PageShift) > lastPage) {
+      mPageBlocks[address >> PageShift].push_back(entry);
+   }
+}
+
+
 /**
  * Allocate memory from the specified CodeCache::FrameAllocator.
+ *
+ * Returns 0 if the allocator's reservation is full.
  */
 uintptr_t
 CodeCache::allocate(FrameAllocator &allocator,
                     size_t size,
                     size_t alignment)
 {
-   auto alignedSize = align_up(size + (alignment - 1), alignment);
-   auto offset = allocator.allocated.fetch_add(alignedSize);
-   auto alignedOffset = align_up(offset, alignment);
+   auto offset = allocator.allocated.load();
+   auto alignedOffset = size_t { 0 };
+
+   do {
+      alignedOffset = align_up(offset, alignment);
+
+      if (alignedOffset + size > allocator.reserved) {
+         return 0;
+      }
+   } while (!allocator.allocated.compare_exchange_weak(offset, alignedOffset + size));
 
    // Check if we have gone past end of committed memory.
-   if (alignedOffset + alignedSize > allocator.committed.load()) {
+   if (alignedOffset + size > allocator.committed.load()) {
       std::lock_guard<std::mutex> lock { allocator.mutex };
       auto committed = allocator.committed.load();
 
-      while (alignedOffset + alignedSize > committed) {
+      while (alignedOffset + size > committed) {
          if (!platform::commitMemory(allocator.baseAddress + committed, allocator.growthSize, allocator.flags)) {
             decaf_abort("Failed to commit memory for JIT");
          }
@@ -1,12 +1,15 @@
 #pragma once
 #include "jit_stats.h"
 
+#include <array>
 #include <atomic>
 #include <cstdint>
 #include <common/platform_compiler.h>
 #include <common/platform_memory.h>
 #include <gsl/gsl>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace cpu
 {
@@ -20,6 +23,11 @@ namespace jit
  * 1. Map guest address to host address.
  * 2. Allocate executable host memory.
  * 3. Allocate and populate unwind information.
+ * 4. Track which guest pages each block was translated from.
+ *
+ * The code memory is split into two regions, flush() starts allocating from
+ * the other region so code which a suspended system call will return into is
+ * not overwritten until the following flush.
  */
 class CodeCache
 {
@@ -48,6 +56,18 @@ class CodeCache
    static constexpr size_t Level1Size = 0x10000;
    static constexpr size_t Level2Size = 0x4000;
 
+   // Granularity of guest page block ownership tracking
+   static constexpr uint32_t PageShift = 12;
+
+   struct PageBlockEntry
+   {
+      //! Guest address the index is registered at.
+      uint32_t address;
+
+      //! Index registered at address.
+      CodeBlockIndex index;
+   };
+
 public:
    ~CodeCache();
 
@@ -58,6 +78,9 @@ public:
    void
    clear();
 
+   void
+   flush();
+
    void
    invalidate(uint32_t address,
               uint32_t size);
@@ -77,6 +100,28 @@ public:
    CodeBlock *
    getBlockByAddress(uint32_t address);
 
+   /**
+    * Get the index of the code region new code is allocated from.
+    */
+   unsigned
+   getCodeRegion()
+   {
+      return mCodeRegion.load(std::memory_order_acquire);
+   }
+
+   /**
+    * Get the current cache generation.
+    *
+    * The generation changes whenever a registered block is removed or
+    * replaced, anything which holds direct references to block code must be
+    * discarded when it changes.
+    */
+   uint32_t
+   getGeneration()
+   {
+      return mGeneration.load(std::memory_order_acquire);
+   }
+
    /**
     * Find a compiled code block from its CodeBlockIndex.
     */
@@ -122,10 +167,13 @@ public:
 
    CodeBlock *
    registerCodeBlock(uint32_t address,
+                     uint32_t guestSize,
                      void *code,
                      size_t size,
                      void *unwindInfo,
-                     size_t unwindSize);
+                     size_t unwindSize,
+                     CodeBlockTier tier = CodeBlockTier::Optimised,
+                     uint32_t tierUpCount = 0);
 
 
 private:
@@ -134,12 +182,21 @@ private:
             size_t size,
             size_t alignment);
 
+   void
+   addPageBlockEntry(uint32_t address,
+                     CodeBlockIndex index,
+                     CodeBlock *block);
+
 private:
    size_t mReserveAddress = 0;
    size_t mReserveSize = 0;
-   FrameAllocator mCodeAllocator;
+   std::array<FrameAllocator, 2> mCodeAllocators;
+   std::atomic<unsigned> mCodeRegion { 0 };
    FrameAllocator mDataAllocator;
    std::atomic<std::atomic<CodeBlockIndex> *> *mFastIndex = nullptr;
+   std::atomic<uint32_t> mGeneration { 1 };
+   std::mutex mPageBlocksMutex;
+   std::unordered_map<uint32_t, std::vector<PageBlockEntry>> mPageBlocks;
 };
 
 } // namespace jit
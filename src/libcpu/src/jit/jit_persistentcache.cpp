@@ -0,0 +1,202 @@
+#include "jit_persistentcache.h"
+#include "mem.h"
+
+#include <common/datahash.h>
+#include <common/log.h>
+#include <common/platform_dir.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+namespace cpu
+{
+
+namespace jit
+{
+
+PersistentCache::~PersistentCache()
+{
+   close();
+}
+
+
+/**
+ * Open a persistent cache file.
+ *
+ * Any existing entries with a matching configuration hash are loaded into
+ * memory, a partially written trailing entry is discarded.  If the file does
+ * not exist or was written with a different configuration it is recreated.
+ */
+bool
+PersistentCache::open(const std::string &path,
+                      uint64_t configHash)
+{
+   std::lock_guard<std::mutex> lock { mMutex };
+   auto validSize = std::streamoff { 0 };
+   mEntries.clear();
+
+   if (platform::fileExists(path)) {
+      auto in = std::ifstream { path, std::ifstream::in | std::ifstream::binary };
+      auto header = FileHeader { };
+
+      if (in.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+          header.magic == FileMagic &&
+          header.version == FileVersion &&
+          header.configHash == configHash) {
+         validSize = in.tellg();
+
+         while (true) {
+            auto entryHeader = EntryHeader { };
+            if (!in.read(reinterpret_cast<char *>(&entryHeader), sizeof(entryHeader))) {
+               break;
+            }
+
+            auto entry = Entry { };
+            entry.address = entryHeader.address;
+            entry.guestSize = entryHeader.guestSize;
+            entry.guestHash = entryHeader.guestHash;
+            entry.code.resize(entryHeader.codeSize);
+            entry.unwindInfo.resize(entryHeader.unwindSize);
+
+            if (!in.read(reinterpret_cast<char *>(entry.code.data()), entry.code.size()) ||
+                !in.read(reinterpret_cast<char *>(entry.unwindInfo.data()), entry.unwindInfo.size())) {
+               break;
+            }
+
+            validSize = in.tellg();
+            mEntries[entry.address].emplace_back(std::move(entry));
+         }
+      }
+   } else if (!platform::createParentDirectories(path)) {
+      gLog->warn("Failed to create directory for JIT cache {}", path);
+   }
+
+   if (validSize == 0) {
+      mFile.open(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+
+      auto header = FileHeader { };
+      header.magic = FileMagic;
+      header.version = FileVersion;
+      header.configHash = configHash;
+      mFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+   } else {
+      // Drop any partially written entry from the end of the file
+      auto ec = std::error_code { };
+      std::filesystem::resize_file(path, static_cast<uintmax_t>(validSize), ec);
+      mFile.open(path, std::ofstream::out | std::ofstream::binary | std::ofstream::app);
+   }
+
+   if (!mFile.is_open() || !mFile.good()) {
+      gLog->warn("Failed to open JIT cache {}", path);
+      mFile.close();
+      mEntries.clear();
+      return false;
+   }
+
+   gLog->info("Loaded {} JIT cache entries from {}", mEntries.size(), path);
+   return true;
+}
+
+
+/**
+ * Close the persistent cache file and forget all loaded entries.
+ */
+void
+PersistentCache::close()
+{
+   std::lock_guard<std::mutex> lock { mMutex };
+
+   if (mFile.is_open()) {
+      mFile.close();
+   }
+
+   mEntries.clear();
+}
+
+
+/**
+ * Find a cached translation for address which matches the guest code
+ * currently in memory.
+ */
+bool
+PersistentCache::find(uint32_t address,
+                      uint64_t seed,
+                      Entry &entry)
+{
+   std::lock_guard<std::mutex> lock { mMutex };
+   auto itr = mEntries.find(address);
+   if (itr == mEntries.end()) {
+      return false;
+   }
+
+   // Most recently written entries take priority
+   for (auto candidate = itr->second.rbegin(); candidate != itr->second.rend(); ++candidate) {
+      if (hashGuestCode(address, candidate->guestSize, seed) == candidate->guestHash) {
+         entry = *candidate;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/**
+ * Insert a new translation into the cache and append it to the cache file.
+ */
+void
+PersistentCache::insert(uint32_t address,
+                        uint32_t guestSize,
+                        uint64_t seed,
+                        const void *code,
+                        size_t codeSize,
+                        const void *unwindInfo,
+                        size_t unwindSize)
+{
+   auto entry = Entry { };
+   entry.address = address;
+   entry.guestSize = guestSize;
+   entry.guestHash = hashGuestCode(address, guestSize, seed);
+   entry.code.resize(codeSize);
+   entry.unwindInfo.resize(unwindSize);
+   std::memcpy(entry.code.data(), code, codeSize);
+
+   if (unwindSize) {
+      std::memcpy(entry.unwindInfo.data(), unwindInfo, unwindSize);
+   }
+
+   auto entryHeader = EntryHeader { };
+   entryHeader.address = entry.address;
+   entryHeader.guestSize = entry.guestSize;
+   entryHeader.guestHash = entry.guestHash;
+   entryHeader.codeSize = static_cast<uint32_t>(codeSize);
+   entryHeader.unwindSize = static_cast<uint32_t>(unwindSize);
+
+   std::lock_guard<std::mutex> lock { mMutex };
+   if (!mFile.is_open()) {
+      return;
+   }
+
+   mFile.write(reinterpret_cast<const char *>(&entryHeader), sizeof(entryHeader));
+   mFile.write(reinterpret_cast<const char *>(entry.code.data()), entry.code.size());
+   mFile.write(reinterpret_cast<const char *>(entry.unwindInfo.data()), entry.unwindInfo.size());
+   mFile.flush();
+   mEntries[address].emplace_back(std::move(entry));
+}
+
+
+/**
+ * Hash a range of guest code.
+ */
+uint64_t
+PersistentCache::hashGuestCode(uint32_t address,
+                               uint32_t size,
+                               uint64_t seed)
+{
+   return XXH64(mem::translate(address), size, seed);
+}
+
+} // namespace jit
+
+} // namespace cpu
@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cpu
+{
+
+namespace jit
+{
+
+/**
+ * Persistent Cache Responsibilities:
+ *
+ * 1. Load previously translated host code from disk.
+ * 2. Match cached code against the current guest code bytes.
+ * 3. Append newly translated code to disk as it is produced.
+ *
+ * The cache file is only valid for a single backend configuration, if the
+ * configuration hash in the file header does not match then the file is
+ * discarded and started from scratch.
+ */
+class PersistentCache
+{
+   static constexpr uint32_t FileMagic = 0x54494A44; // 'DJIT'
+   static constexpr uint32_t FileVersion = 1;
+
+   struct FileHeader
+   {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t configHash;
+   };
+
+   struct EntryHeader
+   {
+      uint32_t address;
+      uint32_t guestSize;
+      uint64_t guestHash;
+      uint32_t codeSize;
+      uint32_t unwindSize;
+   };
+
+public:
+   struct Entry
+   {
+      //! Guest address of PPC code.
+      uint32_t address;
+
+      //! Number of bytes of guest code covered by guestHash.
+      uint32_t guestSize;
+
+      //! Hash of the guest code bytes the host code was translated from.
+      uint64_t guestHash;
+
+      //! Translated host code.
+      std::vector<uint8_t> code;
+
+      //! Unwind info for the host code, only used on Windows.
+      std::vector<uint8_t> unwindInfo;
+   };
+
+public:
+   ~PersistentCache();
+
+   bool
+   open(const std::string &path,
+        uint64_t configHash);
+
+   void
+   close();
+
+   bool
+   isOpen() const
+   {
+      return mFile.is_open();
+   }
+
+   bool
+   find(uint32_t address,
+        uint64_t seed,
+        Entry &entry);
+
+   void
+   insert(uint32_t address,
+          uint32_t guestSize,
+          uint64_t seed,
+          const void *code,
+          size_t codeSize,
+          const void *unwindInfo,
+          size_t unwindSize);
+
+   static uint64_t
+   hashGuestCode(uint32_t address,
+                 uint32_t size,
+                 uint64_t seed);
+
+private:
+   std::mutex mMutex;
+   std::ofstream mFile;
+   std::unordered_map<uint32_t, std::vector<Entry>> mEntries;
+};
+
+} // namespace jit
+
+} // namespace cpu
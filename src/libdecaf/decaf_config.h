@@ -79,6 +79,7 @@ struct SystemSettings
    std::vector<std::string> title_directories = {};
    bool time_scale_enabled = false;
    double time_scale = 1.0;
+   bool io_uring = false; // Read host files with io_uring on Linux
    std::vector<std::string> lle_modules;
    bool dump_hle_rpl = false; // TODO: Move this to a debug api command?
 };
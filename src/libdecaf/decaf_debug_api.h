@@ -302,6 +302,60 @@ struct CafeVoice
    bool loopingEnabled;
 };
 
+struct IosWorkerStatistics
+{
+   //! Number of host threads running IOS tasks such as file system requests.
+   unsigned numThreads = 0;
+
+   //! Number of tasks waiting to run.
+   unsigned queueDepth = 0;
+
+   //! Largest number of tasks that have been waiting to run at once.
+   unsigned maxQueueDepth = 0;
+
+   //! Number of tasks which have completed.
+   uint64_t numCompletedTasks = 0;
+
+   //! Histogram of time from a task being submitted until it started running,
+   //! bucket i counts tasks which waited less than 2^i microseconds.
+   std::vector<uint64_t> waitLatency;
+
+   //! Histogram of time spent running tasks, with the same buckets as
+   //! waitLatency.
+   std::vector<uint64_t> runLatency;
+};
+
+struct VfsPathCacheStatistics
+{
+   //! Number of path lookups answered from a path cache.
+   uint64_t hits = 0;
+
+   //! Number of path lookups which had to query devices.
+   uint64_t misses = 0;
+
+   //! Number of times the path caches have been invalidated by a change to
+   //! the file system.
+   uint64_t invalidations = 0;
+};
+
+struct GpuInterruptStatistics
+{
+   //! Number of interrupt entries written by the GPU.
+   uint64_t entriesWritten = 0;
+
+   //! Number of times the GPU raised an interrupt.
+   uint64_t interruptsRaised = 0;
+
+   //! Number of times pending interrupts were read by the interrupt handler.
+   uint64_t deliveries = 0;
+
+   //! Total nanoseconds between raising an interrupt and it being read.
+   uint64_t totalDeliveryLatency = 0;
+
+   //! Largest nanoseconds between raising an interrupt and it being read.
+   uint64_t maxDeliveryLatency = 0;
+};
+
 enum class Pm4CaptureState
 {
    Disabled,
@@ -335,6 +389,16 @@ bool sampleCafeRunningThread(int coreId, CafeThread &info);
 bool sampleCafeThreads(std::vector<CafeThread> &threads);
 bool sampleCafeVoices(std::vector<CafeVoice> &voiceInfos);
 
+// IOS
+bool sampleIosWorkerStatistics(IosWorkerStatistics &stats);
+
+// VFS
+bool sampleVfsPathCacheStatistics(VfsPathCacheStatistics &stats);
+
+// GPU
+bool sampleGpuInterruptStatistics(GpuInterruptStatistics &stats);
+void resetGpuInterruptStatistics();
+
 // pm4 capture
 Pm4CaptureState pm4CaptureState();
 bool pm4CaptureNextFrame();
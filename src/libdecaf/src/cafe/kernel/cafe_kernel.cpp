@@ -18,6 +18,7 @@
 #include "decaf_configstorage.h"
 #include "decaf_events.h"
 #include "decaf_game.h"
+#include "decaf_graphics.h"
 #include "ios/mcp/ios_mcp_mcp_types.h"
 
 #include <atomic>
@@ -127,6 +128,10 @@ mainCoreEntryPoint(cpu::Core *core)
    }
    decaf::event::onGameLoaded(gameInfo);
 
+   if (auto graphicsDriver = decaf::getGraphicsDriver()) {
+      graphicsDriver->notifyTitleLoaded(titleInfo->titleId);
+   }
+
    // Start the game
    internal::finishInitAndPreload();
 }
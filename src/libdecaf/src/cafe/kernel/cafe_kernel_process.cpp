@@ -330,6 +330,12 @@ loadGameProcess(std::string_view rpx,
             }
          }
 
+         if ((sectionHeader->flags & loader::rpl::SHF_EXECINSTR) &&
+             !(sectionHeader->flags & loader::rpl::SHF_WRITE)) {
+            cpu::addJitReadOnlyCodeRange(sectionAddress.getAddress(),
+                                         sectionHeader->size);
+         }
+
          if (!(sectionHeader->flags & loader::rpl::SHF_WRITE)) {
             // TODO: Fix me
             // When we have a small section, e.g. .syscall section with
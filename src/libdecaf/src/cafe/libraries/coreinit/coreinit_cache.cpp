@@ -5,6 +5,7 @@
 
 #include <atomic>
 #include <common/align.h>
+#include <libcpu/cpu_control.h>
 
 namespace cafe::coreinit
 {
@@ -91,6 +92,19 @@ DCTouchRange(virt_addr address,
 }
 
 
+/**
+ * Equivalent to icbi instruction.
+ */
+void
+ICInvalidateRange(virt_addr address,
+                  uint32_t size)
+{
+   auto alignedAddr = align_down(address, 32);
+   auto alignedSize = align_up(static_cast<uint32_t>(address - alignedAddr) + size, 32);
+   cpu::invalidateInstructionCache(alignedAddr.getAddress(), alignedSize);
+}
+
+
 /**
  * Equivalent to a sync instruction.
  */
@@ -152,6 +166,7 @@ Library::registerCacheSymbols()
    RegisterFunctionExport(DCStoreRangeNoSync);
    RegisterFunctionExport(DCZeroRange);
    RegisterFunctionExport(DCTouchRange);
+   RegisterFunctionExport(ICInvalidateRange);
    RegisterFunctionExport(OSCoherencyBarrier);
    RegisterFunctionExport(OSEnforceInorderIO);
    RegisterFunctionExport(OSIsAddressRangeDCValid);
@@ -38,6 +38,10 @@ void
 DCTouchRange(virt_addr address,
              uint32_t size);
 
+void
+ICInvalidateRange(virt_addr address,
+                  uint32_t size);
+
 void
 OSCoherencyBarrier();
 
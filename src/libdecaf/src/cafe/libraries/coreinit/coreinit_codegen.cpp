@@ -3,9 +3,17 @@
 
 #include "cafe/kernel/cafe_kernel_mmu.h"
 
+#include <atomic>
+#include <cstring>
+#include <libcpu/cpu_control.h>
+
 namespace cafe::coreinit
 {
 
+//! Whether the codegen area is currently executable rather than writable.
+static std::atomic<bool>
+sCodeGenExecuteMode { true };
+
 void
 OSGetCodegenVirtAddrRange(virt_ptr<virt_addr> outAddress,
                           virt_ptr<uint32_t> outSize)
@@ -21,10 +29,68 @@ OSGetCodegenVirtAddrRange(virt_ptr<virt_addr> outAddress,
    }
 }
 
+
+/**
+ * Returns TRUE if the codegen area is in execute mode.
+ */
+BOOL
+OSGetSecCodeGenMode()
+{
+   return sCodeGenExecuteMode.load() ? TRUE : FALSE;
+}
+
+
+/**
+ * Switch the codegen area between write and execute mode.
+ *
+ * We do not enforce the protection, but code may have been written while in
+ * write mode so any translation of the codegen area must be discarded.
+ */
+BOOL
+OSSwitchSecCodeGenMode(BOOL execute)
+{
+   auto range = kernel::getCodeGenVirtualRange();
+   if (!range.second) {
+      return FALSE;
+   }
+
+   if (execute && !sCodeGenExecuteMode.exchange(true)) {
+      cpu::invalidateInstructionCache(range.first.getAddress(), range.second);
+   } else if (!execute) {
+      sCodeGenExecuteMode.store(false);
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Copy code into the codegen area.
+ */
+BOOL
+OSCodegenCopy(virt_ptr<void> dst,
+              virt_ptr<const void> src,
+              uint32_t size)
+{
+   auto range = kernel::getCodeGenVirtualRange();
+   auto dstAddress = virt_cast<virt_addr>(dst);
+   if (!range.second || dstAddress < range.first ||
+       dstAddress + size > range.first + range.second) {
+      return FALSE;
+   }
+
+   std::memmove(dst.get(), src.get(), size);
+   cpu::invalidateInstructionCache(dstAddress.getAddress(), size);
+   return TRUE;
+}
+
 void
 Library::registerCodeGenSymbols()
 {
    RegisterFunctionExport(OSGetCodegenVirtAddrRange);
+   RegisterFunctionExport(OSGetSecCodeGenMode);
+   RegisterFunctionExport(OSSwitchSecCodeGenMode);
+   RegisterFunctionExport(OSCodegenCopy);
 }
 
 } // namespace cafe::coreinit
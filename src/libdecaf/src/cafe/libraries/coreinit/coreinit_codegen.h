@@ -8,4 +8,15 @@ void
 OSGetCodegenVirtAddrRange(virt_ptr<virt_addr> outAddress,
                           virt_ptr<uint32_t> outSize);
 
+BOOL
+OSGetSecCodeGenMode();
+
+BOOL
+OSSwitchSecCodeGenMode(BOOL execute);
+
+BOOL
+OSCodegenCopy(virt_ptr<void> dst,
+              virt_ptr<const void> src,
+              uint32_t size);
+
 } // namespace cafe::coreinit
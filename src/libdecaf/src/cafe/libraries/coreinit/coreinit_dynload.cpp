@@ -21,6 +21,7 @@
 #include <common/strutils.h>
 #include <fmt/core.h>
 #include <gsl/gsl-lite.hpp>
+#include <libcpu/cpu_control.h>
 #include <libcpu/cpu_formatters.h>
 
 namespace cafe::coreinit
@@ -479,6 +480,24 @@ getNotifyCallbackCount()
 }
 
 
+/**
+ * Invalidate any cached translations of the code sections in an RPL, as a
+ * previously unloaded RPL may have had code at the same address.
+ */
+static void
+invalidateCodeSections(virt_ptr<RPL_DATA> rplData)
+{
+   for (auto i = 0u; i < rplData->sectionInfoCount; ++i) {
+      auto &sectionInfo = rplData->sectionInfo[i];
+      if (sectionInfo.type == loader::rpl::SHT_PROGBITS &&
+          (sectionInfo.flags & loader::rpl::SHF_EXECINSTR)) {
+         cpu::invalidateInstructionCache(sectionInfo.address.value().getAddress(),
+                                         sectionInfo.size);
+      }
+   }
+}
+
+
 /**
  * Unload the given module.
  */
@@ -500,6 +519,9 @@ unloadModule(virt_ptr<RPL_DATA> rplData,
       // which reference this module
    }
 
+   // The memory for the code sections may be reused by another module
+   invalidateCodeSections(rplData);
+
    // Release all imported modules
    for (auto i = 0u; i < rplData->importModuleCount; ++i) {
       if (rplData->importModules[i] &&
@@ -832,6 +854,24 @@ findExports(virt_ptr<RPL_DATA> rplData)
 }
 
 
+/**
+ * Notify the JIT of read only code sections in an RPL.
+ */
+static void
+addJitReadOnlyCodeRanges(virt_ptr<RPL_DATA> rplData)
+{
+   for (auto i = 0u; i < rplData->sectionInfoCount; ++i) {
+      auto &sectionInfo = rplData->sectionInfo[i];
+      if (sectionInfo.type == loader::rpl::SHT_PROGBITS &&
+          (sectionInfo.flags & loader::rpl::SHF_EXECINSTR) &&
+          !(sectionInfo.flags & loader::rpl::SHF_WRITE)) {
+         cpu::addJitReadOnlyCodeRange(sectionInfo.address.value().getAddress(),
+                                      sectionInfo.size);
+      }
+   }
+}
+
+
 /**
  * Find TLS sections in an RPL.
  */
@@ -993,6 +1033,8 @@ setupPerm(virt_ptr<RPL_DATA> rplData,
    }
 
    findExports(rplData);
+   invalidateCodeSections(rplData);
+   addJitReadOnlyCodeRanges(rplData);
 
    if (!findTlsSection(rplData)) {
       COSError(COSReportModule::Unknown2,
@@ -1530,6 +1572,8 @@ prepareLoad(virt_ptr<RPL_DATA> *ptrRplData,
    *ptrMinFileInfo = nullptr;
 
    findExports(rplData);
+   invalidateCodeSections(rplData);
+   addJitReadOnlyCodeRanges(rplData);
 
    if (!findTlsSection(rplData)) {
       COSError(COSReportModule::Unknown2,
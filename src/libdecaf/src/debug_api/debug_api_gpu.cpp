@@ -0,0 +1,27 @@
+#include "decaf_debug_api.h"
+
+#include <libgpu/gpu_ih.h>
+
+namespace decaf::debug
+{
+
+bool
+sampleGpuInterruptStatistics(GpuInterruptStatistics &stats)
+{
+   auto ihStats = gpu::ih::Stats { };
+   gpu::ih::sampleStats(ihStats);
+   stats.entriesWritten = ihStats.entriesWritten;
+   stats.interruptsRaised = ihStats.interruptsRaised;
+   stats.deliveries = ihStats.deliveries;
+   stats.totalDeliveryLatency = ihStats.totalDeliveryLatency;
+   stats.maxDeliveryLatency = ihStats.maxDeliveryLatency;
+   return true;
+}
+
+void
+resetGpuInterruptStatistics()
+{
+   gpu::ih::resetStats();
+}
+
+} // namespace decaf::debug
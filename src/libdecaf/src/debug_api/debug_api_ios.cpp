@@ -0,0 +1,23 @@
+#include "decaf_debug_api.h"
+
+#include "ios/ios_worker_thread.h"
+
+namespace decaf::debug
+{
+
+bool
+sampleIosWorkerStatistics(IosWorkerStatistics &stats)
+{
+   auto workerStats = ios::internal::getWorkerStatistics();
+   stats.numThreads = workerStats.numThreads;
+   stats.queueDepth = workerStats.queueDepth;
+   stats.maxQueueDepth = workerStats.maxQueueDepth;
+   stats.numCompletedTasks = workerStats.numCompletedTasks;
+   stats.waitLatency.assign(workerStats.waitLatency.begin(),
+                            workerStats.waitLatency.end());
+   stats.runLatency.assign(workerStats.runLatency.begin(),
+                           workerStats.runLatency.end());
+   return true;
+}
+
+} // namespace decaf::debug
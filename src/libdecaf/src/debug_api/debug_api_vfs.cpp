@@ -0,0 +1,18 @@
+#include "decaf_debug_api.h"
+
+#include "vfs/vfs_pathcache.h"
+
+namespace decaf::debug
+{
+
+bool
+sampleVfsPathCacheStatistics(VfsPathCacheStatistics &stats)
+{
+   auto cacheStats = vfs::getPathCacheStatistics();
+   stats.hits = cacheStats.hits;
+   stats.misses = cacheStats.misses;
+   stats.invalidations = cacheStats.invalidations;
+   return true;
+}
+
+} // namespace decaf::debug
@@ -12,6 +12,7 @@
 #include "cafe/libraries/swkbd/swkbd_keyboard.h"
 #include "debugger/debugger.h"
 #include "vfs/vfs_host_device.h"
+#include "vfs/vfs_pack_device.h"
 #include "vfs/vfs_virtual_device.h"
 #include "input/input.h"
 #include "ios/ios.h"
@@ -70,6 +71,26 @@ getResourcePath(const std::string &filename)
 #endif
 }
 
+/**
+ * Open the device for a title's /vol/content, a content.pack built by
+ * content-pack takes priority over the content directory.
+ */
+static std::shared_ptr<vfs::Device>
+openContentDevice(const std::filesystem::path &volPath)
+{
+   auto packPath = volPath / "content.pack";
+   if (std::filesystem::is_regular_file(packPath)) {
+      if (auto device = vfs::PackDevice::open(packPath)) {
+         gLog->info("Using content pack {}", packPath.string());
+         return device;
+      }
+
+      gLog->warn("Could not open content pack {}", packPath.string());
+   }
+
+   return std::make_shared<vfs::HostDevice>(volPath / "content");
+}
+
 bool
 initialise(const std::string &gamePath)
 {
@@ -130,7 +151,7 @@ initialise(const std::string &gamePath)
 
    if (!volPath.empty()) {
       filesystem->mountDevice(user, "/vol/code", std::make_shared<vfs::HostDevice>(volPath / "code"));
-      filesystem->mountDevice(user, "/vol/content", std::make_shared<vfs::HostDevice>(volPath / "content"));
+      filesystem->mountDevice(user, "/vol/content", openContentDevice(volPath));
       filesystem->mountDevice(user, "/vol/meta", std::make_shared<vfs::HostDevice>(volPath / "meta"));
    } else if (!rpxPath.empty()) {
       filesystem->mountDevice(user, "/vol/code", std::make_shared<vfs::HostDevice>(rpxPath.parent_path()));
@@ -2,12 +2,19 @@
 #include "ios_fs_log.h"
 
 #include "ios/ios.h"
+#include "ios/ios_uring_thread.h"
 #include "vfs/vfs_error.h"
 #include "vfs/vfs_filehandle.h"
+#include "vfs/vfs_host_filehandle.h"
 #include "vfs/vfs_virtual_device.h"
 
+#include <cerrno>
 #include <common/strutils.h>
+#include <cstring>
 #include <libcpu/cpu_formatters.h>
+#include <libcpu/memtrack.h>
+#include <memory>
+#include <vector>
 
 namespace ios::fs::internal
 {
@@ -118,6 +125,7 @@ FSADevice::translateStat(const vfs::Status &entry,
 int32_t
 FSADevice::mapHandle(std::unique_ptr<vfs::FileHandle> file)
 {
+   std::lock_guard<std::mutex> lock { mHandlesMutex };
    auto index = 0;
 
    for (index = 0; index < mHandles.size(); ++index) {
@@ -139,6 +147,7 @@ FSADevice::mapHandle(std::unique_ptr<vfs::FileHandle> file)
 int32_t
 FSADevice::mapHandle(vfs::DirectoryIterator folder)
 {
+   std::lock_guard<std::mutex> lock { mHandlesMutex };
    auto index = 0;
 
    for (index = 0; index < mHandles.size(); ++index) {
@@ -161,6 +170,8 @@ FSAStatus
 FSADevice::mapFileHandle(int32_t index,
                          Handle *&handle)
 {
+   std::lock_guard<std::mutex> lock { mHandlesMutex };
+
    if (index <= 0 || index > mHandles.size()) {
       return FSAStatus::InvalidFileHandle;
    }
@@ -178,6 +189,8 @@ FSAStatus
 FSADevice::mapFolderHandle(int32_t index,
                            Handle *&handle)
 {
+   std::lock_guard<std::mutex> lock { mHandlesMutex };
+
    if (index <= 0 || index > mHandles.size()) {
       return FSAStatus::InvalidDirHandle;
    }
@@ -195,6 +208,11 @@ FSAStatus
 FSADevice::removeHandle(int32_t index,
                         Handle::Type type)
 {
+   // Close the handle after releasing the lock, closing a file can flush
+   std::unique_ptr<vfs::FileHandle> file;
+   vfs::DirectoryIterator directory;
+   std::lock_guard<std::mutex> lock { mHandlesMutex };
+
    if (index <= 0 || index > mHandles.size()) {
       if (type == Handle::File) {
          return FSAStatus::InvalidFileHandle;
@@ -213,8 +231,8 @@ FSADevice::removeHandle(int32_t index,
    }
 
    handle.type = Handle::Unused;
-   handle.file = {};
-   handle.directory = {};
+   file = std::move(handle.file);
+   directory = std::move(handle.directory);
    return FSAStatus::OK;
 }
 
@@ -664,6 +682,193 @@ FSADevice::readFile(vfs::User user,
 }
 
 
+/**
+ * State of a read done through a host file descriptor by submitReadFile.
+ */
+struct DescriptorRead
+{
+   vfs::HostFileHandle *file;
+   int descriptor;
+   int32_t fileHandle;
+   uint8_t *buffer;
+   phys_addr bufferAddress;
+   uint32_t size;
+   uint64_t length;
+   int64_t offset;
+   uint64_t bytesRead = 0;
+   int32_t error = 0;
+   bool useBounceBuffer = false;
+   ReadFileResumeCallback resume;
+   ReadFileCallback callback;
+};
+
+static bool
+submitDescriptorRead(std::shared_ptr<DescriptorRead> read);
+
+
+/**
+ * Read the rest of the request into a host buffer and copy it into the guest
+ * buffer, for when the kernel could not write to the guest buffer itself.
+ */
+static void
+finishDescriptorReadWithBounceBuffer(DescriptorRead &read)
+{
+   auto remaining = read.length - read.bytesRead;
+   auto bounceBuffer = std::vector<uint8_t>(static_cast<size_t>(remaining));
+   read.file->seek(vfs::FileHandle::SeekStart,
+                   read.offset + static_cast<int64_t>(read.bytesRead));
+
+   auto result = read.file->read(bounceBuffer.data(), 1, remaining);
+   if (result) {
+      std::memcpy(read.buffer + read.bytesRead, bounceBuffer.data(),
+                  static_cast<size_t>(*result));
+      read.bytesRead += *result;
+   }
+}
+
+
+/**
+ * Complete a descriptor read, this runs back on the worker strand which
+ * submitted the read with the file system lock held.
+ */
+static void
+finishDescriptorRead(DescriptorRead &read)
+{
+   if (read.useBounceBuffer) {
+      finishDescriptorReadWithBounceBuffer(read);
+   } else if (read.error < 0) {
+      fsLog->warn("FSADevice::readFile[{}] size: {} count: {} pos: {} "
+                  "failed with error {}",
+                  read.fileHandle, read.size, read.length / read.size,
+                  read.offset, -read.error);
+   }
+
+   // Write tracking may have protected the buffer again while the read was in
+   // flight, so make sure the data we have read is seen as a change.
+   cpu::unprotectForHostWrite(read.bufferAddress,
+                              static_cast<uint32_t>(read.bytesRead));
+
+   read.file->completeDescriptorRead(
+      read.offset + static_cast<int64_t>(read.bytesRead),
+      read.bytesRead < read.length);
+
+   // Like fread we only count complete elements
+   auto bytesRead = (read.bytesRead / read.size) * read.size;
+   fsLog->trace("FSADevice::readFile[{}] size: {} count: {} pos: {} "
+                "read bytes: {}",
+                read.fileHandle, read.size, read.length / read.size,
+                read.offset, bytesRead);
+   read.callback(static_cast<FSAStatus>(bytesRead));
+}
+
+
+/**
+ * Handle the completion of a descriptor read on the io_uring thread, short
+ * reads are resubmitted until we reach the end of the file and everything
+ * else is finished back on the worker strand.
+ */
+static void
+onDescriptorRead(std::shared_ptr<DescriptorRead> read,
+                 int32_t result)
+{
+   if (result > 0) {
+      read->bytesRead += static_cast<uint32_t>(result);
+
+      if (read->bytesRead < read->length) {
+         if (submitDescriptorRead(read)) {
+            return;
+         }
+
+         read->useBounceBuffer = true;
+      }
+   } else if (result == -EFAULT || result == -EAGAIN) {
+      // The kernel fails rather than faulting when it can not write to the
+      // guest buffer, e.g. when getMemoryState protected it again mid read.
+      read->useBounceBuffer = true;
+   } else if (result < 0) {
+      read->error = result;
+   }
+
+   read->resume([read]() { finishDescriptorRead(*read); });
+}
+
+
+/**
+ * Submit the remainder of a descriptor read to io_uring.
+ */
+static bool
+submitDescriptorRead(std::shared_ptr<DescriptorRead> read)
+{
+   return ios::internal::submitUringRead(
+      read->descriptor,
+      read->buffer + read->bytesRead,
+      static_cast<uint32_t>(read->length - read->bytesRead),
+      read->offset + static_cast<int64_t>(read->bytesRead),
+      [read](int32_t result) { onDescriptorRead(read, result); });
+}
+
+
+/**
+ * Start reading a host file straight into the guest buffer with io_uring.
+ *
+ * Returns false if the read can not be done asynchronously, readFile should
+ * then be used instead.  Otherwise once the read completes resume is called
+ * with a function which must be run on the caller's worker strand with the
+ * file system lock held, that function then calls callback with the result.
+ * The caller must not run anything else on this file handle until then.
+ */
+bool
+FSADevice::submitReadFile(vfs::User user,
+                          phys_ptr<FSARequestReadFile> request,
+                          phys_ptr<uint8_t> buffer,
+                          uint32_t bufferLen,
+                          ReadFileResumeCallback resume,
+                          ReadFileCallback callback)
+{
+   auto handle = static_cast<Handle *>(nullptr);
+   if (mapFileHandle(request->handle, handle) < 0) {
+      return false;
+   }
+
+   auto file = dynamic_cast<vfs::HostFileHandle *>(handle->file.get());
+   if (!file) {
+      return false;
+   }
+
+   auto descriptor = file->descriptor();
+   auto size = static_cast<uint32_t>(request->size);
+   auto length = static_cast<uint64_t>(size) * request->count;
+   if (descriptor < 0 || length == 0 || length > 0x7FFFFFFF) {
+      return false;
+   }
+
+   auto offset = int64_t { 0 };
+   if (request->readFlags & FSAReadFlag::ReadWithPos) {
+      offset = request->pos;
+   } else if (auto position = file->tell(); position) {
+      offset = *position;
+   } else {
+      return false;
+   }
+
+   auto read = std::make_shared<DescriptorRead>();
+   read->file = file;
+   read->descriptor = descriptor;
+   read->fileHandle = static_cast<int32_t>(request->handle);
+   read->buffer = buffer.get();
+   read->bufferAddress = phys_cast<phys_addr>(buffer);
+   read->size = size;
+   read->length = length;
+   read->offset = offset;
+   read->resume = std::move(resume);
+   read->callback = std::move(callback);
+
+   // The kernel can not write into pages protected by write tracking
+   cpu::unprotectForHostWrite(read->bufferAddress, static_cast<uint32_t>(length));
+   return submitDescriptorRead(read);
+}
+
+
 FSAStatus
 FSADevice::remove(vfs::User user,
                   phys_ptr<FSARequestRemove> request)
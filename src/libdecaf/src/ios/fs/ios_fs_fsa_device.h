@@ -9,9 +9,11 @@
 #include "vfs/vfs_permissions.h"
 
 #include <common/structsize.h>
-#include <vector>
+#include <deque>
+#include <functional>
 #include <libcpu/be2_struct.h>
 #include <memory>
+#include <mutex>
 
 namespace ios::fs::internal
 {
@@ -21,6 +23,11 @@ namespace ios::fs::internal
  * @{
  */
 
+using ReadFileCallback = std::function<void(FSAStatus)>;
+
+//! Runs the given function on the worker strand which submitted a read.
+using ReadFileResumeCallback = std::function<void(std::function<void()>)>;
+
 class FSADevice
 {
    struct Handle
@@ -76,6 +83,7 @@ public:
    FSAStatus openFile(vfs::User user, phys_ptr<FSARequestOpenFile> request, phys_ptr<FSAResponseOpenFile> response);
    FSAStatus readDir(vfs::User user, phys_ptr<FSARequestReadDir> request, phys_ptr<FSAResponseReadDir> response);
    FSAStatus readFile(vfs::User user, phys_ptr<FSARequestReadFile> request, phys_ptr<uint8_t> buffer, uint32_t bufferLen);
+   bool submitReadFile(vfs::User user, phys_ptr<FSARequestReadFile> request, phys_ptr<uint8_t> buffer, uint32_t bufferLen, ReadFileResumeCallback resume, ReadFileCallback callback);
    FSAStatus remove(vfs::User user, phys_ptr<FSARequestRemove> request);
    FSAStatus rename(vfs::User user, phys_ptr<FSARequestRename> request);
    FSAStatus rewindDir(vfs::User user, phys_ptr<FSARequestRewindDir> request);
@@ -121,7 +129,11 @@ private:
 private:
    std::shared_ptr<vfs::Device> mFS;
    vfs::Path mWorkingPath = "/";
-   std::vector<Handle> mHandles;
+
+   //! Handles are stored in a deque so a Handle stays at the same address when
+   //! another is opened, as operations on different handles run in parallel.
+   std::mutex mHandlesMutex;
+   std::deque<Handle> mHandles;
 };
 
 /** @} */
@@ -14,8 +14,15 @@
 #include "ios/ios_stackobject.h"
 #include "ios/ios_worker_thread.h"
 
+#include <cstring>
+#include <shared_mutex>
+
 using namespace ios::kernel;
+using ios::internal::cancelDeferWorkerTaskCompletion;
+using ios::internal::deferWorkerTaskCompletion;
+using ios::internal::resumeDeferredWorkerTask;
 using ios::internal::submitWorkerTask;
+using ios::internal::WorkerTaskKey;
 
 namespace ios::fs::internal
 {
@@ -57,6 +64,60 @@ getDevice(FSADeviceHandle handle,
    return FSAStatus::OK;
 }
 
+/*
+ * FSA requests run on the IOS worker threads, independent clients run in
+ * parallel while requests for one client stay ordered with each other.
+ *
+ * The virtual file system is not thread safe, so requests which can modify
+ * its tree (mounting, creating or removing files and folders) hold an
+ * exclusive lock while everything else holds a shared lock.
+ */
+enum class FsaNamespaceAccess
+{
+   Shared,
+   Exclusive,
+};
+
+static std::shared_mutex
+sFileSystemMutex;
+
+static WorkerTaskKey
+getTaskKey(phys_ptr<ResourceRequest> resourceRequest)
+{
+   return static_cast<WorkerTaskKey>(resourceRequest->requestData.handle);
+}
+
+static bool
+isReadOnlyMode(phys_ptr<const char> mode)
+{
+   // Opening a file for writing can create it
+   return !std::strpbrk(mode.get(), "wa+");
+}
+
+template<typename Function>
+static void
+submitFsaTask(phys_ptr<ResourceRequest> resourceRequest,
+              WorkerTaskKey key,
+              FsaNamespaceAccess access,
+              Function function)
+{
+   submitWorkerTask(
+      key,
+      [=]() {
+         auto status = FSAStatus::OK;
+
+         if (access == FsaNamespaceAccess::Exclusive) {
+            std::unique_lock<std::shared_mutex> lock { sFileSystemMutex };
+            status = function();
+         } else {
+            std::shared_lock<std::shared_mutex> lock { sFileSystemMutex };
+            status = function();
+         }
+
+         fsaAsyncTaskComplete(resourceRequest, status);
+      });
+}
+
 static FSAStatus
 fsaDeviceOpen(phys_ptr<RequestOrigin> origin,
               FSADeviceHandle *outHandle,
@@ -127,185 +188,210 @@ fsaDeviceIoctl(phys_ptr<ResourceRequest> resourceRequest,
 
    switch (command) {
    case FSACommand::AppendFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->appendFile(user, phys_addrof(request->appendFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->appendFile(user, phys_addrof(request->appendFile));
+                    });
       break;
    case FSACommand::ChangeDir:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->changeDir(user, phys_addrof(request->changeDir)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->changeDir(user, phys_addrof(request->changeDir));
+                    });
       break;
    case FSACommand::ChangeMode:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->changeMode(user, phys_addrof(request->changeMode)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->changeMode(user, phys_addrof(request->changeMode));
+                    });
       break;
    case FSACommand::CloseDir:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->closeDir(user, phys_addrof(request->closeDir)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->closeDir(user, phys_addrof(request->closeDir));
+                    });
       break;
    case FSACommand::CloseFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->closeFile(user, phys_addrof(request->closeFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->closeFile(user, phys_addrof(request->closeFile));
+                    });
       break;
    case FSACommand::FlushFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->flushFile(user, phys_addrof(request->flushFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->flushFile(user, phys_addrof(request->flushFile));
+                    });
       break;
    case FSACommand::FlushQuota:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->flushQuota(user, phys_addrof(request->flushQuota)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->flushQuota(user, phys_addrof(request->flushQuota));
+                    });
       break;
    case FSACommand::GetCwd:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->getCwd(user, phys_addrof(response->getCwd)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->getCwd(user, phys_addrof(response->getCwd));
+                    });
       break;
    case FSACommand::GetInfoByQuery:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->getInfoByQuery(user,
-                                      phys_addrof(request->getInfoByQuery),
-                                      phys_addrof(response->getInfoByQuery)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->getInfoByQuery(user,
+                                                     phys_addrof(request->getInfoByQuery),
+                                                     phys_addrof(response->getInfoByQuery));
+                    });
       break;
    case FSACommand::GetPosFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->getPosFile(user,
-                                  phys_addrof(request->getPosFile),
-                                  phys_addrof(response->getPosFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->getPosFile(user,
+                                                 phys_addrof(request->getPosFile),
+                                                 phys_addrof(response->getPosFile));
+                    });
       break;
    case FSACommand::IsEof:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->isEof(user, phys_addrof(request->isEof)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->isEof(user, phys_addrof(request->isEof));
+                    });
       break;
    case FSACommand::MakeDir:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->makeDir(user, phys_addrof(request->makeDir)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->makeDir(user, phys_addrof(request->makeDir));
+                    });
       break;
    case FSACommand::MakeQuota:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->makeQuota(user, phys_addrof(request->makeQuota)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->makeQuota(user, phys_addrof(request->makeQuota));
+                    });
       break;
    case FSACommand::OpenDir:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->openDir(user,
-                               phys_addrof(request->openDir),
-                               phys_addrof(response->openDir)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->openDir(user,
+                                              phys_addrof(request->openDir),
+                                              phys_addrof(response->openDir));
+                    });
       break;
    case FSACommand::OpenFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->openFile(user,
-                                phys_addrof(request->openFile),
-                                phys_addrof(response->openFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    isReadOnlyMode(phys_addrof(request->openFile.mode)) ?
+                       FsaNamespaceAccess::Shared : FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->openFile(user,
+                                               phys_addrof(request->openFile),
+                                               phys_addrof(response->openFile));
+                    });
       break;
    case FSACommand::ReadDir:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->readDir(user,
-                               phys_addrof(request->readDir),
-                               phys_addrof(response->readDir)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->readDir(user,
+                                              phys_addrof(request->readDir),
+                                              phys_addrof(response->readDir));
+                    });
       break;
    case FSACommand::Remove:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->remove(user, phys_addrof(request->remove)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->remove(user, phys_addrof(request->remove));
+                    });
       break;
    case FSACommand::Rename:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->rename(user, phys_addrof(request->rename)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->rename(user, phys_addrof(request->rename));
+                    });
       break;
    case FSACommand::RewindDir:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->rewindDir(user, phys_addrof(request->rewindDir)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->rewindDir(user, phys_addrof(request->rewindDir));
+                    });
       break;
    case FSACommand::SetPosFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->setPosFile(user, phys_addrof(request->setPosFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->setPosFile(user, phys_addrof(request->setPosFile));
+                    });
       break;
    case FSACommand::StatFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->statFile(user,
-                                phys_addrof(request->statFile),
-                                phys_addrof(response->statFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->statFile(user,
+                                               phys_addrof(request->statFile),
+                                               phys_addrof(response->statFile));
+                    });
       break;
    case FSACommand::TruncateFile:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->truncateFile(user, phys_addrof(request->truncateFile)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       return device->truncateFile(user, phys_addrof(request->truncateFile));
+                    });
       break;
    case FSACommand::Unmount:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->unmount(user, phys_addrof(request->unmount)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->unmount(user, phys_addrof(request->unmount));
+                    });
       break;
    case FSACommand::UnmountWithProcess:
-      submitWorkerTask([=]() {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->unmountWithProcess(user,
-                                          phys_addrof(request->unmountWithProcess)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->unmountWithProcess(user,
+                                                         phys_addrof(request->unmountWithProcess));
+                    });
       break;
    default:
       IOS_ResourceReply(resourceRequest,
@@ -341,10 +427,31 @@ fsaDeviceIoctlv(phys_ptr<ResourceRequest> resourceRequest,
    case FSACommand::ReadFile:
    {
       submitWorkerTask(
+         getTaskKey(resourceRequest),
          [=]() {
             auto buffer = phys_cast<uint8_t *>(vecs[1].paddr);
             auto length = vecs[1].len;
-
+            std::shared_lock<std::shared_mutex> lock { sFileSystemMutex };
+
+            // Host files can be read asynchronously straight into the buffer,
+            // the client stays busy until the read completes, which is then
+            // finished back on this strand.
+            auto key = deferWorkerTaskCompletion();
+            if (device->submitReadFile(user, phys_addrof(request->readFile),
+                                       buffer, length,
+                                       [=](std::function<void()> finish) {
+                                          resumeDeferredWorkerTask(key, [=]() {
+                                             std::shared_lock<std::shared_mutex> lock { sFileSystemMutex };
+                                             finish();
+                                          });
+                                       },
+                                       [=](FSAStatus status) {
+                                          fsaAsyncTaskComplete(resourceRequest, status);
+                                       })) {
+               return;
+            }
+
+            cancelDeferWorkerTaskCompletion();
             fsaAsyncTaskComplete(
                resourceRequest,
                device->readFile(user, phys_addrof(request->readFile),
@@ -354,39 +461,35 @@ fsaDeviceIoctlv(phys_ptr<ResourceRequest> resourceRequest,
    }
    case FSACommand::WriteFile:
    {
-      submitWorkerTask(
-         [=]()
-         {
-            auto buffer = phys_cast<uint8_t *>(vecs[1].paddr);
-            auto length = vecs[1].len;
-
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->writeFile(user, phys_addrof(request->writeFile),
-                                 buffer, length));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Shared,
+                    [=]() {
+                       auto buffer = phys_cast<uint8_t *>(vecs[1].paddr);
+                       auto length = vecs[1].len;
+                       return device->writeFile(user, phys_addrof(request->writeFile),
+                                                buffer, length);
+                    });
       break;
    }
    case FSACommand::Mount:
    {
-      submitWorkerTask(
-         [=]()
-         {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->mount(user, phys_addrof(request->mount)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->mount(user, phys_addrof(request->mount));
+                    });
       break;
    }
    case FSACommand::MountWithProcess:
    {
-      submitWorkerTask(
-         [=]()
-         {
-            fsaAsyncTaskComplete(
-               resourceRequest,
-               device->mountWithProcess(user, phys_addrof(request->mountWithProcess)));
-         });
+      submitFsaTask(resourceRequest,
+                    getTaskKey(resourceRequest),
+                    FsaNamespaceAccess::Exclusive,
+                    [=]() {
+                       return device->mountWithProcess(user, phys_addrof(request->mountWithProcess));
+                    });
       break;
    }
    default:
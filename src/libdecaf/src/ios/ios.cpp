@@ -1,6 +1,7 @@
 #include "ios.h"
 #include "ios_alarm_thread.h"
 #include "ios_network_thread.h"
+#include "ios_uring_thread.h"
 #include "ios_worker_thread.h"
 #include "ios/kernel/ios_kernel.h"
 #include "vfs/vfs_virtual_device.h"
@@ -18,6 +19,7 @@ start()
    internal::startAlarmThread();
    internal::startNetworkTaskThread();
    internal::startWorkerThread();
+   internal::startUringThread();
    kernel::start();
 }
 
@@ -26,6 +28,7 @@ join()
 {
    kernel::join();
    internal::stopWorkerThread();
+   internal::stopUringThread();
    internal::stopNetworkTaskThread();
    internal::stopAlarmThread();
 }
@@ -35,6 +38,7 @@ stop()
 {
    kernel::stop();
    internal::stopWorkerThread();
+   internal::stopUringThread();
    internal::stopNetworkTaskThread();
    internal::stopAlarmThread();
 }
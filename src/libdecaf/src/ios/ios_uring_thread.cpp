@@ -0,0 +1,365 @@
+#include "ios_uring_thread.h"
+#include "decaf_config.h"
+
+#include <common/log.h>
+#include <common/platform.h>
+
+#ifdef PLATFORM_LINUX
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+/*
+ * On Linux host file reads can be submitted to an io_uring, the kernel then
+ * reads straight into guest memory without going through stdio's buffer.
+ *
+ * Reads are submitted from the IOS worker threads and a single thread here
+ * waits for completions and calls their callbacks.  We talk to the kernel
+ * with the raw system calls rather than liburing as we only need reads.
+ *
+ * If io_uring is disabled in the config, or not supported by the kernel, then
+ * submitUringRead always returns false and callers fall back to stdio.
+ */
+
+namespace ios::internal
+{
+
+#ifdef PLATFORM_LINUX
+
+static constexpr auto
+UringNumEntries = 64u;
+
+//! Submitted to wake the completion thread when stopping.
+static constexpr auto
+UringStopUserData = uint64_t { 0 };
+
+struct UringRead
+{
+   iovec vec;
+   UringReadCallback callback;
+};
+
+struct Uring
+{
+   int fd = -1;
+
+   void *sqRing = nullptr;
+   size_t sqRingSize = 0;
+   std::atomic<uint32_t> *sqHead = nullptr;
+   std::atomic<uint32_t> *sqTail = nullptr;
+   uint32_t *sqMask = nullptr;
+   uint32_t *sqArray = nullptr;
+
+   io_uring_sqe *sqes = nullptr;
+   size_t sqesSize = 0;
+
+   void *cqRing = nullptr;
+   size_t cqRingSize = 0;
+   std::atomic<uint32_t> *cqHead = nullptr;
+   std::atomic<uint32_t> *cqTail = nullptr;
+   uint32_t *cqMask = nullptr;
+   io_uring_cqe *cqes = nullptr;
+
+   //! Number of reads submitted which have not yet completed, this is kept
+   //! below the size of the completion queue so it can never overflow.
+   uint32_t numInFlight = 0;
+   uint32_t maxInFlight = 0;
+};
+
+static Uring
+sUring;
+
+static std::mutex
+sUringMutex;
+
+static std::thread
+sUringThread;
+
+static std::atomic<bool>
+sUringThreadRunning { false };
+
+template<typename Type>
+static Type *
+ringPointer(void *ring, uint32_t offset)
+{
+   return reinterpret_cast<Type *>(reinterpret_cast<uint8_t *>(ring) + offset);
+}
+
+static int
+uringSetup(unsigned entries, io_uring_params *params)
+{
+   return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int
+uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+   return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit,
+                                   minComplete, flags, nullptr, 0));
+}
+
+static void
+destroyUring(Uring &uring)
+{
+   if (uring.sqes) {
+      munmap(uring.sqes, uring.sqesSize);
+   }
+
+   if (uring.cqRing && uring.cqRing != uring.sqRing) {
+      munmap(uring.cqRing, uring.cqRingSize);
+   }
+
+   if (uring.sqRing) {
+      munmap(uring.sqRing, uring.sqRingSize);
+   }
+
+   if (uring.fd >= 0) {
+      close(uring.fd);
+   }
+
+   uring = Uring { };
+}
+
+static bool
+createUring(Uring &uring)
+{
+   auto params = io_uring_params { };
+   uring.fd = uringSetup(UringNumEntries, &params);
+   if (uring.fd < 0) {
+      gLog->warn("io_uring_setup failed with error {}, using stdio for host file reads",
+                 errno);
+      uring.fd = -1;
+      return false;
+   }
+
+   uring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+   uring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+   if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      uring.sqRingSize = std::max(uring.sqRingSize, uring.cqRingSize);
+      uring.cqRingSize = uring.sqRingSize;
+   }
+
+   uring.sqRing = mmap(nullptr, uring.sqRingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+   if (uring.sqRing == MAP_FAILED) {
+      uring.sqRing = nullptr;
+      destroyUring(uring);
+      return false;
+   }
+
+   if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      uring.cqRing = uring.sqRing;
+   } else {
+      uring.cqRing = mmap(nullptr, uring.cqRingSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+      if (uring.cqRing == MAP_FAILED) {
+         uring.cqRing = nullptr;
+         destroyUring(uring);
+         return false;
+      }
+   }
+
+   uring.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+   auto sqes = mmap(nullptr, uring.sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+   if (sqes == MAP_FAILED) {
+      destroyUring(uring);
+      return false;
+   }
+
+   uring.sqes = reinterpret_cast<io_uring_sqe *>(sqes);
+   uring.sqHead = ringPointer<std::atomic<uint32_t>>(uring.sqRing, params.sq_off.head);
+   uring.sqTail = ringPointer<std::atomic<uint32_t>>(uring.sqRing, params.sq_off.tail);
+   uring.sqMask = ringPointer<uint32_t>(uring.sqRing, params.sq_off.ring_mask);
+   uring.sqArray = ringPointer<uint32_t>(uring.sqRing, params.sq_off.array);
+   uring.cqHead = ringPointer<std::atomic<uint32_t>>(uring.cqRing, params.cq_off.head);
+   uring.cqTail = ringPointer<std::atomic<uint32_t>>(uring.cqRing, params.cq_off.tail);
+   uring.cqMask = ringPointer<uint32_t>(uring.cqRing, params.cq_off.ring_mask);
+   uring.cqes = ringPointer<io_uring_cqe>(uring.cqRing, params.cq_off.cqes);
+
+   // Leave one completion entry for the stop request
+   uring.maxInFlight = std::min(params.sq_entries, params.cq_entries - 1);
+   return true;
+}
+
+/**
+ * Queue a submission entry and tell the kernel about it, sUringMutex must be
+ * held by the caller.
+ */
+static bool
+submitEntry(const io_uring_sqe &entry)
+{
+   auto tail = sUring.sqTail->load(std::memory_order_relaxed);
+   auto index = tail & *sUring.sqMask;
+   sUring.sqes[index] = entry;
+   sUring.sqArray[index] = index;
+   sUring.sqTail->store(tail + 1, std::memory_order_release);
+
+   while (true) {
+      auto result = uringEnter(sUring.fd, 1, 0, 0);
+      if (result >= 0) {
+         return true;
+      }
+
+      if (errno != EINTR && errno != EAGAIN) {
+         // Take the entry back so the ring stays consistent
+         sUring.sqTail->store(tail, std::memory_order_release);
+         gLog->error("io_uring_enter failed with error {}", errno);
+         return false;
+      }
+   }
+}
+
+static void
+uringThread()
+{
+   while (true) {
+      auto result = uringEnter(sUring.fd, 0, 1, IORING_ENTER_GETEVENTS);
+      if (result < 0 && errno != EINTR) {
+         gLog->error("io_uring_enter failed waiting for completions, error {}",
+                     errno);
+         return;
+      }
+
+      auto head = sUring.cqHead->load(std::memory_order_relaxed);
+      auto tail = sUring.cqTail->load(std::memory_order_acquire);
+      auto stop = false;
+
+      for (; head != tail; ++head) {
+         auto &entry = sUring.cqes[head & *sUring.cqMask];
+         if (entry.user_data == UringStopUserData) {
+            stop = true;
+            continue;
+         }
+
+         auto read = std::unique_ptr<UringRead> {
+            reinterpret_cast<UringRead *>(static_cast<uintptr_t>(entry.user_data))
+         };
+
+         read->callback(entry.res);
+
+         std::unique_lock<std::mutex> lock { sUringMutex };
+         sUring.numInFlight--;
+      }
+
+      sUring.cqHead->store(head, std::memory_order_release);
+
+      if (stop) {
+         return;
+      }
+   }
+}
+
+void
+startUringThread()
+{
+   if (sUringThreadRunning || !decaf::config()->system.io_uring) {
+      return;
+   }
+
+   if (!createUring(sUring)) {
+      return;
+   }
+
+   sUringThreadRunning = true;
+   sUringThread = std::thread { uringThread };
+}
+
+void
+stopUringThread()
+{
+   if (!sUringThreadRunning) {
+      return;
+   }
+
+   {
+      std::unique_lock<std::mutex> lock { sUringMutex };
+      sUringThreadRunning = false;
+
+      auto entry = io_uring_sqe { };
+      entry.opcode = IORING_OP_NOP;
+      entry.user_data = UringStopUserData;
+      submitEntry(entry);
+   }
+
+   sUringThread.join();
+   destroyUring(sUring);
+}
+
+/**
+ * Submit a read of length bytes at offset in descriptor, returns false if the
+ * read could not be submitted and so should be done some other way.
+ *
+ * The callback is called from the io_uring thread, possibly before this
+ * function returns.
+ */
+bool
+submitUringRead(int descriptor,
+                void *buffer,
+                uint32_t length,
+                int64_t offset,
+                UringReadCallback callback)
+{
+   std::unique_lock<std::mutex> lock { sUringMutex };
+   if (!sUringThreadRunning || sUring.numInFlight >= sUring.maxInFlight) {
+      return false;
+   }
+
+   auto read = std::make_unique<UringRead>();
+   read->vec.iov_base = buffer;
+   read->vec.iov_len = length;
+   read->callback = std::move(callback);
+
+   // READV rather than READ as it is supported by older kernels
+   auto entry = io_uring_sqe { };
+   entry.opcode = IORING_OP_READV;
+   entry.fd = descriptor;
+   entry.addr = reinterpret_cast<uintptr_t>(&read->vec);
+   entry.len = 1;
+   entry.off = static_cast<uint64_t>(offset);
+   entry.user_data = reinterpret_cast<uintptr_t>(read.get());
+
+   if (!submitEntry(entry)) {
+      return false;
+   }
+
+   sUring.numInFlight++;
+   read.release();
+   return true;
+}
+
+#else
+
+void
+startUringThread()
+{
+}
+
+void
+stopUringThread()
+{
+}
+
+bool
+submitUringRead(int descriptor,
+                void *buffer,
+                uint32_t length,
+                int64_t offset,
+                UringReadCallback callback)
+{
+   return false;
+}
+
+#endif // ifdef PLATFORM_LINUX
+
+} // namespace ios::internal
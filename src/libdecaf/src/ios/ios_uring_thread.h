@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+namespace ios::internal
+{
+
+//! Called with the number of bytes read, or a negative errno on failure.
+using UringReadCallback = std::function<void(int32_t result)>;
+
+void
+startUringThread();
+
+void
+stopUringThread();
+
+bool
+submitUringRead(int descriptor,
+                void *buffer,
+                uint32_t length,
+                int64_t offset,
+                UringReadCallback callback);
+
+} // namespace ios::internal
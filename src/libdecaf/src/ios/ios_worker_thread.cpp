@@ -1,19 +1,53 @@
 #include "ios_worker_thread.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Host I/O tasks run on a small pool of threads so that one slow operation,
+ * such as scanning a large directory, does not hold up every other request.
+ *
+ * Each task has a key and tasks sharing a key form a strand: a strand runs at
+ * most one task at a time, in the order they were submitted.  A strand is in
+ * the ready queue only when it has tasks waiting and none running, after a
+ * task completes the strand goes to the back of the ready queue so a busy
+ * strand cannot starve the others.
+ *
+ * A task which starts an asynchronous operation can defer its completion, its
+ * strand then stays busy after the task returns until the operation calls
+ * completeDeferredWorkerTask, or resumeDeferredWorkerTask to finish its work
+ * back on the strand.
+ */
 
 namespace ios::internal
 {
 
-using WorkerTask = std::function<void()>;
+using Clock = std::chrono::steady_clock;
+
+static constexpr auto MaxWorkerThreads = 4u;
 
-static std::thread
-sWorkerThread;
+struct QueuedTask
+{
+   WorkerTask task;
+   Clock::time_point submitTime;
+};
+
+struct WorkerStrand
+{
+   std::deque<QueuedTask> tasks;
+   bool running = false;
+};
+
+static std::vector<std::thread>
+sWorkerThreads;
 
 static std::atomic<bool>
 sWorkerThreadRunning { false };
@@ -24,27 +58,89 @@ sWorkerThreadConditionVariable;
 static std::mutex
 sWorkerThreadMutex;
 
-static std::queue<WorkerTask>
-sWorkerThreadTasks;
+static std::unordered_map<WorkerTaskKey, WorkerStrand>
+sWorkerStrands;
+
+static std::deque<WorkerTaskKey>
+sReadyStrands;
+
+static WorkerStatistics
+sWorkerStatistics;
+
+static thread_local WorkerTaskKey
+sCurrentTaskKey = 0;
+
+static thread_local bool
+sCurrentTaskDeferred = false;
+
+static unsigned
+getLatencyBucket(Clock::duration duration)
+{
+   auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+   auto bucket = 0u;
+
+   while (bucket < WorkerLatencyBuckets - 1 && us >= (1ll << bucket)) {
+      ++bucket;
+   }
+
+   return bucket;
+}
+
+/**
+ * Mark the running task of a strand as finished, sWorkerThreadMutex must be
+ * held by the caller.
+ */
+static void
+releaseStrand(WorkerTaskKey key)
+{
+   auto itr = sWorkerStrands.find(key);
+   auto &strand = itr->second;
+   strand.running = false;
+
+   if (strand.tasks.empty()) {
+      sWorkerStrands.erase(itr);
+   } else {
+      sReadyStrands.push_back(key);
+      sWorkerThreadConditionVariable.notify_one();
+   }
+}
 
 static void
 iosWorkerThread()
 {
-   while (sWorkerThreadRunning) {
-      auto lock = std::unique_lock { sWorkerThreadMutex };
+   auto lock = std::unique_lock { sWorkerThreadMutex };
 
-      if (sWorkerThreadTasks.empty()) {
+   while (sWorkerThreadRunning) {
+      if (sReadyStrands.empty()) {
          sWorkerThreadConditionVariable.wait(lock);
-         if (!sWorkerThreadRunning) {
-            break;
-         }
+         continue;
       }
 
-      auto task = std::move(sWorkerThreadTasks.front());
-      sWorkerThreadTasks.pop();
+      auto key = sReadyStrands.front();
+      sReadyStrands.pop_front();
+
+      auto &strand = sWorkerStrands[key];
+      auto task = std::move(strand.tasks.front());
+      strand.tasks.pop_front();
+      strand.running = true;
+
+      auto startTime = Clock::now();
+      sWorkerStatistics.queueDepth--;
+      sWorkerStatistics.waitLatency[getLatencyBucket(startTime - task.submitTime)]++;
       lock.unlock();
 
-      task();
+      sCurrentTaskKey = key;
+      sCurrentTaskDeferred = false;
+      task.task();
+
+      auto endTime = Clock::now();
+      lock.lock();
+      sWorkerStatistics.numCompletedTasks++;
+      sWorkerStatistics.runLatency[getLatencyBucket(endTime - startTime)]++;
+
+      if (!sCurrentTaskDeferred) {
+         releaseStrand(key);
+      }
    }
 }
 
@@ -52,8 +148,16 @@ void
 startWorkerThread()
 {
    if (!sWorkerThreadRunning) {
+      auto numThreads =
+         std::clamp(std::thread::hardware_concurrency(), 2u, MaxWorkerThreads);
+
       sWorkerThreadRunning = true;
-      sWorkerThread = std::thread { iosWorkerThread };
+      sWorkerStatistics = { };
+      sWorkerStatistics.numThreads = numThreads;
+
+      for (auto i = 0u; i < numThreads; ++i) {
+         sWorkerThreads.emplace_back(iosWorkerThread);
+      }
    }
 }
 
@@ -61,19 +165,102 @@ void
 stopWorkerThread()
 {
    if (sWorkerThreadRunning) {
-      sWorkerThreadRunning = false;
-      sWorkerThreadConditionVariable.notify_all();
-      sWorkerThread.join();
-      sWorkerThreadTasks = {};
+      {
+         auto lock = std::unique_lock { sWorkerThreadMutex };
+         sWorkerThreadRunning = false;
+         sWorkerThreadConditionVariable.notify_all();
+      }
+
+      for (auto &thread : sWorkerThreads) {
+         thread.join();
+      }
+
+      sWorkerThreads.clear();
+      sWorkerStrands.clear();
+      sReadyStrands.clear();
+   }
+}
+
+void
+submitWorkerTask(WorkerTaskKey key,
+                 WorkerTask task)
+{
+   auto lock = std::unique_lock { sWorkerThreadMutex };
+   auto &strand = sWorkerStrands[key];
+   strand.tasks.push_back({ std::move(task), Clock::now() });
+
+   sWorkerStatistics.queueDepth++;
+   sWorkerStatistics.maxQueueDepth =
+      std::max(sWorkerStatistics.maxQueueDepth, sWorkerStatistics.queueDepth);
+
+   if (!strand.running && strand.tasks.size() == 1) {
+      sReadyStrands.push_back(key);
+      sWorkerThreadConditionVariable.notify_one();
+   }
+}
+
+/**
+ * Called from inside a worker task before starting an asynchronous operation,
+ * the task's strand will not run anything else until
+ * completeDeferredWorkerTask is called with the returned key.
+ */
+WorkerTaskKey
+deferWorkerTaskCompletion()
+{
+   sCurrentTaskDeferred = true;
+   return sCurrentTaskKey;
+}
+
+/**
+ * Undo deferWorkerTaskCompletion when the asynchronous operation could not be
+ * started, the task then completes as normal when it returns.
+ */
+void
+cancelDeferWorkerTaskCompletion()
+{
+   sCurrentTaskDeferred = false;
+}
+
+void
+completeDeferredWorkerTask(WorkerTaskKey key)
+{
+   auto lock = std::unique_lock { sWorkerThreadMutex };
+   if (sWorkerThreadRunning) {
+      releaseStrand(key);
    }
 }
 
+/**
+ * Continue a deferred task by running task on its strand ahead of any tasks
+ * waiting there, the strand is then released when task returns unless it
+ * defers its completion again.
+ */
 void
-submitWorkerTask(WorkerTask task)
+resumeDeferredWorkerTask(WorkerTaskKey key,
+                         WorkerTask task)
+{
+   auto lock = std::unique_lock { sWorkerThreadMutex };
+   if (!sWorkerThreadRunning) {
+      return;
+   }
+
+   auto &strand = sWorkerStrands[key];
+   strand.tasks.push_front({ std::move(task), Clock::now() });
+   strand.running = false;
+
+   sWorkerStatistics.queueDepth++;
+   sWorkerStatistics.maxQueueDepth =
+      std::max(sWorkerStatistics.maxQueueDepth, sWorkerStatistics.queueDepth);
+
+   sReadyStrands.push_front(key);
+   sWorkerThreadConditionVariable.notify_one();
+}
+
+WorkerStatistics
+getWorkerStatistics()
 {
    auto lock = std::unique_lock { sWorkerThreadMutex };
-   sWorkerThreadTasks.push(std::move(task));
-   sWorkerThreadConditionVariable.notify_all();
+   return sWorkerStatistics;
 }
 
 } // namespace ios::internal
@@ -1,3 +1,6 @@
+#pragma once
+#include <array>
+#include <cstdint>
 #include <functional>
 
 namespace ios::internal
@@ -5,6 +8,35 @@ namespace ios::internal
 
 using WorkerTask = std::function<void()>;
 
+//! Tasks submitted with the same key run one at a time in submission order,
+//! tasks with different keys may run in parallel.
+using WorkerTaskKey = uint64_t;
+
+//! Bucket i of a latency histogram counts tasks which took less than 2^i
+//! microseconds, the last bucket counts everything longer.
+static constexpr auto WorkerLatencyBuckets = 24u;
+
+struct WorkerStatistics
+{
+   //! Number of threads running tasks.
+   unsigned numThreads = 0;
+
+   //! Number of tasks waiting to run.
+   unsigned queueDepth = 0;
+
+   //! Largest number of tasks that have been waiting to run at once.
+   unsigned maxQueueDepth = 0;
+
+   //! Number of tasks which have completed.
+   uint64_t numCompletedTasks = 0;
+
+   //! Time from a task being submitted until it starts running.
+   std::array<uint64_t, WorkerLatencyBuckets> waitLatency = { };
+
+   //! Time a task spent running.
+   std::array<uint64_t, WorkerLatencyBuckets> runLatency = { };
+};
+
 void
 startWorkerThread();
 
@@ -12,6 +44,23 @@ void
 stopWorkerThread();
 
 void
-submitWorkerTask(WorkerTask task);
+submitWorkerTask(WorkerTaskKey key,
+                 WorkerTask task);
+
+WorkerTaskKey
+deferWorkerTaskCompletion();
+
+void
+cancelDeferWorkerTaskCompletion();
+
+void
+completeDeferredWorkerTask(WorkerTaskKey key);
+
+void
+resumeDeferredWorkerTask(WorkerTaskKey key,
+                         WorkerTask task);
+
+WorkerStatistics
+getWorkerStatistics();
 
 } // namespace ios::internal
@@ -21,6 +21,7 @@ public:
       Virtual,
       Overlay,
       Link,
+      Pack,
    };
 
    Device(Type type) :
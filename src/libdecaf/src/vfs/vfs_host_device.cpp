@@ -2,6 +2,7 @@
 #include "vfs_host_directoryiterator.h"
 #include "vfs_host_filehandle.h"
 #include "vfs_link_device.h"
+#include "vfs_pathcache.h"
 #include "vfs_virtual_device.h"
 
 #include <algorithm>
@@ -30,6 +31,8 @@ Error
 HostDevice::makeFolder(const User &user,
                        const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    if (mVirtualDevice) {
       mVirtualDevice->makeFolder(user, path);
    }
@@ -50,6 +53,8 @@ Error
 HostDevice::makeFolders(const User &user,
                         const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    if (mVirtualDevice) {
       mVirtualDevice->makeFolders(user, path);
    }
@@ -212,6 +217,11 @@ HostDevice::openFile(const User &user,
    auto handle = fopen(makeHostPath(path).string().c_str(), hostMode.c_str());
 #endif
    if (handle) {
+      if (mode & (FileHandle::Write | FileHandle::Append)) {
+         // Opening for write may have created the file
+         invalidatePathCaches();
+      }
+
       return { std::make_unique<HostFileHandle>(handle, mode) };
    }
 
@@ -230,6 +240,8 @@ Error
 HostDevice::remove(const User &user,
                    const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    if (!checkWritePermission(user, path)) {
       return Error::Permission;
    }
@@ -254,6 +266,8 @@ HostDevice::rename(const User &user,
                    const Path &src,
                    const Path &dst)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    if (!checkReadPermission(user, src)) {
       return Error::Permission;
    }
@@ -41,7 +41,7 @@ HostFileHandle::eof()
       return { Error::NotOpen };
    }
 
-   return { !!feof(mHandle) };
+   return { mDescriptorEof || !!feof(mHandle) };
 }
 
 Error
@@ -62,6 +62,8 @@ HostFileHandle::seek(SeekDirection direction, int64_t offset)
       return Error::NotOpen;
    }
 
+   mDescriptorEof = false;
+
    int seekDirection = SEEK_SET;
    switch (direction) {
    case SeekCurrent:
@@ -182,6 +184,7 @@ HostFileHandle::truncate()
 Result<int64_t>
 HostFileHandle::read(void *buffer, int64_t size, int64_t count)
 {
+   mDescriptorEof = false;
    return { static_cast<int64_t>(fread(buffer, size, count, mHandle)) };
 }
 
@@ -193,7 +196,41 @@ HostFileHandle::write(const void *buffer, int64_t size, int64_t count)
    }
 
    // TODO: Check open mode for read only
+   mDescriptorEof = false;
    return { static_cast<int64_t>(fwrite(buffer, size, count, mHandle)) };
 }
 
+/**
+ * Get the host file descriptor so the file can be read with positioned reads
+ * which bypass stdio, returns -1 if that is not possible.
+ *
+ * Only files opened read only are supported, otherwise stdio could have
+ * buffered writes which have not reached the descriptor yet.
+ */
+int
+HostFileHandle::descriptor()
+{
+   if (!mHandle || (mMode & (Write | Append | Update))) {
+      return -1;
+   }
+
+#ifdef PLATFORM_POSIX
+   return fileno(mHandle);
+#else
+   return -1;
+#endif
+}
+
+/**
+ * Move the file position to after a read done through descriptor(), eof
+ * should be true if the read ended early because it reached the end of the
+ * file.
+ */
+void
+HostFileHandle::completeDescriptorRead(int64_t position, bool eof)
+{
+   seek(SeekStart, position);
+   mDescriptorEof = eof;
+}
+
 } // namespace vfs
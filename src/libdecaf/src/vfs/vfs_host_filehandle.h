@@ -22,9 +22,16 @@ public:
    Result<int64_t> read(void *buffer, int64_t size, int64_t count) override;
    Result<int64_t> write(const void *buffer, int64_t size, int64_t count) override;
 
+   int descriptor();
+   void completeDescriptorRead(int64_t position, bool eof);
+
 private:
    FILE *mHandle;
    Mode mMode;
+
+   //! Set when a read through descriptor() reached the end of the file, as
+   //! that does not set the stdio end of file flag.
+   bool mDescriptorEof = false;
 };
 
 } // namespace vfs
@@ -1,16 +1,71 @@
 #include "vfs_overlay_device.h"
 #include "vfs_overlay_directoryiterator.h"
+#include "vfs_pathcache.h"
 
 #include <algorithm>
 
 namespace vfs
 {
 
+//! Maximum number of paths cached by each overlay device before the cache is
+//! cleared.
+static constexpr size_t MaxCachedPaths = 8192;
+
 OverlayDevice::OverlayDevice() :
    Device(Device::Overlay)
 {
 }
 
+/**
+ * Find path in the cache, the returned generation must be passed to
+ * updateCachedPath when caching the result of a lookup.
+ */
+bool
+OverlayDevice::findCachedPath(const User &user,
+                              const Path &path,
+                              CachedPath &cachedPath,
+                              uint64_t &generation)
+{
+   std::lock_guard<std::mutex> lock { mCacheMutex };
+   generation = getPathCacheGeneration();
+   if (generation != mCacheGeneration) {
+      mCache.clear();
+      mCacheGeneration = generation;
+   }
+
+   auto itr = mCache.find(path.path());
+   if (itr == mCache.end() ||
+       itr->second.user.id != user.id ||
+       itr->second.user.group != user.group) {
+      recordPathCacheLookup(false);
+      return false;
+   }
+
+   recordPathCacheLookup(true);
+   cachedPath = itr->second;
+   return true;
+}
+
+void
+OverlayDevice::updateCachedPath(const Path &path,
+                                uint64_t generation,
+                                CachedPath cachedPath)
+{
+   std::lock_guard<std::mutex> lock { mCacheMutex };
+
+   // Do not cache a result which may be from before the tree changed
+   if (generation != getPathCacheGeneration() ||
+       generation != mCacheGeneration) {
+      return;
+   }
+
+   if (mCache.size() >= MaxCachedPaths) {
+      mCache.clear();
+   }
+
+   mCache[path.path()] = std::move(cachedPath);
+}
+
 Result<std::shared_ptr<Device>>
 OverlayDevice::getLinkDevice(const User &user,
                              const Path &path)
@@ -79,6 +134,8 @@ OverlayDevice::mountOverlayDevice(const User &user,
                                   const Path &path,
                                   std::shared_ptr<Device> device)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    if (path.depth() == 0) {
       for (auto itr = mDevices.begin(); itr != mDevices.end(); ++itr) {
          if (itr->first == priority) {
@@ -133,6 +190,8 @@ OverlayDevice::unmountOverlayDevice(const User &user,
                                     OverlayPriority priority,
                                     const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    if (path.depth() == 0) {
       for (auto itr = mDevices.begin(); itr != mDevices.end(); ++itr) {
          if (itr->first == priority) {
@@ -172,6 +231,20 @@ OverlayDevice::openFile(const User &user,
                         const Path &path,
                         FileHandle::Mode mode)
 {
+   // Only status() fills the cache, as a device can fail to open a path which
+   // it does have, e.g. HostDevice reports any fopen error as NotFound.  Opening
+   // for write may create the file, so the cache is only used for reads.
+   auto cachedPath = CachedPath { };
+   auto generation = uint64_t { 0 };
+   if (!(mode & (FileHandle::Write | FileHandle::Append)) &&
+       findCachedPath(user, path, cachedPath, generation)) {
+      if (!cachedPath.device) {
+         return { Error::NotFound };
+      }
+
+      return cachedPath.device->openFile(user, path, mode);
+   }
+
    for (auto &[priority, device] : mDevices) {
       auto result = device->openFile(user, path, mode);
       if (result.error() != Error::NotFound) {
@@ -260,13 +333,28 @@ Result<Status>
 OverlayDevice::status(const User &user,
                       const Path &path)
 {
+   auto cachedPath = CachedPath { };
+   auto generation = uint64_t { 0 };
+   if (findCachedPath(user, path, cachedPath, generation)) {
+      if (!cachedPath.device) {
+         return { Error::NotFound };
+      }
+
+      // Only the device is cached, the status may change with every write.
+      return cachedPath.device->status(user, path);
+   }
+
+   cachedPath.user = user;
    for (auto &[priority, device] : mDevices) {
       auto result = device->status(user, path);
       if (result.error() != Error::NotFound) {
+         cachedPath.device = device;
+         updateCachedPath(path, generation, std::move(cachedPath));
          return result;
       }
    }
 
+   updateCachedPath(path, generation, std::move(cachedPath));
    return { Error::NotFound };
 }
 
@@ -3,7 +3,11 @@
 #include "vfs_permissions.h"
 #include "vfs_result.h"
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 
@@ -91,8 +95,34 @@ public:
       return mDevices.end();
    }
 
+private:
+   struct CachedPath
+   {
+      //! The user the path was looked up as, as devices check permissions.
+      User user;
+
+      //! The device which the path was found on, nullptr if it was not found
+      //! on any device.
+      std::shared_ptr<Device> device;
+   };
+
+   bool
+   findCachedPath(const User &user, const Path &path,
+                  CachedPath &cachedPath, uint64_t &generation);
+
+   void
+   updateCachedPath(const Path &path, uint64_t generation,
+                    CachedPath cachedPath);
+
 private:
    device_list mDevices;
+
+   //! Cache of which device each path resolves to, so repeated lookups do not
+   //! have to try every device in turn.  Cleared whenever the path cache
+   //! generation changes, see vfs_pathcache.h.
+   std::mutex mCacheMutex;
+   uint64_t mCacheGeneration = 0;
+   std::unordered_map<std::string, CachedPath> mCache;
 };
 
 } // namespace vfs
@@ -0,0 +1,211 @@
+#include "vfs_pack_builder.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace vfs
+{
+
+struct PackBuildEntry
+{
+   std::string path;
+   std::filesystem::path hostPath;
+   bool directory;
+};
+
+static Error
+writeFileData(std::ofstream &out,
+              const PackBuildEntry &buildEntry,
+              const PackBuildOptions &options,
+              PackEntry &entry)
+{
+   auto error = std::error_code { };
+   auto size = std::filesystem::file_size(buildEntry.hostPath, error);
+   if (error) {
+      return Error::GenericError;
+   }
+
+   auto in = std::ifstream { buildEntry.hostPath, std::ifstream::binary };
+   if (!in.is_open()) {
+      return Error::NotFound;
+   }
+
+   entry.size = size;
+   entry.dataOffset = static_cast<uint64_t>(out.tellp());
+
+   auto buffer = std::vector<uint8_t>(options.chunkSize);
+   if (!options.compress) {
+      for (auto remaining = size; remaining > 0; ) {
+         auto length = std::min<uint64_t>(remaining, options.chunkSize);
+         if (!in.read(reinterpret_cast<char *>(buffer.data()), length)) {
+            return Error::GenericError;
+         }
+
+         out.write(reinterpret_cast<const char *>(buffer.data()), length);
+         remaining -= length;
+      }
+
+      return Error::Success;
+   }
+
+   auto compressed = std::vector<uint8_t>(compressBound(options.chunkSize));
+   auto chunks = std::vector<PackChunk> { };
+   auto anyCompressed = false;
+
+   for (auto remaining = size; remaining > 0; ) {
+      auto length = std::min<uint64_t>(remaining, options.chunkSize);
+      if (!in.read(reinterpret_cast<char *>(buffer.data()), length)) {
+         return Error::GenericError;
+      }
+
+      auto chunk = PackChunk { };
+      auto compressedLength = static_cast<uLongf>(compressed.size());
+      chunk.offset = static_cast<uint64_t>(out.tellp());
+
+      if (compress2(compressed.data(), &compressedLength, buffer.data(),
+                    static_cast<uLong>(length), Z_BEST_COMPRESSION) == Z_OK &&
+          compressedLength < length) {
+         chunk.size = static_cast<uint32_t>(compressedLength);
+         chunk.compressed = 1;
+         anyCompressed = true;
+         out.write(reinterpret_cast<const char *>(compressed.data()),
+                   compressedLength);
+      } else {
+         chunk.size = static_cast<uint32_t>(length);
+         chunk.compressed = 0;
+         out.write(reinterpret_cast<const char *>(buffer.data()), length);
+      }
+
+      chunks.push_back(chunk);
+      remaining -= length;
+   }
+
+   if (!anyCompressed) {
+      // Every chunk was stored as is, back to back, so the file can be read
+      // directly from the mapping without a chunk table.
+      return Error::Success;
+   }
+
+   // Align the chunk table so it can be read in place from the mapping
+   auto padding = static_cast<uint64_t>(out.tellp()) % alignof(PackChunk);
+   if (padding) {
+      out.write("\0\0\0\0\0\0\0", alignof(PackChunk) - padding);
+   }
+
+   entry.flags |= PackEntryCompressed;
+   entry.numChunks = static_cast<uint32_t>(chunks.size());
+   entry.dataOffset = static_cast<uint64_t>(out.tellp());
+   out.write(reinterpret_cast<const char *>(chunks.data()),
+             chunks.size() * sizeof(PackChunk));
+   return Error::Success;
+}
+
+/**
+ * Build a pack file from the directory tree at source.
+ */
+Result<PackBuildResult>
+buildPackFile(const std::filesystem::path &source,
+              const std::filesystem::path &pack,
+              const PackBuildOptions &options)
+{
+   auto error = std::error_code { };
+   auto result = PackBuildResult { };
+   auto buildEntries = std::vector<PackBuildEntry> { };
+
+   if (!options.chunkSize) {
+      return { Error::GenericError };
+   }
+
+   if (!std::filesystem::is_directory(source, error)) {
+      return { Error::NotDirectory };
+   }
+
+   for (auto itr = std::filesystem::recursive_directory_iterator { source, error };
+        itr != std::filesystem::recursive_directory_iterator { };
+        itr.increment(error)) {
+      if (error) {
+         return { Error::GenericError };
+      }
+
+      auto buildEntry = PackBuildEntry { };
+      buildEntry.path = itr->path().lexically_relative(source).generic_string();
+      buildEntry.hostPath = itr->path();
+      buildEntry.directory = itr->is_directory(error);
+
+      if (!buildEntry.directory && !itr->is_regular_file(error)) {
+         continue;
+      }
+
+      buildEntries.push_back(std::move(buildEntry));
+   }
+
+   if (error) {
+      return { Error::GenericError };
+   }
+
+   std::sort(buildEntries.begin(), buildEntries.end(),
+             [](const auto &lhs, const auto &rhs) {
+                return lhs.path < rhs.path;
+             });
+
+   auto header = PackHeader { };
+   auto entries = std::vector<PackEntry>(buildEntries.size());
+   auto strings = std::string { };
+
+   for (auto i = 0u; i < buildEntries.size(); ++i) {
+      entries[i].pathOffset = static_cast<uint32_t>(strings.size());
+      entries[i].pathLength = static_cast<uint32_t>(buildEntries[i].path.size());
+      strings += buildEntries[i].path;
+   }
+
+   header.magic = PackMagic;
+   header.version = PackVersion;
+   header.numEntries = static_cast<uint32_t>(entries.size());
+   header.chunkSize = options.chunkSize;
+   header.entriesOffset = sizeof(PackHeader);
+   header.stringsOffset = header.entriesOffset + entries.size() * sizeof(PackEntry);
+   header.stringsSize = strings.size();
+
+   auto out = std::ofstream { pack, std::ofstream::binary | std::ofstream::trunc };
+   if (!out.is_open()) {
+      return { Error::GenericError };
+   }
+
+   // File data goes after the header, entries and strings which we write at
+   // the end once every entry's data offset is known.
+   out.seekp(header.stringsOffset + header.stringsSize);
+
+   for (auto i = 0u; i < buildEntries.size(); ++i) {
+      if (buildEntries[i].directory) {
+         entries[i].flags = PackEntryDirectory;
+         ++result.numDirectories;
+         continue;
+      }
+
+      auto writeError = writeFileData(out, buildEntries[i], options, entries[i]);
+      if (writeError != Error::Success) {
+         return { writeError };
+      }
+
+      ++result.numFiles;
+      result.dataSize += entries[i].size;
+   }
+
+   result.packSize = static_cast<uint64_t>(out.tellp());
+   out.seekp(0);
+   out.write(reinterpret_cast<const char *>(&header), sizeof(PackHeader));
+   out.write(reinterpret_cast<const char *>(entries.data()),
+             entries.size() * sizeof(PackEntry));
+   out.write(strings.data(), strings.size());
+
+   if (!out.good()) {
+      return { Error::GenericError };
+   }
+
+   return { result };
+}
+
+} // namespace vfs
@@ -0,0 +1,34 @@
+#pragma once
+#include "vfs_pack_format.h"
+#include "vfs_result.h"
+
+#include <cstdint>
+#include <filesystem>
+
+namespace vfs
+{
+
+struct PackBuildOptions
+{
+   //! Compress file data with zlib, otherwise data is stored as is and can be
+   //! read directly from the mapping.
+   bool compress = true;
+
+   //! Size of each independently compressed chunk.
+   uint32_t chunkSize = PackDefaultChunkSize;
+};
+
+struct PackBuildResult
+{
+   uint32_t numFiles = 0;
+   uint32_t numDirectories = 0;
+   uint64_t dataSize = 0;
+   uint64_t packSize = 0;
+};
+
+Result<PackBuildResult>
+buildPackFile(const std::filesystem::path &source,
+              const std::filesystem::path &pack,
+              const PackBuildOptions &options = { });
+
+} // namespace vfs
@@ -0,0 +1,365 @@
+#include "vfs_link_device.h"
+#include "vfs_pack_device.h"
+#include "vfs_pack_directoryiterator.h"
+#include "vfs_pack_filehandle.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace vfs
+{
+
+PackDevice::PackDevice() :
+   Device(Device::Pack)
+{
+}
+
+PackDevice::~PackDevice()
+{
+   if (mData) {
+      platform::unmapViewOfFile(const_cast<uint8_t *>(mData), mSize);
+   }
+
+   if (mMapFile != platform::InvalidMapFileHandle) {
+      platform::closeMemoryMappedFile(mMapFile);
+   }
+}
+
+/**
+ * Open a pack file, returns nullptr if it could not be opened or is not a
+ * valid pack file.
+ */
+std::shared_ptr<PackDevice>
+PackDevice::open(const std::filesystem::path &path)
+{
+   auto device = std::make_shared<PackDevice>();
+   if (!device->load(path)) {
+      return nullptr;
+   }
+
+   return device;
+}
+
+/**
+ * Returns true if [offset, offset + size) lies inside a region of limit bytes,
+ * checked without overflowing for corrupt offsets.
+ */
+static bool
+isRangeInside(uint64_t offset,
+              uint64_t size,
+              uint64_t limit)
+{
+   return offset <= limit && size <= limit - offset;
+}
+
+bool
+PackDevice::load(const std::filesystem::path &path)
+{
+   mMapFile = platform::openMemoryMappedFile(path.string(),
+                                             platform::ProtectFlags::ReadOnly,
+                                             &mSize);
+   if (mMapFile == platform::InvalidMapFileHandle ||
+       mSize < sizeof(PackHeader)) {
+      return false;
+   }
+
+   mData = static_cast<const uint8_t *>(
+      platform::mapViewOfFile(mMapFile, platform::ProtectFlags::ReadOnly,
+                              0, mSize));
+   if (!mData) {
+      return false;
+   }
+
+   mHeader = reinterpret_cast<const PackHeader *>(mData);
+   if (mHeader->magic != PackMagic || mHeader->version != PackVersion ||
+       mHeader->chunkSize == 0) {
+      return false;
+   }
+
+   auto entriesSize = static_cast<uint64_t>(mHeader->numEntries) * sizeof(PackEntry);
+   if (mHeader->entriesOffset % alignof(PackEntry) != 0 ||
+       !isRangeInside(mHeader->entriesOffset, entriesSize, mSize) ||
+       !isRangeInside(mHeader->stringsOffset, mHeader->stringsSize, mSize)) {
+      return false;
+   }
+
+   mEntries = reinterpret_cast<const PackEntry *>(mData + mHeader->entriesOffset);
+   mStrings = reinterpret_cast<const char *>(mData + mHeader->stringsOffset);
+
+   // Validate the entries once here so we never read outside of the mapping
+   for (auto i = 0u; i < mHeader->numEntries; ++i) {
+      auto &entry = mEntries[i];
+      if (!isRangeInside(entry.pathOffset, entry.pathLength, mHeader->stringsSize)) {
+         return false;
+      }
+
+      if (entry.flags & PackEntryDirectory) {
+         continue;
+      }
+
+      if (entry.flags & PackEntryCompressed) {
+         auto chunksSize = static_cast<uint64_t>(entry.numChunks) * sizeof(PackChunk);
+         auto expectedChunks = entry.size / mHeader->chunkSize +
+            (entry.size % mHeader->chunkSize != 0 ? 1 : 0);
+         if (entry.numChunks != expectedChunks ||
+             entry.dataOffset % alignof(PackChunk) != 0 ||
+             !isRangeInside(entry.dataOffset, chunksSize, mSize)) {
+            return false;
+         }
+
+         auto chunks = reinterpret_cast<const PackChunk *>(mData + entry.dataOffset);
+         for (auto j = 0u; j < entry.numChunks; ++j) {
+            if (!isRangeInside(chunks[j].offset, chunks[j].size, mSize)) {
+               return false;
+            }
+         }
+      } else if (!isRangeInside(entry.dataOffset, entry.size, mSize)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+std::string_view
+PackDevice::entryPath(const PackEntry &entry) const
+{
+   return { mStrings + entry.pathOffset, entry.pathLength };
+}
+
+std::string_view
+PackDevice::entryName(const PackEntry &entry) const
+{
+   auto path = entryPath(entry);
+   auto separator = path.find_last_of('/');
+   if (separator == std::string_view::npos) {
+      return path;
+   }
+
+   return path.substr(separator + 1);
+}
+
+static std::string_view
+trimPath(std::string_view path)
+{
+   while (!path.empty() && path.front() == '/') {
+      path.remove_prefix(1);
+   }
+
+   while (!path.empty() && path.back() == '/') {
+      path.remove_suffix(1);
+   }
+
+   return path;
+}
+
+const PackEntry *
+PackDevice::findEntry(std::string_view path) const
+{
+   auto first = mEntries;
+   auto last = mEntries + mHeader->numEntries;
+   auto itr = std::lower_bound(first, last, path,
+      [this](const PackEntry &entry, std::string_view value) {
+         return entryPath(entry) < value;
+      });
+
+   if (itr == last || entryPath(*itr) != path) {
+      return nullptr;
+   }
+
+   return itr;
+}
+
+Status
+PackDevice::makeStatus(const PackEntry &entry) const
+{
+   auto status = Status { };
+   status.name = entryName(entry);
+
+   if (entry.flags & PackEntryDirectory) {
+      status.flags = Status::IsDirectory;
+   } else {
+      status.size = entry.size;
+      status.flags = Status::HasSize;
+   }
+
+   return status;
+}
+
+Result<std::shared_ptr<Device>>
+PackDevice::getLinkDevice(const User &user,
+                          const Path &path)
+{
+   return { std::make_shared<LinkDevice>(shared_from_this(), path) };
+}
+
+Error
+PackDevice::makeFolder(const User &user,
+                       const Path &path)
+{
+   return Error::ReadOnly;
+}
+
+Error
+PackDevice::makeFolders(const User &user,
+                        const Path &path)
+{
+   return Error::ReadOnly;
+}
+
+Error
+PackDevice::mountDevice(const User &user,
+                        const Path &path,
+                        std::shared_ptr<Device> device)
+{
+   return Error::OperationNotSupported;
+}
+
+Error
+PackDevice::mountOverlayDevice(const User &user,
+                               OverlayPriority priority,
+                               const Path &path,
+                               std::shared_ptr<Device> device)
+{
+   return Error::OperationNotSupported;
+}
+
+Error
+PackDevice::unmountDevice(const User &user,
+                          const Path &path)
+{
+   return Error::OperationNotSupported;
+}
+
+Error
+PackDevice::unmountOverlayDevice(const User &user,
+                                 OverlayPriority priority,
+                                 const Path &path)
+{
+   return Error::OperationNotSupported;
+}
+
+Result<DirectoryIterator>
+PackDevice::openDirectory(const User &user,
+                          const Path &path)
+{
+   auto directoryPath = trimPath(path.path());
+   auto prefix = std::string { directoryPath };
+
+   if (!directoryPath.empty()) {
+      auto directory = findEntry(directoryPath);
+      if (!directory) {
+         return { Error::NotFound };
+      }
+
+      if (!(directory->flags & PackEntryDirectory)) {
+         return { Error::NotDirectory };
+      }
+
+      prefix += '/';
+   }
+
+   // Everything inside the directory is contiguous in the sorted entries, and
+   // direct children are already sorted by name.
+   auto last = mEntries + mHeader->numEntries;
+   auto itr = std::lower_bound(mEntries, last, std::string_view { prefix },
+      [this](const PackEntry &entry, std::string_view value) {
+         return entryPath(entry) < value;
+      });
+
+   auto listing = std::vector<Status> { };
+   for (; itr != last; ++itr) {
+      auto entryPath = this->entryPath(*itr);
+      if (entryPath.compare(0, prefix.size(), prefix) != 0) {
+         break;
+      }
+
+      if (entryPath.find('/', prefix.size()) == std::string_view::npos) {
+         listing.push_back(makeStatus(*itr));
+      }
+   }
+
+   return { DirectoryIterator {
+      std::make_shared<PackDirectoryIterator>(std::move(listing)) } };
+}
+
+Result<std::unique_ptr<FileHandle>>
+PackDevice::openFile(const User &user,
+                     const Path &path,
+                     FileHandle::Mode mode)
+{
+   if (mode & (FileHandle::Write | FileHandle::Append | FileHandle::Update)) {
+      return { Error::ReadOnly };
+   }
+
+   auto entry = findEntry(trimPath(path.path()));
+   if (!entry) {
+      return { Error::NotFound };
+   }
+
+   if (entry->flags & PackEntryDirectory) {
+      return { Error::NotFile };
+   }
+
+   return { std::make_unique<PackFileHandle>(shared_from_this(), entry) };
+}
+
+Error
+PackDevice::remove(const User &user,
+                   const Path &path)
+{
+   return Error::ReadOnly;
+}
+
+Error
+PackDevice::rename(const User &user,
+                   const Path &src,
+                   const Path &dst)
+{
+   return Error::ReadOnly;
+}
+
+Error
+PackDevice::setGroup(const User &user,
+                     const Path &path,
+                     GroupId group)
+{
+   return Error::OperationNotSupported;
+}
+
+Error
+PackDevice::setOwner(const User &user,
+                     const Path &path,
+                     OwnerId owner)
+{
+   return Error::OperationNotSupported;
+}
+
+Error
+PackDevice::setPermissions(const User &user,
+                           const Path &path,
+                           Permissions mode)
+{
+   return Error::OperationNotSupported;
+}
+
+Result<Status>
+PackDevice::status(const User &user,
+                   const Path &path)
+{
+   auto entryPath = trimPath(path.path());
+   if (entryPath.empty()) {
+      auto status = Status { };
+      status.flags = Status::IsDirectory;
+      return { status };
+   }
+
+   auto entry = findEntry(entryPath);
+   if (!entry) {
+      return { Error::NotFound };
+   }
+
+   return { makeStatus(*entry) };
+}
+
+} // namespace vfs
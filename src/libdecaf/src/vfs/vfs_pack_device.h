@@ -0,0 +1,114 @@
+#pragma once
+#include "vfs_device.h"
+#include "vfs_pack_format.h"
+
+#include <common/platform_memory.h>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+namespace vfs
+{
+
+/**
+ * A read only device which serves files from a memory mapped pack file, see
+ * vfs_pack_format.h.
+ */
+class PackDevice : public Device, public std::enable_shared_from_this<PackDevice>
+{
+public:
+   PackDevice();
+   ~PackDevice() override;
+
+   static std::shared_ptr<PackDevice>
+   open(const std::filesystem::path &path);
+
+   Result<std::shared_ptr<Device>>
+   getLinkDevice(const User &user, const Path &path) override;
+
+   Error
+   makeFolder(const User &user, const Path &path) override;
+
+   Error
+   makeFolders(const User &user, const Path &path) override;
+
+   Error
+   mountDevice(const User &user, const Path &path,
+               std::shared_ptr<Device> device) override;
+
+   Error
+   mountOverlayDevice(const User &user, OverlayPriority priority,
+                      const Path &path,
+                      std::shared_ptr<Device> device) override;
+
+   Error
+   unmountDevice(const User &user, const Path &path) override;
+
+   Error
+   unmountOverlayDevice(const User &user, OverlayPriority priority,
+                        const Path &path) override;
+
+   Result<DirectoryIterator>
+   openDirectory(const User &user, const Path &path) override;
+
+   Result<std::unique_ptr<FileHandle>>
+   openFile(const User &user, const Path &path,
+            FileHandle::Mode mode) override;
+
+   Error
+   remove(const User &user, const Path &path) override;
+
+   Error
+   rename(const User &user, const Path &src, const Path &dst) override;
+
+   Error
+   setGroup(const User &user, const Path &path, GroupId group) override;
+
+   Error
+   setOwner(const User &user, const Path &path, OwnerId owner) override;
+
+   Error
+   setPermissions(const User &user, const Path &path, Permissions mode) override;
+
+   Result<Status>
+   status(const User &user, const Path &path) override;
+
+   const uint8_t *
+   data() const
+   {
+      return mData;
+   }
+
+   uint32_t
+   chunkSize() const
+   {
+      return mHeader->chunkSize;
+   }
+
+private:
+   bool
+   load(const std::filesystem::path &path);
+
+   std::string_view
+   entryPath(const PackEntry &entry) const;
+
+   std::string_view
+   entryName(const PackEntry &entry) const;
+
+   const PackEntry *
+   findEntry(std::string_view path) const;
+
+   Status
+   makeStatus(const PackEntry &entry) const;
+
+private:
+   platform::MapFileHandle mMapFile = platform::InvalidMapFileHandle;
+   const uint8_t *mData = nullptr;
+   size_t mSize = 0;
+
+   const PackHeader *mHeader = nullptr;
+   const PackEntry *mEntries = nullptr;
+   const char *mStrings = nullptr;
+};
+
+} // namespace vfs
@@ -0,0 +1,31 @@
+#include "vfs_pack_directoryiterator.h"
+
+namespace vfs
+{
+
+PackDirectoryIterator::PackDirectoryIterator(std::vector<Status> listing) :
+   mListing(std::move(listing)),
+   mIterator(mListing.begin())
+{
+}
+
+Result<Status>
+PackDirectoryIterator::readEntry()
+{
+   if (mIterator == mListing.end()) {
+      return { Error::EndOfDirectory };
+   }
+
+   auto currentEntry = *mIterator;
+   ++mIterator;
+   return { currentEntry };
+}
+
+Error
+PackDirectoryIterator::rewind()
+{
+   mIterator = mListing.begin();
+   return Error::Success;
+}
+
+} // namespace vfs
@@ -0,0 +1,23 @@
+#pragma once
+#include "vfs_directoryiterator.h"
+
+#include <vector>
+
+namespace vfs
+{
+
+class PackDirectoryIterator : public DirectoryIteratorImpl
+{
+public:
+   PackDirectoryIterator(std::vector<Status> listing);
+   ~PackDirectoryIterator() override = default;
+
+   Result<Status> readEntry() override;
+   Error rewind() override;
+
+private:
+   std::vector<Status> mListing;
+   std::vector<Status>::iterator mIterator;
+};
+
+} // namespace vfs
@@ -0,0 +1,208 @@
+#include "vfs_pack_device.h"
+#include "vfs_pack_filehandle.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace vfs
+{
+
+PackFileHandle::PackFileHandle(std::shared_ptr<PackDevice> device,
+                               const PackEntry *entry) :
+   mDevice(std::move(device)),
+   mEntry(entry),
+   mPosition(0)
+{
+}
+
+PackFileHandle::~PackFileHandle()
+{
+   close();
+}
+
+Error
+PackFileHandle::close()
+{
+   mDevice.reset();
+   mChunkData.clear();
+   mChunkData.shrink_to_fit();
+   mChunkIndex = -1;
+   return Error::Success;
+}
+
+Result<bool>
+PackFileHandle::eof()
+{
+   if (!mDevice) {
+      return { Error::NotOpen };
+   }
+
+   return mPosition >= static_cast<int64_t>(mEntry->size);
+}
+
+Error
+PackFileHandle::flush()
+{
+   if (!mDevice) {
+      return Error::NotOpen;
+   }
+
+   return Error::Success;
+}
+
+Error
+PackFileHandle::seek(SeekDirection direction,
+                     int64_t offset)
+{
+   if (!mDevice) {
+      return Error::NotOpen;
+   }
+
+   auto oldPosition = mPosition;
+   switch (direction) {
+   case SeekCurrent:
+      mPosition += offset;
+      break;
+   case SeekEnd:
+      mPosition = static_cast<int64_t>(mEntry->size) + offset;
+      break;
+   case SeekStart:
+      mPosition = offset;
+      break;
+   default:
+      return Error::InvalidSeekDirection;
+   }
+
+   if (mPosition < 0) {
+      // Cannot seek before start of file!
+      mPosition = oldPosition;
+      return Error::InvalidSeekPosition;
+   }
+
+   return Error::Success;
+}
+
+Result<int64_t>
+PackFileHandle::size()
+{
+   if (!mDevice) {
+      return { Error::NotOpen };
+   }
+
+   return { static_cast<int64_t>(mEntry->size) };
+}
+
+Result<int64_t>
+PackFileHandle::tell()
+{
+   if (!mDevice) {
+      return { Error::NotOpen };
+   }
+
+   return { mPosition };
+}
+
+Result<int64_t>
+PackFileHandle::truncate()
+{
+   return { Error::ReadOnly };
+}
+
+Result<int64_t>
+PackFileHandle::read(void *buffer,
+                     int64_t size,
+                     int64_t count)
+{
+   if (!mDevice) {
+      return { Error::NotOpen };
+   }
+
+   if (size <= 0 || count <= 0) {
+      return { 0 };
+   }
+
+   auto fileSize = static_cast<int64_t>(mEntry->size);
+   if (mPosition >= fileSize) {
+      return { Error::EndOfFile };
+   }
+
+   auto groupsRemaining = (fileSize - mPosition) / size;
+   count = std::min(count, groupsRemaining);
+   if (count == 0) {
+      return { 0 };
+   }
+
+   if (mEntry->flags & PackEntryCompressed) {
+      if (!readCompressed(static_cast<uint8_t *>(buffer), mPosition,
+                          size * count)) {
+         return { Error::GenericError };
+      }
+   } else {
+      // Uncompressed data is copied straight out of the mapping
+      std::memcpy(buffer,
+                  mDevice->data() + mEntry->dataOffset + mPosition,
+                  size * count);
+   }
+
+   mPosition += size * count;
+   return { count };
+}
+
+Result<int64_t>
+PackFileHandle::write(const void *buffer,
+                      int64_t size,
+                      int64_t count)
+{
+   return { Error::ReadOnly };
+}
+
+bool
+PackFileHandle::readCompressed(uint8_t *buffer,
+                               int64_t position,
+                               int64_t length)
+{
+   auto data = mDevice->data();
+   auto chunkSize = static_cast<int64_t>(mDevice->chunkSize());
+   auto chunks = reinterpret_cast<const PackChunk *>(data + mEntry->dataOffset);
+
+   while (length > 0) {
+      auto chunkIndex = position / chunkSize;
+      auto chunkOffset = position % chunkSize;
+      auto chunkLength =
+         std::min<int64_t>(chunkSize,
+                           static_cast<int64_t>(mEntry->size) - chunkIndex * chunkSize);
+      auto copyLength = std::min(length, chunkLength - chunkOffset);
+      auto &chunk = chunks[chunkIndex];
+      auto source = static_cast<const uint8_t *>(nullptr);
+
+      if (!chunk.compressed) {
+         source = data + chunk.offset;
+      } else {
+         if (mChunkIndex != chunkIndex) {
+            auto destLength = static_cast<uLongf>(chunkLength);
+            mChunkData.resize(static_cast<size_t>(chunkSize));
+            mChunkIndex = -1;
+
+            if (uncompress(mChunkData.data(), &destLength,
+                           data + chunk.offset, chunk.size) != Z_OK ||
+                destLength != static_cast<uLongf>(chunkLength)) {
+               return false;
+            }
+
+            mChunkIndex = chunkIndex;
+         }
+
+         source = mChunkData.data();
+      }
+
+      std::memcpy(buffer, source + chunkOffset, static_cast<size_t>(copyLength));
+      buffer += copyLength;
+      position += copyLength;
+      length -= copyLength;
+   }
+
+   return true;
+}
+
+} // namespace vfs
@@ -0,0 +1,44 @@
+#pragma once
+#include "vfs_filehandle.h"
+#include "vfs_pack_format.h"
+
+#include <memory>
+#include <vector>
+
+namespace vfs
+{
+
+class PackDevice;
+
+class PackFileHandle : public FileHandle
+{
+public:
+   PackFileHandle(std::shared_ptr<PackDevice> device,
+                  const PackEntry *entry);
+   ~PackFileHandle() override;
+
+   Error close() override;
+   Result<bool> eof() override;
+   Error flush() override;
+   Error seek(SeekDirection direction, int64_t offset) override;
+   Result<int64_t> size() override;
+   Result<int64_t> tell() override;
+   Result<int64_t> truncate() override;
+   Result<int64_t> read(void *buffer, int64_t size, int64_t count) override;
+   Result<int64_t> write(const void *buffer, int64_t size, int64_t count) override;
+
+private:
+   bool readCompressed(uint8_t *buffer, int64_t position, int64_t length);
+
+private:
+   std::shared_ptr<PackDevice> mDevice;
+   const PackEntry *mEntry;
+   int64_t mPosition;
+
+   //! Most recently decompressed chunk, as reads are usually sequential and
+   //! much smaller than a chunk.
+   std::vector<uint8_t> mChunkData;
+   int64_t mChunkIndex = -1;
+};
+
+} // namespace vfs
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * A pack file holds a whole read only directory tree, such as a title's
+ * /vol/content, in one file which can be memory mapped.
+ *
+ * Layout:
+ *    PackHeader
+ *    PackEntry[numEntries], sorted by path
+ *    Path strings, not null terminated
+ *    File data and chunk tables
+ *
+ * Paths are relative to the root of the pack without a leading or trailing
+ * slash.  As entries are sorted by path every entry inside a directory is
+ * contiguous, which lets us list a directory with a binary search.
+ *
+ * File data is either stored as is, so it can be read directly from the
+ * mapping, or split into chunks of chunkSize bytes which are each compressed
+ * with zlib.  Compressed files point at an 8 byte aligned table of PackChunk,
+ * one per chunk.
+ *
+ * All values are little endian.
+ */
+
+namespace vfs
+{
+
+static constexpr uint32_t PackMagic = 0x4B504344; // "DCPK"
+static constexpr uint32_t PackVersion = 1;
+static constexpr uint32_t PackDefaultChunkSize = 64 * 1024;
+
+struct PackHeader
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t numEntries;
+   uint32_t chunkSize;
+   uint64_t entriesOffset;
+   uint64_t stringsOffset;
+   uint64_t stringsSize;
+};
+static_assert(sizeof(PackHeader) == 0x28);
+
+enum PackEntryFlags : uint32_t
+{
+   PackEntryDirectory = 1 << 0,
+   PackEntryCompressed = 1 << 1,
+};
+
+struct PackEntry
+{
+   //! Offset of the path in the strings table.
+   uint32_t pathOffset;
+   uint32_t pathLength;
+   uint32_t flags;
+   uint32_t numChunks;
+
+   //! Uncompressed size of the file.
+   uint64_t size;
+
+   //! Offset of the file data, or of the chunk table for compressed files.
+   uint64_t dataOffset;
+};
+static_assert(sizeof(PackEntry) == 0x20);
+
+struct PackChunk
+{
+   uint64_t offset;
+   uint32_t size;
+
+   //! 0 when this chunk is stored uncompressed, as it did not compress.
+   uint32_t compressed;
+};
+static_assert(sizeof(PackChunk) == 0x10);
+
+} // namespace vfs
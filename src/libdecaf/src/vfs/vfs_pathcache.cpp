@@ -0,0 +1,44 @@
+#include "vfs_pathcache.h"
+
+#include <atomic>
+
+namespace vfs
+{
+
+static std::atomic<uint64_t> sGeneration { 0 };
+static std::atomic<uint64_t> sHits { 0 };
+static std::atomic<uint64_t> sMisses { 0 };
+
+void
+invalidatePathCaches()
+{
+   sGeneration.fetch_add(1, std::memory_order_acq_rel);
+}
+
+uint64_t
+getPathCacheGeneration()
+{
+   return sGeneration.load(std::memory_order_acquire);
+}
+
+void
+recordPathCacheLookup(bool hit)
+{
+   if (hit) {
+      sHits.fetch_add(1, std::memory_order_relaxed);
+   } else {
+      sMisses.fetch_add(1, std::memory_order_relaxed);
+   }
+}
+
+PathCacheStatistics
+getPathCacheStatistics()
+{
+   auto stats = PathCacheStatistics { };
+   stats.hits = sHits.load(std::memory_order_relaxed);
+   stats.misses = sMisses.load(std::memory_order_relaxed);
+   stats.invalidations = sGeneration.load(std::memory_order_relaxed);
+   return stats;
+}
+
+} // namespace vfs
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+
+namespace vfs
+{
+
+struct PathCacheStatistics
+{
+   uint64_t hits = 0;
+   uint64_t misses = 0;
+   uint64_t invalidations = 0;
+};
+
+/*
+ * Devices which cache path lookups, such as OverlayDevice, only keep their
+ * cache for as long as the path cache generation does not change.
+ *
+ * Caches only remember which device a path resolves to, never its status, so
+ * only changes to the namespace need to invalidate them: mounting, unmounting,
+ * creating, removing or renaming.  The same files can be reached through more
+ * than one device, for example an overlay of LinkDevice which point elsewhere
+ * in the tree, so every such change must call invalidatePathCaches().
+ */
+
+void
+invalidatePathCaches();
+
+uint64_t
+getPathCacheGeneration();
+
+void
+recordPathCacheLookup(bool hit);
+
+PathCacheStatistics
+getPathCacheStatistics();
+
+//! Invalidates path caches when destroyed, so that it happens after the
+//! change to the tree has been made.
+class ScopedPathCacheInvalidation
+{
+public:
+   ~ScopedPathCacheInvalidation()
+   {
+      invalidatePathCaches();
+   }
+};
+
+} // namespace vfs
@@ -6,6 +6,7 @@
 #include "vfs_virtual_mounteddevice.h"
 #include "vfs_link_device.h"
 #include "vfs_overlay_device.h"
+#include "vfs_pathcache.h"
 #include "vfs_pathiterator.h"
 
 #include <cassert>
@@ -32,6 +33,8 @@ Error
 VirtualDevice::makeFolder(const User &user,
                           const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto [node, relativePath] = findDeepest(user, path);
    if (relativePath.empty()) {
       return Error::AlreadyExists;
@@ -61,6 +64,8 @@ Error
 VirtualDevice::makeFolders(const User &user,
                            const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto [node, relativePath] = findDeepest(user, path);
    if (relativePath.empty()) {
       return Error::AlreadyExists;
@@ -90,6 +95,8 @@ VirtualDevice::mountDevice(const User &user,
                            const Path &path,
                            std::shared_ptr<Device> device)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto [node, relativePath] = findDeepest(user, path);
    if (relativePath.depth() == 0) {
       return Error::AlreadyExists;
@@ -122,6 +129,8 @@ VirtualDevice::mountOverlayDevice(const User &user,
                                   const Path &path,
                                   std::shared_ptr<Device> device)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto[node, relativePath] = findDeepest(user, path);
    if (node->type == VirtualNode::MountedDevice) {
       auto mountedDevice = static_cast<VirtualMountedDevice *>(node.get());
@@ -166,6 +175,8 @@ Error
 VirtualDevice::unmountDevice(const User &user,
                              const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto [parentNode, relativePath] = findDeepest(user, path, 1);
    if (parentNode->type == VirtualNode::MountedDevice) {
       auto mountedDevice = static_cast<VirtualMountedDevice *>(parentNode.get());
@@ -191,6 +202,8 @@ VirtualDevice::unmountOverlayDevice(const User &user,
                                     vfs::OverlayPriority priority,
                                     const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto [node, relativePath] = findDeepest(user, path);
    if (node->type != VirtualNode::MountedDevice) {
       return Error::NotMountDevice;
@@ -254,6 +267,8 @@ Error
 VirtualDevice::remove(const User &user,
                       const Path &path)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto [parentNode, relativePath] = findDeepest(user, path, 1);
    if (parentNode->type == VirtualNode::MountedDevice) {
       // Forward remove into mounted device
@@ -281,6 +296,8 @@ VirtualDevice::rename(const User &user,
                       const Path &src,
                       const Path &dst)
 {
+   auto invalidation = ScopedPathCacheInvalidation { };
+
    auto [srcParent, srcRelativePath] = findDeepest(user, src, 1);
    auto [dstParent, dstRelativePath] = findDeepest(user, dst, 1);
 
@@ -2,6 +2,7 @@
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace gpu
@@ -17,6 +18,30 @@ struct DebugSettings
 
    //! Only dump shader binaries
    bool dump_shader_binaries_only = false;
+
+   //! Count and time every PM4 packet executed
+   bool pm4_profiling = false;
+};
+
+struct CacheSettings
+{
+   //! Directory to store persistent caches in, defaults to the config
+   //! directory when empty
+   std::string path;
+
+   //! Store translated shaders on disk
+   bool shader_cache = true;
+
+   //! Store the Vulkan pipeline cache and the pipelines used by each title
+   //! on disk, and precompile those pipelines the next time it is run
+   bool pipeline_cache = true;
+};
+
+struct CompileSettings
+{
+   //! Compile shaders and pipelines on background threads, draws which need
+   //! a shader or pipeline which is still compiling are skipped
+   bool async = false;
 };
 
 struct DisplaySettings
@@ -53,6 +78,8 @@ struct DisplaySettings
 struct Settings
 {
    DebugSettings debug;
+   CacheSettings cache;
+   CompileSettings compile;
    DisplaySettings display;
 };
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <cstdint>
 #include <functional>
 #include <libcpu/be2_struct.h>
@@ -31,11 +32,30 @@ struct WindowSystemInfo
    double renderSurfaceScale = 1.0;
 };
 
+struct Pm4PacketStatistics
+{
+   uint64_t count = 0;
+   uint64_t timeNS = 0;
+};
+
+struct Pm4Statistics
+{
+   //! Type 0 packets, which write directly to registers.
+   Pm4PacketStatistics type0;
+
+   //! Type 3 packets indexed by opcode, the time of INDIRECT_BUFFER packets
+   //! includes the time taken to execute the buffer they call.
+   std::array<Pm4PacketStatistics, 256> type3;
+};
+
 struct GraphicsDriverDebugInfo
 {
    GraphicsDriverType type = GraphicsDriverType::Null;
    double averageFps = 0.0f;
    double averageFrameTimeMS = 0.0f;
+
+   //! Only collected when debug.pm4_profiling is enabled.
+   Pm4Statistics pm4;
 };
 
 class GraphicsDriver
@@ -78,6 +98,14 @@ public:
    {
       return 0;
    }
+
+   // Called when a title has been loaded, allows the driver to restore any
+   //  state it saved for the title in a previous session.  May be called from
+   //  any thread!
+   virtual void
+   notifyTitleLoaded(uint64_t titleId)
+   {
+   }
 };
 
 GraphicsDriver *
@@ -19,6 +19,24 @@ struct Entry
 using Entries = gsl::span<const Entry>;
 using InterruptCallbackFn = void(*) ();
 
+struct Stats
+{
+   //! Number of entries written by the GPU.
+   uint64_t entriesWritten;
+
+   //! Number of times the interrupt callback was called.
+   uint64_t interruptsRaised;
+
+   //! Number of times pending interrupts were read by the interrupt handler.
+   uint64_t deliveries;
+
+   //! Total nanoseconds between raising an interrupt and it being read.
+   uint64_t totalDeliveryLatency;
+
+   //! Largest nanoseconds between raising an interrupt and it being read.
+   uint64_t maxDeliveryLatency;
+};
+
 void
 write(const Entries &entries);
 
@@ -28,9 +46,16 @@ write(const Entry &entry)
    write({ &entry, 1 });
 }
 
+//! Returns all pending entries, which remain valid until the next read.
 Entries
 read();
 
+void
+sampleStats(Stats &stats);
+
+void
+resetStats();
+
 void
 setInterruptCallback(InterruptCallbackFn callback);
 
@@ -7,9 +7,12 @@ namespace gpu::ringbuffer
 
 using Buffer = gsl::span<uint32_t>;
 
+//! Copy a command buffer into the ring, may be called from any thread.
 void
 write(const Buffer &buffer);
 
+//! Returns the next contiguous range of submitted words without copying,
+//! which remains valid until the next call to read or wait.
 Buffer
 read();
 
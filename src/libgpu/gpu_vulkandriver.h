@@ -21,6 +21,21 @@ struct VulkanDriverDebugInfo : GraphicsDriverDebugInfo
    uint64_t numSamplers = 0;
    uint64_t numSurfaces = 0;
    uint64_t numDataBuffers = 0;
+
+   //! Number of draws skipped in the last frame waiting for a shader or
+   //! pipeline to finish compiling.
+   uint64_t numDeferredDraws = 0;
+   uint64_t numPendingCompiles = 0;
+
+   //! Shader and pipeline lookups which found an existing object, and those
+   //! which had to create a new one.
+   uint64_t numShaderHits = 0;
+   uint64_t numShaderMisses = 0;
+   uint64_t numPipelineHits = 0;
+   uint64_t numPipelineMisses = 0;
+
+   //! Total bytes copied into staging buffers to upload to the GPU.
+   uint64_t uploadBytes = 0;
 };
 
 } // namespace gpu
@@ -532,6 +532,21 @@ struct SetConfigRegs
    }
 };
 
+struct SetConfigRegsBE
+{
+   static const auto Opcode = IT_OPCODE::SET_CONFIG_REG;
+
+   latte::Register id;
+   gsl::span<be2_val<uint32_t>> values;
+
+   template<typename Serialiser>
+   void serialise(Serialiser &se)
+   {
+      se.REG_OFFSET(id, latte::Register::ConfigRegisterBase);
+      se(values);
+   }
+};
+
 struct SetContextReg
 {
    static const auto Opcode = IT_OPCODE::SET_CONTEXT_REG;
@@ -562,6 +577,21 @@ struct SetContextRegs
    }
 };
 
+struct SetContextRegsBE
+{
+   static const auto Opcode = IT_OPCODE::SET_CONTEXT_REG;
+
+   latte::Register id;
+   gsl::span<be2_val<uint32_t>> values;
+
+   template<typename Serialiser>
+   void serialise(Serialiser &se)
+   {
+      se.REG_OFFSET(id, latte::Register::ContextRegisterBase);
+      se(values);
+   }
+};
+
 struct SetAllContextsReg
 {
    static const auto Opcode = IT_OPCODE::SET_ALL_CONTEXTS;
@@ -607,6 +637,21 @@ struct SetControlConstants
    }
 };
 
+struct SetControlConstantsBE
+{
+   static const auto Opcode = IT_OPCODE::SET_CTL_CONST;
+
+   latte::Register id;
+   gsl::span<be2_val<uint32_t>> values;
+
+   template<typename Serialiser>
+   void serialise(Serialiser &se)
+   {
+      se.REG_OFFSET(id, latte::Register::ControlRegisterBase);
+      se(values);
+   }
+};
+
 struct SetLoopConst
 {
    static const auto Opcode = IT_OPCODE::SET_LOOP_CONST;
@@ -637,6 +682,21 @@ struct SetLoopConsts
    }
 };
 
+struct SetLoopConstsBE
+{
+   static const auto Opcode = IT_OPCODE::SET_LOOP_CONST;
+
+   latte::Register id;
+   gsl::span<be2_val<uint32_t>> values;
+
+   template<typename Serialiser>
+   void serialise(Serialiser &se)
+   {
+      se.REG_OFFSET(id, latte::Register::LoopConstRegisterBase);
+      se(values);
+   }
+};
+
 struct SetSamplerAttrib
 {
    static const auto Opcode = IT_OPCODE::SET_SAMPLER;
@@ -671,6 +731,21 @@ struct SetSamplers
    }
 };
 
+struct SetSamplersBE
+{
+   static const auto Opcode = IT_OPCODE::SET_SAMPLER;
+
+   latte::Register id;
+   gsl::span<be2_val<uint32_t>> values;
+
+   template<typename Serialiser>
+   void serialise(Serialiser &se)
+   {
+      se.REG_OFFSET(id, latte::Register::SamplerRegisterBase);
+      se(values);
+   }
+};
+
 struct SetVtxResource
 {
    static const auto Opcode = IT_OPCODE::SET_RESOURCE;
@@ -741,6 +816,21 @@ struct SetResources
    }
 };
 
+struct SetResourcesBE
+{
+   static const auto Opcode = IT_OPCODE::SET_RESOURCE;
+
+   uint32_t id;
+   gsl::span<be2_val<uint32_t>> values;
+
+   template<typename Serialiser>
+   void serialise(Serialiser &se)
+   {
+      se.CONST_OFFSET(id);
+      se(values);
+   }
+};
+
 struct IndirectBufferCall
 {
    static const auto Opcode = IT_OPCODE::INDIRECT_BUFFER;
@@ -2,9 +2,12 @@
 #include "latte_pm4.h"
 #include "latte_registers.h"
 
+#include <common/byte_swap_array.h>
 #include <common/decaf_assert.h>
+#include <libcpu/be2_val.h>
 #include <libcpu/mem.h>
 #include <gsl/gsl-lite.hpp>
+#include <vector>
 
 namespace latte
 {
@@ -105,8 +108,133 @@ private:
    gsl::span<uint32_t> mBuffer;
 };
 
-template<typename Type>
-Type read(PacketReader &reader)
+/**
+ * Reads a packet directly from a big endian command buffer, scalar values are
+ * byte swapped as they are read.
+ *
+ * Spans of be2_val are returned as views of the original buffer so large
+ * payloads can be swapped straight to where they are needed, spans of any
+ * other type are byte swapped into the scratch buffer. Only one span can be
+ * read per packet, so a single scratch buffer is enough.
+ */
+class BigEndianPacketReader
+{
+public:
+   BigEndianPacketReader(gsl::span<be2_val<uint32_t>> data,
+                         std::vector<uint32_t> &scratch) :
+      mBuffer(data),
+      mScratch(scratch)
+   {
+   }
+
+   // Read one word
+   BigEndianPacketReader &operator()(uint32_t &value)
+   {
+      checkSize(1);
+      value = readWord();
+      return *this;
+   }
+
+   // Read one float
+   BigEndianPacketReader &operator()(float &value)
+   {
+      checkSize(1);
+      value = bit_cast<float>(readWord());
+      return *this;
+   }
+
+   // Read one uint32_t sized datatype
+   template <typename Type>
+   BigEndianPacketReader &operator()(Type &value)
+   {
+      static_assert(sizeof(Type) == sizeof(uint32_t), "Invalid type size");
+      checkSize(1);
+      value = bit_cast<Type>(readWord());
+      return *this;
+   }
+
+   // Read the rest of the entire packet without swapping
+   template<typename Type>
+   BigEndianPacketReader &operator()(gsl::span<be2_val<Type>> &values)
+   {
+      if (mBuffer.size() - mPosition == 0) {
+         values = {};
+      } else {
+         values = gsl::make_span(reinterpret_cast<be2_val<Type> *>(mBuffer.data() + mPosition),
+                                 ((mBuffer.size() - mPosition) * sizeof(uint32_t)) / sizeof(Type));
+      }
+
+      mPosition = mBuffer.size();
+      return *this;
+   }
+
+   // Read the rest of the entire packet, swapped into the scratch buffer
+   template<typename Type>
+   BigEndianPacketReader &operator()(gsl::span<Type> &values)
+   {
+      auto numWords = mBuffer.size() - mPosition;
+
+      if (numWords == 0) {
+         values = {};
+      } else {
+         mScratch.resize(numWords);
+         byte_swap_copy(mScratch.data(),
+                        reinterpret_cast<const uint32_t *>(mBuffer.data() + mPosition),
+                        numWords);
+         values = gsl::make_span(reinterpret_cast<Type *>(mScratch.data()),
+                                 (numWords * sizeof(uint32_t)) / sizeof(Type));
+      }
+
+      mPosition = mBuffer.size();
+      return *this;
+   }
+
+   // Read one word as a REG_OFFSET
+   BigEndianPacketReader &REG_OFFSET(latte::Register &value, latte::Register base)
+   {
+      checkSize(1);
+      value = static_cast<latte::Register>(((readWord() & 0xFFFF) * 4) + (uint32_t)base);
+      return *this;
+   }
+
+   // Read one word as a CONST_OFFSET
+   BigEndianPacketReader &CONST_OFFSET(uint32_t &value)
+   {
+      checkSize(1);
+      value = readWord() & 0xFFFF;
+      return *this;
+   }
+
+   // Read one word as a size (N - 1)
+   template<typename Type>
+   BigEndianPacketReader &size(Type &value)
+   {
+      checkSize(1);
+      value = static_cast<Type>(readWord() + 1);
+      return *this;
+   }
+
+private:
+   uint32_t readWord()
+   {
+      return mBuffer[mPosition++].value();
+   }
+
+   void checkSize(size_t sizeToRead)
+   {
+      if (mPosition + sizeToRead > mBuffer.size()) {
+         decaf_abort("Read past end of packet");
+      }
+   }
+
+private:
+   size_t mPosition = 0;
+   gsl::span<be2_val<uint32_t>> mBuffer;
+   std::vector<uint32_t> &mScratch;
+};
+
+template<typename Type, typename Reader>
+Type read(Reader &reader)
 {
    Type result;
    result.serialise(reader);
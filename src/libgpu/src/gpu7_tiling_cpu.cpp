@@ -3,11 +3,182 @@
 #include <common/align.h>
 #include <common/decaf_assert.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GPU7_TILING_CPU_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace gpu7::tiling::cpu
 {
 
+/*
+ * Every micro tile is retiled as a fixed sequence of 4, 8 or 16 byte runs,
+ * the runs are never longer than 16 bytes as neighbouring runs on one side
+ * are not neighbours on the other side.  We copy each run with a single
+ * unaligned SSE2 load and store rather than relying on memcpy being inlined.
+ *
+ * Tiles are visited row by row so the tile coordinates are known without a
+ * divide, and large surfaces are split into groups of macro tile rows which
+ * are retiled in parallel by a small pool of worker threads.
+ */
+static constexpr uint32_t MinParallelBytes = 512 * 1024;
+static constexpr uint32_t MinJobBytes = 64 * 1024;
+static constexpr uint32_t MaxWorkerThreads = 8;
+
+template<uint32_t NumBytes>
+static inline void
+copyRun(uint8_t *dst, const uint8_t *src)
+{
+#ifdef GPU7_TILING_CPU_SSE2
+   if constexpr (NumBytes == 16) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+      return;
+   } else if constexpr (NumBytes == 8) {
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(dst),
+                       _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src)));
+      return;
+   }
+#endif
+
+   std::memcpy(dst, src, NumBytes);
+}
+
+class RetileWorkerPool
+{
+public:
+   RetileWorkerPool()
+   {
+      auto numThreads = std::min(std::thread::hardware_concurrency(), MaxWorkerThreads);
+
+      // The dispatching thread also runs jobs, so it does not need a worker.
+      for (auto i = 1u; i < numThreads; ++i) {
+         mThreads.emplace_back(&RetileWorkerPool::workerEntry, this);
+      }
+   }
+
+   ~RetileWorkerPool()
+   {
+      {
+         std::unique_lock<std::mutex> lock { mMutex };
+         mQuit = true;
+      }
+
+      mWorkCondition.notify_all();
+
+      for (auto &thread : mThreads) {
+         thread.join();
+      }
+   }
+
+   /**
+    * Run job(0) .. job(numJobs - 1) across the worker threads and the calling
+    * thread, returns once every job has completed.
+    *
+    * If the pool is already in use by another thread then all jobs are run on
+    * the calling thread.
+    */
+   void
+   run(uint32_t numJobs,
+       const std::function<void(uint32_t)> &job)
+   {
+      std::unique_lock<std::mutex> dispatchLock { mDispatchMutex, std::try_to_lock };
+
+      if (mThreads.empty() || numJobs <= 1 || !dispatchLock.owns_lock()) {
+         for (auto i = 0u; i < numJobs; ++i) {
+            job(i);
+         }
+
+         return;
+      }
+
+      {
+         std::unique_lock<std::mutex> lock { mMutex };
+         mJob = &job;
+         mNumJobs = numJobs;
+         mNextJob.store(0);
+         mActiveWorkers = static_cast<uint32_t>(mThreads.size());
+         ++mGeneration;
+      }
+
+      mWorkCondition.notify_all();
+      runJobs(job, numJobs);
+
+      // Wait for the workers to stop touching job before it goes out of scope.
+      std::unique_lock<std::mutex> lock { mMutex };
+      mDoneCondition.wait(lock, [this]() { return mActiveWorkers == 0; });
+      mJob = nullptr;
+   }
+
+private:
+   void
+   runJobs(const std::function<void(uint32_t)> &job,
+           uint32_t numJobs)
+   {
+      for (auto i = mNextJob.fetch_add(1); i < numJobs; i = mNextJob.fetch_add(1)) {
+         job(i);
+      }
+   }
+
+   void
+   workerEntry()
+   {
+      auto generation = uint64_t { 0 };
+      std::unique_lock<std::mutex> lock { mMutex };
+
+      while (true) {
+         mWorkCondition.wait(lock, [&]() { return mQuit || mGeneration != generation; });
+         if (mQuit) {
+            break;
+         }
+
+         generation = mGeneration;
+         auto job = mJob;
+         auto numJobs = mNumJobs;
+
+         lock.unlock();
+         runJobs(*job, numJobs);
+         lock.lock();
+
+         if (--mActiveWorkers == 0) {
+            mDoneCondition.notify_one();
+         }
+      }
+   }
+
+private:
+   std::vector<std::thread> mThreads;
+
+   //! Held by the thread currently dispatching jobs to the pool.
+   std::mutex mDispatchMutex;
+
+   std::mutex mMutex;
+   std::condition_variable mWorkCondition;
+   std::condition_variable mDoneCondition;
+   bool mQuit = false;
+   uint64_t mGeneration = 0;
+   uint32_t mActiveWorkers = 0;
+   const std::function<void(uint32_t)> *mJob = nullptr;
+   uint32_t mNumJobs = 0;
+   std::atomic<uint32_t> mNextJob { 0 };
+};
+
+static RetileWorkerPool &
+getWorkerPool()
+{
+   static RetileWorkerPool pool;
+   return pool;
+}
+
 template<
    bool IsUntiling,
    uint32_t MicroTileThickness,
@@ -25,14 +196,14 @@ struct RetileCore
    static constexpr uint32_t MicroTileBytes = MicroTileWidth * MicroTileHeight * MicroTileThickness * BytesPerElement;
    static constexpr uint32_t MacroTileBytes = MacroTileWidth * MacroTileHeight * MicroTileBytes;
 
-   template<uint32_t bytesPerElem>
+   template<uint32_t NumBytes>
    static inline void
-   copyElems(uint8_t *untiled, uint8_t *tiled, size_t numElems)
+   copyBytes(uint8_t *untiled, uint8_t *tiled)
    {
-      if (IsUntiling) {
-         std::memcpy(untiled, tiled, bytesPerElem * numElems);
+      if constexpr (IsUntiling) {
+         copyRun<NumBytes>(untiled, tiled);
       } else {
-         std::memcpy(tiled, untiled, bytesPerElem * numElems);
+         copyRun<NumBytes>(tiled, untiled);
       }
    }
 
@@ -42,7 +213,6 @@ struct RetileCore
                 uint32_t untiledStride)
    {
       static constexpr auto tiledStride = MicroTileWidth;
-      static constexpr auto rowElems = MicroTileWidth / 8;
 
       for (int y = 0; y < MicroTileHeight; y += 4) {
          auto untiledRow0 = untiled + 0 * untiledStride;
@@ -55,10 +225,10 @@ struct RetileCore
          auto tiledRow2 = tiled + 2 * tiledStride;
          auto tiledRow3 = tiled + 3 * tiledStride;
 
-         copyElems<8>(untiledRow0, tiledRow0, rowElems);
-         copyElems<8>(untiledRow1, tiledRow2, rowElems);
-         copyElems<8>(untiledRow2, tiledRow1, rowElems);
-         copyElems<8>(untiledRow3, tiledRow3, rowElems);
+         copyBytes<8>(untiledRow0, tiledRow0);
+         copyBytes<8>(untiledRow1, tiledRow2);
+         copyBytes<8>(untiledRow2, tiledRow1);
+         copyBytes<8>(untiledRow3, tiledRow3);
 
          untiled += 4 * untiledStride;
          tiled += 4 * tiledStride;
@@ -71,10 +241,9 @@ struct RetileCore
                  uint32_t untiledStride)
    {
       static constexpr auto tiledStride = MicroTileWidth * 2;
-      static constexpr auto rowElems = MicroTileWidth * 2 / 16;
 
       for (int y = 0; y < MicroTileHeight; ++y) {
-         copyElems<16>(untiled, tiled, rowElems);
+         copyBytes<16>(untiled, tiled);
 
          untiled += untiledStride;
          tiled += tiledStride;
@@ -87,7 +256,6 @@ struct RetileCore
                  uint32_t untiledStride)
    {
       static constexpr auto tiledStride = MicroTileWidth * 4;
-      static constexpr auto groupElems = 4 * 4 / 16;
 
       for (int y = 0; y < MicroTileHeight; y += 2) {
          auto untiledRow1 = untiled + 0 * untiledStride;
@@ -96,11 +264,11 @@ struct RetileCore
          auto tiledRow1 = tiled + 0 * tiledStride;
          auto tiledRow2 = tiled + 1 * tiledStride;
 
-         copyElems<16>(untiledRow1 + 0, tiledRow1 + 0, groupElems);
-         copyElems<16>(untiledRow1 + 16, tiledRow2 + 0, groupElems);
+         copyBytes<16>(untiledRow1 + 0, tiledRow1 + 0);
+         copyBytes<16>(untiledRow1 + 16, tiledRow2 + 0);
 
-         copyElems<16>(untiledRow2 + 0, tiledRow1 + 16, groupElems);
-         copyElems<16>(untiledRow2 + 16, tiledRow2 + 16, groupElems);
+         copyBytes<16>(untiledRow2 + 0, tiledRow1 + 16);
+         copyBytes<16>(untiledRow2 + 16, tiledRow2 + 16);
 
          tiled += tiledStride * 2;
          untiled += untiledStride * 2;
@@ -113,7 +281,6 @@ struct RetileCore
                  uint32_t untiledStride)
    {
       static constexpr auto tiledStride = MicroTileWidth * 8;
-      static constexpr auto groupElems = 2 * (64 / 8) / 16;
 
       for (int y = 0; y < MicroTileHeight; y += 2) {
          if constexpr (IsMacroTiling) {
@@ -130,17 +297,17 @@ struct RetileCore
          auto tiledRow1 = tiled + 0 * tiledStride;
          auto tiledRow2 = tiled + 1 * tiledStride;
 
-         copyElems<16>(untiledRow1 + 0, tiledRow1 + 0, groupElems);
-         copyElems<16>(untiledRow2 + 0, tiledRow1 + 16, groupElems);
+         copyBytes<16>(untiledRow1 + 0, tiledRow1 + 0);
+         copyBytes<16>(untiledRow2 + 0, tiledRow1 + 16);
 
-         copyElems<16>(untiledRow1 + 16, tiledRow1 + 32, groupElems);
-         copyElems<16>(untiledRow2 + 16, tiledRow1 + 48, groupElems);
+         copyBytes<16>(untiledRow1 + 16, tiledRow1 + 32);
+         copyBytes<16>(untiledRow2 + 16, tiledRow1 + 48);
 
-         copyElems<16>(untiledRow1 + 32, tiledRow2 + 0, groupElems);
-         copyElems<16>(untiledRow2 + 32, tiledRow2 + 16, groupElems);
+         copyBytes<16>(untiledRow1 + 32, tiledRow2 + 0);
+         copyBytes<16>(untiledRow2 + 32, tiledRow2 + 16);
 
-         copyElems<16>(untiledRow1 + 48, tiledRow2 + 32, groupElems);
-         copyElems<16>(untiledRow2 + 48, tiledRow2 + 48, groupElems);
+         copyBytes<16>(untiledRow1 + 48, tiledRow2 + 32);
+         copyBytes<16>(untiledRow2 + 48, tiledRow2 + 48);
 
          tiled += tiledStride * 2;
          untiled += untiledStride * 2;
@@ -154,7 +321,6 @@ struct RetileCore
    {
       static constexpr auto tiledStride = MicroTileWidth * 16;
       static constexpr auto groupBytes = 16;
-      static constexpr auto groupElems = 16 / 16;
 
       for (int y = 0; y < MicroTileHeight; y += 2) {
          auto untiledRow1 = untiled + 0 * untiledStride;
@@ -163,25 +329,25 @@ struct RetileCore
          auto tiledRow1 = tiled + 0 * tiledStride;
          auto tiledRow2 = tiled + 1 * tiledStride;
 
-         copyElems<16>(untiledRow1 + 0 * groupBytes, tiledRow1 + 0 * groupBytes, groupElems);
-         copyElems<16>(untiledRow1 + 1 * groupBytes, tiledRow1 + 2 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 0 * groupBytes, tiledRow1 + 1 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 1 * groupBytes, tiledRow1 + 3 * groupBytes, groupElems);
+         copyBytes<16>(untiledRow1 + 0 * groupBytes, tiledRow1 + 0 * groupBytes);
+         copyBytes<16>(untiledRow1 + 1 * groupBytes, tiledRow1 + 2 * groupBytes);
+         copyBytes<16>(untiledRow2 + 0 * groupBytes, tiledRow1 + 1 * groupBytes);
+         copyBytes<16>(untiledRow2 + 1 * groupBytes, tiledRow1 + 3 * groupBytes);
 
-         copyElems<16>(untiledRow1 + 2 * groupBytes, tiledRow1 + 4 * groupBytes, groupElems);
-         copyElems<16>(untiledRow1 + 3 * groupBytes, tiledRow1 + 6 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 2 * groupBytes, tiledRow1 + 5 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 3 * groupBytes, tiledRow1 + 7 * groupBytes, groupElems);
+         copyBytes<16>(untiledRow1 + 2 * groupBytes, tiledRow1 + 4 * groupBytes);
+         copyBytes<16>(untiledRow1 + 3 * groupBytes, tiledRow1 + 6 * groupBytes);
+         copyBytes<16>(untiledRow2 + 2 * groupBytes, tiledRow1 + 5 * groupBytes);
+         copyBytes<16>(untiledRow2 + 3 * groupBytes, tiledRow1 + 7 * groupBytes);
 
-         copyElems<16>(untiledRow1 + 4 * groupBytes, tiledRow2 + 0 * groupBytes, groupElems);
-         copyElems<16>(untiledRow1 + 5 * groupBytes, tiledRow2 + 2 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 4 * groupBytes, tiledRow2 + 1 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 5 * groupBytes, tiledRow2 + 3 * groupBytes, groupElems);
+         copyBytes<16>(untiledRow1 + 4 * groupBytes, tiledRow2 + 0 * groupBytes);
+         copyBytes<16>(untiledRow1 + 5 * groupBytes, tiledRow2 + 2 * groupBytes);
+         copyBytes<16>(untiledRow2 + 4 * groupBytes, tiledRow2 + 1 * groupBytes);
+         copyBytes<16>(untiledRow2 + 5 * groupBytes, tiledRow2 + 3 * groupBytes);
 
-         copyElems<16>(untiledRow1 + 6 * groupBytes, tiledRow2 + 4 * groupBytes, groupElems);
-         copyElems<16>(untiledRow1 + 7 * groupBytes, tiledRow2 + 6 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 6 * groupBytes, tiledRow2 + 5 * groupBytes, groupElems);
-         copyElems<16>(untiledRow2 + 7 * groupBytes, tiledRow2 + 7 * groupBytes, groupElems);
+         copyBytes<16>(untiledRow1 + 6 * groupBytes, tiledRow2 + 4 * groupBytes);
+         copyBytes<16>(untiledRow1 + 7 * groupBytes, tiledRow2 + 6 * groupBytes);
+         copyBytes<16>(untiledRow2 + 6 * groupBytes, tiledRow2 + 5 * groupBytes);
+         copyBytes<16>(untiledRow2 + 7 * groupBytes, tiledRow2 + 7 * groupBytes);
 
          if (IsMacroTiling) {
             tiled += 0x100 << (NumBankBits + NumPipeBits);
@@ -201,10 +367,9 @@ struct RetileCore
                     uint32_t uX, uint32_t uY)
    {
       static constexpr auto groupBytes = 2 * BytesPerElement;
-      static constexpr auto groupElems = 2 * BytesPerElement / 4;
       static constexpr auto tiledStride = MicroTileWidth * BytesPerElement;
 
-      copyElems<4>(untiled + uY * untiledStride + uX * groupBytes, tiled + tY * tiledStride + tX * groupBytes, groupElems);
+      copyBytes<groupBytes>(untiled + uY * untiledStride + uX * groupBytes, tiled + tY * tiledStride + tX * groupBytes);
    }
 
    static inline void
@@ -260,16 +425,16 @@ struct RetileCore
 
    static inline void
    retileMicro(const Params& params,
-               uint32_t tileIndex,
+               uint32_t dispatchSliceIndex,
+               uint32_t srcTileX,
+               uint32_t srcTileY,
                uint8_t *untiled,
                uint8_t *tiled)
    {
       const uint32_t thinSliceBytes = params.thickSliceBytes / MicroTileThickness;
       const uint32_t untiledStride = params.numTilesPerRow * MicroTileWidth * BytesPerElement;
       const uint32_t thickMicroTileBytes = params.thinMicroTileBytes * MicroTileThickness;
-
-      const uint32_t dispatchSliceIndex = tileIndex / params.numTilesPerSlice;
-      const uint32_t sliceTileIndex = tileIndex % params.numTilesPerSlice;
+      const uint32_t sliceTileIndex = srcTileY * params.numTilesPerRow + srcTileX;
 
       // Find the global slice index we are currently at.
       const uint32_t srcSliceIndex = params.firstSliceIndex + dispatchSliceIndex;
@@ -278,9 +443,6 @@ struct RetileCore
       const uint32_t localSliceIndex = srcSliceIndex % MicroTileThickness;
 
       // Calculate the offset to our untiled data starting from the thick slice
-      const uint32_t srcTileY = sliceTileIndex / params.numTilesPerRow;
-      const uint32_t srcTileX = sliceTileIndex % params.numTilesPerRow;
-
       uint32_t untiledOffset =
          (localSliceIndex * thinSliceBytes) +
          (srcTileX * MicroTileWidth * BytesPerElement) +
@@ -327,16 +489,15 @@ struct RetileCore
 
    static inline void
    retileMacro(const Params& params,
-               uint32_t tileIndex,
+               uint32_t dispatchSliceIndex,
+               uint32_t srcTileX,
+               uint32_t srcTileY,
                uint8_t *untiled,
                uint8_t *tiled)
    {
       const uint32_t thinSliceBytes = params.thickSliceBytes / MicroTileThickness;
       const uint32_t untiledStride = params.numTilesPerRow * MicroTileWidth * BytesPerElement;
 
-      const uint32_t dispatchSliceIndex = tileIndex / params.numTilesPerSlice;
-      const uint32_t sliceTileIndex = tileIndex % params.numTilesPerSlice;
-
       // Find the global slice index we are currently at.
       const uint32_t srcSliceIndex = params.firstSliceIndex + dispatchSliceIndex;
 
@@ -346,22 +507,11 @@ struct RetileCore
       // Calculate the thickSliceIndex
       const uint32_t thickSliceIndex = srcSliceIndex / MicroTileThickness;
 
-      // Calculate our tile positions
-      const uint32_t microTilesPerMacro = MacroTileWidth * MacroTileHeight;
+      // Calculate our macro tile position, the macro tile dimensions are
+      // powers of two so these are just shifts.
       const uint32_t macroTilesPerRow = params.numTilesPerRow / MacroTileWidth;
-      const uint32_t microTilesPerMacroRow = microTilesPerMacro * macroTilesPerRow;
-
-      const uint32_t srcMacroTileY = sliceTileIndex / microTilesPerMacroRow;
-      const uint32_t macroRowTileIndex = sliceTileIndex % microTilesPerMacroRow;
-
-      const uint32_t srcMacroTileX = macroRowTileIndex / microTilesPerMacro;
-      const uint32_t microTileIndex = macroRowTileIndex % microTilesPerMacro;
-
-      const uint32_t srcMicroTileY = microTileIndex / MacroTileWidth;
-      const uint32_t srcMicroTileX = microTileIndex % MacroTileWidth;
-
-      const uint32_t srcTileX = srcMacroTileX * MacroTileWidth + srcMicroTileX;
-      const uint32_t srcTileY = srcMacroTileY * MacroTileHeight + srcMicroTileY;
+      const uint32_t srcMacroTileX = srcTileX / MacroTileWidth;
+      const uint32_t srcMacroTileY = srcTileY / MacroTileHeight;
 
       // Figure out what our untiled offset shall be
       uint32_t untiledOffset =
@@ -447,15 +597,21 @@ struct RetileCore
    }
 
    static inline void
-   retile(const Params& params,
-          uint32_t tileIndex,
-          uint8_t *untiled,
-          uint8_t *tiled)
+   retileRows(const Params& params,
+              uint32_t dispatchSliceIndex,
+              uint32_t firstTileY,
+              uint32_t lastTileY,
+              uint8_t *untiled,
+              uint8_t *tiled)
    {
-      if constexpr (IsMacroTiling) {
-         retileMacro(params, tileIndex, untiled, tiled);
-      } else {
-         retileMicro(params, tileIndex, untiled, tiled);
+      for (auto tileY = firstTileY; tileY < lastTileY; ++tileY) {
+         for (auto tileX = 0u; tileX < params.numTilesPerRow; ++tileX) {
+            if constexpr (IsMacroTiling) {
+               retileMacro(params, dispatchSliceIndex, tileX, tileY, untiled, tiled);
+            } else {
+               retileMicro(params, dispatchSliceIndex, tileX, tileY, untiled, tiled);
+            }
+         }
       }
    }
 };
@@ -493,10 +649,31 @@ retileTiledSurface3(const RetileInfo& info,
    params.pipeSwizzle = info.pipeSwizzle;
    params.bankSwapWidth = info.bankSwapWidth;
 
-   uint32_t numTiles = numSlices * info.numTilesPerSlice;
-   for (auto tileIndex = 0u; tileIndex < numTiles; ++tileIndex) {
-      Retiler::retile(params, tileIndex, untiled, tiled);
+   // Split each slice into jobs of whole macro tile rows
+   const uint32_t numTileRows = info.numTilesPerSlice / info.numTilesPerRow;
+   const uint32_t tileRowBytes = info.numTilesPerRow * params.thinMicroTileBytes;
+   const uint32_t macroTileHeight = getMacroTileHeight(RetileMode);
+   const uint32_t totalBytes = numSlices * numTileRows * tileRowBytes;
+
+   if (totalBytes < MinParallelBytes) {
+      for (auto slice = 0u; slice < numSlices; ++slice) {
+         Retiler::retileRows(params, slice, 0, numTileRows, untiled, tiled);
+      }
+
+      return;
    }
+
+   const uint32_t rowsPerJob =
+      align_up(std::max(MinJobBytes / tileRowBytes, 1u), macroTileHeight);
+   const uint32_t jobsPerSlice = (numTileRows + rowsPerJob - 1) / rowsPerJob;
+
+   getWorkerPool().run(numSlices * jobsPerSlice,
+      [&](uint32_t job) {
+         const uint32_t slice = job / jobsPerSlice;
+         const uint32_t firstRow = (job % jobsPerSlice) * rowsPerJob;
+         const uint32_t lastRow = std::min(firstRow + rowsPerJob, numTileRows);
+         Retiler::retileRows(params, slice, firstRow, lastRow, untiled, tiled);
+      });
 }
 
 template<bool IsUntiling, TileMode RetileMode>
@@ -1,21 +1,65 @@
+#include "gpu_clock.h"
 #include "gpu_ih.h"
 
+#include <array>
 #include <atomic>
-#include <condition_variable>
-#include <mutex>
+#include <chrono>
+#include <thread>
 #include <vector>
 
 namespace gpu::ih
 {
 
-static std::vector<Entry>
-mWriteVector;
+/*
+ * Interrupt entries are written by the GPU thread into a bounded lock-free
+ * queue and read by the guest GPU7 interrupt handler.
+ *
+ * Each cell holds a sequence number which tells writers when it is free and
+ * the reader when it has been published, so writers only ever contend on
+ * the write position and the reader does not need any lock.
+ *
+ * The interrupt callback is only called when there is not already a delivery
+ * pending, so a burst of entries written before the guest interrupt handler
+ * runs is delivered as a single interrupt.  The reader clears the pending
+ * flag before draining the queue, so any entry published after that raises a
+ * new interrupt.
+ */
+static constexpr uint64_t QueueSize = 4096;
+static_assert((QueueSize & (QueueSize - 1)) == 0, "QueueSize must be power of 2");
+
+struct QueueCell
+{
+   std::atomic<uint64_t> sequence;
+   Entry entry;
+};
 
+struct Queue
+{
+   Queue()
+   {
+      for (auto i = 0u; i < cells.size(); ++i) {
+         cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+   }
+
+   std::array<QueueCell, QueueSize> cells;
+   alignas(64) std::atomic<uint64_t> writePosition { 0 };
+   alignas(64) uint64_t readPosition = 0;
+};
+
+static Queue
+sQueue;
+
+//! Entries returned by the last read, only used by the reader.
 static std::vector<Entry>
-mReadVector;
+sReadVector;
 
-static std::mutex
-sMutex;
+static std::atomic<bool>
+sDeliveryPending { false };
+
+//! Time the oldest undelivered interrupt was raised, or 0 if there is none.
+static std::atomic<clock::Time>
+sPendingSince { 0 };
 
 static InterruptCallbackFn
 sInterruptCallback = nullptr;
@@ -23,29 +67,112 @@ sInterruptCallback = nullptr;
 static std::atomic<uint32_t>
 sInterruptControl { 0u };
 
+static std::atomic<uint64_t>
+sEntriesWritten { 0 };
+
+static std::atomic<uint64_t>
+sInterruptsRaised { 0 };
+
+static std::atomic<uint64_t>
+sDeliveries { 0 };
+
+static std::atomic<uint64_t>
+sTotalDeliveryLatency { 0 };
+
+static std::atomic<uint64_t>
+sMaxDeliveryLatency { 0 };
+
+static void
+push(const Entry &entry)
+{
+   auto pos = sQueue.writePosition.load(std::memory_order_relaxed);
+   QueueCell *cell = nullptr;
+
+   while (true) {
+      cell = &sQueue.cells[pos & (QueueSize - 1)];
+      auto sequence = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<int64_t>(sequence - pos);
+
+      if (diff == 0) {
+         if (sQueue.writePosition.compare_exchange_weak(pos, pos + 1,
+                                                        std::memory_order_relaxed)) {
+            break;
+         }
+      } else if (diff < 0) {
+         // Queue is full, a delivery must already be pending so wait for the
+         // interrupt handler to drain it.
+         std::this_thread::yield();
+         pos = sQueue.writePosition.load(std::memory_order_relaxed);
+      } else {
+         pos = sQueue.writePosition.load(std::memory_order_relaxed);
+      }
+   }
+
+   cell->entry = entry;
+   cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
 void
 write(const Entries &entries)
 {
-   auto generateInterrupt = false;
+   if (entries.empty()) {
+      return;
+   }
 
-   {
-      std::unique_lock<std::mutex> lock { sMutex };
-      generateInterrupt = mWriteVector.empty();
-      mWriteVector.insert(mWriteVector.end(), entries.begin(), entries.end());
+   for (auto &entry : entries) {
+      push(entry);
    }
 
-   if (generateInterrupt && sInterruptCallback) {
-      sInterruptCallback();
+   sEntriesWritten.fetch_add(entries.size(), std::memory_order_relaxed);
+
+   auto expected = clock::Time { 0 };
+   sPendingSince.compare_exchange_strong(expected, clock::now());
+
+   if (!sDeliveryPending.exchange(true)) {
+      sInterruptsRaised.fetch_add(1, std::memory_order_relaxed);
+
+      if (sInterruptCallback) {
+         sInterruptCallback();
+      }
    }
 }
 
 Entries
 read()
 {
-   std::unique_lock<std::mutex> lock { sMutex };
-   mReadVector.clear();
-   mReadVector.swap(mWriteVector);
-   return mReadVector;
+   auto since = sPendingSince.exchange(0);
+   sDeliveryPending.store(false);
+   sReadVector.clear();
+
+   while (true) {
+      auto pos = sQueue.readPosition;
+      auto &cell = sQueue.cells[pos & (QueueSize - 1)];
+
+      if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+         break;
+      }
+
+      sReadVector.push_back(cell.entry);
+      cell.sequence.store(pos + QueueSize, std::memory_order_release);
+      sQueue.readPosition = pos + 1;
+   }
+
+   if (since) {
+      auto latency = static_cast<uint64_t>(
+         std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::duration { clock::now() - since }).count());
+      auto max = sMaxDeliveryLatency.load(std::memory_order_relaxed);
+
+      while (latency > max &&
+             !sMaxDeliveryLatency.compare_exchange_weak(max, latency,
+                                                        std::memory_order_relaxed)) {
+      }
+
+      sTotalDeliveryLatency.fetch_add(latency, std::memory_order_relaxed);
+      sDeliveries.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   return sReadVector;
 }
 
 /**
@@ -69,4 +196,30 @@ disable(latte::CP_INT_CNTL cntl)
    sInterruptControl &= ~cntl.value;
 }
 
+/**
+ * Sample the interrupt delivery counters.
+ */
+void
+sampleStats(Stats &stats)
+{
+   stats.entriesWritten = sEntriesWritten.load(std::memory_order_relaxed);
+   stats.interruptsRaised = sInterruptsRaised.load(std::memory_order_relaxed);
+   stats.deliveries = sDeliveries.load(std::memory_order_relaxed);
+   stats.totalDeliveryLatency = sTotalDeliveryLatency.load(std::memory_order_relaxed);
+   stats.maxDeliveryLatency = sMaxDeliveryLatency.load(std::memory_order_relaxed);
+}
+
+/**
+ * Reset the interrupt delivery counters.
+ */
+void
+resetStats()
+{
+   sEntriesWritten.store(0);
+   sInterruptsRaised.store(0);
+   sDeliveries.store(0);
+   sTotalDeliveryLatency.store(0);
+   sMaxDeliveryLatency.store(0);
+}
+
 } // namespace gpu::ih
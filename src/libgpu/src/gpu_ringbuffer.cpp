@@ -1,63 +1,300 @@
 #include "gpu_ringbuffer.h"
+#include "latte/latte_pm4.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <common/byte_swap.h>
 #include <condition_variable>
+#include <cstring>
+#include <limits>
 #include <mutex>
-#include <vector>
+#include <thread>
 
 namespace gpu::ringbuffer
 {
 
-static std::vector<uint32_t>
-mWriteVector;
+/*
+ * The ring buffer is a fixed size circular buffer of words which is written
+ * by the CPU threads and read by the GPU thread.
+ *
+ * Positions are 64 bit and only ever increase, the index into the buffer is
+ * position % RingBufferWords.
+ *
+ * Writers are serialised by sWriteMutex, which is never taken by the reader.
+ * A writer copies its words into the buffer and then publishes them by
+ * advancing sCommitPosition.  If the words would not fit before the end of
+ * the buffer the remaining space is skipped as padding.
+ *
+ * Writes larger than MaxWriteWords are split into pieces on PM4 packet
+ * boundaries, as the reader may see each piece separately and a packet must
+ * never be split across two reads.  The write mutex is held across all of the
+ * pieces so no other writer can interleave with them.
+ *
+ * The reader returns the committed words directly from the buffer without
+ * copying, they are released back to the writers on the next call to read or
+ * wait.
+ *
+ * The condition variables are only used when the reader or a writer actually
+ * has to sleep.
+ */
+static constexpr uint64_t RingBufferWords = 1024 * 1024;
+static constexpr uint64_t MaxWriteWords = RingBufferWords / 4;
+static constexpr unsigned ReaderSpinCount = 64;
 
-static std::vector<uint32_t>
-mReadVector;
+static std::array<uint32_t, RingBufferWords>
+sBuffer;
+
+//! Position up to which writers have published words.
+alignas(64) static std::atomic<uint64_t>
+sCommitPosition { 0 };
+
+//! Position up to which the reader has released words back to writers.
+alignas(64) static std::atomic<uint64_t>
+sReadPosition { 0 };
+
+//! End of the buffer most recently returned by read, only used by the reader.
+alignas(64) static uint64_t
+sReadEnd = 0;
+
+//! Start of the padding most recently inserted before the end of the buffer.
+static std::atomic<uint64_t>
+sPaddingPosition { std::numeric_limits<uint64_t>::max() };
+
+static std::atomic<bool>
+sPendingWake { false };
+
+static std::atomic<bool>
+sReaderWaiting { false };
+
+static std::atomic<unsigned>
+sWritersWaiting { 0 };
+
+static std::mutex
+sWriteMutex;
 
 static std::mutex
 sMutex;
 
 static std::condition_variable
-sConditionVariable;
+sReaderCondition;
+
+static std::condition_variable
+sWriterCondition;
 
 static bool
-sPendingWake = false;
+hasPendingData()
+{
+   return sCommitPosition.load() != sReadEnd;
+}
+
+static void
+notifyReader()
+{
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+
+   if (sReaderWaiting.load()) {
+      std::unique_lock<std::mutex> lock { sMutex };
+      sReaderCondition.notify_one();
+   }
+}
+
+static void
+waitForSpace(uint64_t end)
+{
+   std::unique_lock<std::mutex> lock { sMutex };
+   sWritersWaiting.fetch_add(1);
+
+   while (end - sReadPosition.load() > RingBufferWords) {
+      sWriterCondition.wait(lock);
+   }
+
+   sWritersWaiting.fetch_sub(1);
+}
+
+/**
+ * Returns the number of words from the start of words, up to MaxWriteWords,
+ * which end on a PM4 packet boundary.
+ */
+static uint64_t
+findWriteSplit(const uint32_t *words,
+               uint64_t size)
+{
+   auto pos = uint64_t { 0 };
+
+   while (pos < size) {
+      auto header = latte::pm4::Header::get(byte_swap(words[pos]));
+      auto packetSize = uint64_t { 1 };
+
+      switch (header.type()) {
+      case latte::pm4::PacketType::Type0:
+         packetSize = latte::pm4::HeaderType0::get(header.value).count() + 2;
+         break;
+      case latte::pm4::PacketType::Type3:
+         packetSize = latte::pm4::HeaderType3::get(header.value).size() + 2;
+         break;
+      default:
+         break;
+      }
+
+      if (pos + packetSize > MaxWriteWords) {
+         break;
+      }
+
+      pos += packetSize;
+   }
+
+   if (pos == 0) {
+      // Not a valid packet, the reader will reject it anyway
+      pos = MaxWriteWords;
+   }
+
+   return std::min(pos, size);
+}
+
+/**
+ * Copy words into the ring and publish them, the caller must hold
+ * sWriteMutex and size must be at most MaxWriteWords.
+ */
+static void
+writeWords(const uint32_t *words,
+           uint64_t size)
+{
+   auto start = sCommitPosition.load(std::memory_order_relaxed);
+   auto offset = start % RingBufferWords;
+   auto dataStart = start;
+
+   if (offset + size > RingBufferWords) {
+      // Skip to the start of the buffer
+      dataStart += RingBufferWords - offset;
+   }
+
+   auto end = dataStart + size;
+
+   if (end - sReadPosition.load(std::memory_order_acquire) > RingBufferWords) {
+      waitForSpace(end);
+   }
+
+   if (dataStart != start) {
+      sPaddingPosition.store(start, std::memory_order_relaxed);
+   }
+
+   std::memcpy(sBuffer.data() + (dataStart % RingBufferWords),
+               words,
+               size * sizeof(uint32_t));
+
+   sCommitPosition.store(end, std::memory_order_release);
+}
 
 void
 write(const Buffer &items)
 {
-   std::unique_lock<std::mutex> lock { sMutex };
-   mWriteVector.insert(mWriteVector.end(), items.begin(), items.end());
-   sConditionVariable.notify_all();
+   auto words = items.data();
+   auto size = static_cast<uint64_t>(items.size());
+   if (!size) {
+      return;
+   }
+
+   std::unique_lock<std::mutex> lock { sWriteMutex };
+
+   while (size > MaxWriteWords) {
+      auto pieceSize = findWriteSplit(words, size);
+      writeWords(words, pieceSize);
+      words += pieceSize;
+      size -= pieceSize;
+
+      // The reader must consume earlier pieces to make space for later ones
+      notifyReader();
+   }
+
+   writeWords(words, size);
+   lock.unlock();
+
+   notifyReader();
+}
+
+static void
+releaseRead()
+{
+   if (sReadPosition.load(std::memory_order_relaxed) != sReadEnd) {
+      sReadPosition.store(sReadEnd);
+
+      if (sWritersWaiting.load()) {
+         std::unique_lock<std::mutex> lock { sMutex };
+         sWriterCondition.notify_all();
+      }
+   }
 }
 
 Buffer
 read()
 {
-   std::unique_lock<std::mutex> lock { sMutex };
-   mReadVector.clear();
-   mReadVector.swap(mWriteVector);
-   return mReadVector;
+   // Release the previously read buffer back to the writers
+   releaseRead();
+
+   auto start = sReadEnd;
+   auto end = sCommitPosition.load(std::memory_order_acquire);
+   auto offset = start % RingBufferWords;
+   auto boundary = start + (RingBufferWords - offset);
+
+   if (end > boundary) {
+      // Committed words wrap around the end of the buffer, so only return up
+      // to the end of the buffer or the padding, or skip the padding if that
+      // is where we are.
+      auto padding = sPaddingPosition.load(std::memory_order_relaxed);
+
+      if (padding == start) {
+         start = boundary;
+         offset = 0;
+      } else if (padding > start && padding < boundary) {
+         end = padding;
+      } else {
+         end = boundary;
+      }
+   }
+
+   sReadEnd = end;
+   return { sBuffer.data() + offset, static_cast<size_t>(end - start) };
 }
 
 bool
 wait()
 {
-   std::unique_lock<std::mutex> lock { sMutex };
-   if (mWriteVector.empty() && !sPendingWake) {
-      sConditionVariable.wait(lock);
+   // Writers may be waiting for the previously read buffer to be released
+   releaseRead();
+
+   // Briefly give writers a chance to submit more before we go to sleep, as
+   // waking the reader for every small submission is very expensive.
+   for (auto i = 0u; i < ReaderSpinCount; ++i) {
+      if (hasPendingData() || sPendingWake.load()) {
+         break;
+      }
+
+      std::this_thread::yield();
    }
 
-   sPendingWake = false;
+   if (!hasPendingData() && !sPendingWake.load()) {
+      std::unique_lock<std::mutex> lock { sMutex };
+      sReaderWaiting.store(true);
 
-   return !mWriteVector.empty();
+      while (!hasPendingData() && !sPendingWake.load()) {
+         sReaderCondition.wait(lock);
+      }
+
+      sReaderWaiting.store(false);
+   }
+
+   sPendingWake.store(false);
+   return hasPendingData();
 }
 
 void
 wake()
 {
+   sPendingWake.store(true);
+
    std::unique_lock<std::mutex> lock { sMutex };
-   sPendingWake = true;
-   sConditionVariable.notify_all();
+   sReaderCondition.notify_all();
 }
 
 } // namespace gpu::ringbuffer
@@ -1,5 +1,7 @@
 #include "null_driver.h"
+#include "gpu_config.h"
 #include "gpu_event.h"
+#include "gpu_memory.h"
 #include "gpu_ringbuffer.h"
 
 #include <common/decaf_assert.h>
@@ -22,23 +24,42 @@ Driver::windowSizeChanged(int width, int height)
 {
 }
 
+bool
+Driver::processRingBuffer()
+{
+   if (!gpu::ringbuffer::wait()) {
+      return false;
+   }
+
+   auto buffer = gpu::ringbuffer::read();
+   if (!buffer.empty()) {
+      runCommandBuffer(buffer);
+   }
+
+   return true;
+}
+
 void
 Driver::run()
 {
+   mPm4Profiling = gpu::config()->debug.pm4_profiling;
    mRunning = true;
 
    while (mRunning) {
-      if (gpu::ringbuffer::wait()) {
-         auto items = gpu::ringbuffer::read();
-         // TODO: We need to actually process pm4 to do EVENT_WRITE_EOP for retired timestamps
-      }
+      processRingBuffer();
    }
 }
 
 void
 Driver::runUntilFlip()
 {
-   decaf_abort("NullDriver::runUntilFlip unimplemented");
+   auto startingSwap = mSwapCount;
+   mPm4Profiling = gpu::config()->debug.pm4_profiling;
+   mRunning = true;
+
+   while (mRunning && mSwapCount == startingSwap) {
+      processRingBuffer();
+   }
 }
 
 void
@@ -57,7 +78,8 @@ Driver::type()
 gpu::GraphicsDriverDebugInfo *
 Driver::getDebugInfo()
 {
-   return nullptr;
+   mDebugInfo.pm4 = mPm4Statistics;
+   return &mDebugInfo;
 }
 
 void
@@ -72,4 +94,155 @@ Driver::notifyGpuFlush(phys_addr address,
 {
 }
 
+void
+Driver::decafSetBuffer(const latte::pm4::DecafSetBuffer &data)
+{
+}
+
+void
+Driver::decafCopyColorToScan(const latte::pm4::DecafCopyColorToScan &data)
+{
+}
+
+void
+Driver::decafSwapBuffers(const latte::pm4::DecafSwapBuffers &data)
+{
+   static const auto weight = 0.9;
+   auto now = std::chrono::system_clock::now();
+
+   if (mLastSwap.time_since_epoch().count()) {
+      mAverageFrameTime = weight * mAverageFrameTime + (1.0 - weight) * (now - mLastSwap);
+   }
+
+   mLastSwap = now;
+   mDebugInfo.averageFrameTimeMS = mAverageFrameTime.count();
+
+   if (mDebugInfo.averageFrameTimeMS > 0.0) {
+      mDebugInfo.averageFps = 1000.0 / mDebugInfo.averageFrameTimeMS;
+   } else {
+      mDebugInfo.averageFps = 0.0;
+   }
+
+   ++mSwapCount;
+   gpu::onFlip();
+}
+
+void
+Driver::decafClearColor(const latte::pm4::DecafClearColor &data)
+{
+}
+
+void
+Driver::decafClearDepthStencil(const latte::pm4::DecafClearDepthStencil &data)
+{
+}
+
+void
+Driver::decafOSScreenFlip(const latte::pm4::DecafOSScreenFlip &data)
+{
+   ++mSwapCount;
+   gpu::onFlip();
+}
+
+void
+Driver::decafCopySurface(const latte::pm4::DecafCopySurface &data)
+{
+}
+
+void
+Driver::decafExpandColorBuffer(const latte::pm4::DecafExpandColorBuffer &data)
+{
+}
+
+void
+Driver::drawIndexAuto(const latte::pm4::DrawIndexAuto &data)
+{
+}
+
+void
+Driver::drawIndex2(const latte::pm4::DrawIndex2 &data)
+{
+}
+
+void
+Driver::drawIndexImmd(const latte::pm4::DrawIndexImmd &data)
+{
+}
+
+void
+Driver::memWrite(const latte::pm4::MemWrite &data)
+{
+   // There is nothing in flight, so the write can land immediately
+   decodeMemWrite(data).apply();
+}
+
+void
+Driver::eventWrite(const latte::pm4::EventWrite &data)
+{
+   if (data.eventInitiator.EVENT_TYPE() == latte::VGT_EVENT_TYPE::ZPASS_DONE) {
+      // Nothing is rendered so every occlusion query sample is zero, which
+      // gives a result of zero for the begin and end pair.
+      auto addr = phys_addr { data.addrLo.ADDR_LO() << 2 };
+      *reinterpret_cast<uint64_t *>(gpu::internal::translateAddress(addr)) = 0;
+   }
+}
+
+void
+Driver::eventWriteEOP(const latte::pm4::EventWriteEOP &data)
+{
+   // Write event data to memory if required
+   if (auto write = decodeEventWriteEOP(data)) {
+      write->apply();
+   }
+
+   // Generate interrupt if required
+   if (data.addrHi.INT_SEL() != latte::pm4::EWP_INT_NONE) {
+      writeEndOfPipeInterrupt();
+   }
+}
+
+void
+Driver::pfpSyncMe(const latte::pm4::PfpSyncMe &data)
+{
+   // Every previous packet has already completed.
+}
+
+void
+Driver::setPredication(const latte::pm4::SetPredication &data)
+{
+   // Predication only affects draws, which we skip anyway.
+}
+
+void
+Driver::streamOutBaseUpdate(const latte::pm4::StreamOutBaseUpdate &data)
+{
+}
+
+void
+Driver::streamOutBufferUpdate(const latte::pm4::StreamOutBufferUpdate &data)
+{
+   auto bufferIdx = data.control.SELECT_BUFFER();
+
+   // No draws are executed so the buffer offsets only change when they are
+   // loaded, the offsets are stored in the same raw form as we read them.
+   if (data.control.STORE_BUFFER_FILLED_SIZE()) {
+      decaf_check(data.dstLo);
+      auto dstPtr = gpu::internal::translateAddress(data.dstLo);
+      *reinterpret_cast<uint32_t *>(dstPtr) = mStreamOutOffset[bufferIdx];
+   }
+
+   if (data.control.OFFSET_SOURCE() == STRMOUT_OFFSET_SOURCE::STRMOUT_OFFSET_FROM_MEM) {
+      decaf_check(data.srcLo);
+      auto srcPtr = gpu::internal::translateAddress(data.srcLo);
+      mStreamOutOffset[bufferIdx] = *reinterpret_cast<uint32_t *>(srcPtr);
+   } else if (data.control.OFFSET_SOURCE() == STRMOUT_OFFSET_SOURCE::STRMOUT_OFFSET_FROM_PACKET) {
+      mStreamOutOffset[bufferIdx] = static_cast<uint32_t>(data.srcLo);
+   }
+}
+
+void
+Driver::surfaceSync(const latte::pm4::SurfaceSync &data)
+{
+}
+
 } // namespace null
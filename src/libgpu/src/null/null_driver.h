@@ -1,10 +1,21 @@
 #pragma once
 #include "gpu_graphicsdriver.h"
+#include "pm4_processor.h"
+
+#include <array>
+#include <chrono>
 
 namespace null
 {
 
-class Driver : public gpu::GraphicsDriver
+/*
+ * The null driver executes the PM4 command stream without rendering anything.
+ *
+ * Every packet with a side effect visible to the guest (memory writes, end
+ * of pipe events, interrupts, register shadowing, stream out offsets and
+ * flips) is executed, whereas draws, clears and surface copies are skipped.
+ */
+class Driver : public gpu::GraphicsDriver, public Pm4Processor
 {
 public:
    virtual ~Driver() = default;
@@ -23,8 +34,42 @@ public:
    virtual void notifyCpuFlush(phys_addr address, uint32_t size) override;
    virtual void notifyGpuFlush(phys_addr address, uint32_t size) override;
 
+private:
+   // Pm4Processor
+   virtual void decafSetBuffer(const latte::pm4::DecafSetBuffer &data) override;
+   virtual void decafCopyColorToScan(const latte::pm4::DecafCopyColorToScan &data) override;
+   virtual void decafSwapBuffers(const latte::pm4::DecafSwapBuffers &data) override;
+   virtual void decafClearColor(const latte::pm4::DecafClearColor &data) override;
+   virtual void decafClearDepthStencil(const latte::pm4::DecafClearDepthStencil &data) override;
+   virtual void decafOSScreenFlip(const latte::pm4::DecafOSScreenFlip &data) override;
+   virtual void decafCopySurface(const latte::pm4::DecafCopySurface &data) override;
+   virtual void decafExpandColorBuffer(const latte::pm4::DecafExpandColorBuffer &data) override;
+   virtual void drawIndexAuto(const latte::pm4::DrawIndexAuto &data) override;
+   virtual void drawIndex2(const latte::pm4::DrawIndex2 &data) override;
+   virtual void drawIndexImmd(const latte::pm4::DrawIndexImmd &data) override;
+   virtual void memWrite(const latte::pm4::MemWrite &data) override;
+   virtual void eventWrite(const latte::pm4::EventWrite &data) override;
+   virtual void eventWriteEOP(const latte::pm4::EventWriteEOP &data) override;
+   virtual void pfpSyncMe(const latte::pm4::PfpSyncMe &data) override;
+   virtual void setPredication(const latte::pm4::SetPredication &data) override;
+   virtual void streamOutBaseUpdate(const latte::pm4::StreamOutBaseUpdate &data) override;
+   virtual void streamOutBufferUpdate(const latte::pm4::StreamOutBufferUpdate &data) override;
+   virtual void surfaceSync(const latte::pm4::SurfaceSync &data) override;
+
+   bool processRingBuffer();
+
 private:
    bool mRunning = false;
+
+   //! Number of DECAF_SWAP_BUFFERS packets executed, used by runUntilFlip.
+   uint64_t mSwapCount = 0;
+
+   //! Current stream out buffer offsets, as they would be stored by the GPU.
+   std::array<uint32_t, 4> mStreamOutOffset = { 0 };
+
+   std::chrono::time_point<std::chrono::system_clock> mLastSwap;
+   std::chrono::duration<double, std::milli> mAverageFrameTime { 0.0 };
+   gpu::GraphicsDriverDebugInfo mDebugInfo;
 };
 
 } // namespace null
@@ -1,8 +1,12 @@
+#include "latte/latte_endian.h"
 #include "latte/latte_pm4_reader.h"
+#include "gpu_clock.h"
+#include "gpu_ih.h"
 #include "gpu_memory.h"
 #include "pm4_processor.h"
 
 #include <common/byte_swap_array.h>
+#include <common/decaf_assert.h>
 #include <common/log.h>
 #include <libcpu/mmu.h>
 
@@ -20,22 +24,28 @@ Pm4Processor::indirectBufferCallPriv(const IndirectBufferCallPriv &data)
    runCommandBuffer({ buffer, data.size });
 }
 
+/**
+ * Decode a command buffer directly from guest memory.
+ *
+ * The buffer is big endian, headers and scalar packet fields are swapped as
+ * they are read and register payloads are swapped straight into the register
+ * file, so the buffer is only ever read once.
+ */
 void
 Pm4Processor::runCommandBuffer(const gpu::ringbuffer::Buffer &buffer)
 {
-   decaf_check(mSwapScratchDepth + 1 < MaxPm4IndirectDepth);
-   auto& scratchBuffer = mSwapScratch[mSwapScratchDepth++];
+   decaf_check(mIndirectDepth + 1 < MaxPm4IndirectDepth);
+   mIndirectDepth++;
 
-   auto numDwords = buffer.size();
-   auto swappedBytes = byte_swap_to_scratch<uint32_t>(
-      buffer.data(), static_cast<uint32_t>(buffer.size_bytes()), scratchBuffer);
-   auto swapped = reinterpret_cast<uint32_t*>(swappedBytes);
+   auto words = gsl::make_span(reinterpret_cast<be2_val<uint32_t> *>(buffer.data()),
+                               buffer.size());
+   auto numDwords = words.size();
 
    for (auto pos = 0u; pos < numDwords; ) {
-      auto header = *reinterpret_cast<Header *>(&swapped[pos]);
+      auto header = Header::get(words[pos].value());
       auto size = 0u;
 
-      if (swapped[pos] == 0) {
+      if (header.value == 0) {
          break;
       }
 
@@ -46,7 +56,14 @@ Pm4Processor::runCommandBuffer(const gpu::ringbuffer::Buffer &buffer)
          size = header3.size() + 1;
 
          decaf_check(pos + size <= numDwords);
-         handlePacketType3(header3, gsl::make_span(&swapped[pos + 1], size));
+
+         if (mPm4Profiling) {
+            auto start = std::chrono::steady_clock::now();
+            handlePacketType3(header3, words.subspan(pos + 1, size));
+            recordPacketTime(mPm4Statistics.type3[static_cast<size_t>(header3.opcode())], start);
+         } else {
+            handlePacketType3(header3, words.subspan(pos + 1, size));
+         }
          break;
       }
       case PacketType::Type0:
@@ -55,7 +72,14 @@ Pm4Processor::runCommandBuffer(const gpu::ringbuffer::Buffer &buffer)
          size = header0.count() + 1;
 
          decaf_check(pos + size <= numDwords);
-         handlePacketType0(header0, gsl::make_span(&swapped[pos + 1], size));
+
+         if (mPm4Profiling) {
+            auto start = std::chrono::steady_clock::now();
+            handlePacketType0(header0, words.subspan(pos + 1, size));
+            recordPacketTime(mPm4Statistics.type0, start);
+         } else {
+            handlePacketType0(header0, words.subspan(pos + 1, size));
+         }
          break;
       }
       case PacketType::Type2:
@@ -74,20 +98,29 @@ Pm4Processor::runCommandBuffer(const gpu::ringbuffer::Buffer &buffer)
       pos += size + 1;
    }
 
-   mSwapScratchDepth--;
+   mIndirectDepth--;
 }
 
 void
-Pm4Processor::handlePacketType0(HeaderType0 header, const gsl::span<uint32_t> &data)
+Pm4Processor::recordPacketTime(gpu::Pm4PacketStatistics &stats,
+                               std::chrono::steady_clock::time_point start)
+{
+   auto elapsed = std::chrono::steady_clock::now() - start;
+   stats.count++;
+   stats.timeNS += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+void
+Pm4Processor::handlePacketType0(HeaderType0 header, const gsl::span<be2_val<uint32_t>> &data)
 {
    auto base = static_cast<latte::Register>(header.baseIndex() * 4);
    setRegisters(base, data);
 }
 
 void
-Pm4Processor::handlePacketType3(HeaderType3 header, const gsl::span<uint32_t> &data)
+Pm4Processor::handlePacketType3(HeaderType3 header, const gsl::span<be2_val<uint32_t>> &data)
 {
-   PacketReader reader{ data };
+   BigEndianPacketReader reader { data, mPacketScratch };
 
    switch (header.opcode()) {
    case IT_OPCODE::DECAF_COPY_COLOR_TO_SCAN:
@@ -130,25 +163,25 @@ Pm4Processor::handlePacketType3(HeaderType3 header, const gsl::span<uint32_t> &d
       numInstances(read<NumInstances>(reader));
       break;
    case IT_OPCODE::SET_ALU_CONST:
-      setAluConsts(read<SetAluConsts>(reader));
+      setAluConsts(read<SetAluConstsBE>(reader));
       break;
    case IT_OPCODE::SET_CONFIG_REG:
-      setConfigRegs(read<SetConfigRegs>(reader));
+      setConfigRegs(read<SetConfigRegsBE>(reader));
       break;
    case IT_OPCODE::SET_CONTEXT_REG:
-      setContextRegs(read<SetContextRegs>(reader));
+      setContextRegs(read<SetContextRegsBE>(reader));
       break;
    case IT_OPCODE::SET_CTL_CONST:
-      setControlConstants(read<SetControlConstants>(reader));
+      setControlConstants(read<SetControlConstantsBE>(reader));
       break;
    case IT_OPCODE::SET_LOOP_CONST:
-      setLoopConsts(read<SetLoopConsts>(reader));
+      setLoopConsts(read<SetLoopConstsBE>(reader));
       break;
    case IT_OPCODE::SET_SAMPLER:
-      setSamplers(read<SetSamplers>(reader));
+      setSamplers(read<SetSamplersBE>(reader));
       break;
    case IT_OPCODE::SET_RESOURCE:
-      setResources(read<SetResources>(reader));
+      setResources(read<SetResourcesBE>(reader));
       break;
    case IT_OPCODE::LOAD_CONFIG_REG:
       loadConfigRegs(read<LoadConfigReg>(reader));
@@ -202,7 +235,7 @@ Pm4Processor::handlePacketType3(HeaderType3 header, const gsl::span<uint32_t> &d
       streamOutBufferUpdate(read<StreamOutBufferUpdate>(reader));
       break;
    case IT_OPCODE::NOP:
-      nopPacket(read<Nop>(reader));
+      nopPacket(read<NopBE>(reader));
       break;
    case IT_OPCODE::SURFACE_SYNC:
       surfaceSync(read<SurfaceSync>(reader));
@@ -218,7 +251,7 @@ Pm4Processor::handlePacketType3(HeaderType3 header, const gsl::span<uint32_t> &d
    }
 }
 
-void Pm4Processor::nopPacket(const Nop &data)
+void Pm4Processor::nopPacket(const NopBE &data)
 {
    auto str = std::string{};
 
@@ -271,11 +304,100 @@ void Pm4Processor::copyDw(const CopyDw &data)
    mRegAddr_VGT_STRMOUT_DRAW_OPAQUE_BUFFER_FILLED_SIZE = data.srcLo;
 }
 
+void
+Pm4Processor::MemoryWrite::apply() const
+{
+   if (is64Bit) {
+      *reinterpret_cast<uint64_t *>(ptr) = value;
+   } else {
+      *reinterpret_cast<uint32_t *>(ptr) = static_cast<uint32_t>(value);
+   }
+}
+
+Pm4Processor::MemoryWrite
+Pm4Processor::decodeMemWrite(const MemWrite &data)
+{
+   auto addr = phys_addr { data.addrLo.ADDR_LO() << 2 };
+   auto write = MemoryWrite { };
+   write.ptr = gpu::internal::translateAddress(addr);
+   write.is64Bit = !data.addrHi.DATA32();
+
+   // Read value
+   if (data.addrHi.CNTR_SEL() == latte::pm4::MW_WRITE_CLOCK) {
+      write.value = gpu::clock::now();
+   } else if (data.addrHi.DATA32()) {
+      write.value = static_cast<uint64_t>(data.dataLo);
+   } else {
+      write.value = static_cast<uint64_t>(data.dataLo) |
+                    (static_cast<uint64_t>(data.dataHi) << 32);
+   }
+
+   // Swap value
+   write.value = latte::applyEndianSwap(write.value, data.addrLo.ENDIAN_SWAP());
+   return write;
+}
+
+std::optional<Pm4Processor::MemoryWrite>
+Pm4Processor::decodeEventWriteEOP(const EventWriteEOP &data)
+{
+   if (data.addrHi.DATA_SEL() == latte::pm4::EWP_DATA_DISCARD) {
+      return { };
+   }
+
+   auto addr = phys_addr { data.addrLo.ADDR_LO() << 2 };
+   auto write = MemoryWrite { };
+   write.ptr = gpu::internal::translateAddress(addr);
+   decaf_assert(data.addrHi.ADDR_HI() == 0, "Invalid event write address (high word not zero)");
+
+   // Read value
+   switch (data.addrHi.DATA_SEL()) {
+   case latte::pm4::EWP_DATA_32:
+      write.value = data.dataLo;
+      break;
+   case latte::pm4::EWP_DATA_64:
+      write.value = static_cast<uint64_t>(data.dataLo) |
+                    (static_cast<uint64_t>(data.dataHi) << 32);
+      write.is64Bit = true;
+      break;
+   case latte::pm4::EWP_DATA_CLOCK:
+      write.value = gpu::clock::now();
+      write.is64Bit = true;
+      break;
+   default:
+      return { };
+   }
+
+   // Swap value
+   write.value = latte::applyEndianSwap(write.value, data.addrLo.ENDIAN_SWAP());
+   return write;
+}
+
+void
+Pm4Processor::writeEndOfPipeInterrupt()
+{
+   auto interrupt = gpu::ih::Entry { };
+   interrupt.word0 = latte::CP_INT_SRC_ID::CP_EOP_EVENT;
+   gpu::ih::write(interrupt);
+}
+
 void Pm4Processor::shadowWrite(phys_ptr<uint32_t> memory,
-                                   const gsl::span<uint32_t> &registers)
+                               const gsl::span<be2_val<uint32_t>> &registers)
 {
    // Shadow memory is not byte-swapped
-   memcpy(memory.getRawPointer(), registers.data(), registers.size_bytes());
+   byte_swap_copy(memory.getRawPointer(),
+                  reinterpret_cast<const uint32_t *>(registers.data()),
+                  registers.size());
+}
+
+void
+Pm4Processor::clearVertexSemantics(uint32_t clearFlags)
+{
+   auto clearRegBase = latte::Register::SQ_VTX_SEMANTIC_0 / 4;
+   for (auto i = 0u; i < 32; ++i) {
+      if (clearFlags & (1 << i)) {
+         mRegisters[clearRegBase + i] = 0xffffffff;
+      }
+   }
 }
 
 void
@@ -284,20 +406,29 @@ Pm4Processor::setRegisters(latte::Register base,
 {
    if (latte::Register::SQ_VTX_SEMANTIC_CLEAR >= base &&
          latte::Register::SQ_VTX_SEMANTIC_CLEAR < base + values.size_bytes()) {
-      auto clearRegBase = latte::Register::SQ_VTX_SEMANTIC_0 / 4;
       auto valueIdx = (latte::Register::SQ_VTX_SEMANTIC_CLEAR - base) / 4;
-      auto clearFlags = values[valueIdx];
-      for (auto i = 0u; i < 32; ++i) {
-         if (clearFlags & (1 << i)) {
-            mRegisters[clearRegBase + i] = 0xffffffff;
-         }
-      }
+      clearVertexSemantics(values[valueIdx]);
    }
 
    memcpy(&mRegisters[base / 4], values.data(), values.size_bytes());
 }
 
-void Pm4Processor::setAluConsts(const SetAluConsts &data)
+void
+Pm4Processor::setRegisters(latte::Register base,
+                           const gsl::span<be2_val<uint32_t>> &values)
+{
+   if (latte::Register::SQ_VTX_SEMANTIC_CLEAR >= base &&
+         latte::Register::SQ_VTX_SEMANTIC_CLEAR < base + values.size_bytes()) {
+      auto valueIdx = (latte::Register::SQ_VTX_SEMANTIC_CLEAR - base) / 4;
+      clearVertexSemantics(values[valueIdx]);
+   }
+
+   byte_swap_copy(&mRegisters[base / 4],
+                  reinterpret_cast<const uint32_t *>(values.data()),
+                  values.size());
+}
+
+void Pm4Processor::setAluConsts(const SetAluConstsBE &data)
 {
    decaf_check(data.id >= latte::Register::AluConstRegisterBase);
    decaf_check(data.id < latte::Register::AluConstRegisterEnd);
@@ -310,7 +441,7 @@ void Pm4Processor::setAluConsts(const SetAluConsts &data)
    setRegisters(data.id, data.values);
 }
 
-void Pm4Processor::setConfigRegs(const SetConfigRegs &data)
+void Pm4Processor::setConfigRegs(const SetConfigRegsBE &data)
 {
    decaf_check(data.id >= latte::Register::ConfigRegisterBase);
    decaf_check(data.id < latte::Register::ConfigRegisterEnd);
@@ -323,7 +454,7 @@ void Pm4Processor::setConfigRegs(const SetConfigRegs &data)
    setRegisters(data.id, data.values);
 }
 
-void Pm4Processor::setContextRegs(const SetContextRegs &data)
+void Pm4Processor::setContextRegs(const SetContextRegsBE &data)
 {
    decaf_check(data.id >= latte::Register::ContextRegisterBase);
    decaf_check(data.id < latte::Register::ContextRegisterEnd);
@@ -336,7 +467,7 @@ void Pm4Processor::setContextRegs(const SetContextRegs &data)
    setRegisters(data.id, data.values);
 }
 
-void Pm4Processor::setControlConstants(const SetControlConstants &data)
+void Pm4Processor::setControlConstants(const SetControlConstantsBE &data)
 {
    decaf_check(data.id >= latte::Register::ControlRegisterBase);
    decaf_check(data.id < latte::Register::ControlRegisterEnd);
@@ -349,7 +480,7 @@ void Pm4Processor::setControlConstants(const SetControlConstants &data)
    setRegisters(data.id, data.values);
 }
 
-void Pm4Processor::setLoopConsts(const SetLoopConsts &data)
+void Pm4Processor::setLoopConsts(const SetLoopConstsBE &data)
 {
    decaf_check(data.id >= latte::Register::LoopConstRegisterBase);
    decaf_check(data.id < latte::Register::LoopConstRegisterEnd);
@@ -362,7 +493,7 @@ void Pm4Processor::setLoopConsts(const SetLoopConsts &data)
    setRegisters(data.id, data.values);
 }
 
-void Pm4Processor::setSamplers(const SetSamplers &data)
+void Pm4Processor::setSamplers(const SetSamplersBE &data)
 {
    decaf_check(data.id >= latte::Register::SamplerRegisterBase);
    decaf_check(data.id < latte::Register::SamplerRegisterEnd);
@@ -375,7 +506,7 @@ void Pm4Processor::setSamplers(const SetSamplers &data)
    setRegisters(data.id, data.values);
 }
 
-void Pm4Processor::setResources(const SetResources &data)
+void Pm4Processor::setResources(const SetResourcesBE &data)
 {
    if (mShadowState.SHADOW_ENABLE.ENABLE_RESOURCE() && mShadowState.RESOURCE_CONST_BASE) {
       shadowWrite(mShadowState.RESOURCE_CONST_BASE + data.id, data.values);
@@ -1,10 +1,12 @@
 #pragma once
 #include "latte/latte_pm4_commands.h"
+#include "gpu_graphicsdriver.h"
 #include "gpu_ringbuffer.h"
 
 #include <array>
-#include <common/byte_swap_array.h>
+#include <chrono>
 #include <libcpu/pointer.h>
+#include <optional>
 #include <vector>
 
 using namespace latte::pm4;
@@ -38,9 +40,9 @@ protected:
    virtual void streamOutBufferUpdate(const StreamOutBufferUpdate &data) = 0;
    virtual void surfaceSync(const SurfaceSync &data) = 0;
 
-   void handlePacketType0(HeaderType0 header, const gsl::span<uint32_t> &data);
-   void handlePacketType3(HeaderType3 header, const gsl::span<uint32_t> &data);
-   void nopPacket(const Nop &data);
+   void handlePacketType0(HeaderType0 header, const gsl::span<be2_val<uint32_t>> &data);
+   void handlePacketType3(HeaderType3 header, const gsl::span<be2_val<uint32_t>> &data);
+   void nopPacket(const NopBE &data);
    void indirectBufferCall(const IndirectBufferCall &data);
    void indirectBufferCallPriv(const IndirectBufferCallPriv &data);
    void indexType(const IndexType &data);
@@ -48,15 +50,17 @@ protected:
    void contextControl(const ContextControl &data);
    void copyDw(const CopyDw &data);
 
-   void setAluConsts(const SetAluConsts &data);
-   void setConfigRegs(const SetConfigRegs &data);
-   void setContextRegs(const SetContextRegs &data);
-   void setControlConstants(const SetControlConstants &data);
-   void setLoopConsts(const SetLoopConsts &data);
-   void setSamplers(const SetSamplers &data);
-   void setResources(const SetResources &data);
-   void shadowWrite(phys_ptr<uint32_t> address, const gsl::span<uint32_t> &registers);
+   void setAluConsts(const SetAluConstsBE &data);
+   void setConfigRegs(const SetConfigRegsBE &data);
+   void setContextRegs(const SetContextRegsBE &data);
+   void setControlConstants(const SetControlConstantsBE &data);
+   void setLoopConsts(const SetLoopConstsBE &data);
+   void setSamplers(const SetSamplersBE &data);
+   void setResources(const SetResourcesBE &data);
+   void shadowWrite(phys_ptr<uint32_t> address, const gsl::span<be2_val<uint32_t>> &registers);
+   void clearVertexSemantics(uint32_t clearFlags);
    void setRegisters(latte::Register base, const gsl::span<uint32_t> &values);
+   void setRegisters(latte::Register base, const gsl::span<be2_val<uint32_t>> &values);
 
    void loadAluConsts(const LoadAluConst &data);
    void loadBoolConsts(const LoadBoolConst &data);
@@ -71,12 +75,25 @@ protected:
                       const gsl::span<std::pair<uint32_t, uint32_t>> &registers);
 
    void runCommandBuffer(const gpu::ringbuffer::Buffer &buffer);
+   void recordPacketTime(gpu::Pm4PacketStatistics &stats,
+                         std::chrono::steady_clock::time_point start);
 
-   uint32_t *byteSwapRegValues(uint32_t *values, size_t numValues)
+   /*
+    * A memory write decoded from a MEM_WRITE or EVENT_WRITE_EOP packet, the
+    * driver decides when it lands in guest memory.
+    */
+   struct MemoryWrite
    {
-      return reinterpret_cast<uint32_t*>(byte_swap_to_scratch<uint32_t>(
-         values, static_cast<uint32_t>(numValues) * sizeof(uint32_t), mRegisterScratch));
-   }
+      void *ptr = nullptr;
+      uint64_t value = 0;
+      bool is64Bit = false;
+
+      void apply() const;
+   };
+
+   static MemoryWrite decodeMemWrite(const MemWrite &data);
+   static std::optional<MemoryWrite> decodeEventWriteEOP(const EventWriteEOP &data);
+   static void writeEndOfPipeInterrupt();
 
    template<typename Type>
    Type getRegister(uint32_t id)
@@ -99,7 +116,11 @@ protected:
    std::array<uint32_t, 0x10000> mRegisters = { 0 };
    phys_addr mRegAddr_VGT_STRMOUT_DRAW_OPAQUE_BUFFER_FILLED_SIZE = phys_addr { 0 };
 
-   std::vector<uint8_t> mRegisterScratch;
-   std::array<std::vector<uint8_t>, MaxPm4IndirectDepth> mSwapScratch;
-   uint32_t mSwapScratchDepth = 0;
+   //! Holds the swapped payload of packets which are not read in place.
+   std::vector<uint32_t> mPacketScratch;
+   uint32_t mIndirectDepth = 0;
+
+   //! Count and time every packet into mPm4Statistics.
+   bool mPm4Profiling = false;
+   gpu::Pm4Statistics mPm4Statistics;
 };
@@ -0,0 +1,486 @@
+#ifdef DECAF_VULKAN
+#include "spirv_shadercache.h"
+
+#include <common/datahash.h>
+#include <common/log.h>
+#include <common/platform_dir.h>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+
+namespace spirv
+{
+
+static constexpr uint32_t CacheMagic = 0x43565053; // "SPVC"
+
+struct CacheFileHeader
+{
+   uint32_t magic;
+   uint32_t version;
+};
+
+struct CacheRecordHeader
+{
+   uint64_t key;
+   ShaderType type;
+   uint32_t size;
+};
+
+class RecordWriter
+{
+public:
+   RecordWriter(std::vector<uint8_t> &data) :
+      mData(data)
+   {
+      mData.clear();
+   }
+
+   template<typename Type>
+   void
+   write(const Type &value)
+   {
+      static_assert(std::is_trivially_copyable<Type>::value, "Serialised types must be trivial");
+      auto pos = mData.size();
+      mData.resize(pos + sizeof(Type));
+      std::memcpy(mData.data() + pos, &value, sizeof(Type));
+   }
+
+   template<typename Type>
+   void
+   write(const std::vector<Type> &values)
+   {
+      static_assert(std::is_trivially_copyable<Type>::value, "Serialised types must be trivial");
+      write(static_cast<uint32_t>(values.size()));
+
+      auto pos = mData.size();
+      mData.resize(pos + values.size() * sizeof(Type));
+
+      if (!values.empty()) {
+         std::memcpy(mData.data() + pos, values.data(), values.size() * sizeof(Type));
+      }
+   }
+
+private:
+   std::vector<uint8_t> &mData;
+};
+
+class RecordReader
+{
+public:
+   RecordReader(const std::vector<uint8_t> &data) :
+      mData(data)
+   {
+   }
+
+   template<typename Type>
+   bool
+   read(Type &value)
+   {
+      static_assert(std::is_trivially_copyable<Type>::value, "Serialised types must be trivial");
+      if (mPosition + sizeof(Type) > mData.size()) {
+         return false;
+      }
+
+      std::memcpy(&value, mData.data() + mPosition, sizeof(Type));
+      mPosition += sizeof(Type);
+      return true;
+   }
+
+   template<typename Type>
+   bool
+   read(std::vector<Type> &values)
+   {
+      static_assert(std::is_trivially_copyable<Type>::value, "Serialised types must be trivial");
+      auto count = uint32_t { 0 };
+      if (!read(count)) {
+         return false;
+      }
+
+      if (mPosition + count * sizeof(Type) > mData.size()) {
+         return false;
+      }
+
+      values.resize(count);
+
+      if (count) {
+         std::memcpy(values.data(), mData.data() + mPosition, count * sizeof(Type));
+      }
+
+      mPosition += count * sizeof(Type);
+      return true;
+   }
+
+   bool
+   atEnd() const
+   {
+      return mPosition == mData.size();
+   }
+
+private:
+   const std::vector<uint8_t> &mData;
+   size_t mPosition = 0;
+};
+
+/**
+ * Calculate the cache key for a shader from its description with the guest
+ * binary pointers cleared, followed by the contents of those binaries.
+ */
+template<typename DescType>
+static uint64_t
+computeKey(DescType desc,
+           std::initializer_list<gsl::span<const uint8_t>> binaries)
+{
+   auto data = std::vector<uint8_t> { };
+   auto writer = RecordWriter { data };
+   writer.write(desc);
+
+   for (auto &binary : binaries) {
+      writer.write(static_cast<uint32_t>(binary.size()));
+
+      auto pos = data.size();
+      data.resize(pos + binary.size());
+
+      if (!binary.empty()) {
+         std::memcpy(data.data() + pos, binary.data(), binary.size());
+      }
+   }
+
+   return DataHash {}.write(data.data(), data.size()).value();
+}
+
+uint64_t
+ShaderCache::getKey(const VertexShaderDesc &desc)
+{
+   auto keyDesc = desc;
+   keyDesc.binary = {};
+   keyDesc.fsBinary = {};
+   return computeKey(keyDesc, { desc.binary, desc.fsBinary });
+}
+
+uint64_t
+ShaderCache::getKey(const GeometryShaderDesc &desc)
+{
+   auto keyDesc = desc;
+   keyDesc.binary = {};
+   keyDesc.dcBinary = {};
+   return computeKey(keyDesc, { desc.binary, desc.dcBinary });
+}
+
+uint64_t
+ShaderCache::getKey(const PixelShaderDesc &desc)
+{
+   auto keyDesc = desc;
+   keyDesc.binary = {};
+   return computeKey(keyDesc, { desc.binary });
+}
+
+ShaderCache::~ShaderCache()
+{
+   close();
+}
+
+/**
+ * Set the path of the cache file, an empty path disables the cache.
+ *
+ * The file is not opened until the cache is first used.
+ */
+void
+ShaderCache::setPath(const std::string &path)
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+
+   if (mFile.is_open()) {
+      mFile.close();
+   }
+
+   mPath = path;
+   mLoaded = false;
+   mEndOffset = 0;
+   mRecords.clear();
+}
+
+void
+ShaderCache::close()
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+
+   if (mFile.is_open()) {
+      mFile.close();
+   }
+}
+
+/**
+ * Open the cache file and index the records in it.
+ */
+bool
+ShaderCache::load()
+{
+   if (mLoaded) {
+      return mFile.is_open();
+   }
+
+   mLoaded = true;
+
+   if (mPath.empty()) {
+      return false;
+   }
+
+   auto error = std::error_code { };
+   auto fileSize = uint64_t { 0 };
+   auto validSize = uint64_t { 0 };
+
+   if (std::filesystem::exists(mPath, error)) {
+      fileSize = std::filesystem::file_size(mPath, error);
+
+      auto file = std::ifstream { mPath, std::ifstream::in | std::ifstream::binary };
+      auto header = CacheFileHeader { };
+
+      if (file.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+          header.magic == CacheMagic &&
+          header.version == TranspilerVersion) {
+         validSize = sizeof(CacheFileHeader);
+
+         // Index records until the end of the file or a truncated record, which
+         // we can get if we were killed while writing it.
+         auto record = CacheRecordHeader { };
+         while (file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+            auto offset = validSize + sizeof(CacheRecordHeader);
+            if (offset + record.size > fileSize) {
+               break;
+            }
+
+            mRecords[record.key] = Record { offset, record.size };
+            validSize = offset + record.size;
+            file.seekg(validSize);
+         }
+      } else {
+         gLog->info("Discarding out of date shader cache {}", mPath);
+      }
+   }
+
+   if (validSize == 0) {
+      // Start a new cache file
+      platform::createParentDirectories(mPath);
+
+      auto file = std::ofstream { mPath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc };
+      auto header = CacheFileHeader { CacheMagic, TranspilerVersion };
+
+      if (!file.write(reinterpret_cast<const char *>(&header), sizeof(header))) {
+         gLog->warn("Failed to create shader cache {}", mPath);
+         return false;
+      }
+
+      validSize = sizeof(CacheFileHeader);
+   } else if (validSize < fileSize) {
+      // Drop the truncated record so new records can be appended after the
+      // last valid one.
+      std::filesystem::resize_file(mPath, validSize, error);
+   }
+
+   mFile.open(mPath, std::fstream::in | std::fstream::out | std::fstream::binary);
+   if (!mFile.is_open()) {
+      gLog->warn("Failed to open shader cache {}", mPath);
+      mRecords.clear();
+      return false;
+   }
+
+   mEndOffset = validSize;
+   gLog->info("Loaded {} shaders from shader cache {}", mRecords.size(), mPath);
+   return true;
+}
+
+bool
+ShaderCache::readRecord(ShaderType type,
+                        uint64_t key,
+                        std::vector<uint8_t> &data)
+{
+   if (!load()) {
+      return false;
+   }
+
+   auto itr = mRecords.find(key);
+   if (itr == mRecords.end()) {
+      return false;
+   }
+
+   auto header = CacheRecordHeader { };
+   data.resize(itr->second.size);
+
+   mFile.clear();
+   mFile.seekg(itr->second.offset - sizeof(CacheRecordHeader));
+
+   if (!mFile.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+       !mFile.read(reinterpret_cast<char *>(data.data()), data.size()) ||
+       header.key != key || header.type != type) {
+      mRecords.erase(itr);
+      return false;
+   }
+
+   return true;
+}
+
+void
+ShaderCache::writeRecord(ShaderType type,
+                         uint64_t key,
+                         const std::vector<uint8_t> &data)
+{
+   if (!load()) {
+      return;
+   }
+
+   auto header = CacheRecordHeader { };
+   header.key = key;
+   header.type = type;
+   header.size = static_cast<uint32_t>(data.size());
+
+   mFile.clear();
+   mFile.seekp(mEndOffset);
+   mFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+   mFile.write(reinterpret_cast<const char *>(data.data()), data.size());
+   mFile.flush();
+
+   if (!mFile) {
+      gLog->warn("Failed to write to shader cache {}, disabling it", mPath);
+      mFile.close();
+      mRecords.clear();
+      return;
+   }
+
+   mRecords[key] = Record { mEndOffset + sizeof(CacheRecordHeader), header.size };
+   mEndOffset += sizeof(CacheRecordHeader) + header.size;
+}
+
+static void
+writeShaderMeta(RecordWriter &writer,
+                const ShaderMeta &meta)
+{
+   writer.write(meta.samplerUsed);
+   writer.write(meta.textureUsed);
+   writer.write(meta.cbufferUsed);
+   writer.write(meta.cfileUsed);
+}
+
+static bool
+readShaderMeta(RecordReader &reader,
+               ShaderMeta &meta)
+{
+   return reader.read(meta.samplerUsed)
+       && reader.read(meta.textureUsed)
+       && reader.read(meta.cbufferUsed)
+       && reader.read(meta.cfileUsed);
+}
+
+bool
+ShaderCache::find(uint64_t key,
+                  VertexShader *shader)
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+   if (!readRecord(ShaderType::Vertex, key, mScratch)) {
+      return false;
+   }
+
+   auto reader = RecordReader { mScratch };
+   auto valid = reader.read(shader->binary)
+       && readShaderMeta(reader, shader->meta)
+       && reader.read(shader->meta.numExports)
+       && reader.read(shader->meta.streamOutUsed)
+       && reader.read(shader->meta.attribBuffers)
+       && reader.read(shader->meta.attribElems)
+       && reader.atEnd();
+
+   if (!valid) {
+      gLog->warn("Ignoring corrupt record in shader cache {}", mPath);
+      *shader = {};
+   }
+
+   return valid;
+}
+
+bool
+ShaderCache::find(uint64_t key,
+                  GeometryShader *shader)
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+   if (!readRecord(ShaderType::Geometry, key, mScratch)) {
+      return false;
+   }
+
+   auto reader = RecordReader { mScratch };
+   auto valid = reader.read(shader->binary)
+       && readShaderMeta(reader, shader->meta)
+       && reader.read(shader->meta.streamOutUsed)
+       && reader.atEnd();
+
+   if (!valid) {
+      gLog->warn("Ignoring corrupt record in shader cache {}", mPath);
+      *shader = {};
+   }
+
+   return valid;
+}
+
+bool
+ShaderCache::find(uint64_t key,
+                  PixelShader *shader)
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+   if (!readRecord(ShaderType::Pixel, key, mScratch)) {
+      return false;
+   }
+
+   auto reader = RecordReader { mScratch };
+   auto valid = reader.read(shader->binary)
+       && readShaderMeta(reader, shader->meta)
+       && reader.read(shader->meta.pixelOutUsed)
+       && reader.atEnd();
+
+   if (!valid) {
+      gLog->warn("Ignoring corrupt record in shader cache {}", mPath);
+      *shader = {};
+   }
+
+   return valid;
+}
+
+void
+ShaderCache::insert(uint64_t key,
+                    const VertexShader &shader)
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+   auto writer = RecordWriter { mScratch };
+   writer.write(shader.binary);
+   writeShaderMeta(writer, shader.meta);
+   writer.write(shader.meta.numExports);
+   writer.write(shader.meta.streamOutUsed);
+   writer.write(shader.meta.attribBuffers);
+   writer.write(shader.meta.attribElems);
+   writeRecord(ShaderType::Vertex, key, mScratch);
+}
+
+void
+ShaderCache::insert(uint64_t key,
+                    const GeometryShader &shader)
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+   auto writer = RecordWriter { mScratch };
+   writer.write(shader.binary);
+   writeShaderMeta(writer, shader.meta);
+   writer.write(shader.meta.streamOutUsed);
+   writeRecord(ShaderType::Geometry, key, mScratch);
+}
+
+void
+ShaderCache::insert(uint64_t key,
+                    const PixelShader &shader)
+{
+   std::unique_lock<std::mutex> lock { mMutex };
+   auto writer = RecordWriter { mScratch };
+   writer.write(shader.binary);
+   writeShaderMeta(writer, shader.meta);
+   writer.write(shader.meta.pixelOutUsed);
+   writeRecord(ShaderType::Pixel, key, mScratch);
+}
+
+} // namespace spirv
+
+#endif // ifdef DECAF_VULKAN
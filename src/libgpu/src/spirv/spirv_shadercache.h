@@ -0,0 +1,108 @@
+#pragma once
+#ifdef DECAF_VULKAN
+#include "spirv_translate.h"
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace spirv
+{
+
+/*
+The shader cache stores translated shaders on disk so that they do not need
+to be translated again in later sessions.
+
+The cache is a single file containing a header followed by a list of records,
+each record holds the SPIR-V binary and metadata for one shader, keyed by a
+hash of the shader description and the contents of its guest shader binaries.
+ShaderDesc::hash() can not be used as the key as it includes the host
+addresses of the guest shader binaries, which are not stable across sessions.
+
+The file is only opened and indexed the first time the cache is used, the
+records themselves are read on demand and new records are appended to the
+end of the file as soon as they are inserted.  If the header does not match
+the current TranspilerVersion the file is discarded.
+*/
+
+class ShaderCache
+{
+public:
+   ~ShaderCache();
+
+   void
+   setPath(const std::string &path);
+
+   void
+   close();
+
+   static uint64_t
+   getKey(const VertexShaderDesc &desc);
+
+   static uint64_t
+   getKey(const GeometryShaderDesc &desc);
+
+   static uint64_t
+   getKey(const PixelShaderDesc &desc);
+
+   bool
+   find(uint64_t key, VertexShader *shader);
+
+   bool
+   find(uint64_t key, GeometryShader *shader);
+
+   bool
+   find(uint64_t key, PixelShader *shader);
+
+   void
+   insert(uint64_t key, const VertexShader &shader);
+
+   void
+   insert(uint64_t key, const GeometryShader &shader);
+
+   void
+   insert(uint64_t key, const PixelShader &shader);
+
+private:
+   struct Record
+   {
+      uint64_t offset;
+      uint32_t size;
+   };
+
+   bool
+   load();
+
+   bool
+   readRecord(ShaderType type, uint64_t key, std::vector<uint8_t> &data);
+
+   void
+   writeRecord(ShaderType type, uint64_t key, const std::vector<uint8_t> &data);
+
+private:
+   std::mutex mMutex;
+
+   //! Path of the cache file, empty if the cache is disabled.
+   std::string mPath;
+
+   //! Whether we have tried to open the cache file yet.
+   bool mLoaded = false;
+
+   std::fstream mFile;
+
+   //! Offset to append the next record at.
+   uint64_t mEndOffset = 0;
+
+   //! Offset and size of the payload of each record, indexed by key.
+   std::unordered_map<uint64_t, Record> mRecords;
+
+   //! Scratch buffer for serialising records.
+   std::vector<uint8_t> mScratch;
+};
+
+} // namespace spirv
+
+#endif // ifdef DECAF_VULKAN
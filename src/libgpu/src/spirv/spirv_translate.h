@@ -15,6 +15,10 @@
 namespace spirv
 {
 
+//! Must be incremented whenever the output of translate changes, this
+//! invalidates the shaders stored in the shader cache.
+static constexpr uint32_t TranspilerVersion = 1;
+
 enum class ShaderType : uint32_t
 {
    Unknown,
@@ -0,0 +1,162 @@
+#ifdef DECAF_VULKAN
+#include "vulkan_driver.h"
+
+#include <algorithm>
+#include <common/platform_thread.h>
+#include <fmt/core.h>
+
+/*
+When async compilation is enabled shader translation, shader module creation
+and pipeline creation are moved off the GPU thread onto the compile threads.
+
+Objects which are being compiled are added to their object maps as normal but
+with ready set to false, any draw which needs an object which is not ready is
+skipped rather than waiting for it.  Only the GPU thread ever reads or writes
+ready, the compile threads hand finished jobs back to the GPU thread which
+runs their completion functions in checkCompileJobs.
+*/
+
+namespace vulkan
+{
+
+void
+Driver::startCompileThreads()
+{
+   if (mCompileThreadsRunning) {
+      return;
+   }
+
+   auto numThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+   numThreads = std::min(numThreads, 4u);
+
+   mCompileThreadsRunning = true;
+
+   for (auto i = 0u; i < numThreads; ++i) {
+      mCompileThreads.emplace_back([this]() { compileThread(); });
+      platform::setThreadName(&mCompileThreads.back(),
+                              fmt::format("GPU Compile Thread #{}", i));
+   }
+}
+
+/**
+ * Stop the compile threads, any jobs which have not started yet are dropped.
+ */
+void
+Driver::stopCompileThreads()
+{
+   {
+      std::unique_lock<std::mutex> lock { mCompileMutex };
+      mCompileThreadsRunning = false;
+      mCompileQueue.clear();
+   }
+
+   mCompileSignal.notify_all();
+
+   for (auto &thread : mCompileThreads) {
+      thread.join();
+   }
+
+   mCompileThreads.clear();
+}
+
+/**
+ * Wait for any running compile jobs to finish and stop new ones from starting
+ * until resumeCompileThreads is called.
+ */
+void
+Driver::pauseCompileThreads()
+{
+   std::unique_lock<std::mutex> lock { mCompileMutex };
+   mCompileThreadsPaused = true;
+
+   while (mNumRunningCompileJobs > 0) {
+      mCompileIdleSignal.wait(lock);
+   }
+}
+
+void
+Driver::resumeCompileThreads()
+{
+   {
+      std::unique_lock<std::mutex> lock { mCompileMutex };
+      mCompileThreadsPaused = false;
+   }
+
+   mCompileSignal.notify_all();
+}
+
+void
+Driver::compileThread()
+{
+   std::unique_lock<std::mutex> lock { mCompileMutex };
+
+   while (true) {
+      if (!mCompileThreadsRunning) {
+         break;
+      }
+
+      if (mCompileQueue.empty() || mCompileThreadsPaused) {
+         mCompileSignal.wait(lock);
+         continue;
+      }
+
+      auto job = std::move(mCompileQueue.front());
+      mCompileQueue.pop_front();
+      mNumRunningCompileJobs++;
+
+      lock.unlock();
+      job.compile();
+      lock.lock();
+
+      mCompletedCompileJobs.push_back(std::move(job.complete));
+      mCompileJobsCompleted.store(true, std::memory_order_release);
+
+      if (--mNumRunningCompileJobs == 0 && mCompileThreadsPaused) {
+         mCompileIdleSignal.notify_all();
+      }
+   }
+}
+
+void
+Driver::submitCompileJob(std::function<void()> compile,
+                         std::function<void()> complete)
+{
+   startCompileThreads();
+
+   {
+      std::unique_lock<std::mutex> lock { mCompileMutex };
+      mCompileQueue.push_back(CompileJob { std::move(compile), std::move(complete) });
+   }
+
+   mCompileSignal.notify_one();
+   mNumPendingCompileJobs++;
+}
+
+/**
+ * Run the completion functions of any finished compile jobs.
+ */
+void
+Driver::checkCompileJobs()
+{
+   if (!mCompileJobsCompleted.load(std::memory_order_acquire)) {
+      return;
+   }
+
+   std::vector<std::function<void()>> completedJobs;
+
+   {
+      std::unique_lock<std::mutex> lock { mCompileMutex };
+      completedJobs.swap(mCompletedCompileJobs);
+      mCompileJobsCompleted.store(false, std::memory_order_relaxed);
+   }
+
+   for (auto &complete : completedJobs) {
+      complete();
+   }
+
+   mNumPendingCompileJobs -= completedJobs.size();
+}
+
+} // namespace vulkan
+
+#endif // ifdef DECAF_VULKAN
@@ -16,6 +16,7 @@ Driver::getDebugInfo()
    // TODO: This is not thread safe wrt updateDebuggerInfo, maybe it should
    // be some sort of double buffered thing with a std atomic pointer to the
    // latest filled out one
+   mDebugInfo.pm4 = mPm4Statistics;
    return &mDebugInfo;
 }
 
@@ -369,6 +369,23 @@ struct PipelineDesc
    }
 };
 
+// A PipelineDesc in a form which can be stored on disk, the shader and render
+// pass objects are replaced by their shader cache keys and descriptions.
+struct PersistentPipelineDesc
+{
+   uint64_t vertexShaderKey;
+   uint64_t geometryShaderKey;
+   uint64_t pixelShaderKey;
+   bool hasRectStubShader;
+   RenderPassDesc renderPass;
+   PipelineDesc pipeline;
+
+   inline DataHash hash() const
+   {
+      return DataHash {}.write(*this);
+   }
+};
+
 struct StreamOutBufferDesc
 {
    phys_addr baseAddress;
@@ -179,6 +179,8 @@ getWindowSystemExtensions(gpu::WindowSystemType wsiType, std::vector<const char*
       extensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
       break;
 #endif
+   case gpu::WindowSystemType::Headless:
+      break;
    default:
       return false;
    }
@@ -452,7 +454,7 @@ createDevice(vk::PhysicalDevice &physicalDevice, vk::SurfaceKHR &surface)
    for (; queueFamilyIndex < queueFamilyProps.size(); ++queueFamilyIndex) {
       auto &qfp = queueFamilyProps[queueFamilyIndex];
 
-      if (!physicalDevice.getSurfaceSupportKHR(queueFamilyIndex, surface)) {
+      if (surface && !physicalDevice.getSurfaceSupportKHR(queueFamilyIndex, surface)) {
          continue;
       }
 
@@ -1017,14 +1019,20 @@ Driver::setWindowSystemInfo(const gpu::WindowSystemInfo &wsi)
       decaf_abort("choosePhysicalDevice failed");
    }
 
-   auto windowSurface = createVulkanSurface(instance, wsi);
-   if (!windowSurface) {
-      decaf_abort("createVulkanSurface failed");
-   }
+   // When headless there is no surface and we never create a display pipeline
+   auto windowSurface = vk::SurfaceKHR { };
+   auto surfaceFormat = vk::Format { };
 
-   auto surfaceFormat = chooseSurfaceFormat(physicalDevice, windowSurface);
-   if (!windowSurface) {
-      decaf_abort("chooseSurfaceFormat failed");
+   if (wsi.type != gpu::WindowSystemType::Headless) {
+      windowSurface = createVulkanSurface(instance, wsi);
+      if (!windowSurface) {
+         decaf_abort("createVulkanSurface failed");
+      }
+
+      surfaceFormat = chooseSurfaceFormat(physicalDevice, windowSurface);
+      if (!windowSurface) {
+         decaf_abort("chooseSurfaceFormat failed");
+      }
    }
 
 
@@ -1044,6 +1052,10 @@ Driver::setWindowSystemInfo(const gpu::WindowSystemInfo &wsi)
 
    initialise(instance, physicalDevice, device, queue, queueFamilyIndex);
 
+   if (!windowSurface) {
+      return;
+   }
+
    // Create our full display pipeline
    mDisplayPipeline.windowSurface = windowSurface;
    mDisplayPipeline.windowSurfaceFormat = surfaceFormat;
@@ -1086,6 +1098,10 @@ Driver::setWindowSystemInfo(const gpu::WindowSystemInfo &wsi)
 void
 Driver::destroyDisplayPipeline()
 {
+   if (!mDisplayPipeline.windowSurface) {
+      return;
+   }
+
    // createFences
    for (auto &semaphore : mDisplayPipeline.imageAvailableSemaphores) {
       mDevice.destroySemaphore(semaphore);
@@ -1231,6 +1247,11 @@ releaseScanBuffer(vk::CommandBuffer cmdBuffer,
 void
 Driver::renderDisplay()
 {
+   if (!mDisplayPipeline.windowSurface) {
+      // Running headless, there is nowhere to display to
+      return;
+   }
+
    auto frameIndex = mDisplayPipeline.frameIndex;
    auto &renderFence = mDisplayPipeline.renderFences[frameIndex];
    auto &imageAvailableSemaphore = mDisplayPipeline.imageAvailableSemaphores[frameIndex];
@@ -73,7 +73,7 @@ Driver::bindDescriptors()
             auto gprBuffer = mCurrentDraw->gprBuffers[shaderStage];
 
             bufferInfos[shaderStage][0].buffer = gprBuffer->buffer;
-            bufferInfos[shaderStage][0].offset = 0;
+            bufferInfos[shaderStage][0].offset = gprBuffer->offset;
             bufferInfos[shaderStage][0].range = gprBuffer->size;
 
             dSetHasValues = true;
@@ -305,6 +305,9 @@ Driver::drawGenericIndexed(latte::VGT_DRAW_INITIATOR drawInit, uint32_t numIndic
 
    mCurrentDraw = &drawDesc;
 
+   // Pick up any shaders and pipelines which have finished compiling
+   checkCompileJobs();
+
    // Set up all the required state, ordering here is very important
    if (!checkCurrentVertexShader()) {
       gLog->debug("Skipped draw due to a vertex shader error");
@@ -6,6 +6,8 @@
 #include "gpu_graphicsdriver.h"
 #include "gpu_ringbuffer.h"
 
+#include <common/platform_dir.h>
+
 namespace vulkan
 {
 
@@ -17,6 +19,20 @@ Driver::~Driver()
 {
 }
 
+/**
+ * Get the path of a file in the persistent cache directory.
+ */
+std::string
+Driver::getCacheFilePath(const std::string &filename)
+{
+   auto path = gpu::config()->cache.path;
+   if (path.empty()) {
+      path = platform::getConfigDirectory() + "/decaf/cache";
+   }
+
+   return path + "/" + filename;
+}
+
 void
 Driver::notifyCpuFlush(phys_addr address,
                        uint32_t size)
@@ -29,6 +45,13 @@ Driver::notifyGpuFlush(phys_addr address,
 {
 }
 
+void
+Driver::notifyTitleLoaded(uint64_t titleId)
+{
+   // The GPU thread picks this up in checkTitlePipelineCache
+   mLoadedTitleId.store(titleId);
+}
+
 void
 Driver::initialise(vk::Instance instance,
                    vk::PhysicalDevice physDevice,
@@ -49,6 +72,8 @@ Driver::initialise(vk::Instance instance,
                mDebug = settings.debug.debug_enabled;
                mDumpShaders = settings.debug.dump_shaders;
                mDumpShaderBinariesOnly = settings.debug.dump_shader_binaries_only;
+               mAsyncCompile = settings.compile.async;
+               mPm4Profiling = settings.debug.pm4_profiling;
             });
       });
 
@@ -57,6 +82,13 @@ Driver::initialise(vk::Instance instance,
    mDebug = gpuConfig->debug.debug_enabled;
    mDumpShaders = gpuConfig->debug.dump_shaders;
    mDumpShaderBinariesOnly = gpuConfig->debug.dump_shader_binaries_only;
+   mAsyncCompile = gpuConfig->compile.async;
+   mPm4Profiling = gpuConfig->debug.pm4_profiling;
+
+   // The shader cache is only opened once the first shader is needed
+   if (gpuConfig->cache.shader_cache) {
+      mShaderCache.setPath(getCacheFilePath("spirv_shaders.bin"));
+   }
 
    mPhysDevice = physDevice;
    mDevice = device;
@@ -115,7 +147,12 @@ Driver::destroy()
    mFenceSignal.notify_all();
    mFenceThread.join();
 
+   stopCompileThreads();
+   stopPipelinePrecompile();
+   savePipelineCache();
+
    destroyDisplayPipeline();
+   mShaderCache.close();
 }
 
 void
@@ -368,6 +405,9 @@ Driver::run()
       // Check for any fences completing
       checkSyncFences();
 
+      // Check if we need to load the pipeline cache for a new title
+      checkTitlePipelineCache();
+
       // Process the buffer if there is anything new
       if (!buffer.empty()) {
          executeBuffer(buffer);
@@ -389,6 +429,9 @@ Driver::runUntilFlip()
       // Check for any fences completing
       checkSyncFences();
 
+      // Check if we need to load the pipeline cache for a new title
+      checkTitlePipelineCache();
+
       // Process the buffer if there is anything new
       auto buffer = gpu::ringbuffer::read();
       if (!buffer.empty()) {
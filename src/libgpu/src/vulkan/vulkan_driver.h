@@ -9,6 +9,7 @@
 #include "latte/latte_constants.h"
 #include "spirv/spirv_translate.h"
 #include "spirv/spirv_pushconstants.h"
+#include "spirv/spirv_shadercache.h"
 #include "pm4_processor.h"
 #include "vk_mem_alloc_decaf.h"
 #include "vulkan_descs.h"
@@ -17,13 +18,16 @@
 #include <atomic>
 #include <common/vulkan_hpp.h>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <gsl/gsl>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
@@ -137,7 +141,7 @@ struct SectionRange
 
 struct MemCacheSection
 {
-   // Pointer into the segments map for this memory range
+   // Reference to the first memory segment of this section
    MemSegmentRef firstSegment;
 
    // Records the last change index for this data
@@ -201,22 +205,28 @@ enum class ShaderStage
 struct VertexShaderObject
 {
    HashedDesc<spirv::VertexShaderDesc> desc;
+   uint64_t cacheKey;
    spirv::VertexShader shader;
    vk::ShaderModule module;
+   bool ready = true;
 };
 
 struct GeometryShaderObject
 {
    HashedDesc<spirv::GeometryShaderDesc> desc;
+   uint64_t cacheKey;
    spirv::GeometryShader shader;
    vk::ShaderModule module;
+   bool ready = true;
 };
 
 struct PixelShaderObject
 {
    HashedDesc<spirv::PixelShaderDesc> desc;
+   uint64_t cacheKey;
    spirv::PixelShader shader;
    vk::ShaderModule module;
+   bool ready = true;
 };
 
 struct RectStubShaderObject
@@ -233,6 +243,8 @@ enum class StagingBufferType : uint32_t
    GpuToGpu = 2
 };
 
+struct StagingRing;
+
 struct StagingBuffer
 {
    StagingBufferType type;
@@ -243,6 +255,25 @@ struct StagingBuffer
    vk::Buffer buffer;
    VmaAllocation memory;
    void *mappedPtr;
+
+   // The ring this buffer was allocated from, or nullptr for a dedicated
+   // buffer.  Ring allocations start at offset within buffer.
+   StagingRing *ring = nullptr;
+   uint32_t offset = 0;
+   bool retired = false;
+};
+
+struct StagingRing
+{
+   // The persistent buffer which allocations are made from
+   StagingBuffer *buffer = nullptr;
+
+   // Allocations in the order they were made, an allocation is only released
+   // once every allocation made before it has been retired as well.
+   std::deque<StagingBuffer *> allocations;
+
+   // The offset of the end of the most recent allocation
+   uint32_t head = 0;
 };
 
 struct SyncWaiter
@@ -375,6 +406,33 @@ struct PipelineObject
    uint32_t shaderLopMode;
    uint32_t shaderAlphaFunc;
    float shaderAlphaRef;
+   bool ready = true;
+};
+
+struct PipelinePrecompileJob
+{
+   // Shaders loaded from the shader cache, indexed by shader cache key.
+   std::unordered_map<uint64_t, std::unique_ptr<VertexShaderObject>> vertexShaders;
+   std::unordered_map<uint64_t, std::unique_ptr<GeometryShaderObject>> geometryShaders;
+   std::unordered_map<uint64_t, std::unique_ptr<PixelShaderObject>> pixelShaders;
+
+   // The pipelines to compile, these are destroyed as soon as they have been
+   // compiled, we only want them to be in the pipeline cache.
+   std::vector<PipelineObject> pipelines;
+
+   std::atomic<size_t> nextPipeline { 0 };
+   std::atomic<size_t> numRunningThreads { 0 };
+   std::atomic<bool> cancelled { false };
+   std::vector<std::thread> threads;
+};
+
+struct CompileJob
+{
+   // Run on a compile thread
+   std::function<void()> compile;
+
+   // Run on the GPU thread once compile has finished
+   std::function<void()> complete;
 };
 
 struct StreamContextObject
@@ -495,6 +553,7 @@ public:
 
    virtual void notifyCpuFlush(phys_addr address, uint32_t size) override;
    virtual void notifyGpuFlush(phys_addr address, uint32_t size) override;
+   virtual void notifyTitleLoaded(uint64_t titleId) override;
 
 protected:
    void initialise(vk::Instance instance, vk::PhysicalDevice physDevice,
@@ -532,6 +591,15 @@ protected:
    void checkSyncFences();
    void addRetireTask(std::function<void()> fn);
 
+   // Async Compilation
+   void startCompileThreads();
+   void stopCompileThreads();
+   void pauseCompileThreads();
+   void resumeCompileThreads();
+   void compileThread();
+   void submitCompileJob(std::function<void()> compile, std::function<void()> complete);
+   void checkCompileJobs();
+
    // Retiling
    void dispatchGpuTile(const gpu7::tiling::RetileInfo& retileInfo,
                         vk::CommandBuffer &commandBuffer,
@@ -589,6 +657,8 @@ protected:
 
    // Staging
    StagingBuffer * _allocStagingBuffer(uint32_t size, StagingBufferType type);
+   StagingBuffer * _allocRingStagingBuffer(uint32_t size, StagingBufferType type);
+   StagingBuffer * _getDedicatedStagingBuffer(uint32_t size, StagingBufferType type);
    StagingBuffer * getStagingBuffer(uint32_t size, StagingBufferType type);
    void retireStagingBuffer(StagingBuffer *sbuffer);
    void transitionStagingBuffer(StagingBuffer *sbuffer, ResourceUsage usage);
@@ -656,13 +726,18 @@ protected:
    spirv::VertexShaderDesc getVertexShaderDesc();
    spirv::GeometryShaderDesc getGeometryShaderDesc();
    spirv::PixelShaderDesc getPixelShaderDesc();
+   void compileVertexShader(VertexShaderObject *shader, const spirv::VertexShaderDesc& desc, const std::string &name);
+   void compileGeometryShader(GeometryShaderObject *shader, const spirv::GeometryShaderDesc& desc, const std::string &name);
+   void compilePixelShader(PixelShaderObject *shader, const spirv::PixelShaderDesc& desc, const std::string &name);
    bool checkCurrentVertexShader();
    bool checkCurrentGeometryShader();
    bool checkCurrentPixelShader();
+   RectStubShaderObject * getRectStubShader(const HashedDesc<spirv::RectStubShaderDesc>& desc);
    bool checkCurrentRectStubShader();
 
    // Render Passes
    RenderPassDesc getRenderPassDesc();
+   RenderPassObject * getRenderPass(const HashedDesc<RenderPassDesc>& desc);
    bool checkCurrentRenderPass();
 
    // Pipeline Layouts
@@ -671,8 +746,20 @@ protected:
 
    // Pipelines
    PipelineDesc getPipelineDesc();
+   PipelineLayoutObject * getPipelinePushLayout(const PipelineDesc& desc);
+   void compilePipeline(PipelineObject *pipelineObj);
    bool checkCurrentPipeline();
 
+   // Pipeline Cache
+   std::string getCacheFilePath(const std::string &filename);
+   void checkTitlePipelineCache();
+   void loadPipelineCache(uint64_t titleId);
+   void savePipelineCache();
+   void recordPipeline(const PipelineDesc& desc);
+   void startPipelinePrecompile();
+   void stopPipelinePrecompile();
+   void pipelinePrecompileThread(PipelinePrecompileJob *job);
+
    // Stream Out
    StreamContextObject * allocateStreamContext(uint32_t initialOffset);
    void releaseStreamContext(StreamContextObject* stream);
@@ -738,6 +825,44 @@ private:
    vk::QueryPool mLastOccQuery;
    vk::PipelineCache mPipelineCache;
 
+   //! Title ID passed to notifyTitleLoaded, 0 if no title has been loaded.
+   std::atomic<uint64_t> mLoadedTitleId = 0;
+
+   //! Title ID the pipeline cache was loaded for.
+   uint64_t mPipelineCacheTitleId = 0;
+
+   //! Paths to save the pipeline cache and pipeline list to, empty when the
+   //! pipeline cache is disabled.
+   std::string mPipelineCachePath;
+   std::string mPipelineListPath;
+
+   //! Every pipeline used by the current title, in this or previous sessions.
+   std::vector<PersistentPipelineDesc> mPersistentPipelines;
+   std::unordered_set<DataHash> mPersistentPipelineHashes;
+
+   std::unique_ptr<PipelinePrecompileJob> mPipelinePrecompile;
+
+   std::vector<std::thread> mCompileThreads;
+   std::mutex mCompileMutex;
+   std::condition_variable mCompileSignal;
+   bool mCompileThreadsRunning = false;
+
+   //! While paused the compile threads do not start new jobs, this is used
+   //! to stop them touching objects such as mPipelineCache while the GPU
+   //! thread replaces them.
+   bool mCompileThreadsPaused = false;
+   unsigned mNumRunningCompileJobs = 0;
+   std::condition_variable mCompileIdleSignal;
+   std::deque<CompileJob> mCompileQueue;
+   std::vector<std::function<void()>> mCompletedCompileJobs;
+   std::atomic<bool> mCompileJobsCompleted = false;
+
+   //! Number of compile jobs submitted which have not been completed yet.
+   uint64_t mNumPendingCompileJobs = 0;
+
+   //! Number of draws skipped this frame waiting for async compilation.
+   uint64_t mDeferredDrawsThisFrame = 0;
+
    SyncWaiter *mActiveSyncWaiter = nullptr;
    vk::CommandBuffer mActiveCommandBuffer;
    std::vector<vk::DescriptorSet> mAvailableDescriptorSets;
@@ -788,6 +913,8 @@ private:
    SwapChainObject *mDrcSwapChain = nullptr;
    RenderPassObject *mRenderPass = nullptr;
    std::array<std::array<std::vector<StagingBuffer *>, 20>, 3> mStagingBuffers;
+   std::array<StagingRing, 3> mStagingRings;
+   std::vector<StagingBuffer *> mStagingRingAllocPool;
    std::vector<StreamContextObject *> mStreamOutContextPool;
    std::vector<vk::DescriptorPool> mDescriptorPools;
    std::vector<vk::QueryPool> mOccQueryPools;
@@ -807,11 +934,13 @@ private:
 
    gpu7::tiling::vulkan::Retiler mGpuRetiler;
    DriverMemoryTracker mMemTracker;
+   spirv::ShaderCache mShaderCache;
 
    bool mDebug = false;
    bool mDumpShaders = false;
    bool mDumpShaderBinariesOnly = false;
    bool mDumpTextures = false;
+   bool mAsyncCompile = false;
 };
 
 } // namespace vulkan
@@ -194,7 +194,9 @@ Driver::bindIndexBuffer()
       decaf_abort("Unexpected index type");
    }
 
-   mActiveCommandBuffer.bindIndexBuffer(mCurrentDraw->indexBuffer->buffer, 0, bindIndexType);
+   mActiveCommandBuffer.bindIndexBuffer(mCurrentDraw->indexBuffer->buffer,
+                                        mCurrentDraw->indexBuffer->offset,
+                                        bindIndexType);
 }
 
 } // namespace vulkan
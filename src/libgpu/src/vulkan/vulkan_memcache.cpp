@@ -6,50 +6,26 @@
 namespace vulkan
 {
 
-// void(MemSegment&)
-template<typename FunctorType>
-static inline void
-forEachMemSegment(MemSegmentRef begin, uint32_t size, FunctorType functor)
-{
-   auto segment = begin.get();
-   for (auto sizeLeft = size; sizeLeft > 0;) {
-      functor(*segment);
-      sizeLeft -= segment->size;
-      segment = segment->nextSegment;
-   }
-}
-
 // void(MemCacheSection&, MemSegment&)
 template<typename FunctorType>
 static inline void
-forEachSectionSegment(MemCacheObject *cache, SectionRange range, FunctorType functor)
+forEachSectionSegment(DriverMemoryTracker &tracker, MemCacheObject *cache, SectionRange range, FunctorType functor)
 {
-   auto rangeStart = range.start;
-   auto rangeEnd = range.start + range.count;
-
-   auto firstSection = cache->sections[rangeStart];
-   auto segment = firstSection.firstSegment.get();
-   for (auto i = rangeStart; i < rangeEnd; ++i) {
-      auto& section = cache->sections[i];
-
-      for (auto sizeLeft = cache->sectionSize; sizeLeft > 0;) {
-         functor(section, *segment);
-
-         sizeLeft -= segment->size;
-         segment = segment->nextSegment;
+   auto sectionIndex = range.start;
+   auto sizeLeft = cache->sectionSize;
+
+   // Segments never cross a section boundary, so we can walk all the
+   // segments in the range at once and just count off the sections.
+   auto firstSegment = cache->sections[range.start].firstSegment;
+   tracker.forEachSegment(firstSegment, range.count * cache->sectionSize, [&](MemSegment& segment){
+      functor(cache->sections[sectionIndex], segment);
+
+      sizeLeft -= segment.size;
+      if (sizeLeft == 0) {
+         sectionIndex++;
+         sizeLeft = cache->sectionSize;
       }
-   }
-}
-
-// void(MemSegment&)
-template<typename FunctorType>
-static inline void
-forEachMemSegment(MemCacheObject *cache, SectionRange range, FunctorType functor)
-{
-   auto& firstSection = cache->sections[range.start];
-   auto begin = firstSection.firstSegment;
-   auto size = range.count * cache->sectionSize;
-   forEachMemSegment(begin, size, functor);
+   });
 }
 
 MemCacheObject *
@@ -144,7 +120,7 @@ Driver::_uploadMemCache(MemCacheObject *cache, SectionRange range)
 
    // Copy the data out of the staging buffer into the memory cache.
    vk::BufferCopy copyDesc;
-   copyDesc.srcOffset = 0;
+   copyDesc.srcOffset = stagingBuffer->offset;
    copyDesc.dstOffset = offsetStart;
    copyDesc.size = rangeSize;
    mActiveCommandBuffer.copyBuffer(stagingBuffer->buffer, cache->buffer, { copyDesc });
@@ -174,7 +150,7 @@ Driver::_downloadMemCache(MemCacheObject *cache, SectionRange range)
    // Copy the data into our staging buffer from the cache object
    vk::BufferCopy copyDesc;
    copyDesc.srcOffset = offsetStart;
-   copyDesc.dstOffset = 0;
+   copyDesc.dstOffset = stagingBuffer->offset;
    copyDesc.size = rangeSize;
    mActiveCommandBuffer.copyBuffer(cache->buffer, stagingBuffer->buffer, { copyDesc });
 
@@ -199,7 +175,7 @@ Driver::_downloadMemCache(MemCacheObject *cache, SectionRange range)
 
          // We need to calculate new data hashes for the relevant segments that
          // are affected by this image and are not still being GPU written.
-         forEachMemSegment(section.firstSegment, cache->sectionSize, [&](MemSegment& segment){
+         mMemTracker.forEachSegment(section.firstSegment, cache->sectionSize, [&](MemSegment& segment){
             // For safety purposes, lets confirm that this write was intended.
             decaf_check(segment.lastChangeIndex >= section.lastChangeIndex);
 
@@ -216,7 +192,7 @@ Driver::_downloadMemCache(MemCacheObject *cache, SectionRange range)
 void
 Driver::_refreshMemCache_Check(MemCacheObject *cache, SectionRange range)
 {
-   forEachSectionSegment(cache, range, [&](MemCacheSection& section, MemSegment& segment){
+   forEachSectionSegment(mMemTracker, cache, range, [&](MemCacheSection& section, MemSegment& segment){
       // Refresh the segment to make sure we have up-to-date information
       mMemTracker.refreshSegment(&segment);
 
@@ -275,7 +251,7 @@ Driver::_refreshMemCache_Update(MemCacheObject *cache, SectionRange range)
    for (auto i = range.start; i < range.start + range.count; ++i) {
       auto& section = cache->sections[i];
 
-      forEachMemSegment(section.firstSegment, cache->sectionSize, [&](MemSegment& segment){
+      mMemTracker.forEachSegment(section.firstSegment, cache->sectionSize, [&](MemSegment& segment){
          // Note that we have to do this delayed write check before we exit
          // early as we are not actually 'up to date' until the write occurs.
          auto& lastChangeOwner = segment.lastChangeOwner;
@@ -353,7 +329,8 @@ Driver::_invalidateMemCache(MemCacheObject *cache, SectionRange range, const Del
       cache->sections[i].lastChangeIndex = changeIndex;
    }
 
-   forEachMemSegment(cache, range, [&](MemSegment& segment){
+   auto firstSegment = cache->sections[range.start].firstSegment;
+   mMemTracker.forEachSegment(firstSegment, range.count * cache->sectionSize, [&](MemSegment& segment){
       segment.lastChangeIndex = changeIndex;
       segment.lastChangeOwner = cache;
       segment.gpuWritten = true;
@@ -1,26 +1,38 @@
 #pragma once
 #ifdef DECAF_VULKAN
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <libcpu/be2_struct.h>
 #include <libcpu/memtrack.h>
-#include <map>
-#include <forward_list>
+#include <memory>
+#include <vector>
 
 namespace vulkan
 {
 
 /*
 This memory tracker keeps track of a range of phys_addr memory for changes.
-It attempts to make iteration as fast as possible by trying to keep the
-segments linearly arranged in memory, while still allowing fast insertions.
-It does this by using a dynamic list to hold the segments initially, but
-then quickly optimizes them into a linear vector.
+
+Segments are stored in flat arrays sorted by address, the start addresses are
+kept in their own array so that a lookup is a branchless binary search over a
+few cachelines, and iterating a range of segments is a linear walk through
+contiguous memory.  Segments are never merged or removed, so the start address
+of a segment uniquely identifies it for the lifetime of the tracker.
+
+When the CPU write tracker is enabled, memory states are sums of per-page
+write counters, so the tracker also samples the state of each 4KiB page once
+per batch.  A bitmap records which pages have been sampled during the current
+batch, and each page remembers the batch during which it was last seen to
+change.  Small segments whose pages have not changed since they were last
+checked can then skip querying the memory state altogether, which avoids
+querying the same page once for every segment which lives in it.
 
 Important Semantics:
  - SegmentRef's are stable
- - Pointers to segments ARE NOT stable.
- - Don't forget to call optimize periodically.
+ - Pointers and references to segments ARE NOT stable, they are invalidated
+   by any call to get().
 */
 
 template<typename _DataOwnerType>
@@ -28,18 +40,12 @@ class MemoryTracker
 {
 public:
    struct Segment {
-      // We keep a linked list of segments connected to eachother for
-      // faster iteration through all the segments.  It is intentionally
-      // at the top to increase the chance of being on the cacheline of
-      // the previous segment.
-      Segment *nextSegment = nullptr;
-
       // Meta-data about what this segment represents
       phys_addr address = {};
       uint32_t size = 0;
 
       // Stores the last memory tracking state for this segment.
-      cpu::MemtrackState dataState;
+      cpu::MemtrackState dataState = {};
 
       // Tracks the last CPU check of this segment, to avoid checking the
       // memory multiple times in a single batch.
@@ -56,11 +62,6 @@ public:
       _DataOwnerType lastChangeOwner = {};
    };
 
-protected:
-   typedef std::map<phys_addr, Segment*> SegmentMap;
-   typedef typename SegmentMap::iterator SegmentMapIter;
-
-public:
    class SegmentRef
    {
       friend MemoryTracker;
@@ -70,29 +71,67 @@ public:
       {
       }
 
-      Segment * get() const
+      phys_addr address() const
       {
-         return mIterator->second;
-      }
-
-      Segment * operator->() const
-      {
-         return get();
+         return mAddress;
       }
 
    protected:
-      SegmentRef(SegmentMapIter iterator)
-         : mIterator(iterator)
+      SegmentRef(phys_addr address)
+         : mAddress(address)
       {
       }
 
-      SegmentMapIter mIterator;
+      phys_addr mAddress = {};
+   };
+
+   static constexpr uint32_t PageShift = 12;
+   static constexpr uint32_t PageSize = 1u << PageShift;
 
+   // Segments spanning more pages than this check their memory state
+   // directly, as querying each page individually would cost more than the
+   // single query it is trying to avoid.
+   static constexpr uint32_t MaxPageFilterPages = 16;
+
+protected:
+   static constexpr uint32_t ChunkShift = 9;
+   static constexpr uint32_t PagesPerChunk = 1u << ChunkShift;
+   static constexpr uint32_t NumChunks = 1u << (32 - PageShift - ChunkShift);
+   static constexpr uint64_t NeverSampled = ~0ull;
+
+   struct PageChunk
+   {
+      // Whether this chunk is in mSampledChunks.
+      bool sampledThisBatch;
+
+      // Bitmap of the pages which have been sampled in the current batch.
+      std::array<uint64_t, PagesPerChunk / 64> sampled;
+
+      // The batch during which each page was last seen to change.
+      std::array<uint64_t, PagesPerChunk> lastChangeIndex;
+
+      // The memory state of each page when it was last sampled.
+      std::array<cpu::MemtrackState, PagesPerChunk> state;
    };
 
+public:
+   MemoryTracker()
+   {
+      mPageChunks.resize(NumChunks);
+   }
+
    void nextBatch()
    {
       mCurrentBatchIndex++;
+
+      // Forget which pages were sampled during the previous batch.
+      for (auto chunk : mSampledChunks) {
+         chunk->sampledThisBatch = false;
+         chunk->sampled.fill(0);
+      }
+
+      mSampledChunks.clear();
+      mPageFilterEnabled = cpu::isWriteTrackingEnabled();
    }
 
    uint64_t newChangeIndex()
@@ -102,9 +141,21 @@ public:
 
    SegmentRef get(phys_addr address, uint32_t size)
    {
-      auto iter = _getSegment(address, size);
-      _ensureSegments(iter, size);
-      return iter;
+      _ensureSegments(address, size);
+      return SegmentRef { address };
+   }
+
+   // void(Segment&)
+   template<typename FunctorType>
+   void forEachSegment(SegmentRef begin, uint32_t size, FunctorType functor)
+   {
+      auto index = _findSegment(begin.mAddress);
+
+      for (auto sizeLeft = size; sizeLeft > 0; ++index) {
+         auto &segment = mSegments[index];
+         functor(segment);
+         sizeLeft -= segment.size;
+      }
    }
 
    void markSegmentGpuDone(Segment *segment)
@@ -118,206 +169,260 @@ public:
       _refreshSegment(segment);
    }
 
-   void optimize()
+   size_t numSegments() const
    {
-      // TODO: Maybe avoid optimizing for low dynamic segment counts.
-
-      if (mLookupMap.empty() || mDynamicSegments.empty()) {
-         // If the map is empty, or there are no dynamic segments,
-         // there is no need to optimize the map.
-         return;
-      }
-
-      // Reserve the new linear segments
-      std::vector<Segment> newLinearSegments;
-      newLinearSegments.reserve(mLookupMap.size());
-
-      // Move all our segments
-      auto iter = mLookupMap.begin();
-      newLinearSegments.push_back(std::move(*iter->second));
-      auto lastSegment = &newLinearSegments.back();
-      iter->second = lastSegment;
-      ++iter;
-
-      for ( ; iter != mLookupMap.end(); ++iter) {
-         newLinearSegments.push_back(std::move(*iter->second));
-         auto newSegment = &newLinearSegments.back();
-
-         iter->second = newSegment;
-
-         lastSegment->nextSegment = newSegment;
-
-         lastSegment = newSegment;
-      }
-      lastSegment->nextSegment = nullptr;
-
-      // Move the new linear map into place and clear the dynamic segments
-      // that are no longer being used.
-      mLinearSegments = std::move(newLinearSegments);
-      mDynamicSegments.clear();
+      return mSegments.size();
    }
 
 protected:
-   SegmentMapIter
-   _insertSegment(SegmentMapIter position, phys_addr address, uint32_t size)
+   /**
+    * Returns the index of the first segment which starts after address.
+    */
+   size_t
+   _upperBound(uint32_t address) const
    {
-      auto &segment = mDynamicSegments.emplace_front();
-      segment.address = address;
-      segment.size = size;
+      auto base = mStarts.data();
+      auto count = mStarts.size();
 
-      auto newIter = mLookupMap.insert(position, { segment.address, &segment });
-
-      if (newIter != mLookupMap.begin()) {
-         auto prevIter = newIter;
-         prevIter--;
-         prevIter->second->nextSegment = &segment;
+      if (count == 0) {
+         return 0;
       }
 
-      auto nextIter = newIter;
-      nextIter++;
-      if (nextIter != mLookupMap.end()) {
-         segment.nextSegment = nextIter->second;
-      } else {
-         segment.nextSegment = nullptr;
+      while (count > 1) {
+         auto half = count / 2;
+         base = (base[half] <= address) ? base + half : base;
+         count -= half;
       }
 
-      return newIter;
+      return static_cast<size_t>(base - mStarts.data()) + (*base <= address);
+   }
+
+   /**
+    * Returns the index of the first segment which starts at or after address.
+    */
+   size_t
+   _lowerBound(uint32_t address) const
+   {
+      return address ? _upperBound(address - 1) : 0;
    }
 
-   SegmentMapIter
-   _splitSegment(SegmentMapIter iter, uint32_t newSize)
+   /**
+    * Returns the index of the segment which starts exactly at address.
+    */
+   size_t
+   _findSegment(phys_addr address) const
    {
-      auto& oldSegment = iter->second;
-      decaf_check(oldSegment->size > newSize);
+      auto index = _upperBound(address.getAddress());
+      decaf_check(index > 0 && mStarts[index - 1] == address.getAddress());
+      return index - 1;
+   }
+
+   void
+   _splitSegment(size_t index, uint32_t newSize)
+   {
+      decaf_check(mSegments[index].size > newSize);
+
+      // Create the new segment directly after the old one, this must happen
+      // before we take any references as it moves the following segments.
+      auto newAddress = mSegments[index].address + newSize;
+      mStarts.insert(mStarts.begin() + index + 1, newAddress.getAddress());
+      mSegments.insert(mSegments.begin() + index + 1, Segment { });
+
+      auto &oldSegment = mSegments[index];
+      auto &newSegment = mSegments[index + 1];
 
       // Save the old info so we can do the final hash check
-      auto oldSize = oldSegment->size;
-      auto oldState = oldSegment->dataState;
+      auto oldSize = oldSegment.size;
+      auto oldState = oldSegment.dataState;
 
-      // Create the new segment, save it to the map and resize the
-      // old segment to not overlap the new one.
-      auto newIter = _insertSegment(iter, oldSegment->address + newSize, oldSegment->size - newSize);
-      auto &newSegment = newIter->second;
-      oldSegment->size = newSize;
+      // Resize the old segment to not overlap the new one.
+      newSegment.address = newAddress;
+      newSegment.size = oldSegment.size - newSize;
+      oldSegment.size = newSize;
 
       // Copy over some state from the old Segment
-      newSegment->lastCheckIndex = oldSegment->lastCheckIndex;
-      newSegment->gpuWritten = oldSegment->gpuWritten;
-      newSegment->lastChangeIndex = oldSegment->lastChangeIndex;
-      newSegment->lastChangeOwner = oldSegment->lastChangeOwner;
+      newSegment.lastCheckIndex = oldSegment.lastCheckIndex;
+      newSegment.gpuWritten = oldSegment.gpuWritten;
+      newSegment.lastChangeIndex = oldSegment.lastChangeIndex;
+      newSegment.lastChangeOwner = oldSegment.lastChangeOwner;
 
       // If the old segment was written by the GPU, there is no need to
       // do any of the hashing work, it will be done during readback.
-      if (oldSegment->gpuWritten) {
-         newSegment->dataState = {};
-         return newIter;
+      if (oldSegment.gpuWritten) {
+         newSegment.dataState = {};
+         return;
       }
 
       // Lets calculate the new hashes for the segments after they have been
       // split to ensure we don't do unneeded uploading after a split.  We check
       // that the new hashes reflect the same data that previous existed in the
       // segment following this.
-      oldSegment->dataState = cpu::getMemoryState(oldSegment->address, oldSegment->size);
-      newSegment->dataState = cpu::getMemoryState(newSegment->address, newSegment->size);
+      oldSegment.dataState = cpu::getMemoryState(oldSegment.address, oldSegment.size);
+      newSegment.dataState = cpu::getMemoryState(newSegment.address, newSegment.size);
 
       // If the segment was last checked during this batch, there is no need to do
       // any additional work to figure out if the data changed.
-      if (oldSegment->lastCheckIndex >= mCurrentBatchIndex) {
-         return newIter;
+      if (oldSegment.lastCheckIndex >= mCurrentBatchIndex) {
+         return;
       }
 
       // Now check that the data hasn't changed since we did the last hashing.
-      auto newFullState = cpu::getMemoryState(oldSegment->address, oldSize);
+      auto newFullState = cpu::getMemoryState(oldSegment.address, oldSize);
       if (newFullState != oldState) {
          auto changeIndex = newChangeIndex();
 
-         oldSegment->lastCheckIndex = mCurrentBatchIndex;
-         oldSegment->lastChangeIndex = changeIndex;
-         oldSegment->lastChangeOwner = nullptr;
+         oldSegment.lastCheckIndex = mCurrentBatchIndex;
+         oldSegment.lastChangeIndex = changeIndex;
+         oldSegment.lastChangeOwner = nullptr;
 
-         newSegment->lastCheckIndex = mCurrentBatchIndex;
-         newSegment->lastChangeIndex = changeIndex;
-         newSegment->lastChangeOwner = nullptr;
+         newSegment.lastCheckIndex = mCurrentBatchIndex;
+         newSegment.lastChangeIndex = changeIndex;
+         newSegment.lastChangeOwner = nullptr;
       }
-
-      return newIter;
    }
 
-   SegmentMapIter
-   _getSegment(phys_addr address, uint32_t maxSize)
+   /**
+    * Ensure that there is a segment boundary at address, splitting the
+    * segment which covers it if there is one.
+    */
+   void
+   _splitAt(uint32_t address)
    {
-      auto iter = mLookupMap.lower_bound(address);
+      auto index = _upperBound(address);
+      if (index == 0) {
+         return;
+      }
+
+      auto &segment = mSegments[index - 1];
+      auto offset = address - mStarts[index - 1];
+      if (offset == 0 || offset >= segment.size) {
+         return;
+      }
+
+      _splitSegment(index - 1, offset);
+   }
 
-      if (iter != mLookupMap.end()) {
-         // Check if we found an exact match.  If so, return that.
-         if (iter->second->address == address) {
-            return iter;
+   void
+   _ensureSegments(phys_addr address, uint32_t size)
+   {
+      auto start = address.getAddress();
+      auto end = start + size;
+
+      // Make sure that no segment crosses either end of the range, after
+      // this every segment which starts in the range also ends in it.
+      _splitAt(start);
+      _splitAt(end);
+
+      // Find all the gaps in the range which are not covered by a segment.
+      auto first = _lowerBound(start);
+      auto last = first;
+      auto curAddress = start;
+      mGapScratch.clear();
+
+      for (; last < mStarts.size() && mStarts[last] < end; ++last) {
+         if (mStarts[last] != curAddress) {
+            mGapScratch.push_back({ curAddress, mStarts[last] - curAddress });
          }
 
-         // Otherwise we need to bound our maxSize not to tramble this.
-         auto gapSize = static_cast<uint32_t>(iter->second->address - address);
-         maxSize = std::min(maxSize, gapSize);
+         curAddress = mStarts[last] + mSegments[last].size;
       }
 
-      // Check that we are not at the beginning, if we are and it wasn't an
-      // exact match, we know we need to make a new segment before this one.
-      if (iter != mLookupMap.begin()) {
-         --iter;
+      if (curAddress != end) {
+         mGapScratch.push_back({ curAddress, end - curAddress });
+      }
 
-         auto& foundSegment = iter->second;
+      if (mGapScratch.empty()) {
+         return;
+      }
 
-         // If the previous segment covers this new segments range, we
-         // need to split it and return that.
-         if (address < foundSegment->address + foundSegment->size) {
-            auto newSize = static_cast<uint32_t>(address - foundSegment->address);
-            return _splitSegment(iter, newSize);
+      // Make room for the new segments and then merge them in from the back,
+      // this moves each existing segment at most once.
+      auto oldCount = mStarts.size();
+      auto numGaps = mGapScratch.size();
+      mStarts.resize(oldCount + numGaps);
+      mSegments.resize(oldCount + numGaps);
+
+      std::move_backward(mStarts.begin() + last, mStarts.begin() + oldCount, mStarts.end());
+      std::move_backward(mSegments.begin() + last, mSegments.begin() + oldCount, mSegments.end());
+
+      auto dst = last + numGaps;
+      auto src = last;
+
+      while (numGaps > 0) {
+         --dst;
+
+         auto &gap = mGapScratch[numGaps - 1];
+         if (src > first && mStarts[src - 1] > gap.first) {
+            --src;
+            mStarts[dst] = mStarts[src];
+            mSegments[dst] = std::move(mSegments[src]);
+         } else {
+            --numGaps;
+
+            auto segment = Segment { };
+            segment.address = phys_addr { gap.first };
+            segment.size = gap.second;
+            mStarts[dst] = gap.first;
+            mSegments[dst] = segment;
          }
       }
+   }
 
-      // maxSize being 0 indicates that we need to ensure there is a split
-      // point in the map, but we don't need to generate anything for it.
-      if (maxSize == 0) {
-         return mLookupMap.end();
+   PageChunk *
+   _getPageChunk(uint32_t page)
+   {
+      auto &chunk = mPageChunks[page >> ChunkShift];
+
+      if (!chunk) {
+         chunk = std::make_unique<PageChunk>();
+         chunk->sampledThisBatch = false;
+         chunk->sampled.fill(0);
+         chunk->lastChangeIndex.fill(NeverSampled);
+         chunk->state.fill({});
       }
 
-      // Allocate a new segment for this at the end
-      return _insertSegment(mLookupMap.end(), address, maxSize);
+      return chunk.get();
    }
 
-   void
-   _ensureSegments(SegmentMapIter firstSegment, uint32_t size)
+   /**
+    * Returns true if any page covered by the segment may have changed since
+    * the segment was last checked.  Pages are sampled at most once per batch,
+    * a page which changed during the batch the segment was checked in counts
+    * as changed as we do not know whether it was sampled before or after the
+    * segment was.
+    */
+   bool
+   _pagesChangedSince(const Segment *segment)
    {
-      auto curAddress = firstSegment->second->address;
-      auto sizeLeft = size;
-
-      // We ensure there is a split point at the end for us to hit.
-      // TODO: Do this below as it will be slightly faster
-      _getSegment(curAddress + size, 0);
-
-      auto iter = firstSegment;
-      while (sizeLeft > 0) {
-         if (iter == mLookupMap.end()) {
-            _insertSegment(iter, curAddress, sizeLeft);
-            break;
-         }
-
-         if (iter->second->address != curAddress) {
-            auto gapSize = static_cast<uint32_t>(iter->second->address - curAddress);
-            auto newSize = std::min(gapSize, sizeLeft);
-
-            iter = _insertSegment(iter, curAddress, newSize);
+      auto firstPage = segment->address.getAddress() >> PageShift;
+      auto lastPage = (segment->address.getAddress() + segment->size - 1) >> PageShift;
+      auto lastChangeIndex = uint64_t { 0 };
+
+      for (auto page = firstPage; page <= lastPage; ++page) {
+         auto chunk = _getPageChunk(page);
+         auto index = page & (PagesPerChunk - 1);
+         auto &sampled = chunk->sampled[index / 64];
+         auto bit = 1ull << (index % 64);
+
+         if (!(sampled & bit)) {
+            auto state = cpu::getMemoryState(phys_addr { page << PageShift }, PageSize);
+            if (chunk->lastChangeIndex[index] == NeverSampled || chunk->state[index] != state) {
+               chunk->state[index] = state;
+               chunk->lastChangeIndex[index] = mCurrentBatchIndex;
+            }
+
+            if (!chunk->sampledThisBatch) {
+               chunk->sampledThisBatch = true;
+               mSampledChunks.push_back(chunk);
+            }
+
+            sampled |= bit;
          }
 
-         auto& segment = iter->second;
-
-         decaf_check(segment->address == curAddress);
-         decaf_check(segment->size <= sizeLeft);
-
-         curAddress += segment->size;
-         sizeLeft -= segment->size;
-
-         iter++;
+         lastChangeIndex = std::max(lastChangeIndex, chunk->lastChangeIndex[index]);
       }
+
+      return lastChangeIndex >= segment->lastCheckIndex;
    }
 
    void
@@ -335,6 +440,17 @@ protected:
          return;
       }
 
+      // If none of the pages this segment covers have changed since we last
+      // checked it, then neither has the segment.
+      if (mPageFilterEnabled && segment->lastCheckIndex > 0) {
+         auto pageOffset = segment->address.getAddress() & (PageSize - 1);
+         auto numPages = (pageOffset + segment->size + PageSize - 1) >> PageShift;
+         if (numPages <= MaxPageFilterPages && !_pagesChangedSince(segment)) {
+            segment->lastCheckIndex = mCurrentBatchIndex;
+            return;
+         }
+      }
+
       // Rehash all our data
       auto dataState = cpu::getMemoryState(segment->address, segment->size);
 
@@ -357,9 +473,15 @@ protected:
 
    uint64_t mCurrentBatchIndex = 0;
    uint64_t mChangeCounter = 0;
-   SegmentMap mLookupMap;
-   std::vector<Segment> mLinearSegments;
-   std::forward_list<Segment> mDynamicSegments;
+
+   // Start address of each segment, sorted, parallel to mSegments.
+   std::vector<uint32_t> mStarts;
+   std::vector<Segment> mSegments;
+   std::vector<std::pair<uint32_t, uint32_t>> mGapScratch;
+
+   bool mPageFilterEnabled = false;
+   std::vector<std::unique_ptr<PageChunk>> mPageChunks;
+   std::vector<PageChunk *> mSampledChunks;
 
 };
 
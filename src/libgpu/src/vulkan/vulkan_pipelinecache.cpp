@@ -0,0 +1,411 @@
+#ifdef DECAF_VULKAN
+#include "vulkan_driver.h"
+#include "gpu_config.h"
+
+#include <algorithm>
+#include <common/log.h>
+#include <common/platform_dir.h>
+#include <common/platform_thread.h>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+
+/*
+The pipeline cache persists two things for each title between sessions:
+
+ - The VkPipelineCache data, this is specific to the device and driver so it
+   is stored per title and per device pipelineCacheUUID.
+ - The list of every pipeline the title has used, as PersistentPipelineDesc.
+
+When a title is loaded the VkPipelineCache is recreated from the saved data
+and every pipeline in the list is compiled on background threads, using the
+shaders stored in the shader cache.  The pipelines compiled in the background
+are thrown away, their only purpose is to fill the VkPipelineCache so that
+when the title actually needs a pipeline creating it is a cache hit.  We can
+not put them straight into mPipelines as PipelineDesc is keyed on the shader
+objects, which are keyed on the guest address of the shader binaries.
+
+Both files are written when the title changes and when the driver is destroyed.
+*/
+
+namespace vulkan
+{
+
+static constexpr uint32_t PipelineListMagic = 0x4C504B44; // "DKPL"
+static constexpr uint32_t PipelineListVersion = 1;
+
+struct PipelineListHeader
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t descSize;
+   uint32_t numPipelines;
+};
+
+static bool
+readCacheFile(const std::string &path,
+              std::vector<uint8_t> &data)
+{
+   auto error = std::error_code { };
+   if (!std::filesystem::exists(path, error)) {
+      return false;
+   }
+
+   auto size = std::filesystem::file_size(path, error);
+   if (error) {
+      return false;
+   }
+
+   auto file = std::ifstream { path, std::ifstream::in | std::ifstream::binary };
+   data.resize(static_cast<size_t>(size));
+   return !!file.read(reinterpret_cast<char *>(data.data()), data.size());
+}
+
+/**
+ * Write a cache file, we write to a temporary file first so that we never
+ * leave a partially written cache file behind.
+ */
+static bool
+writeCacheFile(const std::string &path,
+               const void *header,
+               size_t headerSize,
+               const void *data,
+               size_t dataSize)
+{
+   auto tmpPath = path + ".tmp";
+   platform::createParentDirectories(path);
+
+   {
+      auto file = std::ofstream { tmpPath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc };
+      if (!file.write(reinterpret_cast<const char *>(header), headerSize) ||
+          !file.write(reinterpret_cast<const char *>(data), dataSize)) {
+         return false;
+      }
+   }
+
+   auto error = std::error_code { };
+   std::filesystem::rename(tmpPath, path, error);
+   return !error;
+}
+
+/**
+ * Load a shader for pipeline precompilation from the shader cache.
+ */
+template<typename ObjectType>
+static ObjectType *
+loadPrecompileShader(vk::Device device,
+                     spirv::ShaderCache &shaderCache,
+                     std::unordered_map<uint64_t, std::unique_ptr<ObjectType>> &shaders,
+                     uint64_t key)
+{
+   auto itr = shaders.find(key);
+   if (itr != shaders.end()) {
+      return itr->second.get();
+   }
+
+   auto &shader = shaders[key];
+   auto object = std::make_unique<ObjectType>();
+   object->cacheKey = key;
+
+   if (!shaderCache.find(key, &object->shader)) {
+      return nullptr;
+   }
+
+   object->module = device.createShaderModule(
+      vk::ShaderModuleCreateInfo({}, object->shader.binary.size() * 4,
+                                 object->shader.binary.data()));
+   shader = std::move(object);
+   return shader.get();
+}
+
+template<typename ObjectType>
+static void
+destroyPrecompileShaders(vk::Device device,
+                         std::unordered_map<uint64_t, std::unique_ptr<ObjectType>> &shaders)
+{
+   for (auto &[key, shader] : shaders) {
+      if (shader) {
+         device.destroyShaderModule(shader->module);
+      }
+   }
+
+   shaders.clear();
+}
+
+/**
+ * Check if the loaded title has changed and if so save the pipeline cache for
+ * the previous title and load the one for the new title.
+ */
+void
+Driver::checkTitlePipelineCache()
+{
+   auto titleId = mLoadedTitleId.load();
+
+   if (titleId != mPipelineCacheTitleId) {
+      // Nothing else may use mPipelineCache while we replace it
+      stopPipelinePrecompile();
+      pauseCompileThreads();
+      savePipelineCache();
+      loadPipelineCache(titleId);
+      resumeCompileThreads();
+   } else if (mPipelinePrecompile && mPipelinePrecompile->numRunningThreads == 0) {
+      // Precompilation has finished, release the shader modules it used
+      stopPipelinePrecompile();
+   }
+}
+
+void
+Driver::loadPipelineCache(uint64_t titleId)
+{
+   mPipelineCacheTitleId = titleId;
+   mPipelineCachePath.clear();
+   mPipelineListPath.clear();
+   mPersistentPipelines.clear();
+   mPersistentPipelineHashes.clear();
+
+   if (!titleId || !gpu::config()->cache.pipeline_cache) {
+      return;
+   }
+
+   // The pipeline cache data is only valid for the device it came from
+   auto deviceProps = mPhysDevice.getProperties();
+   auto deviceUuid = std::string { };
+   for (auto byte : deviceProps.pipelineCacheUUID) {
+      deviceUuid += fmt::format("{:02x}", byte);
+   }
+
+   mPipelineCachePath = getCacheFilePath(
+      fmt::format("vk_pipeline_cache_{:016X}_{}.bin", titleId, deviceUuid));
+   mPipelineListPath = getCacheFilePath(
+      fmt::format("pipelines_{:016X}.bin", titleId));
+
+   // Replace our pipeline cache with one created from the saved data, if the
+   // data is not compatible the driver will just give us an empty cache.
+   auto cacheData = std::vector<uint8_t> { };
+   readCacheFile(mPipelineCachePath, cacheData);
+
+   auto pipelineCacheCreateInfo = vk::PipelineCacheCreateInfo { };
+   pipelineCacheCreateInfo.flags = vk::PipelineCacheCreateFlags { };
+   pipelineCacheCreateInfo.pInitialData = cacheData.data();
+   pipelineCacheCreateInfo.initialDataSize = cacheData.size();
+   mDevice.destroyPipelineCache(mPipelineCache);
+   mPipelineCache = mDevice.createPipelineCache(pipelineCacheCreateInfo);
+
+   // Read the list of pipelines used by the title
+   auto listData = std::vector<uint8_t> { };
+   auto header = PipelineListHeader { };
+
+   if (readCacheFile(mPipelineListPath, listData) &&
+       listData.size() >= sizeof(PipelineListHeader)) {
+      std::memcpy(&header, listData.data(), sizeof(PipelineListHeader));
+
+      auto numPipelines = (listData.size() - sizeof(PipelineListHeader)) / sizeof(PersistentPipelineDesc);
+      if (header.magic == PipelineListMagic &&
+          header.version == PipelineListVersion &&
+          header.descSize == sizeof(PersistentPipelineDesc) &&
+          header.numPipelines == numPipelines) {
+         mPersistentPipelines.resize(numPipelines);
+         std::memcpy(mPersistentPipelines.data(),
+                     listData.data() + sizeof(PipelineListHeader),
+                     numPipelines * sizeof(PersistentPipelineDesc));
+
+         for (auto &desc : mPersistentPipelines) {
+            mPersistentPipelineHashes.insert(desc.hash());
+         }
+      } else {
+         gLog->info("Discarding out of date pipeline list {}", mPipelineListPath);
+      }
+   }
+
+   gLog->info("Loaded pipeline cache for title {:016X}, {} bytes of pipeline cache data, {} pipelines",
+              titleId, cacheData.size(), mPersistentPipelines.size());
+
+   startPipelinePrecompile();
+}
+
+void
+Driver::savePipelineCache()
+{
+   if (mPipelineCachePath.empty()) {
+      return;
+   }
+
+   auto cacheData = mDevice.getPipelineCacheData(mPipelineCache);
+   if (!writeCacheFile(mPipelineCachePath, nullptr, 0,
+                       cacheData.data(), cacheData.size())) {
+      gLog->warn("Failed to write pipeline cache {}", mPipelineCachePath);
+   }
+
+   auto header = PipelineListHeader { };
+   header.magic = PipelineListMagic;
+   header.version = PipelineListVersion;
+   header.descSize = sizeof(PersistentPipelineDesc);
+   header.numPipelines = static_cast<uint32_t>(mPersistentPipelines.size());
+
+   if (!writeCacheFile(mPipelineListPath, &header, sizeof(header),
+                       mPersistentPipelines.data(),
+                       mPersistentPipelines.size() * sizeof(PersistentPipelineDesc))) {
+      gLog->warn("Failed to write pipeline list {}", mPipelineListPath);
+   }
+}
+
+/**
+ * Add a pipeline to the list of pipelines used by the current title.
+ */
+void
+Driver::recordPipeline(const PipelineDesc& desc)
+{
+   if (mPipelineListPath.empty()) {
+      return;
+   }
+
+   auto persistentDesc = PersistentPipelineDesc { };
+   persistentDesc.vertexShaderKey = desc.vertexShader ? desc.vertexShader->cacheKey : 0;
+   persistentDesc.geometryShaderKey = desc.geometryShader ? desc.geometryShader->cacheKey : 0;
+   persistentDesc.pixelShaderKey = desc.pixelShader ? desc.pixelShader->cacheKey : 0;
+   persistentDesc.hasRectStubShader = !!desc.rectStubShader;
+   persistentDesc.renderPass = *desc.renderPass->desc;
+
+   persistentDesc.pipeline = desc;
+   persistentDesc.pipeline.renderPass = nullptr;
+   persistentDesc.pipeline.vertexShader = nullptr;
+   persistentDesc.pipeline.geometryShader = nullptr;
+   persistentDesc.pipeline.pixelShader = nullptr;
+   persistentDesc.pipeline.rectStubShader = nullptr;
+
+   if (mPersistentPipelineHashes.insert(persistentDesc.hash()).second) {
+      mPersistentPipelines.push_back(persistentDesc);
+   }
+}
+
+/**
+ * Start compiling the pipelines used by the title in previous sessions on
+ * background threads.
+ *
+ * The shaders, render passes and pipeline layouts are all created here on the
+ * GPU thread, leaving only the pipeline creation for the background threads.
+ */
+void
+Driver::startPipelinePrecompile()
+{
+   if (mPersistentPipelines.empty()) {
+      return;
+   }
+
+   auto job = std::make_unique<PipelinePrecompileJob>();
+   job->pipelines.reserve(mPersistentPipelines.size());
+
+   for (auto &persistentDesc : mPersistentPipelines) {
+      auto desc = persistentDesc.pipeline;
+
+      // Skip any pipelines whose shaders are missing from the shader cache
+      desc.vertexShader =
+         loadPrecompileShader(mDevice, mShaderCache, job->vertexShaders,
+                              persistentDesc.vertexShaderKey);
+      if (!desc.vertexShader) {
+         continue;
+      }
+
+      if (persistentDesc.geometryShaderKey) {
+         desc.geometryShader =
+            loadPrecompileShader(mDevice, mShaderCache, job->geometryShaders,
+                                 persistentDesc.geometryShaderKey);
+         if (!desc.geometryShader) {
+            continue;
+         }
+      }
+
+      if (persistentDesc.pixelShaderKey) {
+         desc.pixelShader =
+            loadPrecompileShader(mDevice, mShaderCache, job->pixelShaders,
+                                 persistentDesc.pixelShaderKey);
+         if (!desc.pixelShader) {
+            continue;
+         }
+      }
+
+      if (persistentDesc.hasRectStubShader) {
+         desc.rectStubShader = getRectStubShader(
+            spirv::generateRectSubShaderDesc(&desc.vertexShader->shader));
+      }
+
+      desc.renderPass = getRenderPass(persistentDesc.renderPass);
+
+      auto &pipelineObj = job->pipelines.emplace_back();
+      pipelineObj.desc = desc;
+      pipelineObj.pipelineLayout = getPipelinePushLayout(desc);
+   }
+
+   if (job->pipelines.empty()) {
+      destroyPrecompileShaders(mDevice, job->vertexShaders);
+      destroyPrecompileShaders(mDevice, job->geometryShaders);
+      destroyPrecompileShaders(mDevice, job->pixelShaders);
+      return;
+   }
+
+   auto numThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+   numThreads = std::min(numThreads, 4u);
+   numThreads = std::min(numThreads, static_cast<unsigned>(job->pipelines.size()));
+
+   gLog->info("Precompiling {} pipelines on {} threads",
+              job->pipelines.size(), numThreads);
+
+   job->numRunningThreads = numThreads;
+   for (auto i = 0u; i < numThreads; ++i) {
+      job->threads.emplace_back(&Driver::pipelinePrecompileThread, this, job.get());
+      platform::setThreadName(&job->threads.back(),
+                              fmt::format("Pipeline Precompile Thread #{}", i));
+   }
+
+   mPipelinePrecompile = std::move(job);
+}
+
+/**
+ * Cancel any pipeline precompilation still in progress and release the
+ * resources used by it.
+ */
+void
+Driver::stopPipelinePrecompile()
+{
+   if (!mPipelinePrecompile) {
+      return;
+   }
+
+   auto &job = *mPipelinePrecompile;
+   job.cancelled = true;
+
+   for (auto &thread : job.threads) {
+      thread.join();
+   }
+
+   destroyPrecompileShaders(mDevice, job.vertexShaders);
+   destroyPrecompileShaders(mDevice, job.geometryShaders);
+   destroyPrecompileShaders(mDevice, job.pixelShaders);
+
+   gLog->info("Precompiled {} of {} pipelines",
+              std::min<size_t>(job.nextPipeline, job.pipelines.size()),
+              job.pipelines.size());
+   mPipelinePrecompile.reset();
+}
+
+void
+Driver::pipelinePrecompileThread(PipelinePrecompileJob *job)
+{
+   while (!job->cancelled) {
+      auto index = job->nextPipeline++;
+      if (index >= job->pipelines.size()) {
+         break;
+      }
+
+      auto &pipelineObj = job->pipelines[index];
+      compilePipeline(&pipelineObj);
+      mDevice.destroyPipeline(pipelineObj.pipeline);
+   }
+
+   job->numRunningThreads--;
+}
+
+} // namespace vulkan
+
+#endif // ifdef DECAF_VULKAN
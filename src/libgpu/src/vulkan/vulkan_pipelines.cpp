@@ -397,30 +397,72 @@ Driver::checkCurrentPipeline()
 
    auto& foundPipeline = mPipelines[currentDesc.hash()];
    if (foundPipeline) {
+      if (!foundPipeline->ready) {
+         // Still compiling, skip this draw
+         mDeferredDrawsThisFrame++;
+         return false;
+      }
+
+      mDebugInfo.numPipelineHits++;
       mCurrentDraw->pipeline = foundPipeline;
       return true;
    }
 
+   mDebugInfo.numPipelineMisses++;
+
    foundPipeline = new PipelineObject();
    foundPipeline->desc = currentDesc;
+   foundPipeline->pipelineLayout = getPipelinePushLayout(*currentDesc);
+   recordPipeline(*currentDesc);
 
-   // ------------------------------------------------------------
-   // Pipeline Layout
-   // ------------------------------------------------------------
+   if (mAsyncCompile) {
+      foundPipeline->ready = false;
+      submitCompileJob(
+         [this, foundPipeline]() { compilePipeline(foundPipeline); },
+         [foundPipeline]() { foundPipeline->ready = true; });
 
-   vk::PipelineLayout pipelineLayout;
+      mDeferredDrawsThisFrame++;
+      return false;
+   }
+
+   compilePipeline(foundPipeline);
+   mCurrentDraw->pipeline = foundPipeline;
+   return true;
+}
 
-   HashedDesc<PipelineLayoutDesc> pipelineLayoutDesc = generatePipelineLayoutDesc(*currentDesc);
+/**
+ * Get the push descriptor pipeline layout to use for a pipeline, returns
+ * nullptr when the pipeline must use the generic descriptor set layout.
+ */
+PipelineLayoutObject *
+Driver::getPipelinePushLayout(const PipelineDesc &desc)
+{
+   HashedDesc<PipelineLayoutDesc> pipelineLayoutDesc = generatePipelineLayoutDesc(desc);
 
    if (!ForceDescriptorSets && pipelineLayoutDesc->numDescriptors < 32) {
-      auto pipelineLayoutObj = getPipelineLayout(pipelineLayoutDesc, true);
-      foundPipeline->pipelineLayout = pipelineLayoutObj;
-      pipelineLayout = pipelineLayoutObj->pipelineLayout;
-   } else {
-      // Too many descriptors to take advantage of using push descriptors, we have to
-      // fall back to using dynamically generated descriptor sets.
-      foundPipeline->pipelineLayout = nullptr;
-      pipelineLayout = mPipelineLayout;
+      return getPipelineLayout(pipelineLayoutDesc, true);
+   }
+
+   // Too many descriptors to take advantage of using push descriptors, we have to
+   // fall back to using dynamically generated descriptor sets.
+   return nullptr;
+}
+
+/**
+ * Create the Vulkan pipeline for a pipeline object from its description.
+ *
+ * This only uses the device and the pipeline cache, both of which Vulkan lets
+ * us use from multiple threads at once, so it is safe to call from the
+ * compile and pipeline precompile threads.
+ */
+void
+Driver::compilePipeline(PipelineObject *pipelineObj)
+{
+   const auto &currentDesc = pipelineObj->desc;
+
+   vk::PipelineLayout pipelineLayout = mPipelineLayout;
+   if (pipelineObj->pipelineLayout) {
+      pipelineLayout = pipelineObj->pipelineLayout->pipelineLayout;
    }
 
 
@@ -911,20 +953,18 @@ Driver::checkCurrentPipeline()
    pipelineInfo.pColorBlendState = &colorBlendState;
    pipelineInfo.pDynamicState = &dynamicDesc;
    pipelineInfo.layout = pipelineLayout;
-   pipelineInfo.renderPass = mCurrentDraw->renderPass->renderPass;
+   pipelineInfo.renderPass = currentDesc->renderPass->renderPass;
    pipelineInfo.subpass = 0;
    pipelineInfo.basePipelineHandle = vk::Pipeline();
    pipelineInfo.basePipelineIndex = -1;
    auto pipeline = mDevice.createGraphicsPipeline(mPipelineCache, pipelineInfo);
 
-   foundPipeline->pipeline = pipeline.value;
-   foundPipeline->needsPremultipliedTargets = needsPremultipliedTargets;
-   foundPipeline->targetIsPremultiplied = targetIsPremultiplied;
-   foundPipeline->shaderLopMode = shaderLopMode;
-   foundPipeline->shaderAlphaFunc = currentDesc->alphaFunc;
-   foundPipeline->shaderAlphaRef = currentDesc->alphaRef;
-   mCurrentDraw->pipeline = foundPipeline;
-   return true;
+   pipelineObj->pipeline = pipeline.value;
+   pipelineObj->needsPremultipliedTargets = needsPremultipliedTargets;
+   pipelineObj->targetIsPremultiplied = targetIsPremultiplied;
+   pipelineObj->shaderLopMode = shaderLopMode;
+   pipelineObj->shaderAlphaFunc = currentDesc->alphaFunc;
+   pipelineObj->shaderAlphaRef = currentDesc->alphaRef;
 }
 
 } // namespace vulkan
@@ -118,6 +118,10 @@ Driver::decafSwapBuffers(const latte::pm4::DecafSwapBuffers &data)
 {
    static const auto weight = 0.9;
 
+   auto deferredDraws = mDeferredDrawsThisFrame;
+   auto pendingCompiles = mNumPendingCompileJobs;
+   mDeferredDrawsThisFrame = 0;
+
    addRetireTask([=](){
       // Send out the flip event
       gpu::onFlip();
@@ -132,6 +136,8 @@ Driver::decafSwapBuffers(const latte::pm4::DecafSwapBuffers &data)
       mLastSwap = now;
 
       // Update our debugging info every flip
+      mDebugInfo.numDeferredDraws = deferredDraws;
+      mDebugInfo.numPendingCompiles = pendingCompiles;
       updateDebuggerInfo();
 
       // Render the display!
@@ -347,30 +353,9 @@ Driver::drawIndexImmd(const latte::pm4::DrawIndexImmd &data)
 void
 Driver::memWrite(const latte::pm4::MemWrite &data)
 {
-   auto addr = phys_addr { data.addrLo.ADDR_LO() << 2 };
-   auto ptr = gpu::internal::translateAddress(addr);
-   auto value = uint64_t { 0 };
-
-   // Read value
-   if (data.addrHi.CNTR_SEL() == latte::pm4::MW_WRITE_CLOCK) {
-      value = gpu::clock::now();
-   } else if (data.addrHi.DATA32()) {
-      value = static_cast<uint64_t>(data.dataLo);
-   } else {
-      value = static_cast<uint64_t>(data.dataLo) |
-              (static_cast<uint64_t>(data.dataHi) << 32);
-   }
-
-   // Swap value
-   value = latte::applyEndianSwap(value, data.addrLo.ENDIAN_SWAP());
-
-   // Write value
+   auto write = decodeMemWrite(data);
    addRetireTask([=](){
-      if (data.addrHi.DATA32()) {
-         *reinterpret_cast<uint32_t *>(ptr) = static_cast<uint32_t>(value);
-      } else {
-         *reinterpret_cast<uint64_t *>(ptr) = value;
-      }
+      write.apply();
    });
 }
 
@@ -430,49 +415,16 @@ void
 Driver::eventWriteEOP(const latte::pm4::EventWriteEOP &data)
 {
    // Write event data to memory if required
-   if (data.addrHi.DATA_SEL() != latte::pm4::EWP_DATA_DISCARD) {
-      auto addr = phys_addr { data.addrLo.ADDR_LO() << 2 };
-      auto ptr = gpu::internal::translateAddress(addr);
-      decaf_assert(data.addrHi.ADDR_HI() == 0, "Invalid event write address (high word not zero)");
-
-      // Read value
-      auto value = uint64_t { 0u };
-      switch (data.addrHi.DATA_SEL()) {
-      case latte::pm4::EWP_DATA_32:
-         value = data.dataLo;
-         break;
-      case latte::pm4::EWP_DATA_64:
-         value = static_cast<uint64_t>(data.dataLo) |
-                 (static_cast<uint64_t>(data.dataHi) << 32);
-         break;
-      case latte::pm4::EWP_DATA_CLOCK:
-         value = gpu::clock::now();
-         break;
-      }
-
-      // Swap value
-      value = latte::applyEndianSwap(value, data.addrLo.ENDIAN_SWAP());
-
-      addRetireTask([=](){
-         // Write value
-         switch (data.addrHi.DATA_SEL()) {
-         case latte::pm4::EWP_DATA_32:
-            *reinterpret_cast<uint32_t *>(ptr) = static_cast<uint32_t>(value);
-            break;
-         case latte::pm4::EWP_DATA_64:
-         case latte::pm4::EWP_DATA_CLOCK:
-            *reinterpret_cast<uint64_t *>(ptr) = value;
-            break;
-         }
+   if (auto write = decodeEventWriteEOP(data)) {
+      addRetireTask([write = *write](){
+         write.apply();
       });
    }
 
    // Generate interrupt if required
    if (data.addrHi.INT_SEL() != latte::pm4::EWP_INT_NONE) {
-      addRetireTask([=](){
-         auto interrupt = gpu::ih::Entry { };
-         interrupt.word0 = latte::CP_INT_SRC_ID::CP_EOP_EVENT;
-         gpu::ih::write(interrupt);
+      addRetireTask([](){
+         writeEndOfPipeInterrupt();
       });
    }
 }
@@ -574,11 +526,6 @@ Driver::executeBuffer(const gpu::ringbuffer::Buffer &buffer)
 
    // End our command group
    endCommandGroup();
-
-   // Optimize the memory layout of our segments every 10 frames.
-   if (mActiveBatchIndex % 10 == 0) {
-      mMemTracker.optimize();
-   }
 }
 
 } // namespace vulkan
@@ -97,44 +97,23 @@ Driver::getRenderPassDesc()
    return desc;
 }
 
-bool
-Driver::checkCurrentRenderPass()
+RenderPassObject *
+Driver::getRenderPass(const HashedDesc<RenderPassDesc> &desc)
 {
-   HashedDesc<RenderPassDesc> currentDesc = getRenderPassDesc();
-
-   if (!currentDesc->colorTargets[0].isEnabled &&
-       !currentDesc->colorTargets[1].isEnabled &&
-       !currentDesc->colorTargets[2].isEnabled &&
-       !currentDesc->colorTargets[3].isEnabled &&
-       !currentDesc->colorTargets[4].isEnabled &&
-       !currentDesc->colorTargets[5].isEnabled &&
-       !currentDesc->colorTargets[6].isEnabled &&
-       !currentDesc->colorTargets[7].isEnabled &&
-       !currentDesc->depthTarget.isEnabled) {
-      decaf_check_warn_once(!"Draw executed with no render targets");
-      return false;
-   }
-
-   if (mCurrentDraw->renderPass && mCurrentDraw->renderPass->desc == currentDesc) {
-      // Already active, nothing to do.
-      return true;
-   }
-
-   auto& foundRp = mRenderPasses[currentDesc.hash()];
+   auto& foundRp = mRenderPasses[desc.hash()];
    if (foundRp) {
-      mCurrentDraw->renderPass = foundRp;
-      return true;
+      return foundRp;
    }
 
    foundRp = new RenderPassObject();
-   foundRp->desc = currentDesc;
+   foundRp->desc = desc;
 
    std::vector<vk::AttachmentDescription> attachmentDescs;
    std::array<vk::AttachmentReference, latte::MaxRenderTargets> colorAttachmentRefs;
    vk::AttachmentReference depthAttachmentRef;
 
    for (auto i = 0u; i < latte::MaxRenderTargets; ++i) {
-      auto &colorTarget = currentDesc->colorTargets[i];
+      auto &colorTarget = desc->colorTargets[i];
 
       if (!colorTarget.isEnabled || colorTarget.format == latte::CB_FORMAT::COLOR_INVALID) {
          colorAttachmentRefs[i].attachment = VK_ATTACHMENT_UNUSED;
@@ -167,7 +146,7 @@ Driver::checkCurrentRenderPass()
    }
 
    do {
-      auto depthTarget = currentDesc->depthTarget;
+      auto depthTarget = desc->depthTarget;
       if (!depthTarget.isEnabled || depthTarget.format == latte::DB_FORMAT::DEPTH_INVALID) {
          depthAttachmentRef.attachment = VK_ATTACHMENT_UNUSED;
          depthAttachmentRef.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
@@ -218,7 +197,33 @@ Driver::checkCurrentRenderPass()
    auto renderPass = mDevice.createRenderPass(renderPassDesc);
    foundRp->renderPass = renderPass;
 
-   mCurrentDraw->renderPass = foundRp;
+   return foundRp;
+}
+
+bool
+Driver::checkCurrentRenderPass()
+{
+   HashedDesc<RenderPassDesc> currentDesc = getRenderPassDesc();
+
+   if (!currentDesc->colorTargets[0].isEnabled &&
+       !currentDesc->colorTargets[1].isEnabled &&
+       !currentDesc->colorTargets[2].isEnabled &&
+       !currentDesc->colorTargets[3].isEnabled &&
+       !currentDesc->colorTargets[4].isEnabled &&
+       !currentDesc->colorTargets[5].isEnabled &&
+       !currentDesc->colorTargets[6].isEnabled &&
+       !currentDesc->colorTargets[7].isEnabled &&
+       !currentDesc->depthTarget.isEnabled) {
+      decaf_check_warn_once(!"Draw executed with no render targets");
+      return false;
+   }
+
+   if (mCurrentDraw->renderPass && mCurrentDraw->renderPass->desc == currentDesc) {
+      // Already active, nothing to do.
+      return true;
+   }
+
+   mCurrentDraw->renderPass = getRenderPass(currentDesc);
    return true;
 }
 
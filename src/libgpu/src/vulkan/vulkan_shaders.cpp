@@ -376,14 +376,14 @@ dumpRawShader(const spirv::ShaderDesc *desc,
    }
 }
 
-static void
-dumpTranslatedShader(const spirv::ShaderDesc *desc,
-                     const spirv::Shader *shader)
+/**
+ * Returns the name used for dumped and debug named shader objects, this is
+ * based on the guest addresses of the shader binaries so it must be called
+ * with the guest desc rather than a copy of it.
+ */
+static std::string
+getShaderName(const spirv::ShaderDesc *desc)
 {
-   auto shaderText = spirv::shaderToString(shader);
-   auto shaderName = std::string { };
-   auto outputStr = std::string { };
-
    if (desc->type == spirv::ShaderType::Vertex) {
       auto vsDesc = reinterpret_cast<const spirv::VertexShaderDesc*>(desc);
       auto vsAddr = static_cast<uint32_t>(
@@ -391,7 +391,7 @@ dumpTranslatedShader(const spirv::ShaderDesc *desc,
       auto fsAddr = static_cast<uint32_t>(
          reinterpret_cast<uintptr_t>(vsDesc->fsBinary.data()));
 
-      shaderName = fmt::format("vs_{:08x}_{:08x}", vsAddr, fsAddr);
+      return fmt::format("vs_{:08x}_{:08x}", vsAddr, fsAddr);
    } else if (desc->type == spirv::ShaderType::Geometry) {
       auto gsDesc = reinterpret_cast<const spirv::GeometryShaderDesc*>(desc);
       auto gsAddr = static_cast<uint32_t>(
@@ -399,16 +399,25 @@ dumpTranslatedShader(const spirv::ShaderDesc *desc,
       auto dcAddr = static_cast<uint32_t>(
          reinterpret_cast<uintptr_t>(gsDesc->dcBinary.data()));
 
-      shaderName = fmt::format("gs_{:08x}_{:08x}", gsAddr, dcAddr);
+      return fmt::format("gs_{:08x}_{:08x}", gsAddr, dcAddr);
    } else if (desc->type == spirv::ShaderType::Pixel) {
       auto psDesc = reinterpret_cast<const spirv::PixelShaderDesc*>(desc);
       auto psAddr = static_cast<uint32_t>(
          reinterpret_cast<uintptr_t>(psDesc->binary.data()));
 
-      shaderName = fmt::format("ps_{:08x}", psAddr);
+      return fmt::format("ps_{:08x}", psAddr);
    } else {
       decaf_abort("Unexpected shader type");
    }
+}
+
+static void
+dumpTranslatedShader(const spirv::ShaderDesc *desc,
+                     const std::string &shaderName,
+                     const spirv::Shader *shader)
+{
+   auto shaderText = spirv::shaderToString(shader);
+   auto outputStr = std::string { };
 
    if (desc->type == spirv::ShaderType::Vertex) {
       outputStr += "Compiled Vertex Shader:\n";
@@ -441,6 +450,93 @@ dumpTranslatedShader(const spirv::ShaderDesc *desc,
    }
 }
 
+static gsl::span<const uint8_t>
+copyShaderBinary(gsl::span<const uint8_t> binary,
+                 std::vector<uint8_t> &storage)
+{
+   storage.assign(binary.begin(), binary.end());
+   return gsl::make_span(storage.data(), storage.size());
+}
+
+/**
+ * Translate a shader and create its shader module, when async compilation is
+ * enabled this is called from the compile threads.
+ */
+void
+Driver::compileVertexShader(VertexShaderObject *shader,
+                            const spirv::VertexShaderDesc &desc,
+                            const std::string &name)
+{
+   if (!mShaderCache.find(shader->cacheKey, &shader->shader)) {
+      if (!spirv::translate(desc, &shader->shader)) {
+         decaf_abort("Failed to translate vertex shader");
+      }
+
+      mShaderCache.insert(shader->cacheKey, shader->shader);
+   }
+
+   if (mDumpShaders) {
+      dumpTranslatedShader(&desc, name, &shader->shader);
+   }
+
+   auto module = mDevice.createShaderModule(
+      vk::ShaderModuleCreateInfo({}, shader->shader.binary.size() * 4,
+                                 shader->shader.binary.data()));
+   shader->module = module;
+
+   setVkObjectName(module, name.c_str());
+}
+
+void
+Driver::compileGeometryShader(GeometryShaderObject *shader,
+                              const spirv::GeometryShaderDesc &desc,
+                              const std::string &name)
+{
+   if (!mShaderCache.find(shader->cacheKey, &shader->shader)) {
+      if (!spirv::translate(desc, &shader->shader)) {
+         decaf_abort("Failed to translate geometry shader");
+      }
+
+      mShaderCache.insert(shader->cacheKey, shader->shader);
+   }
+
+   if (mDumpShaders) {
+      dumpTranslatedShader(&desc, name, &shader->shader);
+   }
+
+   auto module = mDevice.createShaderModule(
+      vk::ShaderModuleCreateInfo({}, shader->shader.binary.size() * 4,
+                                 shader->shader.binary.data()));
+   shader->module = module;
+
+   setVkObjectName(module, name.c_str());
+}
+
+void
+Driver::compilePixelShader(PixelShaderObject *shader,
+                           const spirv::PixelShaderDesc &desc,
+                           const std::string &name)
+{
+   if (!mShaderCache.find(shader->cacheKey, &shader->shader)) {
+      if (!spirv::translate(desc, &shader->shader)) {
+         decaf_abort("Failed to translate pixel shader");
+      }
+
+      mShaderCache.insert(shader->cacheKey, shader->shader);
+   }
+
+   if (mDumpShaders) {
+      dumpTranslatedShader(&desc, name, &shader->shader);
+   }
+
+   auto module = mDevice.createShaderModule(
+      vk::ShaderModuleCreateInfo({}, shader->shader.binary.size() * 4,
+                                 shader->shader.binary.data()));
+   shader->module = module;
+
+   setVkObjectName(module, name.c_str());
+}
+
 bool
 Driver::checkCurrentVertexShader()
 {
@@ -465,34 +561,48 @@ Driver::checkCurrentVertexShader()
 
    auto& foundShader = mVertexShaders[currentDesc.hash()];
    if (foundShader) {
+      if (!foundShader->ready) {
+         // Still compiling, skip this draw
+         mDeferredDrawsThisFrame++;
+         return false;
+      }
+
+      mDebugInfo.numShaderHits++;
       mCurrentDraw->vertexShader = foundShader;
       return true;
    }
 
+   mDebugInfo.numShaderMisses++;
+
    foundShader = new VertexShaderObject();
    foundShader->desc = currentDesc;
+   foundShader->cacheKey = spirv::ShaderCache::getKey(*currentDesc);
 
    if (mDumpShaders) {
       dumpRawShader(&*currentDesc, mDumpShaderBinariesOnly);
    }
 
-   if (!spirv::translate(*currentDesc, &foundShader->shader)) {
-      decaf_abort("Failed to translate vertex shader");
-   }
+   auto name = getShaderName(&*currentDesc);
+   if (mAsyncCompile) {
+      // The guest may have overwritten the shader by the time the compile
+      // thread gets to it, so it must compile from a copy of the binaries.
+      auto binaries = std::make_shared<std::array<std::vector<uint8_t>, 2>>();
+      auto desc = *currentDesc;
+      desc.binary = copyShaderBinary(desc.binary, (*binaries)[0]);
+      desc.fsBinary = copyShaderBinary(desc.fsBinary, (*binaries)[1]);
 
-   if (mDumpShaders) {
-      dumpTranslatedShader(&*currentDesc, &foundShader->shader);
-   }
+      foundShader->ready = false;
+      submitCompileJob(
+         [this, foundShader, desc, binaries, name]() {
+            compileVertexShader(foundShader, desc, name);
+         },
+         [foundShader]() { foundShader->ready = true; });
 
-   auto module = mDevice.createShaderModule(
-      vk::ShaderModuleCreateInfo({}, foundShader->shader.binary.size() * 4,
-                                 foundShader->shader.binary.data()));
-   foundShader->module = module;
-
-   auto shaderAddr = static_cast<uint32_t>(
-      reinterpret_cast<uintptr_t>(currentDesc->binary.data()));
-   setVkObjectName(module, fmt::format("vs_{:08x}", shaderAddr).c_str());
+      mDeferredDrawsThisFrame++;
+      return false;
+   }
 
+   compileVertexShader(foundShader, *currentDesc, name);
    mCurrentDraw->vertexShader = foundShader;
    return true;
 }
@@ -521,34 +631,48 @@ Driver::checkCurrentGeometryShader()
 
    auto& foundShader = mGeometryShaders[currentDesc.hash()];
    if (foundShader) {
+      if (!foundShader->ready) {
+         // Still compiling, skip this draw
+         mDeferredDrawsThisFrame++;
+         return false;
+      }
+
+      mDebugInfo.numShaderHits++;
       mCurrentDraw->geometryShader = foundShader;
       return true;
    }
 
+   mDebugInfo.numShaderMisses++;
+
    foundShader = new GeometryShaderObject();
    foundShader->desc = currentDesc;
+   foundShader->cacheKey = spirv::ShaderCache::getKey(*currentDesc);
 
    if (mDumpShaders) {
       dumpRawShader(&*currentDesc, mDumpShaderBinariesOnly);
    }
 
-   if (!spirv::translate(*currentDesc, &foundShader->shader)) {
-      decaf_abort("Failed to translate geometry shader");
-   }
-
-   if (mDumpShaders) {
-      dumpTranslatedShader(&*currentDesc, &foundShader->shader);
-   }
+   auto name = getShaderName(&*currentDesc);
+   if (mAsyncCompile) {
+      // The guest may have overwritten the shader by the time the compile
+      // thread gets to it, so it must compile from a copy of the binaries.
+      auto binaries = std::make_shared<std::array<std::vector<uint8_t>, 2>>();
+      auto desc = *currentDesc;
+      desc.binary = copyShaderBinary(desc.binary, (*binaries)[0]);
+      desc.dcBinary = copyShaderBinary(desc.dcBinary, (*binaries)[1]);
 
-   auto module = mDevice.createShaderModule(
-      vk::ShaderModuleCreateInfo({}, foundShader->shader.binary.size() * 4,
-                                 foundShader->shader.binary.data()));
-   foundShader->module = module;
+      foundShader->ready = false;
+      submitCompileJob(
+         [this, foundShader, desc, binaries, name]() {
+            compileGeometryShader(foundShader, desc, name);
+         },
+         [foundShader]() { foundShader->ready = true; });
 
-   auto shaderAddr = static_cast<uint32_t>(
-      reinterpret_cast<uintptr_t>(currentDesc->binary.data()));
-   setVkObjectName(module, fmt::format("gs_{:08x}", shaderAddr).c_str());
+      mDeferredDrawsThisFrame++;
+      return false;
+   }
 
+   compileGeometryShader(foundShader, *currentDesc, name);
    mCurrentDraw->geometryShader = foundShader;
    return true;
 }
@@ -576,23 +700,64 @@ Driver::checkCurrentPixelShader()
 
    auto& foundShader = mPixelShaders[currentDesc.hash()];
    if (foundShader) {
+      if (!foundShader->ready) {
+         // Still compiling, skip this draw
+         mDeferredDrawsThisFrame++;
+         return false;
+      }
+
+      mDebugInfo.numShaderHits++;
       mCurrentDraw->pixelShader = foundShader;
       return true;
    }
 
+   mDebugInfo.numShaderMisses++;
+
    foundShader = new PixelShaderObject();
    foundShader->desc = currentDesc;
+   foundShader->cacheKey = spirv::ShaderCache::getKey(*currentDesc);
 
    if (mDumpShaders) {
       dumpRawShader(&*currentDesc, mDumpShaderBinariesOnly);
    }
 
-   if (!spirv::translate(*currentDesc, &foundShader->shader)) {
-      decaf_abort("Failed to translate pixel shader");
+   auto name = getShaderName(&*currentDesc);
+   if (mAsyncCompile) {
+      // The guest may have overwritten the shader by the time the compile
+      // thread gets to it, so it must compile from a copy of the binaries.
+      auto binaries = std::make_shared<std::array<std::vector<uint8_t>, 1>>();
+      auto desc = *currentDesc;
+      desc.binary = copyShaderBinary(desc.binary, (*binaries)[0]);
+
+      foundShader->ready = false;
+      submitCompileJob(
+         [this, foundShader, desc, binaries, name]() {
+            compilePixelShader(foundShader, desc, name);
+         },
+         [foundShader]() { foundShader->ready = true; });
+
+      mDeferredDrawsThisFrame++;
+      return false;
    }
 
-   if (mDumpShaders) {
-      dumpTranslatedShader(&*currentDesc, &foundShader->shader);
+   compilePixelShader(foundShader, *currentDesc, name);
+   mCurrentDraw->pixelShader = foundShader;
+   return true;
+}
+
+RectStubShaderObject *
+Driver::getRectStubShader(const HashedDesc<spirv::RectStubShaderDesc> &desc)
+{
+   auto& foundShader = mRectStubShaders[desc.hash()];
+   if (foundShader) {
+      return foundShader;
+   }
+
+   foundShader = new RectStubShaderObject();
+   foundShader->desc = desc;
+
+   if (!spirv::generateRectStub(*desc, &foundShader->shader)) {
+      decaf_abort("Failed to generate rect stub shader");
    }
 
    auto module = mDevice.createShaderModule(
@@ -600,12 +765,10 @@ Driver::checkCurrentPixelShader()
                                  foundShader->shader.binary.data()));
    foundShader->module = module;
 
-   auto shaderAddr = static_cast<uint32_t>(
-      reinterpret_cast<uintptr_t>(currentDesc->binary.data()));
-   setVkObjectName(module, fmt::format("ps_{:08x}", shaderAddr).c_str());
+   setVkObjectName(module,
+                   fmt::format("rstub_{}", desc->numVsExports).c_str());
 
-   mCurrentDraw->pixelShader = foundShader;
-   return true;
+   return foundShader;
 }
 
 bool
@@ -627,28 +790,7 @@ Driver::checkCurrentRectStubShader()
       return true;
    }
 
-   auto& foundShader = mRectStubShaders[currentDesc.hash()];
-   if (foundShader) {
-      mCurrentDraw->rectStubShader = foundShader;
-      return true;
-   }
-
-   foundShader = new RectStubShaderObject();
-   foundShader->desc = currentDesc;
-
-   if (!spirv::generateRectStub(*currentDesc, &foundShader->shader)) {
-      decaf_abort("Failed to generate rect stub shader");
-   }
-
-   auto module = mDevice.createShaderModule(
-      vk::ShaderModuleCreateInfo({}, foundShader->shader.binary.size() * 4,
-                                 foundShader->shader.binary.data()));
-   foundShader->module = module;
-
-   setVkObjectName(module,
-                   fmt::format("rstub_{}", currentDesc->numVsExports).c_str());
-
-   mCurrentDraw->rectStubShader = foundShader;
+   mCurrentDraw->rectStubShader = getRectStubShader(currentDesc);
    return true;
 }
 
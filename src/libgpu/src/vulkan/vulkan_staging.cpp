@@ -9,8 +9,22 @@ Staging buffers are used for performing uploads/downloads from the host GPU.
 These buffers will only last as long as a single host command buffer does, and
 thus all uploading must be done in the context where the buffer is created, or
 within a retire task of that particular command buffer.
+
+Most staging buffers are suballocated from a persistently mapped ring buffer
+for their type.  Allocations are released in the order they were made once
+the command buffer which used them has retired, so the space in front of the
+oldest live allocation is always free.  Transfers too large for the ring, or
+made while the ring is full, fall back to dedicated pooled buffers.
 */
 
+static constexpr uint32_t StagingRingAlignment = 256;
+
+static constexpr std::array<uint32_t, 3> StagingRingSize = {
+   32 * 1024 * 1024, // CpuToGpu
+   16 * 1024 * 1024, // GpuToCpu
+   32 * 1024 * 1024, // GpuToGpu
+};
+
 StagingBuffer *
 Driver::_allocStagingBuffer(uint32_t size, StagingBufferType type)
 {
@@ -85,7 +99,77 @@ Driver::_allocStagingBuffer(uint32_t size, StagingBufferType type)
 }
 
 StagingBuffer *
-Driver::getStagingBuffer(uint32_t size, StagingBufferType type)
+Driver::_allocRingStagingBuffer(uint32_t size, StagingBufferType type)
+{
+   auto typeIndex = static_cast<uint32_t>(type);
+   auto &ring = mStagingRings[typeIndex];
+   auto ringSize = StagingRingSize[typeIndex];
+   auto allocSize = align_up(size, StagingRingAlignment);
+
+   // Large transfers would take up too much of the ring at once
+   if (allocSize > ringSize / 4) {
+      return nullptr;
+   }
+
+   if (!ring.buffer) {
+      ring.buffer = _allocStagingBuffer(ringSize, type);
+   }
+
+   auto offset = 0u;
+
+   if (!ring.allocations.empty()) {
+      auto tail = ring.allocations.front()->offset;
+
+      if (ring.head > tail) {
+         // The free space is from head to the end of the ring, and from the
+         // start of the ring up to tail
+         if (ringSize - ring.head >= allocSize) {
+            offset = ring.head;
+         } else if (tail >= allocSize) {
+            offset = 0;
+         } else {
+            return nullptr;
+         }
+      } else {
+         // We have wrapped around, the free space is between head and tail
+         if (tail - ring.head >= allocSize) {
+            offset = ring.head;
+         } else {
+            return nullptr;
+         }
+      }
+   }
+
+   StagingBuffer *sbuffer = nullptr;
+   if (!mStagingRingAllocPool.empty()) {
+      sbuffer = mStagingRingAllocPool.back();
+      mStagingRingAllocPool.pop_back();
+   } else {
+      sbuffer = new StagingBuffer();
+   }
+
+   sbuffer->type = type;
+   sbuffer->poolIndex = 0;
+   sbuffer->maximumSize = allocSize;
+   sbuffer->activeUsage = ResourceUsage::Undefined;
+   sbuffer->buffer = ring.buffer->buffer;
+   sbuffer->memory = ring.buffer->memory;
+   sbuffer->mappedPtr = nullptr;
+   sbuffer->ring = &ring;
+   sbuffer->offset = offset;
+   sbuffer->retired = false;
+
+   if (ring.buffer->mappedPtr) {
+      sbuffer->mappedPtr = static_cast<uint8_t *>(ring.buffer->mappedPtr) + offset;
+   }
+
+   ring.head = offset + allocSize;
+   ring.allocations.push_back(sbuffer);
+   return sbuffer;
+}
+
+StagingBuffer *
+Driver::_getDedicatedStagingBuffer(uint32_t size, StagingBufferType type)
 {
    StagingBuffer *sbuffer = nullptr;
 
@@ -112,6 +196,18 @@ Driver::getStagingBuffer(uint32_t size, StagingBufferType type)
       sbuffer->poolIndex = alignedSizeBit;
    }
 
+   return sbuffer;
+}
+
+StagingBuffer *
+Driver::getStagingBuffer(uint32_t size, StagingBufferType type)
+{
+   auto sbuffer = _allocRingStagingBuffer(size, type);
+
+   if (!sbuffer) {
+      sbuffer = _getDedicatedStagingBuffer(size, type);
+   }
+
    sbuffer->size = size;
 
    mActiveSyncWaiter->stagingBuffers.push_back(sbuffer);
@@ -122,6 +218,20 @@ Driver::getStagingBuffer(uint32_t size, StagingBufferType type)
 void
 Driver::retireStagingBuffer(StagingBuffer *sbuffer)
 {
+   if (sbuffer->ring) {
+      // Release every allocation at the start of the ring which has retired,
+      // command buffers do not always retire in the order they were submitted.
+      auto &allocations = sbuffer->ring->allocations;
+      sbuffer->retired = true;
+
+      while (!allocations.empty() && allocations.front()->retired) {
+         mStagingRingAllocPool.push_back(allocations.front());
+         allocations.pop_front();
+      }
+
+      return;
+   }
+
    auto typeIndex = static_cast<uint32_t>(sbuffer->type);
    auto poolIndex = sbuffer->poolIndex;
    mStagingBuffers[typeIndex][poolIndex].push_back(sbuffer);
@@ -146,8 +256,8 @@ Driver::transitionStagingBuffer(StagingBuffer *sbuffer, ResourceUsage usage)
    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
    bufferBarrier.buffer = sbuffer->buffer;
-   bufferBarrier.offset = 0;
-   bufferBarrier.size = VK_WHOLE_SIZE;
+   bufferBarrier.offset = sbuffer->offset;
+   bufferBarrier.size = sbuffer->maximumSize;
 
    mActiveCommandBuffer.pipelineBarrier(
       srcMeta.stageFlags,
@@ -172,7 +282,9 @@ Driver::copyToStagingBuffer(StagingBuffer *sbuffer, uint32_t offset, const void
    memcpy(static_cast<uint8_t*>(sbuffer->mappedPtr) + offset, data, size);
 
    // Flush the allocation to make the CPU write visible to the GPU.
-   vmaFlushAllocation(mAllocator, sbuffer->memory, 0, VK_WHOLE_SIZE);
+   vmaFlushAllocation(mAllocator, sbuffer->memory, sbuffer->offset + offset, size);
+
+   mDebugInfo.uploadBytes += size;
 }
 
 void
@@ -186,7 +298,7 @@ Driver::copyFromStagingBuffer(StagingBuffer *sbuffer, uint32_t offset, void *dat
    decaf_check(sbuffer->activeUsage == ResourceUsage::HostRead);
 
    // Invalidate the allocation to make the GPU writes visible to the CPU
-   vmaInvalidateAllocation(mAllocator, sbuffer->memory, 0, VK_WHOLE_SIZE);
+   vmaInvalidateAllocation(mAllocator, sbuffer->memory, sbuffer->offset + offset, size);
 
    // Copy the data from the staging buffer
    memcpy(data, static_cast<uint8_t*>(sbuffer->mappedPtr) + offset, size);
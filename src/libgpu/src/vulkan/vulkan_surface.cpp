@@ -619,7 +619,7 @@ Driver::_readSurfaceData(SurfaceObject *surface, SurfaceSubRange range)
       auto tiledBuffer = untiledBuffer;
 
       // Remap the untiled surface to our staging buffer
-      untiledOffset = 0;
+      untiledOffset = retileStaging->offset;
       untiledBuffer = retileStaging->buffer;
 
       _barrierMemCache(surface->memCache, ResourceUsage::ComputeSsboRead, sectionRange);
@@ -696,7 +696,7 @@ Driver::_writeSurfaceData(SurfaceObject *surface, SurfaceSubRange range)
       // Grab our buffer used for retiling
       auto retileStaging = getStagingBuffer(retileSize, StagingBufferType::GpuToGpu);
 
-      untiledOffset = 0;
+      untiledOffset = retileStaging->offset;
       untiledBuffer = retileStaging->buffer;
    } else {
       // Write directly to the surface.
@@ -0,0 +1,143 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <common/platform.h>
+#include <common/platform_fiber.h>
+
+#include <chrono>
+#include <vector>
+
+#ifdef PLATFORM_POSIX
+#include <ucontext.h>
+
+static constexpr auto NumSwitches = 1000000u;
+
+struct PingPong
+{
+   platform::Fiber *main = nullptr;
+   platform::Fiber *fiber = nullptr;
+   unsigned count = 0;
+};
+
+static void
+pingPongEntry(void *param)
+{
+   auto state = reinterpret_cast<PingPong *>(param);
+
+   while (true) {
+      ++state->count;
+      platform::swapToFiber(state->fiber, state->main);
+   }
+}
+
+TEST_CASE("fiber switches preserve state")
+{
+   auto state = PingPong { };
+   state.main = platform::getThreadFiber();
+   state.fiber = platform::createFiber(pingPongEntry, &state);
+
+   // Values live across the switch in callee saved registers
+   auto sum = 0.0;
+   for (auto i = 0u; i < 1000; ++i) {
+      auto before = i * 3;
+      platform::swapToFiber(state.main, state.fiber);
+      sum += 0.5;
+      REQUIRE(before == i * 3);
+      REQUIRE(state.count == i + 1);
+   }
+
+   REQUIRE(sum == 500.0);
+   platform::destroyFiber(state.fiber);
+   platform::destroyFiber(state.main);
+}
+
+TEST_CASE("fiber stacks are reused")
+{
+   auto state = PingPong { };
+   state.main = platform::getThreadFiber();
+
+   // Create and destroy many more fibers than the stack pool holds, each one
+   // touching its stack, to make sure recycled stacks still work.
+   for (auto i = 0u; i < 1000; ++i) {
+      state.fiber = platform::createFiber(
+         [](void *param) {
+            auto state = reinterpret_cast<PingPong *>(param);
+            volatile char buffer[64 * 1024];
+            buffer[0] = 1;
+            buffer[sizeof(buffer) - 1] = 1;
+
+            while (true) {
+               state->count += buffer[0] + buffer[sizeof(buffer) - 1];
+               platform::swapToFiber(state->fiber, state->main);
+            }
+         }, &state);
+
+      platform::swapToFiber(state.main, state.fiber);
+      platform::destroyFiber(state.fiber);
+   }
+
+   REQUIRE(state.count == 2000);
+   platform::destroyFiber(state.main);
+}
+
+/*
+ * The benchmark compares against swapcontext, which is what the fibers were
+ * implemented with before, so there is a before and after in a single run.
+ */
+static ucontext_t sReferenceMain;
+static ucontext_t sReferenceFiber;
+
+static void
+referenceEntry()
+{
+   while (true) {
+      swapcontext(&sReferenceFiber, &sReferenceMain);
+   }
+}
+
+static double
+switchesPerSecond(std::chrono::steady_clock::duration elapsed)
+{
+   auto seconds = std::chrono::duration<double> { elapsed }.count();
+   return (2.0 * NumSwitches) / seconds;
+}
+
+TEST_CASE("fiber switch perf", "[!benchmark]")
+{
+   auto state = PingPong { };
+   state.main = platform::getThreadFiber();
+   state.fiber = platform::createFiber(pingPongEntry, &state);
+
+   auto referenceStack = std::vector<char>(1024 * 1024);
+   getcontext(&sReferenceFiber);
+   sReferenceFiber.uc_stack.ss_sp = referenceStack.data();
+   sReferenceFiber.uc_stack.ss_size = referenceStack.size();
+   sReferenceFiber.uc_link = nullptr;
+   makecontext(&sReferenceFiber, referenceEntry, 0);
+
+   BENCHMARK("swapcontext 1000000 round trips")
+   {
+      auto start = std::chrono::steady_clock::now();
+      for (auto i = 0u; i < NumSwitches; ++i) {
+         swapcontext(&sReferenceMain, &sReferenceFiber);
+      }
+
+      WARN("swapcontext: " << switchesPerSecond(std::chrono::steady_clock::now() - start) << " switches/s");
+   }
+
+   BENCHMARK("swapToFiber 1000000 round trips")
+   {
+      auto start = std::chrono::steady_clock::now();
+      for (auto i = 0u; i < NumSwitches; ++i) {
+         platform::swapToFiber(state.main, state.fiber);
+      }
+
+      WARN("swapToFiber: " << switchesPerSecond(std::chrono::steady_clock::now() - start) << " switches/s");
+   }
+
+   REQUIRE(state.count != 0);
+   platform::destroyFiber(state.fiber);
+   platform::destroyFiber(state.main);
+}
+
+#endif // ifdef PLATFORM_POSIX
@@ -0,0 +1,176 @@
+#include <catch.hpp>
+
+#include <libcpu/espresso/espresso_instructionset.h>
+
+#include <random>
+#include <vector>
+
+using namespace espresso;
+
+/*
+ * Reference decoder which walks a tree of instruction fields, this is how
+ * decodeInstruction used to work before it was replaced by flat tables.
+ */
+struct ReferenceTableEntry
+{
+   struct FieldMap
+   {
+      InstructionField field;
+      std::vector<ReferenceTableEntry> children;
+   };
+
+   FieldMap *
+   getFieldMap(InstructionField field)
+   {
+      for (auto &fieldMap : fieldMaps) {
+         if (fieldMap.field == field) {
+            return &fieldMap;
+         }
+      }
+
+      return nullptr;
+   }
+
+   ReferenceTableEntry *
+   addTable(InstructionField field, uint32_t value)
+   {
+      auto fieldMap = getFieldMap(field);
+
+      if (!fieldMap) {
+         fieldMaps.emplace_back();
+         fieldMap = &fieldMaps.back();
+         fieldMap->field = field;
+         fieldMap->children.resize(1u << getInstructionFieldWidth(field));
+      }
+
+      return &fieldMap->children[value];
+   }
+
+   InstructionInfo *instr = nullptr;
+   std::vector<FieldMap> fieldMaps;
+};
+
+static ReferenceTableEntry
+sReferenceTable;
+
+static void
+initialiseDecoders()
+{
+   static bool initialised = false;
+
+   if (initialised) {
+      return;
+   }
+
+   initialiseInstructionSet();
+
+   for (auto id = 0u; id < static_cast<unsigned>(InstructionID::Invalid); ++id) {
+      auto info = findInstructionInfo(static_cast<InstructionID>(id));
+      auto table = &sReferenceTable;
+
+      for (auto &op : info->opcode) {
+         table = table->addTable(op.field, op.value);
+      }
+
+      table->instr = info;
+   }
+
+   initialised = true;
+}
+
+static InstructionInfo *
+referenceDecodeInstruction(Instruction instr)
+{
+   auto table = &sReferenceTable;
+
+   while (table) {
+      for (auto &fieldMap : table->fieldMaps) {
+         auto value = (instr.value & getInstructionFieldBitmask(fieldMap.field))
+            >> getInstructionFieldStart(fieldMap.field);
+         table = &fieldMap.children[value];
+
+         if (table->instr || table->fieldMaps.size()) {
+            break;
+         }
+      }
+
+      if (table->fieldMaps.size() == 0) {
+         return table->instr;
+      }
+   }
+
+   return nullptr;
+}
+
+// Generate valid encodings of every instruction with random operands
+static std::vector<Instruction>
+generateInstructions(size_t count)
+{
+   auto rng = std::mt19937 { 0x5eed };
+   auto instrs = std::vector<Instruction> { };
+   auto numIds = static_cast<uint32_t>(InstructionID::Invalid);
+   instrs.reserve(count);
+
+   for (auto i = 0u; i < count; ++i) {
+      auto id = static_cast<InstructionID>(rng() % numIds);
+      auto info = findInstructionInfo(id);
+      auto instr = encodeInstruction(id);
+      auto mask = 0u;
+
+      for (auto &op : info->opcode) {
+         mask |= getInstructionFieldBitmask(op.field);
+      }
+
+      instr.value |= rng() & ~mask;
+      instrs.push_back(instr);
+   }
+
+   return instrs;
+}
+
+TEST_CASE("espresso decodeInstruction matches reference")
+{
+   initialiseDecoders();
+
+   // Every primary and extended opcode with random remaining bits
+   auto rng = std::mt19937 { 0x5eed };
+
+   for (auto opcd = 0u; opcd < 64; ++opcd) {
+      for (auto xo = 0u; xo < 1024; ++xo) {
+         for (auto i = 0; i < 8; ++i) {
+            auto bits = static_cast<uint32_t>(rng()) & 0x03FFF801u;
+            auto instr = Instruction { (opcd << 26) | (xo << 1) | bits };
+            REQUIRE(decodeInstruction(instr) == referenceDecodeInstruction(instr));
+         }
+      }
+   }
+
+   // Valid encodings of every instruction
+   for (auto instr : generateInstructions(1000000)) {
+      REQUIRE(decodeInstruction(instr) == referenceDecodeInstruction(instr));
+   }
+}
+
+TEST_CASE("espresso decodeInstruction perf", "[!benchmark]")
+{
+   initialiseDecoders();
+
+   auto instrs = generateInstructions(1000000);
+   auto result = size_t { 0 };
+
+   BENCHMARK("reference tree decode (1000000 instructions)")
+   {
+      for (auto instr : instrs) {
+         result += reinterpret_cast<uintptr_t>(referenceDecodeInstruction(instr));
+      }
+   }
+
+   BENCHMARK("table decode (1000000 instructions)")
+   {
+      for (auto instr : instrs) {
+         result += reinterpret_cast<uintptr_t>(decodeInstruction(instr));
+      }
+   }
+
+   REQUIRE(result != 0);
+}
@@ -0,0 +1,113 @@
+#include <catch.hpp>
+
+#include <common/datahash.h>
+#include <common/platform.h>
+#include <libcpu/cpu_config.h>
+#include <libcpu/memtrack.h>
+#include <libcpu/mmu.h>
+
+#include <cstring>
+
+#ifdef PLATFORM_POSIX
+#include <unistd.h>
+
+static constexpr auto TrackVirtualAddress = cpu::VirtualAddress { 0x10000000 };
+static constexpr auto TrackPhysicalAddress = cpu::PhysicalAddress { 0x10000000 };
+static constexpr auto TrackSize = 16u * 1024 * 1024;
+
+static void
+initialiseTrackedMemory()
+{
+   static bool initialised = false;
+
+   if (initialised) {
+      return;
+   }
+
+   auto settings = cpu::Settings { };
+   settings.memory.writeTrackEnabled = true;
+   cpu::setConfig(settings);
+
+   REQUIRE(cpu::initialiseMemory());
+   REQUIRE(cpu::allocateVirtualAddress(TrackVirtualAddress, TrackSize));
+   REQUIRE(cpu::mapMemory(TrackVirtualAddress, TrackPhysicalAddress, TrackSize,
+                          cpu::MapPermission::ReadWrite));
+   initialised = true;
+}
+
+TEST_CASE("memtrack detects writes to tracked memory")
+{
+   initialiseTrackedMemory();
+
+   auto ptr = cpu::internal::translate<uint8_t>(TrackVirtualAddress);
+   auto range = TrackPhysicalAddress + 0x20000;
+   auto state = cpu::getMemoryState(range, 0x10000);
+   REQUIRE(cpu::getMemoryState(range, 0x10000) == state);
+
+   // Write inside the range
+   ptr[0x28000] = 1;
+   auto newState = cpu::getMemoryState(range, 0x10000);
+   REQUIRE(newState != state);
+   REQUIRE(cpu::getMemoryState(range, 0x10000) == newState);
+
+   // Write outside the range
+   ptr[0x40000] = 1;
+   REQUIRE(cpu::getMemoryState(range, 0x10000) == newState);
+
+   // Multiple writes to the same page after it was queried
+   std::memset(ptr + 0x20000, 2, 0x10000);
+   REQUIRE(cpu::getMemoryState(range, 0x10000) != newState);
+}
+
+TEST_CASE("memtrack allows host writes to tracked memory")
+{
+   initialiseTrackedMemory();
+
+   auto ptr = cpu::internal::translate<uint8_t>(TrackVirtualAddress);
+   auto physPtr = cpu::internal::translate<uint8_t>(TrackPhysicalAddress);
+   auto range = TrackPhysicalAddress + 0x50000;
+   auto state = cpu::getMemoryState(range, 0x10000);
+
+   // The kernel can not write into write protected pages
+   int fds[2];
+   uint8_t data[64];
+   std::memset(data, 3, sizeof(data));
+   REQUIRE(pipe(fds) == 0);
+   REQUIRE(write(fds[1], data, sizeof(data)) == sizeof(data));
+
+   cpu::unprotectForHostWrite(range + 0x8000, sizeof(data));
+   REQUIRE(read(fds[0], ptr + 0x58000, sizeof(data)) == sizeof(data));
+   REQUIRE(std::memcmp(ptr + 0x58000, data, sizeof(data)) == 0);
+   close(fds[0]);
+   close(fds[1]);
+
+   auto newState = cpu::getMemoryState(range, 0x10000);
+   REQUIRE(newState != state);
+
+   // Writes through the physical view never fault, but are still seen
+   physPtr[0x5C000] = 4;
+   cpu::unprotectForHostWrite(range + 0xC000, 1);
+   REQUIRE(cpu::getMemoryState(range, 0x10000) != newState);
+}
+
+TEST_CASE("memtrack perf", "[!benchmark]")
+{
+   initialiseTrackedMemory();
+
+   auto physPtr = cpu::internal::translate<uint8_t>(TrackPhysicalAddress);
+   auto result = uint64_t { 0 };
+
+   BENCHMARK("hash 16MB")
+   {
+      result += DataHash {}.write(physPtr, TrackSize).value();
+   }
+
+   BENCHMARK("write tracked state of 16MB")
+   {
+      result += cpu::getMemoryState(TrackPhysicalAddress, TrackSize).state;
+   }
+
+   REQUIRE(result != 0);
+}
+
+#endif // PLATFORM_POSIX
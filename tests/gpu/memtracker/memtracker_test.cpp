@@ -0,0 +1,222 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <common/platform.h>
+#include <libcpu/cpu_config.h>
+#include <libcpu/mmu.h>
+#include <libgpu/src/vulkan/vulkan_memtracker.h>
+
+#include <vector>
+
+#ifdef PLATFORM_POSIX
+
+using MemoryTracker = vulkan::MemoryTracker<void *>;
+using Segment = MemoryTracker::Segment;
+using SegmentRef = MemoryTracker::SegmentRef;
+
+static constexpr auto TrackVirtualAddress = cpu::VirtualAddress { 0x10000000 };
+static constexpr auto TrackPhysicalAddress = cpu::PhysicalAddress { 0x10000000 };
+static constexpr auto TrackSize = 16u * 1024 * 1024;
+
+/*
+ * Write tracking is enabled so that the page sampling path of the tracker is
+ * exercised, this means writes must go through the virtual mapping.
+ */
+static uint8_t *
+initialiseTrackedMemory()
+{
+   static bool initialised = false;
+
+   if (!initialised) {
+      auto settings = cpu::Settings { };
+      settings.memory.writeTrackEnabled = true;
+      cpu::setConfig(settings);
+
+      REQUIRE(cpu::initialiseMemory());
+      REQUIRE(cpu::allocateVirtualAddress(TrackVirtualAddress, TrackSize));
+      REQUIRE(cpu::mapMemory(TrackVirtualAddress, TrackPhysicalAddress, TrackSize,
+                             cpu::MapPermission::ReadWrite));
+      initialised = true;
+   }
+
+   return cpu::internal::translate<uint8_t>(TrackVirtualAddress);
+}
+
+static std::vector<std::pair<uint32_t, uint32_t>>
+getSegments(MemoryTracker &tracker, SegmentRef ref, uint32_t size)
+{
+   auto segments = std::vector<std::pair<uint32_t, uint32_t>> { };
+   tracker.forEachSegment(ref, size, [&](Segment &segment) {
+      segments.push_back({ segment.address.getAddress(), segment.size });
+   });
+   return segments;
+}
+
+static uint64_t
+refresh(MemoryTracker &tracker, SegmentRef ref, uint32_t size)
+{
+   auto lastChangeIndex = uint64_t { 0 };
+   tracker.forEachSegment(ref, size, [&](Segment &segment) {
+      tracker.refreshSegment(&segment);
+      lastChangeIndex = std::max(lastChangeIndex, segment.lastChangeIndex);
+   });
+   return lastChangeIndex;
+}
+
+TEST_CASE("memtracker splits overlapping ranges")
+{
+   initialiseTrackedMemory();
+
+   auto tracker = MemoryTracker { };
+   auto base = TrackPhysicalAddress.getAddress() + 0x1000;
+   tracker.nextBatch();
+
+   auto first = tracker.get(phys_addr { base }, 0x1000);
+   auto second = tracker.get(phys_addr { base + 0x800 }, 0x1000);
+   REQUIRE(tracker.numSegments() == 3);
+
+   using Segments = std::vector<std::pair<uint32_t, uint32_t>>;
+   REQUIRE(getSegments(tracker, first, 0x1000) ==
+           Segments { { base, 0x800 }, { base + 0x800, 0x800 } });
+   REQUIRE(getSegments(tracker, second, 0x1000) ==
+           Segments { { base + 0x800, 0x800 }, { base + 0x1000, 0x800 } });
+
+   // A range covering the existing segments should only fill the gaps
+   auto outer = tracker.get(phys_addr { base - 0x100 }, 0x2000);
+   REQUIRE(tracker.numSegments() == 5);
+   REQUIRE(getSegments(tracker, outer, 0x2000) ==
+           Segments {
+              { base - 0x100, 0x100 },
+              { base, 0x800 },
+              { base + 0x800, 0x800 },
+              { base + 0x1000, 0x800 },
+              { base + 0x1800, 0x700 },
+           });
+
+   // Disjoint ranges before and after everything
+   auto before = tracker.get(phys_addr { base - 0x800 }, 0x100);
+   auto after = tracker.get(phys_addr { base + 0x4000 }, 0x100);
+   REQUIRE(tracker.numSegments() == 7);
+   REQUIRE(getSegments(tracker, before, 0x100) == Segments { { base - 0x800, 0x100 } });
+   REQUIRE(getSegments(tracker, after, 0x100) == Segments { { base + 0x4000, 0x100 } });
+}
+
+TEST_CASE("memtracker detects CPU writes")
+{
+   auto ptr = initialiseTrackedMemory();
+
+   auto tracker = MemoryTracker { };
+   auto offset = 0x20000u;
+   auto segment = tracker.get(TrackPhysicalAddress + offset, 0x100);
+   auto otherSegment = tracker.get(TrackPhysicalAddress + offset + 0x4000, 0x100);
+
+   tracker.nextBatch();
+   auto changeIndex = refresh(tracker, segment, 0x100);
+   auto otherChangeIndex = refresh(tracker, otherSegment, 0x100);
+   REQUIRE(changeIndex != 0);
+
+   // Nothing was written
+   tracker.nextBatch();
+   REQUIRE(refresh(tracker, segment, 0x100) == changeIndex);
+   tracker.nextBatch();
+   REQUIRE(refresh(tracker, segment, 0x100) == changeIndex);
+
+   // Write to the segment
+   ptr[offset + 0x10] = 1;
+   tracker.nextBatch();
+   auto newChangeIndex = refresh(tracker, segment, 0x100);
+   REQUIRE(newChangeIndex > changeIndex);
+   REQUIRE(refresh(tracker, otherSegment, 0x100) == otherChangeIndex);
+
+   // Splitting an unchanged segment does not create a change
+   tracker.nextBatch();
+   tracker.get(TrackPhysicalAddress + offset + 0x80, 0x10);
+   REQUIRE(refresh(tracker, segment, 0x100) == newChangeIndex);
+}
+
+TEST_CASE("memtracker perf", "[!benchmark]")
+{
+   static constexpr auto NumUniformBlocks = 4096u;
+   static constexpr auto UniformBlockSize = 256u;
+   static constexpr auto NumVertexBuffers = 64u;
+   static constexpr auto VertexBufferSize = 64u * 1024;
+
+   auto ptr = initialiseTrackedMemory();
+
+   // Lots of small uniform blocks packed together, and some larger vertex
+   // buffers which are used both as a whole and in parts.
+   auto uniformBase = TrackPhysicalAddress;
+   auto vertexBase = TrackPhysicalAddress + NumUniformBlocks * UniformBlockSize;
+
+   auto tracker = MemoryTracker { };
+   auto uniformRefs = std::vector<SegmentRef> { };
+   auto vertexRefs = std::vector<SegmentRef> { };
+   auto result = uint64_t { 0 };
+   tracker.nextBatch();
+
+   for (auto i = 0u; i < NumVertexBuffers; ++i) {
+      vertexRefs.push_back(tracker.get(vertexBase + i * VertexBufferSize, VertexBufferSize));
+   }
+
+   for (auto i = 0u; i < NumUniformBlocks; ++i) {
+      uniformRefs.push_back(tracker.get(uniformBase + i * UniformBlockSize, UniformBlockSize));
+   }
+
+   BENCHMARK("split 64 vertex buffers into 4096 ranges")
+   {
+      auto splitTracker = MemoryTracker { };
+      splitTracker.nextBatch();
+
+      for (auto i = 0u; i < NumVertexBuffers; ++i) {
+         splitTracker.get(vertexBase + i * VertexBufferSize, VertexBufferSize);
+      }
+
+      for (auto i = 0u; i < NumVertexBuffers * 64; ++i) {
+         splitTracker.get(vertexBase + i * 1024 + 512, 1024);
+      }
+
+      result += splitTracker.numSegments();
+   }
+
+   BENCHMARK("lookup 4096 uniform blocks")
+   {
+      for (auto i = 0u; i < NumUniformBlocks; ++i) {
+         result += tracker.get(uniformBase + i * UniformBlockSize, UniformBlockSize).address().getAddress();
+      }
+   }
+
+   BENCHMARK("check 4096 uniform blocks, none changed")
+   {
+      tracker.nextBatch();
+
+      for (auto &ref : uniformRefs) {
+         result += refresh(tracker, ref, UniformBlockSize);
+      }
+   }
+
+   BENCHMARK("check 4096 uniform blocks, 1 in 16 changed")
+   {
+      tracker.nextBatch();
+
+      for (auto i = 0u; i < NumUniformBlocks; i += 16) {
+         ptr[i * UniformBlockSize] += 1;
+      }
+
+      for (auto &ref : uniformRefs) {
+         result += refresh(tracker, ref, UniformBlockSize);
+      }
+   }
+
+   BENCHMARK("check 64 vertex buffers, none changed")
+   {
+      tracker.nextBatch();
+
+      for (auto &ref : vertexRefs) {
+         result += refresh(tracker, ref, VertexBufferSize);
+      }
+   }
+
+   REQUIRE(result != 0);
+}
+
+#endif // ifdef PLATFORM_POSIX
@@ -0,0 +1,181 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <common/byte_swap.h>
+#include <libgpu/gpu_ringbuffer.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static constexpr auto NumWriters = 3u;
+static constexpr auto SubmitWords = 9u;
+
+/*
+ * The previous mutex and vector based ring buffer, used as a baseline for
+ * the benchmark.
+ */
+namespace reference
+{
+
+static std::vector<uint32_t> sWriteVector;
+static std::vector<uint32_t> sReadVector;
+static std::mutex sMutex;
+static std::condition_variable sConditionVariable;
+static bool sPendingWake = false;
+
+static void
+write(const gpu::ringbuffer::Buffer &items)
+{
+   std::unique_lock<std::mutex> lock { sMutex };
+   sWriteVector.insert(sWriteVector.end(), items.begin(), items.end());
+   sConditionVariable.notify_all();
+}
+
+static gpu::ringbuffer::Buffer
+read()
+{
+   std::unique_lock<std::mutex> lock { sMutex };
+   sReadVector.clear();
+   sReadVector.swap(sWriteVector);
+   return sReadVector;
+}
+
+static bool
+wait()
+{
+   std::unique_lock<std::mutex> lock { sMutex };
+   if (sWriteVector.empty() && !sPendingWake) {
+      sConditionVariable.wait(lock);
+   }
+
+   sPendingWake = false;
+   return !sWriteVector.empty();
+}
+
+} // namespace reference
+
+/*
+ * Run NumWriters threads each submitting numSubmits buffers of SubmitWords
+ * words, where the first word is the writer index and the second word is the
+ * submission index.  Returns the words read in order for each writer.
+ */
+template<typename WriteFn, typename ReadFn, typename WaitFn>
+static std::array<std::vector<uint32_t>, NumWriters>
+runSubmissions(unsigned numSubmits, WriteFn write, ReadFn read, WaitFn wait)
+{
+   std::array<std::vector<uint32_t>, NumWriters> received;
+   auto writers = std::vector<std::thread> { };
+   auto remaining = static_cast<size_t>(NumWriters) * numSubmits * SubmitWords;
+
+   for (auto i = 0u; i < NumWriters; ++i) {
+      writers.emplace_back([i, numSubmits, &write]() {
+         auto submit = std::array<uint32_t, SubmitWords> { };
+         submit[0] = i;
+
+         for (auto j = 0u; j < numSubmits; ++j) {
+            submit[1] = j;
+            write({ submit.data(), submit.size() });
+         }
+      });
+   }
+
+   while (remaining) {
+      wait();
+      auto buffer = read();
+
+      for (auto pos = 0u; pos + SubmitWords <= buffer.size(); pos += SubmitWords) {
+         received[buffer[pos]].push_back(buffer[pos + 1]);
+      }
+
+      remaining -= buffer.size();
+   }
+
+   for (auto &writer : writers) {
+      writer.join();
+   }
+
+   return received;
+}
+
+TEST_CASE("gpu ringbuffer keeps submissions in order")
+{
+   static constexpr auto NumSubmits = 200000u;
+   auto received = runSubmissions(NumSubmits,
+                                  gpu::ringbuffer::write,
+                                  gpu::ringbuffer::read,
+                                  gpu::ringbuffer::wait);
+
+   for (auto &writer : received) {
+      REQUIRE(writer.size() == NumSubmits);
+
+      for (auto i = 0u; i < writer.size(); ++i) {
+         REQUIRE(writer[i] == i);
+      }
+   }
+}
+
+TEST_CASE("gpu ringbuffer splits large writes on packet boundaries")
+{
+   static constexpr auto NumPackets = 2000u;
+   auto words = std::vector<uint32_t> { };
+
+   // Type 3 NOP packets of varying sizes, with the packet index as the first
+   // word of each payload, about three times the size of the ring.
+   for (auto i = 0u; i < NumPackets; ++i) {
+      auto payloadSize = 1u + (i * 7919u) % 0x3000u;
+      words.push_back(byte_swap((3u << 30) | ((payloadSize - 1) << 16) | (0x10u << 8)));
+      words.push_back(byte_swap(i));
+      words.insert(words.end(), payloadSize - 1, 0u);
+   }
+
+   auto writer = std::thread { [&]() {
+      gpu::ringbuffer::write({ words.data(), words.size() });
+   } };
+
+   auto nextPacket = 0u;
+   auto remaining = words.size();
+
+   while (remaining) {
+      gpu::ringbuffer::wait();
+      auto buffer = gpu::ringbuffer::read();
+
+      for (auto pos = size_t { 0 }; pos < buffer.size(); ) {
+         auto header = byte_swap(buffer[pos]);
+         auto size = ((header >> 16) & 0x3FFF) + 2;
+         REQUIRE(pos + size <= buffer.size());
+         REQUIRE(byte_swap(buffer[pos + 1]) == nextPacket);
+         ++nextPacket;
+         pos += size;
+      }
+
+      remaining -= buffer.size();
+   }
+
+   writer.join();
+   REQUIRE(nextPacket == NumPackets);
+}
+
+TEST_CASE("gpu ringbuffer perf", "[!benchmark]")
+{
+   static constexpr auto NumSubmits = 1000000u;
+
+   BENCHMARK("mutex vector (3000000 submissions)")
+   {
+      runSubmissions(NumSubmits,
+                     reference::write,
+                     reference::read,
+                     reference::wait);
+   }
+
+   BENCHMARK("packet ring (3000000 submissions)")
+   {
+      runSubmissions(NumSubmits,
+                     gpu::ringbuffer::write,
+                     gpu::ringbuffer::read,
+                     gpu::ringbuffer::wait);
+   }
+}
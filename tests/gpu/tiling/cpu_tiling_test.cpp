@@ -2,6 +2,7 @@
 #include "addrlib_helpers.h"
 #include "test_helpers.h"
 
+#include <chrono>
 #include <common/align.h>
 #include <libgpu/gpu7_tiling_cpu.h>
 
@@ -244,3 +245,62 @@ TEST_CASE("cpuTilingPerf", "[!benchmark]")
    }
 }
 
+TEST_CASE("cpuTilingThroughput", "[!benchmark]")
+{
+   // Get some random data to use
+   auto& tiled = sRandomData;
+
+   auto untiledImage = std::vector<uint8_t> { };
+   untiledImage.resize(tiled.size());
+
+   static constexpr auto TestIterations = 20;
+
+   auto& layout = sPerfTestLayout;
+   for (auto& mode : sTestTilingMode) {
+      for (auto& format : sTestFormats) {
+         auto surface = gpu7::tiling::SurfaceDescription {};
+         surface.tileMode = mode.tileMode;
+         surface.format = format.format;
+         surface.bpp = format.bpp;
+         surface.width = layout.width;
+         surface.height = layout.height;
+         surface.numSlices = layout.depth;
+         surface.numSamples = 1u;
+         surface.numLevels = 1u;
+         surface.bankSwizzle = 0u;
+         surface.pipeSwizzle = 0u;
+         surface.dim = gpu7::tiling::SurfaceDim::Texture2DArray;
+         surface.use = format.depth ?
+            gpu7::tiling::SurfaceUse::DepthBuffer :
+            gpu7::tiling::SurfaceUse::None;
+
+         auto info = gpu7::tiling::computeSurfaceInfo(surface, 0);
+         auto retileInfo = gpu7::tiling::computeRetileInfo(info);
+         REQUIRE(tiled.size() >= info.surfSize);
+
+         auto tiledFirstSliceIndex = align_down(layout.testFirstSlice, retileInfo.microTileThickness);
+         auto tiledSliceOffset = tiledFirstSliceIndex * retileInfo.thinSliceBytes;
+         auto untiledSliceOffset = layout.testFirstSlice * retileInfo.thinSliceBytes;
+
+         auto start = std::chrono::high_resolution_clock::now();
+
+         for (auto i = 0; i < TestIterations; ++i) {
+            gpu7::tiling::cpu::untile(retileInfo,
+                                      untiledImage.data() + untiledSliceOffset,
+                                      tiled.data() + tiledSliceOffset,
+                                      layout.testFirstSlice,
+                                      layout.testNumSlices);
+         }
+
+         auto elapsed = std::chrono::duration<double> {
+            std::chrono::high_resolution_clock::now() - start };
+         auto bytes = static_cast<double>(retileInfo.thinSliceBytes) *
+            layout.testNumSlices * TestIterations;
+
+         WARN(fmt::format("{} {}bpp{}: {:.2f} GB/s",
+                          tileModeToString(mode.tileMode), format.bpp,
+                          format.depth ? " depth" : "",
+                          bytes / elapsed.count() / 1e9));
+      }
+   }
+}
@@ -0,0 +1,418 @@
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#include <vfs/vfs_pack_builder.h>
+#include <vfs/vfs_pack_device.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+static constexpr auto ChunkSize = 4096u;
+
+static const auto sUser = vfs::User { 0, 0 };
+
+/*
+ * A host directory tree which is packed by the tests, removed again when the
+ * test case ends.
+ */
+struct TemporaryTree
+{
+   TemporaryTree()
+   {
+      root = std::filesystem::temp_directory_path() / "decaf-test-vfs-pack";
+      source = root / "content";
+      pack = root / "content.pack";
+
+      std::filesystem::remove_all(root);
+      std::filesystem::create_directories(source / "data" / "empty");
+      std::filesystem::create_directories(source / "data" / "sub");
+
+      // Text compresses well, so these are split into compressed chunks
+      small = makeText(100);
+      large = makeText(ChunkSize * 3 + 1000);
+      nested = makeText(ChunkSize);
+
+      // Random data does not compress, so it is stored as is
+      auto engine = std::mt19937 { 1234 };
+      random.resize(ChunkSize * 2 + 17);
+      for (auto &value : random) {
+         value = static_cast<char>(engine());
+      }
+
+      writeFile(source / "a.txt", small);
+      writeFile(source / "data" / "large.txt", large);
+      writeFile(source / "data" / "random.bin", random);
+      writeFile(source / "data" / "sub" / "nested.txt", nested);
+   }
+
+   ~TemporaryTree()
+   {
+      auto error = std::error_code { };
+      std::filesystem::remove_all(root, error);
+   }
+
+   static std::string
+   makeText(size_t size)
+   {
+      auto text = std::string { };
+      char line[16];
+
+      while (text.size() < size) {
+         std::snprintf(line, sizeof(line), "%08zx\n", text.size());
+         text += line;
+      }
+
+      text.resize(size);
+      return text;
+   }
+
+   static void
+   writeFile(const std::filesystem::path &path,
+             const std::string &data)
+   {
+      auto out = std::ofstream { path, std::ofstream::binary };
+      out.write(data.data(), data.size());
+   }
+
+   std::filesystem::path root;
+   std::filesystem::path source;
+   std::filesystem::path pack;
+   std::string small;
+   std::string large;
+   std::string nested;
+   std::string random;
+};
+
+static std::vector<std::string>
+listDirectory(vfs::PackDevice &device,
+              const vfs::Path &path)
+{
+   auto names = std::vector<std::string> { };
+   auto result = device.openDirectory(sUser, path);
+   REQUIRE(result);
+
+   for (auto entry = result->readEntry(); entry; entry = result->readEntry()) {
+      names.push_back(entry->name);
+   }
+
+   return names;
+}
+
+static std::string
+readFile(vfs::PackDevice &device,
+         const vfs::Path &path,
+         int64_t readSize)
+{
+   auto result = device.openFile(sUser, path, vfs::FileHandle::Read);
+   REQUIRE(result);
+
+   auto &file = *result;
+   auto data = std::string { };
+   auto buffer = std::vector<char>(static_cast<size_t>(readSize));
+
+   while (true) {
+      auto read = file->read(buffer.data(), 1, readSize);
+      if (read.error() == vfs::Error::EndOfFile) {
+         break;
+      }
+
+      REQUIRE(read);
+      data.append(buffer.data(), static_cast<size_t>(*read));
+   }
+
+   return data;
+}
+
+static std::string
+readAt(vfs::FileHandle &file,
+       int64_t position,
+       int64_t length)
+{
+   REQUIRE(file.seek(vfs::FileHandle::SeekStart, position) == vfs::Error::Success);
+
+   auto buffer = std::vector<char>(static_cast<size_t>(length));
+   auto read = file.read(buffer.data(), 1, length);
+   REQUIRE(read);
+   return { buffer.data(), static_cast<size_t>(*read) };
+}
+
+static void
+checkPack(const TemporaryTree &tree,
+          bool compress)
+{
+   auto options = vfs::PackBuildOptions { };
+   options.compress = compress;
+   options.chunkSize = ChunkSize;
+
+   auto build = vfs::buildPackFile(tree.source, tree.pack, options);
+   REQUIRE(build);
+   REQUIRE(build->numFiles == 4);
+   REQUIRE(build->numDirectories == 3);
+
+   auto device = vfs::PackDevice::open(tree.pack);
+   REQUIRE(device);
+
+   SECTION("status")
+   {
+      auto root = device->status(sUser, "/");
+      REQUIRE(root);
+      REQUIRE(root->flags == vfs::Status::IsDirectory);
+
+      auto directory = device->status(sUser, "/data/sub/");
+      REQUIRE(directory);
+      REQUIRE(directory->name == "sub");
+      REQUIRE(directory->flags == vfs::Status::IsDirectory);
+
+      auto file = device->status(sUser, "/data/large.txt");
+      REQUIRE(file);
+      REQUIRE(file->name == "large.txt");
+      REQUIRE(file->flags == vfs::Status::HasSize);
+      REQUIRE(file->size == tree.large.size());
+
+      REQUIRE(device->status(sUser, "/data/missing").error() == vfs::Error::NotFound);
+      REQUIRE(device->status(sUser, "/dat").error() == vfs::Error::NotFound);
+   }
+
+   SECTION("openDirectory")
+   {
+      REQUIRE(listDirectory(*device, "/") ==
+              std::vector<std::string> { "a.txt", "data" });
+      REQUIRE(listDirectory(*device, "/data") ==
+              std::vector<std::string> { "empty", "large.txt", "random.bin", "sub" });
+      REQUIRE(listDirectory(*device, "/data/sub") ==
+              std::vector<std::string> { "nested.txt" });
+      REQUIRE(listDirectory(*device, "/data/empty").empty());
+
+      REQUIRE(device->openDirectory(sUser, "/missing").error() == vfs::Error::NotFound);
+      REQUIRE(device->openDirectory(sUser, "/a.txt").error() == vfs::Error::NotDirectory);
+   }
+
+   SECTION("sequential read")
+   {
+      // Read sizes which do not divide the chunk size so reads straddle chunks
+      REQUIRE(readFile(*device, "/a.txt", 7) == tree.small);
+      REQUIRE(readFile(*device, "/data/large.txt", 1000) == tree.large);
+      REQUIRE(readFile(*device, "/data/large.txt", ChunkSize * 4) == tree.large);
+      REQUIRE(readFile(*device, "/data/random.bin", 333) == tree.random);
+      REQUIRE(readFile(*device, "/data/sub/nested.txt", ChunkSize) == tree.nested);
+   }
+
+   SECTION("seek read")
+   {
+      auto files = {
+         std::make_pair("/data/large.txt", &tree.large),
+         std::make_pair("/data/random.bin", &tree.random),
+      };
+
+      for (auto [path, contents] : files) {
+         auto &expected = *contents;
+         auto result = device->openFile(sUser, path, vfs::FileHandle::Read);
+         REQUIRE(result);
+
+         auto &file = **result;
+         auto size = static_cast<int64_t>(expected.size());
+
+         // Across a chunk boundary, then backwards into an earlier chunk
+         REQUIRE(readAt(file, ChunkSize * 2 - 10, 20) == expected.substr(ChunkSize * 2 - 10, 20));
+         REQUIRE(readAt(file, ChunkSize - 1, 2) == expected.substr(ChunkSize - 1, 2));
+         REQUIRE(readAt(file, 0, ChunkSize + 1) == expected.substr(0, ChunkSize + 1));
+
+         // Reads at the end are cut short
+         REQUIRE(readAt(file, size - 5, 10) == expected.substr(size - 5));
+         REQUIRE(*file.eof());
+
+         REQUIRE(file.seek(vfs::FileHandle::SeekEnd, -3) == vfs::Error::Success);
+         REQUIRE(*file.tell() == size - 3);
+         REQUIRE(file.seek(vfs::FileHandle::SeekCurrent, -static_cast<int64_t>(ChunkSize)) == vfs::Error::Success);
+         REQUIRE(*file.tell() == size - 3 - ChunkSize);
+         REQUIRE(file.seek(vfs::FileHandle::SeekStart, -1) == vfs::Error::InvalidSeekPosition);
+      }
+   }
+
+   SECTION("empty read")
+   {
+      auto result = device->openFile(sUser, "/a.txt", vfs::FileHandle::Read);
+      REQUIRE(result);
+
+      auto &file = **result;
+      auto buffer = char { };
+      REQUIRE(*file.read(&buffer, 0, 1) == 0);
+      REQUIRE(*file.read(&buffer, 1, 0) == 0);
+      REQUIRE(*file.tell() == 0);
+   }
+
+   SECTION("read only")
+   {
+      REQUIRE(device->openFile(sUser, "/a.txt", vfs::FileHandle::Write).error() == vfs::Error::ReadOnly);
+      REQUIRE(device->openFile(sUser, "/data", vfs::FileHandle::Read).error() == vfs::Error::NotFile);
+      REQUIRE(device->remove(sUser, "/a.txt") == vfs::Error::ReadOnly);
+   }
+}
+
+static std::vector<char>
+readPackFile(const std::filesystem::path &path)
+{
+   auto in = std::ifstream { path, std::ifstream::binary };
+   return { std::istreambuf_iterator<char> { in }, std::istreambuf_iterator<char> { } };
+}
+
+static void
+writePackFile(const std::filesystem::path &path,
+              const std::vector<char> &data)
+{
+   auto out = std::ofstream { path, std::ofstream::binary | std::ofstream::trunc };
+   out.write(data.data(), data.size());
+}
+
+TEST_CASE("vfs pack compressed")
+{
+   auto tree = TemporaryTree { };
+   checkPack(tree, true);
+}
+
+TEST_CASE("vfs pack uncompressed")
+{
+   auto tree = TemporaryTree { };
+   checkPack(tree, false);
+}
+
+static void
+checkInvalidPack(const TemporaryTree &tree,
+                 bool compress)
+{
+   auto options = vfs::PackBuildOptions { };
+   options.compress = compress;
+   options.chunkSize = ChunkSize;
+   REQUIRE(vfs::buildPackFile(tree.source, tree.pack, options));
+
+   auto data = readPackFile(tree.pack);
+   auto header = vfs::PackHeader { };
+   REQUIRE(data.size() > sizeof(header));
+   std::memcpy(&header, data.data(), sizeof(header));
+   REQUIRE(vfs::PackDevice::open(tree.pack));
+
+   SECTION("truncated data")
+   {
+      data.resize(data.size() - 1);
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+
+   SECTION("truncated entries")
+   {
+      data.resize(static_cast<size_t>(header.stringsOffset) - 1);
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+
+   SECTION("truncated header")
+   {
+      data.resize(sizeof(header) - 1);
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+
+   SECTION("bad magic")
+   {
+      data[0] ^= 0xFF;
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+
+   SECTION("bad version")
+   {
+      header.version = vfs::PackVersion + 1;
+      std::memcpy(data.data(), &header, sizeof(header));
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+
+   SECTION("misaligned entries")
+   {
+      header.entriesOffset += 1;
+      std::memcpy(data.data(), &header, sizeof(header));
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+
+   SECTION("overflowing strings offset")
+   {
+      // Wraps around to inside the pack if the bounds check overflows
+      header.stringsOffset = ~uint64_t { 0 };
+      header.stringsSize = 2;
+      std::memcpy(data.data(), &header, sizeof(header));
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+
+   SECTION("entry outside of the pack")
+   {
+      auto entry = vfs::PackEntry { };
+      auto entryOffset = static_cast<size_t>(header.entriesOffset);
+      std::memcpy(&entry, data.data() + entryOffset, sizeof(entry));
+      entry.pathOffset = static_cast<uint32_t>(header.stringsSize);
+      std::memcpy(data.data() + entryOffset, &entry, sizeof(entry));
+      writePackFile(tree.pack, data);
+      REQUIRE(!vfs::PackDevice::open(tree.pack));
+   }
+}
+
+TEST_CASE("vfs pack rejects invalid compressed packs")
+{
+   auto tree = TemporaryTree { };
+   checkInvalidPack(tree, true);
+}
+
+TEST_CASE("vfs pack rejects invalid uncompressed packs")
+{
+   auto tree = TemporaryTree { };
+   checkInvalidPack(tree, false);
+}
+
+TEST_CASE("vfs pack corrupt chunk fails to read")
+{
+   auto tree = TemporaryTree { };
+   REQUIRE(vfs::buildPackFile(tree.source, tree.pack));
+
+   // Chunk contents are only checked when they are decompressed, so corrupt
+   // the first chunk of large.txt and make sure the read fails cleanly.
+   auto data = readPackFile(tree.pack);
+   auto header = vfs::PackHeader { };
+   std::memcpy(&header, data.data(), sizeof(header));
+
+   for (auto i = 0u; i < header.numEntries; ++i) {
+      auto entry = vfs::PackEntry { };
+      std::memcpy(&entry, data.data() + header.entriesOffset + i * sizeof(entry), sizeof(entry));
+
+      auto path = std::string { data.data() + header.stringsOffset + entry.pathOffset, entry.pathLength };
+      if (path != "data/large.txt") {
+         continue;
+      }
+
+      REQUIRE((entry.flags & vfs::PackEntryCompressed));
+
+      auto chunk = vfs::PackChunk { };
+      std::memcpy(&chunk, data.data() + entry.dataOffset, sizeof(chunk));
+      REQUIRE(chunk.compressed);
+      std::fill_n(data.data() + chunk.offset, chunk.size, '\xFF');
+   }
+
+   writePackFile(tree.pack, data);
+
+   auto device = vfs::PackDevice::open(tree.pack);
+   REQUIRE(device);
+
+   auto result = device->openFile(sUser, "/data/large.txt", vfs::FileHandle::Read);
+   REQUIRE(result);
+
+   char buffer[16];
+   REQUIRE((*result)->read(buffer, 1, sizeof(buffer)).error() == vfs::Error::GenericError);
+}
@@ -0,0 +1,76 @@
+#include <excmd.h>
+#include <iostream>
+#include <libdecaf/src/vfs/vfs_pack_builder.h>
+#include <string>
+
+static bool
+buildPack(const std::string &source,
+          const std::string &output,
+          const vfs::PackBuildOptions &options)
+{
+   auto result = vfs::buildPackFile(source, output, options);
+   if (!result) {
+      std::cout << "Failed to build " << output << " from " << source
+                << ", error " << static_cast<int>(result.error()) << std::endl;
+      return false;
+   }
+
+   std::cout << "Packed " << result->numFiles << " files and "
+             << result->numDirectories << " directories, "
+             << result->dataSize << " bytes into "
+             << result->packSize << " bytes" << std::endl;
+   return true;
+}
+
+int main(int argc, char **argv)
+{
+   int result = -1;
+   excmd::parser parser;
+   excmd::option_state options;
+
+   // Setup command line options
+   parser.global_options()
+      .add_option("h,help", excmd::description { "Show the help." });
+
+   parser.add_command("help")
+      .add_argument("command", excmd::value<std::string> { });
+
+   auto buildOptions = parser.add_option_group("Build Options")
+      .add_option("no-compress",
+                  excmd::description { "Store file data uncompressed." });
+
+   parser.add_command("build")
+      .add_option_group(buildOptions)
+      .add_argument("source", excmd::value<std::string> { })
+      .add_argument("output", excmd::value<std::string> { });
+
+   // Parse command line
+   try {
+      options = parser.parse(argc, argv);
+   } catch (excmd::exception ex) {
+      std::cout << "Error parsing command line: " << ex.what() << std::endl;
+      std::exit(-1);
+   }
+
+   // Print help
+   if (argc == 1 || options.has("help")) {
+      if (options.has("command")) {
+         std::cout << parser.format_help("content-pack", options.get<std::string>("command")) << std::endl;
+      } else {
+         std::cout << parser.format_help("content-pack") << std::endl;
+      }
+
+      std::exit(0);
+   }
+
+   if (options.has("build")) {
+      auto packOptions = vfs::PackBuildOptions { };
+      packOptions.compress = !options.has("no-compress");
+
+      auto source = options.get<std::string>("source");
+      auto output = options.get<std::string>("output");
+      result = buildPack(source, output, packOptions) ? 0 : -1;
+   }
+
+   return result;
+}
@@ -0,0 +1,280 @@
+#include "benchmark.h"
+#include "clilog.h"
+
+#include "replay_ringbuffer.h"
+#include "replay_parser_pm4.h"
+
+#include <chrono>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <libgpu/gpu_vulkandriver.h>
+#include <libgpu/latte/latte_enum_as_string.h>
+#include <thread>
+#include <vector>
+
+/*
+The benchmark replays a capture through a graphics driver without a window.
+
+Timing starts after the warm up iterations, by which point the driver should
+have translated every shader and created every pipeline the capture uses. The
+counters reported are the difference between the driver's debug info before
+and after the timed iterations.  Results are written as JSON so they can be
+compared between builds by scripts.
+*/
+
+static RingBuffer *sBenchmarkRingBuffer = nullptr;
+
+struct BenchmarkCounters
+{
+   gpu::Pm4Statistics pm4;
+   uint64_t shaderHits = 0;
+   uint64_t shaderMisses = 0;
+   uint64_t pipelineHits = 0;
+   uint64_t pipelineMisses = 0;
+   uint64_t uploadBytes = 0;
+};
+
+static void
+onGpuInterrupt()
+{
+   gpu::ih::read();
+   sBenchmarkRingBuffer->onGpuInterrupt();
+}
+
+/**
+ * Read the counters from the driver, this must only be called while the
+ * driver is idle as the debug info is updated from the GPU thread.
+ */
+static BenchmarkCounters
+readCounters(gpu::GraphicsDriver *driver)
+{
+   auto counters = BenchmarkCounters { };
+   auto debugInfo = driver->getDebugInfo();
+   counters.pm4 = debugInfo->pm4;
+
+#ifdef DECAF_VULKAN
+   if (debugInfo->type == gpu::GraphicsDriverType::Vulkan) {
+      auto vulkanInfo = static_cast<gpu::VulkanDriverDebugInfo *>(debugInfo);
+      counters.shaderHits = vulkanInfo->numShaderHits;
+      counters.shaderMisses = vulkanInfo->numShaderMisses;
+      counters.pipelineHits = vulkanInfo->numPipelineHits;
+      counters.pipelineMisses = vulkanInfo->numPipelineMisses;
+      counters.uploadBytes = vulkanInfo->uploadBytes;
+   }
+#endif
+
+   return counters;
+}
+
+static gpu::Pm4PacketStatistics
+operator -(const gpu::Pm4PacketStatistics &lhs,
+           const gpu::Pm4PacketStatistics &rhs)
+{
+   auto result = gpu::Pm4PacketStatistics { };
+   result.count = lhs.count - rhs.count;
+   result.timeNS = lhs.timeNS - rhs.timeNS;
+   return result;
+}
+
+static BenchmarkCounters
+operator -(const BenchmarkCounters &lhs,
+           const BenchmarkCounters &rhs)
+{
+   auto result = BenchmarkCounters { };
+   result.pm4.type0 = lhs.pm4.type0 - rhs.pm4.type0;
+
+   for (auto i = 0u; i < result.pm4.type3.size(); ++i) {
+      result.pm4.type3[i] = lhs.pm4.type3[i] - rhs.pm4.type3[i];
+   }
+
+   result.shaderHits = lhs.shaderHits - rhs.shaderHits;
+   result.shaderMisses = lhs.shaderMisses - rhs.shaderMisses;
+   result.pipelineHits = lhs.pipelineHits - rhs.pipelineHits;
+   result.pipelineMisses = lhs.pipelineMisses - rhs.pipelineMisses;
+   result.uploadBytes = lhs.uploadBytes - rhs.uploadBytes;
+   return result;
+}
+
+static std::string
+escapeJson(const std::string &str)
+{
+   auto result = std::string { };
+
+   for (auto c : str) {
+      switch (c) {
+      case '"':
+         result += "\\\"";
+         break;
+      case '\\':
+         result += "\\\\";
+         break;
+      default:
+         if (static_cast<unsigned char>(c) < 0x20) {
+            result += fmt::format("\\u{:04x}", static_cast<int>(c));
+         } else {
+            result += c;
+         }
+      }
+   }
+
+   return result;
+}
+
+static void
+writePacketJson(fmt::memory_buffer &out,
+                const std::string &name,
+                const gpu::Pm4PacketStatistics &stats)
+{
+   auto averageUs = stats.count ? (stats.timeNS / 1000.0) / stats.count : 0.0;
+   fmt::format_to(out,
+                  "    {{ \"name\": \"{}\", \"count\": {}, \"total_ms\": {:.3f}, \"average_us\": {:.3f} }}",
+                  name, stats.count, stats.timeNS / 1000000.0, averageUs);
+}
+
+static std::string
+formatResults(const std::string &tracePath,
+              const BenchmarkOptions &options,
+              const std::vector<double> &iterationTimesMS,
+              const BenchmarkCounters &counters)
+{
+   auto totalTimeMS = 0.0;
+   for (auto time : iterationTimesMS) {
+      totalTimeMS += time;
+   }
+
+   auto numPackets = counters.pm4.type0.count;
+   for (auto &stats : counters.pm4.type3) {
+      numPackets += stats.count;
+   }
+
+   auto numFrames =
+      counters.pm4.type3[latte::pm4::IT_OPCODE::DECAF_SWAP_BUFFERS].count;
+   auto totalTimeSeconds = totalTimeMS / 1000.0;
+   auto perSecond =
+      [&](uint64_t value) {
+         return totalTimeSeconds > 0.0 ? value / totalTimeSeconds : 0.0;
+      };
+
+   fmt::memory_buffer out;
+   fmt::format_to(out, "{{\n");
+   fmt::format_to(out, "  \"trace\": \"{}\",\n", escapeJson(tracePath));
+   fmt::format_to(out, "  \"driver\": \"{}\",\n",
+                  options.driverType == gpu::GraphicsDriverType::Vulkan ? "vulkan" : "null");
+   fmt::format_to(out, "  \"warmup_iterations\": {},\n", options.warmupIterations);
+   fmt::format_to(out, "  \"iterations\": {},\n", options.iterations);
+   fmt::format_to(out, "  \"total_ms\": {:.3f},\n", totalTimeMS);
+
+   fmt::format_to(out, "  \"iteration_ms\": [");
+   for (auto i = 0u; i < iterationTimesMS.size(); ++i) {
+      fmt::format_to(out, "{}{:.3f}", i ? ", " : "", iterationTimesMS[i]);
+   }
+   fmt::format_to(out, "],\n");
+
+   fmt::format_to(out, "  \"frames\": {},\n", numFrames);
+   fmt::format_to(out, "  \"frames_per_second\": {:.3f},\n", perSecond(numFrames));
+   fmt::format_to(out, "  \"packets\": {},\n", numPackets);
+   fmt::format_to(out, "  \"packets_per_second\": {:.3f},\n", perSecond(numPackets));
+   fmt::format_to(out, "  \"shader_hits\": {},\n", counters.shaderHits);
+   fmt::format_to(out, "  \"shader_misses\": {},\n", counters.shaderMisses);
+   fmt::format_to(out, "  \"pipeline_hits\": {},\n", counters.pipelineHits);
+   fmt::format_to(out, "  \"pipeline_misses\": {},\n", counters.pipelineMisses);
+   fmt::format_to(out, "  \"upload_bytes\": {},\n", counters.uploadBytes);
+
+   fmt::format_to(out, "  \"packet_types\": [\n");
+   writePacketJson(out, "TYPE0", counters.pm4.type0);
+
+   for (auto i = 0u; i < counters.pm4.type3.size(); ++i) {
+      auto &stats = counters.pm4.type3[i];
+      if (!stats.count) {
+         continue;
+      }
+
+      fmt::format_to(out, ",\n");
+      writePacketJson(out,
+                      latte::pm4::to_string(static_cast<latte::pm4::IT_OPCODE>(i)),
+                      stats);
+   }
+
+   fmt::format_to(out, "\n  ]\n");
+   fmt::format_to(out, "}}\n");
+   return { out.data(), out.size() };
+}
+
+int
+runBenchmark(const std::string &tracePath,
+             const BenchmarkOptions &options)
+{
+   auto driver = gpu::createGraphicsDriver(options.driverType);
+   if (!driver) {
+      gCliLog->error("Failed to create graphics driver");
+      return -1;
+   }
+
+   // Run without a window, the Vulkan driver skips presenting when headless
+   driver->setWindowSystemInfo(gpu::WindowSystemInfo { });
+
+   // Setup replay parser
+   auto replayHeap = phys_cast<cafe::TinyHeapPhysical *>(phys_addr { 0x34000000 });
+   cafe::TinyHeap_Setup(replayHeap,
+                        0x430,
+                        phys_cast<void *>(phys_addr { 0x34000000 + 0x430 }),
+                        0x1C000000 - 0x430);
+   auto ringBuffer = std::make_unique<RingBuffer>(replayHeap);
+   sBenchmarkRingBuffer = ringBuffer.get();
+
+   initialiseRegisters(ringBuffer.get());
+
+   auto parser = ReplayParserPM4::Create(driver, ringBuffer.get(),
+                                         replayHeap, tracePath);
+   if (!parser) {
+      gCliLog->error("Failed to open trace {}", tracePath);
+      return -1;
+   }
+
+   gpu::ih::enable(latte::CP_INT_CNTL::get(0xFFFFFFFF));
+   gpu::ih::setInterruptCallback(onGpuInterrupt);
+
+   auto graphicsThread = std::thread {
+      [&]() {
+         driver->run();
+      } };
+
+   for (auto i = 0u; i < options.warmupIterations; ++i) {
+      parser->runUntilTimestamp(0xFFFFFFFFFFFFFFFFull);
+   }
+
+   // runUntilTimestamp waits for the GPU to retire everything it submitted,
+   // so the driver is idle whenever we read its counters.
+   auto startCounters = readCounters(driver);
+   auto iterationTimesMS = std::vector<double> { };
+
+   for (auto i = 0u; i < options.iterations; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      parser->runUntilTimestamp(0xFFFFFFFFFFFFFFFFull);
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      iterationTimesMS.push_back(
+         std::chrono::duration<double, std::milli> { elapsed }.count());
+   }
+
+   auto counters = readCounters(driver) - startCounters;
+
+   driver->stop();
+   graphicsThread.join();
+
+   auto results = formatResults(tracePath, options, iterationTimesMS, counters);
+
+   if (options.outputPath.empty()) {
+      std::cout << results;
+   } else {
+      auto file = std::ofstream { options.outputPath, std::ofstream::out };
+      if (!file.is_open()) {
+         gCliLog->error("Failed to open {} for writing", options.outputPath);
+         return -1;
+      }
+
+      file << results;
+   }
+
+   return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <libgpu/gpu_graphicsdriver.h>
+#include <string>
+
+struct BenchmarkOptions
+{
+   gpu::GraphicsDriverType driverType = gpu::GraphicsDriverType::Null;
+
+   //! Number of times to replay the capture before timing starts, these fill
+   //! the driver's shader and pipeline caches.
+   unsigned warmupIterations = 1;
+
+   //! Number of timed replays of the capture.
+   unsigned iterations = 10;
+
+   //! File to write the JSON results to, stdout when empty.
+   std::string outputPath;
+};
+
+int
+runBenchmark(const std::string &tracePath,
+             const BenchmarkOptions &options);
@@ -7,5 +7,9 @@ namespace config
 extern bool dump_drc_frames;
 extern bool dump_tv_frames;
 extern std::string dump_frames_dir;
+extern std::string renderer;
+extern unsigned benchmark_iterations;
+extern unsigned benchmark_warmup;
+extern std::string benchmark_output;
 
 } // namespace config
@@ -1,3 +1,4 @@
+#include "benchmark.h"
 #include "config.h"
 #include "sdl_window.h"
 
@@ -19,6 +20,9 @@ bool dump_drc_frames = false;
 bool dump_tv_frames = false;
 std::string dump_frames_dir = "frames";
 std::string renderer = "vulkan";
+unsigned benchmark_iterations = 10;
+unsigned benchmark_warmup = 1;
+std::string benchmark_output;
 
 } // namespace config
 
@@ -50,7 +54,9 @@ getCommandLineParser()
                   description { "Dump rendered TV frames to file." })
       .add_option("dump-frames-dir",
                   description { "Folder to place dumped frames in" },
-                  make_default_value(config::dump_frames_dir))
+                  make_default_value(config::dump_frames_dir));
+
+   auto rendererOptions = parser.add_option_group("Renderer Options")
       .add_option("renderer",
                   description { "Which graphics renderer to use." },
                   make_default_value(config::renderer));
@@ -60,10 +66,28 @@ getCommandLineParser()
                     optional {},
                     value<std::string> {});
 
+   auto benchmarkOptions = parser.add_option_group("Benchmark Options")
+      .add_option("iterations",
+                  description { "Number of timed replays of the trace." },
+                  make_default_value(config::benchmark_iterations))
+      .add_option("warmup",
+                  description { "Number of replays before timing starts." },
+                  make_default_value(config::benchmark_warmup))
+      .add_option("output",
+                  description { "File to write the JSON results to, defaults to stdout." },
+                  value<std::string> {});
+
    parser.add_command("replay")
       .add_argument("trace file",
                     value<std::string> {})
-      .add_option_group(replayOptions);
+      .add_option_group(replayOptions)
+      .add_option_group(rendererOptions);
+
+   parser.add_command("benchmark")
+      .add_argument("trace file",
+                    value<std::string> {})
+      .add_option_group(benchmarkOptions)
+      .add_option_group(rendererOptions);
 
    return parser;
 }
@@ -86,6 +110,26 @@ replay(const std::string &path)
    return sdl.run(path);
 }
 
+static int
+benchmark(const std::string &path)
+{
+   auto options = BenchmarkOptions { };
+   options.iterations = config::benchmark_iterations;
+   options.warmupIterations = config::benchmark_warmup;
+   options.outputPath = config::benchmark_output;
+
+   if (config::renderer == "null") {
+      options.driverType = gpu::GraphicsDriverType::Null;
+   } else if (config::renderer == "vulkan") {
+      options.driverType = gpu::GraphicsDriverType::Vulkan;
+   } else {
+      gCliLog->error("Unknown renderer {}", config::renderer);
+      return -1;
+   }
+
+   return runBenchmark(path, options);
+}
+
 int
 start(excmd::parser &parser,
       excmd::option_state &options)
@@ -108,7 +152,8 @@ start(excmd::parser &parser,
       std::exit(0);
    }
 
-   if (!options.has("replay")) {
+   auto isBenchmark = options.has("benchmark");
+   if (!options.has("replay") && !isBenchmark) {
       return 0;
    }
 
@@ -128,18 +173,31 @@ start(excmd::parser &parser,
       config::renderer = options.get<std::string>("renderer");
    }
 
+   if (options.has("iterations")) {
+      config::benchmark_iterations = options.get<unsigned>("iterations");
+   }
+
+   if (options.has("warmup")) {
+      config::benchmark_warmup = options.get<unsigned>("warmup");
+   }
+
+   if (options.has("output")) {
+      config::benchmark_output = options.get<std::string>("output");
+   }
+
    auto traceFile = options.get<std::string>("trace file");
 
    // Initialise libdecaf logger
    auto decafSettings = decaf::Settings { };
    decafSettings.log.to_file = true;
-   decafSettings.log.to_stdout = true;
-   decafSettings.log.level = "debug";
+   decafSettings.log.to_stdout = !isBenchmark || !config::benchmark_output.empty();
+   decafSettings.log.level = isBenchmark ? "warn" : "debug";
    decaf::setConfig(decafSettings);
    decaf::initialiseLogging("pm4-replay.txt");
 
    auto gpuSettings = gpu::Settings { };
-   gpuSettings.debug.debug_enabled = true;
+   gpuSettings.debug.debug_enabled = !isBenchmark;
+   gpuSettings.debug.pm4_profiling = isBenchmark;
    gpu::setConfig(gpuSettings);
 
    gCliLog = decaf::makeLogger("decaf-pm4-replay");
@@ -149,6 +207,10 @@ start(excmd::parser &parser,
    // Initialise CPU to setup physical memory
    cpu::initialise();
 
+   if (isBenchmark) {
+      return benchmark(traceFile);
+   }
+
    return replay(traceFile);
 }
 
@@ -133,6 +133,10 @@ ReplayParserPM4::handleCommandBuffer(void *buffer, uint32_t sizeBytes)
 {
    auto numWords = sizeBytes / 4;
    mRingBuffer->writeBuffer(buffer, numWords);
+
+   // Submit each command buffer as we go rather than the whole capture at
+   // once, so the GPU can start on it while we read the rest of the file.
+   mRingBuffer->submitCommandBuffer();
    return scanCommandBuffer(buffer, numWords);
 }
 
@@ -61,9 +61,15 @@ public:
    flushCommandBuffer()
    {
       auto timestamp = insertRetiredTimestamp();
+      submitCommandBuffer();
+      return timestamp;
+   }
+
+   void
+   submitCommandBuffer()
+   {
       gpu::ringbuffer::write(mBuffer);
       mBuffer.clear();
-      return timestamp;
    }
 
    void
@@ -129,3 +135,6 @@ private:
    std::mutex mRetireMutex;
    std::condition_variable mRetireCV;
 };
+
+void
+initialiseRegisters(RingBuffer *ringBuffer);
@@ -18,8 +18,6 @@ using namespace latte::pm4;
 
 RingBuffer *sRingBuffer = nullptr; // eww is global because of onGpuInterrupt
 
-void initialiseRegisters(RingBuffer *ringBuffer);
-
 SDLWindow::~SDLWindow()
 {
 }